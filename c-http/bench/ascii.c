@@ -0,0 +1,209 @@
+// ASCII case kernels against the <ctype.h> loops they replaced. Before
+// timing anything it checks that both agree on every byte value, at every
+// position and length that reaches each code path, and stops on the first
+// difference. `make bench/ascii`
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../src/sv.h"
+#include "bench.h"
+
+#define BENCH_BYTES (16 << 20)
+#define CHECK_LEN 48 // two SSE2 blocks, an 8-byte step and a tail
+
+// ---------- The previous versions ----------
+
+static void lower_ctype(char *s, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    s[i] = (char)tolower((unsigned char)s[i]);
+  }
+}
+
+static void upper_ctype(char *s, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    s[i] = (char)toupper((unsigned char)s[i]);
+  }
+}
+
+static bool eq_ctype(String_View a, String_View b) {
+  if (a.count != b.count) {
+    return false;
+  }
+  for (size_t i = 0; i < a.count; i++) {
+    if (tolower((unsigned char)a.data[i]) != tolower((unsigned char)b.data[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Stops at a NUL, so only for the timings, where there is none
+static bool eq_strncasecmp(String_View a, String_View b) {
+  return a.count == b.count && strncasecmp(a.data, b.data, a.count) == 0;
+}
+
+static String_View trim_ctype(String_View sv) {
+  while (sv.count > 0 && isspace((unsigned char)sv.data[0])) {
+    sv.data++;
+    sv.count--;
+  }
+  while (sv.count > 0 && isspace((unsigned char)sv.data[sv.count - 1])) {
+    sv.count--;
+  }
+  return sv;
+}
+
+// ---------- Equivalence ----------
+
+static void fill(char *s, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    s[i] = (char)(rand() & 0xFF);
+  }
+}
+
+// Every byte value `c` at position `at` of a random string of `n` bytes
+static void check_byte(int c, size_t at, size_t n) {
+  char src[CHECK_LEN], a[CHECK_LEN], b[CHECK_LEN], other[CHECK_LEN];
+  String_Builder sb = {0};
+
+  fill(src, n);
+  src[at] = (char)c;
+
+  memcpy(a, src, n);
+  memcpy(b, src, n);
+  sv_to_lower_inplace(a, n);
+  lower_ctype(b, n);
+  CHECK(memcmp(a, b, n) == 0, "lower of 0x%02x at %zu/%zu", c, at, n);
+
+  String_View up = sv_to_upper_sb(&sb, sv_from_parts(src, n));
+  memcpy(b, src, n);
+  upper_ctype(b, n);
+  CHECK(memcmp(up.data, b, n) == 0, "upper of 0x%02x at %zu/%zu", c, at, n);
+
+  // Against itself in the other case, and with a single byte changed
+  for (int d = 0; d < 256; d += (d < 'A' || d > 'z') ? 7 : 1) {
+    memcpy(other, b, n);
+    other[at] = (char)d;
+    String_View x = sv_from_parts(src, n);
+    String_View y = sv_from_parts(other, n);
+    CHECK(sv_eq_ignore_case(x, y) == eq_ctype(x, y),
+          "eq of 0x%02x/0x%02x at %zu/%zu", c, d, at, n);
+    CHECK(sv_starts_with_ignore_case(x, sv_from_parts(other, at + 1)) ==
+              eq_ctype(sv_from_parts(src, at + 1), sv_from_parts(other, at + 1)),
+          "starts_with of 0x%02x/0x%02x at %zu/%zu", c, d, at, n);
+  }
+
+  // Trim: surround the byte with whitespace on both sides
+  memset(a, ' ', n);
+  a[at] = (char)c;
+  if (at > 0) {
+    a[0] = "\t\n\v\f\r "[rand() % 6];
+  }
+  String_View t1 = sv_trim(sv_from_parts(a, n));
+  String_View t2 = trim_ctype(sv_from_parts(a, n));
+  CHECK(t1.data == t2.data && t1.count == t2.count, "trim of 0x%02x at %zu/%zu",
+        c, at, n);
+
+  sb_free(sb);
+}
+
+static void check_equivalence(void) {
+  for (size_t n = 1; n <= CHECK_LEN; n++) {
+    for (size_t at = 0; at < n; at++) {
+      for (int c = 0; c < 256; c++) {
+        check_byte(c, at, n);
+      }
+    }
+  }
+  // Different lengths are never equal, but a prefix may be
+  String_View s = sv_from_cstr("Content-Type");
+  CHECK(!sv_eq_ignore_case(s, sv_from_cstr("content-typ")), "length");
+  CHECK(sv_starts_with_ignore_case(s, sv_from_cstr("CONTENT-")), "prefix");
+  CHECK(!sv_starts_with_ignore_case(sv_from_cstr("co"), s), "long prefix");
+
+  if (failures > 0) {
+    fprintf(stderr, "%d mismatches\n", failures);
+    exit(1);
+  }
+  printf("equivalent to <ctype.h> on every byte value, lengths 1..%d\n",
+         CHECK_LEN);
+}
+
+// ---------- Timing ----------
+
+static volatile size_t sink;
+
+#define BENCH(label, bytes, expr)                                              \
+  do {                                                                         \
+    double best = 1e9;                                                         \
+    for (int round = 0; round < 5; round++) {                                  \
+      double start = now();                                                    \
+      sink += (size_t)(expr);                                                  \
+      double t = now() - start;                                                \
+      best = t < best ? t : best;                                              \
+    }                                                                          \
+    printf("  %-30s %7.2f GB/s\n", label, (double)(bytes) / best / 1e9);       \
+  } while (0)
+
+static size_t lower_all(void (*lower)(char *, size_t), char *s, size_t n,
+                        size_t chunk) {
+  for (size_t i = 0; i < n; i += chunk) {
+    lower(s + i, chunk < n - i ? chunk : n - i);
+  }
+  return (size_t)s[n - 1];
+}
+
+static void lower_inplace(char *s, size_t n) { sv_to_lower_inplace(s, n); }
+
+static size_t eq_all(bool (*eq)(String_View, String_View), const char *a,
+                     const char *b, size_t n, size_t chunk) {
+  size_t equal = 0;
+  for (size_t i = 0; i + chunk <= n; i += chunk) {
+    equal += eq(sv_from_parts(a + i, chunk), sv_from_parts(b + i, chunk));
+  }
+  return equal;
+}
+
+int main(void) {
+  check_equivalence();
+
+  const char *text = "Accept-Encoding: GZIP, Deflate, BR Content-Type: "
+                     "Application/JSON; Charset=UTF-8 Connection: Keep-Alive ";
+  size_t text_len = strlen(text);
+  char *a = malloc(BENCH_BYTES);
+  char *b = malloc(BENCH_BYTES);
+  for (size_t i = 0; i < BENCH_BYTES; i++) {
+    a[i] = text[i % text_len];
+  }
+
+  // Header names run about 4 to 30 bytes, values longer
+  const size_t chunks[] = {12, 32, 1024};
+  for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    size_t chunk = chunks[i];
+    printf("%zu-byte strings\n", chunk);
+    BENCH("tolower loop", BENCH_BYTES,
+          lower_all(lower_ctype, a, BENCH_BYTES, chunk));
+    BENCH("sv_to_lower_inplace", BENCH_BYTES,
+          lower_all(lower_inplace, a, BENCH_BYTES, chunk));
+    // `a` is lowercase now, `b` gets uppercase again for the compares
+    for (size_t j = 0; j < BENCH_BYTES; j++) {
+      b[j] = (char)toupper((unsigned char)a[j]);
+    }
+    BENCH("tolower compare loop", BENCH_BYTES,
+          eq_all(eq_ctype, a, b, BENCH_BYTES, chunk));
+    BENCH("strncasecmp", BENCH_BYTES,
+          eq_all(eq_strncasecmp, a, b, BENCH_BYTES, chunk));
+    BENCH("sv_eq_ignore_case", BENCH_BYTES,
+          eq_all(sv_eq_ignore_case, a, b, BENCH_BYTES, chunk));
+  }
+
+  free(a);
+  free(b);
+  return 0;
+}
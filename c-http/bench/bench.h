@@ -0,0 +1,33 @@
+// What the benches share: a clock for the timings, and the counter their
+// equivalence checks report mismatches through.
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// rand() gives 31 bits at a time
+static inline uint64_t rand64(void) {
+  return (uint64_t)rand() << 62 ^ (uint64_t)rand() << 31 ^ (uint64_t)rand();
+}
+
+// Only the first ten are printed; a check exits 1 when there were any
+static int failures;
+
+#define CHECK(cond, ...)                                                       \
+  do {                                                                         \
+    if (!(cond) && failures++ < 10) {                                          \
+      fprintf(stderr, "mismatch: " __VA_ARGS__);                               \
+      fprintf(stderr, "\n");                                                   \
+    }                                                                          \
+  } while (0)
+
+#endif // BENCH_H
@@ -0,0 +1,171 @@
+// Interned header names and values against lowercasing a fresh copy of each
+// per request, as http_parse_headers did. First checks that threads racing
+// to intern the same strings all get the same pointers, and that the table
+// stops taking values and then names at their bounds. `make bench/intern`
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/intern.h"
+#include "bench.h"
+
+#define BENCH_REQUESTS (1 << 18)
+#define CHECK_THREADS 4
+#define CHECK_STRINGS 2000
+
+// ---------- Equivalence ----------
+
+static char check_text[CHECK_STRINGS][32];
+static String_View check_result[CHECK_THREADS][CHECK_STRINGS];
+
+static void *check_thread(void *arg) {
+  size_t t = (size_t)arg;
+  // Each thread in its own order, so they collide on different slots. The
+  // strides share no factor with CHECK_STRINGS.
+  static const size_t strides[CHECK_THREADS] = {1, 3, 7, 11};
+  for (size_t k = 0; k < CHECK_STRINGS; k++) {
+    size_t i = (k * strides[t]) % CHECK_STRINGS;
+    check_result[t][i] = intern(sv_from_cstr(check_text[i]));
+  }
+  return NULL;
+}
+
+static void check_equivalence(void) {
+  size_t before = intern_count();
+  for (size_t i = 0; i < CHECK_STRINGS; i++) {
+    snprintf(check_text[i], sizeof(check_text[i]), "x-header-%zu", i);
+  }
+
+  pthread_t threads[CHECK_THREADS];
+  for (size_t t = 0; t < CHECK_THREADS; t++) {
+    pthread_create(&threads[t], NULL, check_thread, (void *)t);
+  }
+  for (size_t t = 0; t < CHECK_THREADS; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  for (size_t i = 0; i < CHECK_STRINGS; i++) {
+    String_View first = check_result[0][i];
+    bool found = first.data && sv_eq(first, sv_from_cstr(check_text[i]));
+    CHECK(found, "%s not interned", check_text[i]);
+    if (!found) {
+      continue;
+    }
+    for (size_t t = 1; t < CHECK_THREADS; t++) {
+      CHECK(check_result[t][i].data == first.data,
+            "thread %zu got another %s", t, check_text[i]);
+    }
+    for (size_t j = 0; j < i && i < 50; j++) {
+      CHECK(intern_id(check_result[0][j]) != intern_id(first),
+            "%s and %s share an id", check_text[j], check_text[i]);
+    }
+  }
+  CHECK(intern_count() - before == CHECK_STRINGS, "%zu entries for %d strings",
+        intern_count() - before, CHECK_STRINGS);
+
+  // Lowercase folds into the same entry
+  String_View a = intern_lower(sv_from_cstr("X-Header-7"));
+  CHECK(a.data == check_result[0][7].data, "X-Header-7 not folded");
+
+  // Values stop at their own bound, names still go in past it
+  char s[32];
+  for (size_t i = 0; i < INTERN_SLOTS; i++) {
+    snprintf(s, sizeof(s), "value-%zu", i);
+    intern_lower_value(sv_from_cstr(s));
+  }
+  CHECK(intern_count() == INTERN_VALUE_ENTRIES &&
+            !intern_lower_value(sv_from_cstr("one more value")).data &&
+            intern_lower_value(sv_from_cstr(check_text[5])).data ==
+                check_result[0][5].data &&
+            intern_lower(sv_from_cstr("one more name")).data,
+        "value bound not kept");
+
+  // Past the bound new strings are refused, known ones still found
+  for (size_t i = 0; i < INTERN_SLOTS; i++) {
+    snprintf(s, sizeof(s), "fill-%zu", i);
+    intern(sv_from_cstr(s));
+  }
+  CHECK(intern_count() == INTERN_MAX_ENTRIES &&
+            !intern(sv_from_cstr("one more")).data &&
+            intern(sv_from_cstr(check_text[3])).data == check_result[0][3].data,
+        "bound not kept");
+
+  if (failures > 0) {
+    fprintf(stderr, "%d mismatches\n", failures);
+    exit(1);
+  }
+  printf("racing threads agree on every pointer, values stop at %d, names "
+         "at %d\n",
+         INTERN_VALUE_ENTRIES, INTERN_MAX_ENTRIES);
+}
+
+// ---------- Timing ----------
+
+static volatile size_t sink;
+
+int main(void) {
+  // What a browser sends on every request
+  const char *headers[][2] = {
+      {"Host", "localhost:3490"},
+      {"User-Agent", "Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 "
+                     "Firefox/128.0"},
+      {"Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;"
+                 "q=0.8"},
+      {"Accept-Language", "en-US,en;q=0.5"},
+      {"Accept-Encoding", "gzip, deflate, br, zstd"},
+      {"Connection", "keep-alive"},
+      {"Upgrade-Insecure-Requests", "1"},
+      {"Cache-Control", "max-age=0"},
+  };
+  size_t count = sizeof(headers) / sizeof(headers[0]);
+  size_t bytes = 0;
+  for (size_t i = 0; i < count; i++) {
+    bytes += strlen(headers[i][0]) + strlen(headers[i][1]);
+  }
+
+  // In before the check fills the table up
+  intern_init();
+  for (size_t i = 0; i < count; i++) {
+    intern_lower(sv_from_cstr(headers[i][0]));
+    intern_lower_value(sv_from_cstr(headers[i][1]));
+  }
+  check_equivalence();
+  printf("%zu headers, %zu bytes, per request\n", count, bytes);
+
+  String_Builder sb = {0};
+  double best = 1e9;
+  for (int round = 0; round < 5; round++) {
+    double start = now();
+    for (size_t r = 0; r < BENCH_REQUESTS; r++) {
+      sb.count = 0;
+      for (size_t i = 0; i < count; i++) {
+        sink += (size_t)sv_to_lower_sb(&sb, sv_from_cstr(headers[i][0])).data;
+        sink += (size_t)sv_to_lower_sb(&sb, sv_from_cstr(headers[i][1])).data;
+      }
+    }
+    double t = now() - start;
+    best = t < best ? t : best;
+  }
+  printf("  %-24s %7.1f ns\n", "sv_to_lower_sb", best / BENCH_REQUESTS * 1e9);
+
+  best = 1e9;
+  for (int round = 0; round < 5; round++) {
+    double start = now();
+    for (size_t r = 0; r < BENCH_REQUESTS; r++) {
+      for (size_t i = 0; i < count; i++) {
+        sink += (size_t)intern_lower(sv_from_cstr(headers[i][0])).data;
+        sink += (size_t)intern_lower_value(sv_from_cstr(headers[i][1])).data;
+      }
+    }
+    double t = now() - start;
+    best = t < best ? t : best;
+  }
+  printf("  %-24s %7.1f ns\n", "intern_lower", best / BENCH_REQUESTS * 1e9);
+
+  sb_free(sb);
+  return 0;
+}
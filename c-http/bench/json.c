@@ -0,0 +1,620 @@
+// The JSON tokenizer on what RFC 8259 allows and forbids, nesting at and past
+// JSON_MAX_DEPTH, lookups of keys written with escapes, and numbers printed
+// by libc coming back out to the same double through strtod. The writer the
+// other way: doubles it prints read back the same, and strings come out
+// escaped byte for byte like a plain loop does it. Then how fast both go,
+// the writer against sb_appendf. `make bench/json`
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/json.h"
+#include "bench.h"
+
+#define CHECK_DOUBLES 2000000
+#define CHECK_SHORTEST 300000
+#define CHECK_STRINGS 200000
+#define BENCH_VALUES (1 << 20)
+#define BENCH_STRING (1 << 20)
+#define BENCH_RECORDS 20000
+#define BENCH_QUERIES (1 << 20)
+
+// Any finite double, the exponents spread evenly
+static double random_double(void) {
+  uint64_t bits = rand64();
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  if (!isfinite(d)) {
+    d = (double)(int64_t)bits / 3; // no NaN or infinity in JSON
+  }
+  return d;
+}
+
+// ---------- Byte at a time ----------
+
+// What json_write_quoted must produce: the short escapes where JSON has one,
+// \u00XX for the other control characters, everything else as is
+static void quoted_bytewise(String_Builder *sb, String_View s) {
+  da_append(sb, '"');
+  for (size_t i = 0; i < s.count; i++) {
+    unsigned char c = (unsigned char)s.data[i];
+    const char *esc = c == '"'   ? "\\\""
+                      : c == '\\' ? "\\\\"
+                      : c == '\b' ? "\\b"
+                      : c == '\f' ? "\\f"
+                      : c == '\n' ? "\\n"
+                      : c == '\r' ? "\\r"
+                      : c == '\t' ? "\\t"
+                                  : NULL;
+    if (esc) {
+      sb_append_cstr(sb, esc);
+    } else if (c < 0x20) {
+      sb_appendf(sb, "\\u%04x", c);
+    } else {
+      da_append(sb, (char)c);
+    }
+  }
+  da_append(sb, '"');
+}
+
+// ---------- Equivalence ----------
+
+// Lengths from sizeof, so NUL bytes stay in
+#define DOC(text, error) {text, sizeof(text) - 1, error}
+
+static const struct {
+  const char *text;
+  size_t len;
+  Json_Error want;
+} grammar[] = {
+    // One value, whitespace around it only
+    DOC("", JSON_ERROR_SYNTAX),
+    DOC(" \t\r\n", JSON_ERROR_SYNTAX),
+    DOC(" \t\r\n[ ]\n", JSON_OK),
+    DOC("[] []", JSON_ERROR_SYNTAX),
+    DOC("[]x", JSON_ERROR_SYNTAX),
+    DOC("\f[]", JSON_ERROR_SYNTAX),
+    DOC("[]\0", JSON_ERROR_SYNTAX),
+
+    // Literals
+    DOC("null", JSON_OK),
+    DOC("true", JSON_OK),
+    DOC("false", JSON_OK),
+    DOC("nul", JSON_ERROR_SYNTAX),
+    DOC("nulll", JSON_ERROR_SYNTAX),
+    DOC("True", JSON_ERROR_SYNTAX),
+    DOC("NaN", JSON_ERROR_SYNTAX),
+    DOC("Infinity", JSON_ERROR_SYNTAX),
+
+    // Numbers
+    DOC("0", JSON_OK),
+    DOC("-0", JSON_OK),
+    DOC("-0.0e-0", JSON_OK),
+    DOC("1E+2", JSON_OK),
+    DOC("123456789012345678901234567890", JSON_OK),
+    DOC("01", JSON_ERROR_SYNTAX),
+    DOC("-01", JSON_ERROR_SYNTAX),
+    DOC("+1", JSON_ERROR_SYNTAX),
+    DOC("-", JSON_ERROR_SYNTAX),
+    DOC("1.", JSON_ERROR_SYNTAX),
+    DOC(".1", JSON_ERROR_SYNTAX),
+    DOC("1.e1", JSON_ERROR_SYNTAX),
+    DOC("1e", JSON_ERROR_SYNTAX),
+    DOC("1e+", JSON_ERROR_SYNTAX),
+    DOC("0x10", JSON_ERROR_SYNTAX),
+    DOC("1 2", JSON_ERROR_SYNTAX),
+
+    // Strings
+    DOC("\"\"", JSON_OK),
+    DOC("\"abc", JSON_ERROR_SYNTAX),
+    DOC("'abc'", JSON_ERROR_SYNTAX),
+    DOC("\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"", JSON_OK),
+    DOC("\"\\x41\"", JSON_ERROR_SYNTAX),
+    DOC("\"\\u00e9\\u00E9\"", JSON_OK),
+    DOC("\"\\u00g9\"", JSON_ERROR_SYNTAX),
+    DOC("\"\\u00e\"", JSON_ERROR_SYNTAX),
+    DOC("\"\\ud83d\\ude00\"", JSON_OK),
+    DOC("\"\\ud83d\"", JSON_ERROR_SYNTAX),
+    DOC("\"\\ud83dx\"", JSON_ERROR_SYNTAX),
+    DOC("\"\\ude00\\ud83d\"", JSON_ERROR_SYNTAX),
+    DOC("\"\\ud83d\\u0041\"", JSON_ERROR_SYNTAX),
+    DOC("\"tab\there\"", JSON_ERROR_SYNTAX),
+    DOC("\"nul\0here\"", JSON_ERROR_SYNTAX),
+    DOC("\"\x7f\"", JSON_OK),
+    DOC("\"caf\xc3\xa9 \xe6\x97\xa5 \xf0\x9f\x98\x80\"", JSON_OK),
+    DOC("\"\xc0\xaf\"", JSON_ERROR_UTF8),         // overlong '/'
+    DOC("\"\xed\xa0\x80\"", JSON_ERROR_UTF8),     // encoded surrogate
+    DOC("\"\xf4\x90\x80\x80\"", JSON_ERROR_UTF8), // past U+10FFFF
+    DOC("\"\xe6\x97\"", JSON_ERROR_UTF8),         // cut short by the quote
+    DOC("\"\x80\"", JSON_ERROR_UTF8),
+
+    // Arrays
+    DOC("[1,[2,[3]],{}]", JSON_OK),
+    DOC("[", JSON_ERROR_SYNTAX),
+    DOC("]", JSON_ERROR_SYNTAX),
+    DOC("[,]", JSON_ERROR_SYNTAX),
+    DOC("[1,]", JSON_ERROR_SYNTAX),
+    DOC("[,1]", JSON_ERROR_SYNTAX),
+    DOC("[1 2]", JSON_ERROR_SYNTAX),
+    DOC("[1}", JSON_ERROR_SYNTAX),
+
+    // Objects
+    DOC("{ \"a\" : 1 , \"b\" : [ ] }", JSON_OK),
+    DOC("{\"a\":1,\"a\":2}", JSON_OK),
+    DOC("{", JSON_ERROR_SYNTAX),
+    DOC("{\"a\"}", JSON_ERROR_SYNTAX),
+    DOC("{\"a\":}", JSON_ERROR_SYNTAX),
+    DOC("{\"a\" 1}", JSON_ERROR_SYNTAX),
+    DOC("{\"a\":1,}", JSON_ERROR_SYNTAX),
+    DOC("{,}", JSON_ERROR_SYNTAX),
+    DOC("{1:2}", JSON_ERROR_SYNTAX),
+    DOC("{a:1}", JSON_ERROR_SYNTAX),
+    DOC("{\"a\":1]", JSON_ERROR_SYNTAX),
+};
+
+static void check_grammar(void) {
+  Json_Token tape[64];
+  for (size_t i = 0; i < sizeof(grammar) / sizeof(grammar[0]); i++) {
+    String_View src = sv_from_parts(grammar[i].text, grammar[i].len);
+    Json doc;
+    Json_Error got = json_parse(&doc, src, tape, 64);
+    CHECK(got == grammar[i].want, "'" SV_Fmt "' gave %s, want %s",
+          SV_Arg(src), json_error_name(got),
+          json_error_name(grammar[i].want));
+
+    // Validating only agrees, and counts what the tape got
+    Json check;
+    Json_Error validated = json_parse(&check, src, NULL, 0);
+    CHECK(validated == got && (got != JSON_OK || check.count == doc.count),
+          "'" SV_Fmt "' without a tape", SV_Arg(src));
+
+    // One token short of the document is TAPE_FULL, never a write past it
+    if (got == JSON_OK) {
+      Json_Error short_tape = json_parse(&check, src, tape, doc.count - 1);
+      CHECK(short_tape == JSON_ERROR_TAPE_FULL, "'" SV_Fmt "' on a tape of %zu",
+            SV_Arg(src), doc.count - 1);
+    }
+  }
+}
+
+static void check_depth(void) {
+  // Five bytes and two tokens a level at most, plus the innermost value
+  char text[6 * (JSON_MAX_DEPTH + 1) + 1];
+  Json_Token tape[2 * (JSON_MAX_DEPTH + 1) + 1];
+  size_t capacity = sizeof(tape) / sizeof(tape[0]);
+
+  for (int depth = JSON_MAX_DEPTH; depth <= JSON_MAX_DEPTH + 1; depth++) {
+    Json_Error want = depth > JSON_MAX_DEPTH ? JSON_ERROR_DEPTH : JSON_OK;
+
+    // [[[...]]]
+    size_t n = 0;
+    for (int i = 0; i < depth; i++) {
+      text[n++] = '[';
+    }
+    for (int i = 0; i < depth; i++) {
+      text[n++] = ']';
+    }
+    Json doc;
+    Json_Error got = json_parse(&doc, sv_from_parts(text, n), tape, capacity);
+    CHECK(got == want, "%d arrays deep gave %s", depth, json_error_name(got));
+
+    // {"a":{"a":...1}}, the innermost value a scalar
+    n = 0;
+    for (int i = 0; i < depth; i++) {
+      memcpy(text + n, "{\"a\":", 5);
+      n += 5;
+    }
+    text[n++] = '1';
+    for (int i = 0; i < depth; i++) {
+      text[n++] = '}';
+    }
+    got = json_parse(&doc, sv_from_parts(text, n), tape, capacity);
+    CHECK(got == want, "%d objects deep gave %s", depth, json_error_name(got));
+    if (got == JSON_OK) {
+      CHECK(json_type(&doc, 2 * (size_t)depth) == JSON_NUMBER &&
+                doc.tokens[0].next == doc.count,
+            "%d objects deep, innermost value", depth);
+    }
+  }
+}
+
+static void check_escaped_keys(void) {
+  const char *text = "{\"plain\":1,"
+                     "\"a\\u0062c\":2,"
+                     "\"tab\\tkey\":3,"
+                     "\"\\u00e9t\\u00E9\":4,"
+                     "\"\\ud83d\\ude00\":5,"
+                     "\"quo\\\"te\":6,"
+                     "\"nested\":{\"x\\/y\":7,\"list\":[8,{\"k\\u0021\":9}]}}";
+  const struct {
+    const char *path;
+    int64_t want; // 0 for no such value
+  } queries[] = {
+      {"plain", 1},
+      {"abc", 2},
+      {"ab", 0},
+      {"abcd", 0},
+      {"a\\u0062c", 0}, // compared unescaped, not as written
+      {"tab\tkey", 3},
+      {"\xc3\xa9t\xc3\xa9", 4},
+      {"\xf0\x9f\x98\x80", 5},
+      {"quo\"te", 6},
+      {"nested.x/y", 7},
+      {"nested.list[0]", 8},
+      {"nested.list[1].k!", 9},
+      {"nested.list[2]", 0},
+  };
+
+  Json_Token tape[32];
+  Json doc;
+  Json_Error err = json_parse(&doc, sv_from_cstr(text), tape, 32);
+  CHECK(err == JSON_OK, "escaped keys document gave %s", json_error_name(err));
+  if (err != JSON_OK) {
+    return;
+  }
+  for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+    int64_t got = 0;
+    bool found = json_query_i64(&doc, queries[i].path, &got);
+    CHECK(found == (queries[i].want != 0) && got == queries[i].want,
+          "query '%s' gave %s %lld", queries[i].path,
+          found ? "found" : "missing", (long long)got);
+  }
+}
+
+// printf's idea of a double, as JSON, must come back through strtod the same
+static void check_doubles(void) {
+  char text[96];
+  char number[2][40];
+  Json_Token tape[3];
+
+  for (int round = 0; round < CHECK_DOUBLES; round++) {
+    double d[2];
+    for (int k = 0; k < 2; k++) {
+      d[k] = random_double();
+      // Shortest exact, then shorter and exponent forms now and then
+      int precision = 1 + rand() % 17;
+      switch (rand() % 4) {
+      case 0:
+        snprintf(number[k], sizeof(number[k]), "%.*g", precision, d[k]);
+        break;
+      case 1:
+        snprintf(number[k], sizeof(number[k]), "%.*e", precision, d[k]);
+        break;
+      default:
+        snprintf(number[k], sizeof(number[k]), "%.17g", d[k]);
+        break;
+      }
+    }
+
+    int n = snprintf(text, sizeof(text), "[%s,\n%s ]", number[0], number[1]);
+    Json doc;
+    Json_Error err = json_parse(&doc, sv_from_parts(text, (size_t)n), tape, 3);
+    CHECK(err == JSON_OK && doc.count == 3, "'%s' gave %s", text,
+          json_error_name(err));
+    if (err != JSON_OK) {
+      continue;
+    }
+
+    for (int k = 0; k < 2; k++) {
+      String_View sv = json_sv(&doc, 1 + (size_t)k);
+      CHECK(json_type(&doc, 1 + (size_t)k) == JSON_NUMBER &&
+                sv_eq(sv, sv_from_cstr(number[k])),
+            "'%s' element %d is '" SV_Fmt "'", text, k, SV_Arg(sv));
+
+      char copy[40];
+      snprintf(copy, sizeof(copy), SV_Fmt, SV_Arg(sv));
+      double back = strtod(copy, NULL);
+      double want = strtod(number[k], NULL);
+      CHECK(memcmp(&back, &want, sizeof(back)) == 0, "'%s' read back as %.17g",
+            number[k], back);
+    }
+  }
+}
+
+// Significant digits in a number as written, without the exponent
+static int significant_digits(String_View number) {
+  char digits[40];
+  size_t n = 0;
+  for (size_t i = 0; i < number.count && number.data[i] != 'e'; i++) {
+    if (number.data[i] >= '0' && number.data[i] <= '9') {
+      digits[n++] = number.data[i];
+    }
+  }
+  size_t first = 0;
+  while (first < n && digits[first] == '0') {
+    first++;
+  }
+  while (n > first && digits[n - 1] == '0') {
+    n--;
+  }
+  return (int)(n - first);
+}
+
+// Fewest %g digits that strtod reads back as `d`
+static int shortest_digits(double d) {
+  char text[40];
+  for (int precision = 1; precision < 17; precision++) {
+    snprintf(text, sizeof(text), "%.*g", precision, d);
+    if (strtod(text, NULL) == d) {
+      return precision;
+    }
+  }
+  return 17;
+}
+
+static void check_write_double(double d, String_Builder *sb, size_t *longer,
+                               int index) {
+  Json_Writer w;
+  sb->count = 0;
+  json_writer_init(&w, sb);
+  json_write_double(&w, d);
+  da_append(sb, '\0');
+  String_View out = sv_from_parts(sb->items, sb->count - 1);
+
+  Json doc;
+  Json_Token tape[1];
+  Json_Error err = json_parse(&doc, out, tape, 1);
+  CHECK(!w.failed && err == JSON_OK && json_type(&doc, 0) == JSON_NUMBER,
+        "%.17g written as '%s'", d, sb->items);
+
+  double back = strtod(sb->items, NULL);
+  CHECK(memcmp(&back, &d, sizeof(d)) == 0, "%.17g written as '%s'", d,
+        sb->items);
+  if (index < CHECK_SHORTEST && d != 0 &&
+      significant_digits(out) > shortest_digits(d)) {
+    (*longer)++;
+  }
+}
+
+static void check_writer(void) {
+  String_Builder sb = {0};
+  size_t longer = 0;
+
+  // Boundaries of the notations and of the format itself
+  const double fixed[] = {
+      0.0,    -0.0,    1.0,     -1.0,   0.1,        1.0 / 3, 2.0 / 3,
+      1e-6,   1e-7,    9.99e-7, 1e20,   1e21,       1e22,    123e18,
+      5e-324, DBL_MIN, DBL_MAX, 0x1p53, 0x1p53 + 2, 0x1p63,  0x1p64,
+      -1e-300, 1e300,  4.35,    0.3,    2.5e-5,     1234567890123456789.0,
+  };
+  for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+    check_write_double(fixed[i], &sb, &longer, CHECK_SHORTEST);
+  }
+  for (int i = 0; i < CHECK_DOUBLES; i++) {
+    check_write_double(random_double(), &sb, &longer, i);
+  }
+
+  const double none[] = {NAN, -NAN, INFINITY, -INFINITY};
+  for (size_t i = 0; i < sizeof(none) / sizeof(none[0]); i++) {
+    Json_Writer w;
+    sb.count = 0;
+    json_writer_init(&w, &sb);
+    json_write_double(&w, none[i]);
+    CHECK(sv_eq(sb_to_sv(sb), sv_from_cstr("null")), "%g not written as null",
+          none[i]);
+  }
+
+  // Strings of everything that needs escaping and everything that does not,
+  // some long enough to go through the 16 byte scan
+  static const char *pieces[] = {
+      "a",    "plain text ", "\"",       "\\",           "/",
+      "\b",   "\f",          "\n",       "\r",           "\t",
+      "\x01", "\x1f",        "\x7f",     "\xc3\xa9",     "\xe6\x97\xa5",
+      "\xf0\x9f\x98\x80",
+  };
+  size_t piece_count = sizeof(pieces) / sizeof(pieces[0]);
+  String_Builder s = {0};
+  String_Builder want = {0};
+  String_Builder back = {0};
+  Json_Token tape[3];
+  for (int i = 0; i < CHECK_STRINGS; i++) {
+    s.count = 0;
+    size_t count = (size_t)rand() % (i % 10 == 0 ? 200 : 12);
+    for (size_t k = 0; k < count; k++) {
+      sb_append_cstr(&s, pieces[(size_t)rand() % piece_count]);
+    }
+    // A NUL now and then, which strlen would have dropped, over an ASCII
+    // byte so the string stays UTF-8
+    size_t at = s.count > 0 ? (size_t)rand() % s.count : 0;
+    if (at < s.count && (unsigned char)s.items[at] < 0x80 && rand() % 8 == 0) {
+      s.items[at] = '\0';
+    }
+    String_View sv = sb_to_sv(s);
+
+    want.count = 0;
+    da_append(&want, '[');
+    quoted_bytewise(&want, sv);
+    da_append(&want, ',');
+    quoted_bytewise(&want, sv);
+    da_append(&want, ']');
+
+    Json_Writer w;
+    sb.count = 0;
+    json_writer_init(&w, &sb);
+    json_write_begin_array(&w);
+    json_write_string(&w, sv);
+    json_write_string(&w, sv);
+    json_write_end_array(&w);
+    CHECK(!w.failed && sv_eq(sb_to_sv(sb), sb_to_sv(want)),
+          "json_write_string wrote '" SV_Fmt "', want '" SV_Fmt "'",
+          SV_Arg(sb_to_sv(sb)), SV_Arg(sb_to_sv(want)));
+
+    // And the tokenizer reads back what went in
+    Json doc;
+    back.count = 0;
+    bool ok = json_parse(&doc, sb_to_sv(sb), tape, 3) == JSON_OK &&
+              json_unescape(&doc, 2, &back);
+    CHECK(ok && sv_eq(sb_to_sv(back), sv),
+          "'" SV_Fmt "' did not read back as written", SV_Arg(sb_to_sv(sb)));
+  }
+
+  sb_free(s);
+  sb_free(want);
+  sb_free(back);
+  sb_free(sb);
+  printf("writer: %d doubles read back through strtod, %zu of %d longer than "
+         "the shortest %%g\n",
+         CHECK_DOUBLES, longer, CHECK_SHORTEST);
+}
+
+static void check_equivalence(void) {
+  check_grammar();
+  check_depth();
+  check_escaped_keys();
+  check_doubles();
+  printf("grammar, depth %d/%d, escaped keys and %d doubles through strtod "
+         "check out\n",
+         JSON_MAX_DEPTH, JSON_MAX_DEPTH + 1, CHECK_DOUBLES);
+  check_writer();
+
+  if (failures > 0) {
+    fprintf(stderr, "%d mismatches\n", failures);
+    exit(1);
+  }
+  printf("writer escapes strings byte for byte like the plain loop\n");
+}
+
+// ---------- Timing ----------
+
+static volatile size_t sink;
+
+#define BENCH(label, expr)                                                     \
+  do {                                                                         \
+    double best = 1e9;                                                         \
+    for (int round = 0; round < 5; round++) {                                  \
+      double start = now();                                                    \
+      for (size_t i = 0; i < BENCH_VALUES; i++) {                              \
+        sb.count = 0;                                                          \
+        expr;                                                                  \
+        sink += sb.count;                                                      \
+      }                                                                        \
+      double t = now() - start;                                                \
+      best = t < best ? t : best;                                              \
+    }                                                                          \
+    printf("  %-24s %7.1f ns\n", label, best / BENCH_VALUES * 1e9);            \
+  } while (0)
+
+// An array of records the way /create gets them, some keys and strings
+// escaped and some non-ASCII, numbers of every kind
+static void bench_document(String_Builder *sb) {
+  da_append(sb, '[');
+  for (int i = 0; i < BENCH_RECORDS; i++) {
+    sb_appendf(sb,
+               "%s{\"id\": %d, \"name\": \"user %d\", "
+               "\"email\": \"user%d@example.com\", \"score\": %.6g, "
+               "\"bio\": \"Caf\xc3\xa9 regular, likes \\\"quotes\\\" and "
+               "\xe6\x97\xa5\xe6\x9c\xac\\u00e9\\n\", "
+               "\"tags\": [\"a\", \"b\", \"c\\td\"], \"active\": %s, "
+               "\"parent\": null, \"pos\": {\"x\": %d.25, \"y\": -%de-3}}",
+               i > 0 ? ",\n  " : "", i, i, i, (double)rand() / 7.0,
+               i % 3 ? "true" : "false", i % 1000, i % 977);
+  }
+  da_append(sb, ']');
+}
+
+int main(void) {
+  check_equivalence();
+
+  String_Builder sb = {0};
+  bench_document(&sb);
+  String_View src = sb_to_sv(sb);
+
+  Json doc;
+  if (json_parse(&doc, src, NULL, 0) != JSON_OK) {
+    fprintf(stderr, "benchmark document does not parse\n");
+    return 1;
+  }
+  size_t capacity = doc.count;
+  Json_Token *tape = malloc(capacity * sizeof(*tape));
+  printf("%d records (%zu bytes, %zu tokens)\n", BENCH_RECORDS, src.count,
+         capacity);
+
+  const struct {
+    const char *label;
+    Json_Token *tape;
+  } modes[] = {{"json_parse, validate", NULL}, {"json_parse, tape", tape}};
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    double best = 1e9;
+    for (int round = 0; round < 5; round++) {
+      double start = now();
+      json_parse(&doc, src, modes[m].tape, capacity);
+      sink += doc.count;
+      double t = now() - start;
+      best = t < best ? t : best;
+    }
+    printf("  %-24s %7.2f GB/s\n", modes[m].label,
+           (double)src.count / best / 1e9);
+  }
+
+  // The body of one /create request, parsed and queried per request
+  const char *body = "{\"user\": {\"name\": \"ada\", "
+                     "\"tags\": [\"x\", \"y\"]}, "
+                     "\"input\": \"let x = 10;\", \"count\": 3}";
+  String_View body_sv = sv_from_cstr(body);
+  Json_Token small[32];
+  printf("one request body (%zu bytes), per body\n", body_sv.count);
+  double best = 1e9;
+  for (int round = 0; round < 5; round++) {
+    double start = now();
+    for (size_t i = 0; i < BENCH_QUERIES; i++) {
+      Json body_doc;
+      String_View input;
+      json_parse(&body_doc, body_sv, small, 32);
+      json_query_string(&body_doc, "input", &input);
+      sink += input.count + json_query(&body_doc, 0, "user.tags[1]");
+    }
+    double t = now() - start;
+    best = t < best ? t : best;
+  }
+  printf("  %-24s %7.1f ns\n", "parse + two queries",
+         best / BENCH_QUERIES * 1e9);
+
+  // The writer, one value per document
+  double *doubles = malloc(BENCH_VALUES * sizeof(*doubles));
+  int64_t *ints = malloc(BENCH_VALUES * sizeof(*ints));
+  for (size_t i = 0; i < BENCH_VALUES; i++) {
+    doubles[i] = random_double();
+    ints[i] = (int64_t)(rand64() >> (rand() % 64));
+  }
+  sb.count = 0;
+  Json_Writer w;
+  printf("writer, per value\n");
+  BENCH("sb_appendf %.17g", sb_appendf(&sb, "%.17g", doubles[i]));
+  BENCH("json_write_double",
+        (json_writer_init(&w, &sb), json_write_double(&w, doubles[i])));
+  BENCH("sb_appendf %" PRId64, sb_appendf(&sb, "%" PRId64, ints[i]));
+  BENCH("json_write_i64",
+        (json_writer_init(&w, &sb), json_write_i64(&w, ints[i])));
+
+  // Prose with a few escapes in it, the way /create bodies echo back
+  String_Builder text = {0};
+  while (text.count < BENCH_STRING) {
+    sb_append_cstr(&text, "The quick brown fox jumps over the lazy dog, "
+                          "\"twice\" on Tuesdays.\n");
+  }
+  double best_string = 1e9;
+  for (int round = 0; round < 5; round++) {
+    double start = now();
+    sb.count = 0;
+    json_writer_init(&w, &sb);
+    json_write_string(&w, sb_to_sv(text));
+    sink += sb.count;
+    double t = now() - start;
+    best_string = t < best_string ? t : best_string;
+  }
+  printf("  %-24s %7.2f GB/s\n", "json_write_string",
+         (double)text.count / best_string / 1e9);
+
+  free(doubles);
+  free(ints);
+  free(tape);
+  sb_free(text);
+  sb_free(sb);
+  return 0;
+}
@@ -0,0 +1,270 @@
+// Integer parsing and formatting against the digit at a time versions and
+// libc. Checks that they agree first, on boundaries and random input, and
+// stops on the first difference. `make bench/numbers`
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/sv.h"
+#include "bench.h"
+
+#define BENCH_NUMBERS (1 << 20)
+
+// ---------- The previous version ----------
+
+static bool to_i64_divide(String_View sv, int64_t *out) {
+  if (sv.count == 0)
+    return false;
+
+  size_t i = 0;
+  bool negative = false;
+  if (sv.data[0] == '-') {
+    negative = true;
+    i++;
+  } else if (sv.data[0] == '+') {
+    i++;
+  }
+  if (i == sv.count)
+    return false;
+
+  uint64_t result = 0;
+  for (; i < sv.count; i++) {
+    char c = sv.data[i];
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    uint64_t digit = (uint64_t)(c - '0');
+    if (result > (UINT64_MAX - digit) / 10) {
+      errno = ERANGE;
+      return false;
+    }
+    result = result * 10 + digit;
+  }
+
+  if (negative) {
+    if (result > (uint64_t)INT64_MAX + 1)
+      return false;
+    *out = (int64_t)(0 - result);
+  } else {
+    if (result > INT64_MAX)
+      return false;
+    *out = (int64_t)result;
+  }
+  return true;
+}
+
+// ---------- Equivalence ----------
+
+static void check_parse(const char *s, size_t n) {
+  String_View sv = sv_from_parts(s, n);
+  int64_t a = 0, b = 0;
+  bool ok_a = sv_to_i64(sv, &a);
+  bool ok_b = to_i64_divide(sv, &b);
+  CHECK(ok_a == ok_b && a == b, "sv_to_i64 '%.*s'", (int)n, s);
+
+  // Unsigned: the same digits without a sign, overflowing only past 2^64
+  uint64_t u;
+  bool digits = n > 0 && strspn(s, "0123456789") >= n;
+  if (digits) {
+    char copy[64];
+    snprintf(copy, sizeof(copy), "%.*s", (int)n, s);
+    errno = 0;
+    uint64_t expected = strtoull(copy, NULL, 10);
+    bool fits = errno != ERANGE;
+    errno = 0;
+    bool ok = sv_to_u64(sv, &u);
+    CHECK(ok == fits && (!ok || u == expected) && (ok || errno == ERANGE),
+          "sv_to_u64 '%.*s'", (int)n, s);
+  } else {
+    CHECK(!sv_to_u64(sv, &u), "sv_to_u64 '%.*s' not digits", (int)n, s);
+  }
+}
+
+static void check_hex(const char *s, size_t n) {
+  uint64_t u;
+  bool ok = sv_to_u64_hex(sv_from_parts(s, n), &u);
+  bool hex = n > 0 && strspn(s, "0123456789abcdefABCDEF") >= n;
+  if (!hex) {
+    CHECK(!ok, "sv_to_u64_hex '%.*s' not hex", (int)n, s);
+    return;
+  }
+  char copy[64];
+  snprintf(copy, sizeof(copy), "%.*s", (int)n, s);
+  errno = 0;
+  uint64_t expected = strtoull(copy, NULL, 16);
+  bool fits = errno != ERANGE;
+  CHECK(ok == fits && (!ok || u == expected), "sv_to_u64_hex '%.*s'", (int)n,
+        s);
+}
+
+static void check_format(uint64_t n) {
+  char expected[32];
+  String_Builder sb = {0};
+
+  snprintf(expected, sizeof(expected), "%" PRIu64, n);
+  sb_append_u64(&sb, n);
+  CHECK(sv_eq(sb_to_sv(sb), sv_from_cstr(expected)), "sb_append_u64 %s",
+        expected);
+
+  sb.count = 0;
+  snprintf(expected, sizeof(expected), "%" PRId64, (int64_t)n);
+  sb_append_i64(&sb, (int64_t)n);
+  CHECK(sv_eq(sb_to_sv(sb), sv_from_cstr(expected)), "sb_append_i64 %s",
+        expected);
+  sb_free(sb);
+}
+
+static void check_equivalence(void) {
+  const char *fixed[] = {
+      "",
+      "+",
+      "-",
+      "0",
+      "-0",
+      "+7",
+      "00000000000000000000000000042",
+      "9223372036854775807",
+      "9223372036854775808",
+      "-9223372036854775808",
+      "-9223372036854775809",
+      "18446744073709551615",
+      "18446744073709551616",
+      "18446744073709551620",
+      "99999999999999999999",
+      "100000000000000000000",
+      "0018446744073709551615",
+      "12345678",
+      "1234567/",
+      "1234567:",
+      "12345678 ",
+      " 1",
+      "1e3",
+  };
+  for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+    check_parse(fixed[i], strlen(fixed[i]));
+    check_hex(fixed[i], strlen(fixed[i]));
+  }
+  const char *hex[] = {"ffffffffffffffff", "FFFFFFFFFFFFFFFF0",
+                       "00000000000000000ffffffffffffffff", "1A2b", "0x10",
+                       "g"};
+  for (size_t i = 0; i < sizeof(hex) / sizeof(hex[0]); i++) {
+    check_hex(hex[i], strlen(hex[i]));
+  }
+
+  // Digit strings of every length with a stray byte dropped in sometimes,
+  // the bytes around '0' and '9' among them
+  const char stray[] = "+-/: a\x80\xff\0";
+  char s[32];
+  for (int round = 0; round < 2000000; round++) {
+    size_t n = (size_t)rand() % 24;
+    for (size_t i = 0; i < n; i++) {
+      s[i] = (char)('0' + rand() % 10);
+    }
+    if (n > 0 && rand() % 2 == 0) {
+      s[(size_t)rand() % n] = stray[rand() % (sizeof(stray) - 1)];
+    }
+    s[n] = '\0';
+    check_parse(s, n);
+    for (size_t i = 0; i < n; i++) {
+      if (rand() % 3 == 0) {
+        s[i] = "abcdefABCDEF"[rand() % 12];
+      }
+    }
+    check_hex(s, n);
+  }
+
+  for (int shift = 0; shift < 64; shift++) {
+    uint64_t p = 1ull << shift;
+    check_format(p - 1);
+    check_format(p);
+    check_format(p + 1);
+  }
+  for (uint64_t p = 1; p <= UINT64_MAX / 10; p *= 10) {
+    check_format(p - 1);
+    check_format(p);
+  }
+  check_format(UINT64_MAX);
+  check_format((uint64_t)INT64_MIN);
+  for (int round = 0; round < 1000000; round++) {
+    check_format(rand64() >> (rand() % 64));
+  }
+
+  if (failures > 0) {
+    fprintf(stderr, "%d mismatches\n", failures);
+    exit(1);
+  }
+  printf("parsing and formatting agree with the previous code and libc\n");
+}
+
+// ---------- Timing ----------
+
+static volatile uint64_t sink;
+
+#define BENCH(label, expr)                                                     \
+  do {                                                                         \
+    double best = 1e9;                                                         \
+    for (int round = 0; round < 5; round++) {                                  \
+      double start = now();                                                    \
+      for (size_t i = 0; i < BENCH_NUMBERS; i++) {                             \
+        expr;                                                                  \
+      }                                                                        \
+      double t = now() - start;                                                \
+      best = t < best ? t : best;                                              \
+    }                                                                          \
+    printf("  %-24s %7.2f ns\n", label, best / BENCH_NUMBERS * 1e9);           \
+  } while (0)
+
+int main(void) {
+  check_equivalence();
+
+  // Content-Length sized numbers, then the full 64-bit range
+  const struct {
+    const char *name;
+    uint64_t max;
+  } ranges[] = {{"up to 6 digits", 999999}, {"up to 20 digits", UINT64_MAX}};
+
+  uint64_t *values = malloc(BENCH_NUMBERS * sizeof(*values));
+  char(*text)[24] = malloc(BENCH_NUMBERS * sizeof(*text));
+  String_View *views = malloc(BENCH_NUMBERS * sizeof(*views));
+  String_Builder sb = {0};
+  da_reserve(&sb, 32);
+
+  for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+    for (size_t i = 0; i < BENCH_NUMBERS; i++) {
+      values[i] = rand64() >> (rand() % 64);
+      if (ranges[r].max != UINT64_MAX) {
+        values[i] %= ranges[r].max + 1;
+      }
+      // Signed parsers see the top half as out of range, keep it comparable
+      values[i] >>= 1;
+      int n = snprintf(text[i], sizeof(text[i]), "%" PRIu64, values[i]);
+      views[i] = sv_from_parts(text[i], (size_t)n);
+    }
+    printf("%s, per number\n", ranges[r].name);
+
+    int64_t x;
+    uint64_t u;
+    BENCH("to_i64 dividing", (to_i64_divide(views[i], &x), sink += (uint64_t)x));
+    BENCH("strtoll", sink += (uint64_t)strtoll(text[i], NULL, 10));
+    BENCH("sv_to_i64", (sv_to_i64(views[i], &x), sink += (uint64_t)x));
+    BENCH("sv_to_u64", (sv_to_u64(views[i], &u), sink += u));
+
+    BENCH("sb_appendf %zu", (sb.count = 0, sb_appendf(&sb, "%zu", values[i]),
+                             sink += (uint64_t)sb.items[0]));
+    BENCH("snprintf", (snprintf(sb.items, 24, "%" PRIu64, values[i]),
+                       sink += (uint64_t)sb.items[0]));
+    BENCH("sb_append_u64", (sb.count = 0, sb_append_u64(&sb, values[i]),
+                            sink += (uint64_t)sb.items[0]));
+  }
+
+  free(values);
+  free(text);
+  free(views);
+  sb_free(sb);
+  return 0;
+}
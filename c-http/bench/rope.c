@@ -0,0 +1,145 @@
+// Assembling a large body in a Rope against a String_Builder, the way the
+// multipart/byteranges handler does: a short formatted head, then a slice of
+// a file, over and over. Checks first that the rope's iovecs carry exactly
+// the bytes the builder holds. `make bench/rope`
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/rope.h"
+#include "bench.h"
+
+#define BENCH_PARTS 64
+#define BENCH_ROUNDS 20
+
+static char *source;
+static size_t source_size;
+
+// The part sizes of one body, up to `max` bytes each
+static size_t parts[BENCH_PARTS];
+
+static void build_sb(String_Builder *sb) {
+  size_t at = 0;
+  for (size_t i = 0; i < BENCH_PARTS; i++) {
+    sb_appendf(sb, "\r\n--boundary\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+               at, at + parts[i] - 1, source_size);
+    da_append_many(sb, source + at, parts[i]);
+    at += parts[i];
+  }
+  sb_append_cstr(sb, "\r\n--boundary--\r\n");
+}
+
+static void build_rope(Rope *rope) {
+  size_t at = 0;
+  for (size_t i = 0; i < BENCH_PARTS; i++) {
+    rope_appendf(rope, "\r\n--boundary\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                 at, at + parts[i] - 1, source_size);
+    rope_append(rope, source + at, parts[i]);
+    at += parts[i];
+  }
+  rope_splice(rope, sv_from_cstr("\r\n--boundary--\r\n"));
+}
+
+// ---------- Equivalence ----------
+
+// Walks the rope through small iovec windows at every kind of offset, the way
+// a sender resumes after short writes
+static bool rope_matches(const Rope *rope, String_View want) {
+  if (rope->length != want.count) {
+    return false;
+  }
+  size_t at = 0;
+  while (at < want.count) {
+    struct iovec iov[3];
+    size_t n = rope_iov(rope, at, iov, 3);
+    if (n == 0) {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (memcmp(iov[i].iov_base, want.data + at, iov[i].iov_len) != 0) {
+        return false;
+      }
+      // Stop partway through the window now and then
+      size_t step = iov[i].iov_len;
+      if (i == n - 1 && step > 1 && rand() % 2 == 0) {
+        step = 1 + (size_t)rand() % (step - 1);
+      }
+      at += step;
+      if (step < iov[i].iov_len) {
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+static void check_equivalence(void) {
+  String_Builder sb = {0};
+  Rope rope = {0};
+  for (int round = 0; round < 200; round++) {
+    for (size_t i = 0; i < BENCH_PARTS; i++) {
+      // Mostly small, sometimes bigger than a chunk
+      parts[i] = 1 + (size_t)rand() % (rand() % 8 == 0 ? 3 * ROPE_CHUNK_SIZE
+                                                      : 512);
+    }
+    sb.count = 0;
+    rope_clear(&rope);
+    build_sb(&sb);
+    build_rope(&rope);
+    CHECK(rope_matches(&rope, sb_to_sv(sb)), "round %d", round);
+  }
+  sb_free(sb);
+  rope_free(&rope);
+  if (failures > 0) {
+    fprintf(stderr, "%d mismatches\n", failures);
+    exit(1);
+  }
+  printf("rope iovecs carry the same bytes as the builder\n");
+}
+
+// ---------- Timing ----------
+
+int main(void) {
+  source_size = 64 << 20;
+  source = malloc(source_size);
+  for (size_t i = 0; i < source_size; i++) {
+    source[i] = (char)rand();
+  }
+
+  check_equivalence();
+
+  // Bodies of about 64 KB to 64 MB, each one built from nothing the way a
+  // fresh response is
+  const size_t sizes[] = {1 << 10, 16 << 10, 1 << 20};
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    for (size_t i = 0; i < BENCH_PARTS; i++) {
+      parts[i] = sizes[s];
+    }
+    printf("%d parts of %zu KB, per body\n", BENCH_PARTS, sizes[s] >> 10);
+
+    double best_sb = 1e9, best_rope = 1e9;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+      double start = now();
+      String_Builder sb = {0};
+      build_sb(&sb);
+      sb_free(sb);
+      double t = now() - start;
+      best_sb = t < best_sb ? t : best_sb;
+
+      start = now();
+      Rope rope = {0};
+      build_rope(&rope);
+      rope_free(&rope);
+      t = now() - start;
+      best_rope = t < best_rope ? t : best_rope;
+    }
+    printf("  %-24s %9.1f us\n", "String_Builder", best_sb * 1e6);
+    printf("  %-24s %9.1f us\n", "Rope", best_rope * 1e6);
+  }
+
+  free(source);
+  return 0;
+}
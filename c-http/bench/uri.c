@@ -0,0 +1,187 @@
+// uri_path_clean against what it replaced: cut the query and fragment,
+// percent-decode into a String_Builder, then sb_path_clean. First checks
+// random targets built from the pieces that matter (slashes, dot segments,
+// escapes good and bad) for the same path and the same rejects, also with
+// the output on top of the input. `make bench/uri`
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/sv.h"
+#include "bench.h"
+
+#define CHECK_INPUTS 1000000
+#define CHECK_PIECES 12
+#define BENCH_TARGETS (1 << 20)
+
+// ---------- The previous version ----------
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// False where uri_path_clean rejects the target, or out of memory
+static bool decode_then_clean(String_View uri, String_Builder *decoded,
+                              String_Builder *out) {
+  size_t end = 0;
+  while (end < uri.count && uri.data[end] != '?' && uri.data[end] != '#') {
+    end++;
+  }
+
+  decoded->count = 0;
+  for (size_t i = 0; i < end; i++) {
+    char c = uri.data[i];
+    if (c == '%') {
+      int hi = i + 2 < end ? hex_value(uri.data[i + 1]) : -1;
+      int lo = hi >= 0 ? hex_value(uri.data[i + 2]) : -1;
+      if (lo < 0) {
+        return false;
+      }
+      c = (char)(hi << 4 | lo);
+      i += 2;
+      if (c == '/') {
+        return false;
+      }
+    }
+    if (c == '\0') {
+      return false;
+    }
+    if (!da_append(decoded, c)) {
+      return false;
+    }
+  }
+
+  return sb_path_clean(out, sb_to_sv(*decoded));
+}
+
+// ---------- Equivalence ----------
+
+static const char *pieces[] = {
+    "/",   "/",   "//",  ".",   "..",  "a",   "bc",  "%2e", "%2E", "%2e%2e",
+    "%2f", "%2F", "%00", "%41", "%4",  "%zz", "%",   "?q", "?a/../b", "#f",
+    "a.",  ".b",  "...", "%25", "\x80"};
+#define PIECE_COUNT (sizeof(pieces) / sizeof(pieces[0]))
+
+static size_t random_target(char *buf) {
+  size_t n = 0;
+  size_t count = (size_t)rand() % CHECK_PIECES;
+  for (size_t i = 0; i < count; i++) {
+    const char *p = pieces[(size_t)rand() % PIECE_COUNT];
+    size_t len = strlen(p);
+    memcpy(buf + n, p, len);
+    n += len;
+  }
+  return n;
+}
+
+static void check_equivalence(void) {
+  String_Builder decoded = {0};
+  String_Builder want = {0};
+  char uri[CHECK_PIECES * 8];
+  char out[sizeof(uri) + 1];
+  size_t rejected = 0;
+
+  for (int i = 0; i < CHECK_INPUTS && failures < 10; i++) {
+    size_t n = random_target(uri);
+    String_View target = sv_from_parts(uri, n);
+    bool want_ok = decode_then_clean(target, &decoded, &want);
+    rejected += !want_ok;
+
+    size_t got_len = 0;
+    bool got_ok = uri_path_clean(target, out, sizeof(out), &got_len);
+    bool same = got_ok == want_ok &&
+                (!got_ok || sv_eq(sv_from_parts(out, got_len), sb_to_sv(want)));
+
+    // In place, into a buffer the target starts at
+    char inplace[sizeof(out)];
+    memcpy(inplace, uri, n);
+    size_t inplace_len = 0;
+    bool inplace_ok = uri_path_clean(sv_from_parts(inplace, n), inplace,
+                                     sizeof(inplace), &inplace_len);
+    same = same && inplace_ok == got_ok &&
+           (!got_ok || (inplace_len == got_len &&
+                        memcmp(inplace, out, got_len) == 0));
+
+    CHECK(same, "on \"%.*s\": want %s \"" SV_Fmt "\"", (int)n, uri,
+          want_ok ? "ok" : "reject", SV_Arg(sb_to_sv(want)));
+  }
+
+  // Too small a buffer is a reject, not an overflow
+  size_t len;
+  CHECK(!uri_path_clean(sv_from_cstr("/abc"), out, 4, &len),
+        "wrote past out_cap");
+
+  sb_free(decoded);
+  sb_free(want);
+  if (failures > 0) {
+    fprintf(stderr, "%d mismatches\n", failures);
+    exit(1);
+  }
+  printf("same paths and rejects as decode + sb_path_clean on %d targets "
+         "(%zu rejected), in place too\n",
+         CHECK_INPUTS, rejected);
+}
+
+// ---------- Timing ----------
+
+static volatile size_t sink;
+
+int main(void) {
+  check_equivalence();
+
+  // What browsers ask a static server for
+  const char *targets[] = {
+      "/",
+      "/favicon.ico",
+      "/assets/css/site.min.css?v=3f2a91",
+      "/docs/guide/../api/http%20server.html#routing",
+      "/img/photos/2024/summer/IMG_0042.jpg",
+  };
+  size_t count = sizeof(targets) / sizeof(targets[0]);
+  printf("%zu request targets, per target\n", count);
+
+  String_Builder decoded = {0};
+  String_Builder sb = {0};
+  double best = 1e9;
+  for (int round = 0; round < 5; round++) {
+    double start = now();
+    for (size_t i = 0; i < BENCH_TARGETS; i++) {
+      decode_then_clean(sv_from_cstr(targets[i % count]), &decoded, &sb);
+      sink += sb.count;
+    }
+    double t = now() - start;
+    best = t < best ? t : best;
+  }
+  printf("  %-24s %7.1f ns\n", "decode + sb_path_clean",
+         best / BENCH_TARGETS * 1e9);
+
+  char out[256];
+  best = 1e9;
+  for (int round = 0; round < 5; round++) {
+    double start = now();
+    for (size_t i = 0; i < BENCH_TARGETS; i++) {
+      size_t len = 0;
+      uri_path_clean(sv_from_cstr(targets[i % count]), out, sizeof(out), &len);
+      sink += len;
+    }
+    double t = now() - start;
+    best = t < best ? t : best;
+  }
+  printf("  %-24s %7.1f ns\n", "uri_path_clean", best / BENCH_TARGETS * 1e9);
+
+  sb_free(decoded);
+  sb_free(sb);
+  return 0;
+}
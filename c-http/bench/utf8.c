@@ -0,0 +1,230 @@
+// UTF-8 kernels against the one code point at a time versions. Before timing
+// anything it feeds every validation kernel the CPU has, and utf8_to_utf32,
+// strings of edge bytes at every length and position around the 16 and
+// 32-byte blocks, and stops on the first difference. `make bench/utf8`
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The kernels are static: built in here they can be called one by one
+#include "../src/sv.c"
+#include "bench.h"
+
+#define BENCH_BYTES (16 << 20)
+#define CHECK_LEN 72 // two AVX2 blocks and a tail
+#define FUZZ_ROUNDS 2000
+
+// The text repeated up to BENCH_BYTES, cut at a code point boundary
+static String_Builder corpus(const char *text) {
+  String_Builder sb = {0};
+  size_t n = strlen(text);
+  while (sb.count + n <= BENCH_BYTES) {
+    da_append_many(&sb, text, n);
+  }
+  return sb;
+}
+
+static bool validate_decode(const char *s, size_t n) {
+  size_t consumed;
+  for (size_t i = 0; i < n; i += consumed) {
+    if (utf8_decode(s + i, n - i, &consumed) == 0xFFFD && consumed == 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static size_t to_utf32_decode(const char *s, size_t n, uint32_t *out) {
+  size_t consumed, count = 0;
+  for (size_t i = 0; i < n; i += consumed) {
+    out[count++] = utf8_decode(s + i, n - i, &consumed);
+  }
+  return count;
+}
+
+// ---------- Equivalence ----------
+
+// Each side of every split the lookups make: ASCII, continuations where the
+// overlong, surrogate and too-large checks cut them, and leads from the
+// overlong ones to the ones past U+10FFFF
+static const unsigned char EDGE_BYTES[] = {
+    0x00, 0x41, 0x7F, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xC1,
+    0xC2, 0xDF, 0xE0, 0xE1, 0xEC, 0xED, 0xEE, 0xEF, 0xF0, 0xF1, 0xF3,
+    0xF4, 0xF5, 0xF8, 0xFF,
+};
+
+static const uint32_t EDGE_CODE_POINTS[] = {
+    0x00,   0x7F,   0x80,    0x7FF,   0x800,    0xFFF,    0x1000,
+    0xD7FF, 0xE000, 0xFFFF,  0x10000, 0x3FFFF,  0x40000,  0xFFFFF,
+    0x100000, 0x10FFFF,
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct {
+  const char *name;
+  bool (*validate)(const unsigned char *s, size_t n);
+} Kernel;
+
+static Kernel kernels[3];
+static size_t kernel_count;
+
+static void pick_kernels(void) {
+  kernels[kernel_count++] = (Kernel){"scalar", utf8_validate_scalar};
+#if UTF8_X86
+  if (__builtin_cpu_supports("sse4.1")) {
+    kernels[kernel_count++] = (Kernel){"sse4.1", utf8_validate_sse4};
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    kernels[kernel_count++] = (Kernel){"avx2", utf8_validate_avx2};
+  }
+#endif
+}
+
+// Edge code points, then ASCII where the next one does not fit. An edge byte
+// takes the place of a code point one time in `1 << rarity`, never when
+// `rarity` is negative.
+static void fill(char *s, size_t n, int rarity) {
+  size_t i = 0;
+  while (i < n) {
+    if (rarity >= 0 && (rand() & ((1 << rarity) - 1)) == 0) {
+      s[i++] = (char)EDGE_BYTES[rand() % COUNT(EDGE_BYTES)];
+      continue;
+    }
+    char cp[4];
+    size_t len = utf8_encode(EDGE_CODE_POINTS[rand() % COUNT(EDGE_CODE_POINTS)],
+                             cp);
+    if (len > n - i) {
+      memset(s + i, 'a', n - i);
+      break;
+    }
+    memcpy(s + i, cp, len);
+    i += len;
+  }
+}
+
+static void check_string(const char *s, size_t n, const char *what) {
+  bool valid = validate_decode(s, n);
+  CHECK(utf8_validate(s, n) == valid, "utf8_validate of %s, %zu bytes", what,
+        n);
+  for (size_t k = 0; k < kernel_count; k++) {
+    CHECK(kernels[k].validate((const unsigned char *)s, n) == valid,
+          "%s validate of %s, %zu bytes", kernels[k].name, what, n);
+  }
+
+  uint32_t got[CHECK_LEN], want[CHECK_LEN];
+  size_t count = utf8_to_utf32(s, n, got);
+  if (!valid) {
+    CHECK(count == SIZE_MAX, "utf8_to_utf32 of invalid %s, %zu bytes", what,
+          n);
+  } else {
+    size_t expected = to_utf32_decode(s, n, want);
+    CHECK(count == expected && memcmp(got, want, count * sizeof(*got)) == 0,
+          "utf8_to_utf32 of %s, %zu bytes", what, n);
+  }
+}
+
+static void check_equivalence(void) {
+  _Alignas(32) char buf[32 + CHECK_LEN];
+  char what[32];
+  int strings = 0;
+
+  pick_kernels();
+  for (size_t n = 0; n <= CHECK_LEN; n++) {
+    // Every edge byte at every position of a valid string, at shifting
+    // alignments
+    for (size_t at = 0; at < n; at++) {
+      char *s = buf + (n + at) % 32;
+      fill(s, n, -1);
+      for (size_t e = 0; e < COUNT(EDGE_BYTES); e++) {
+        char saved = s[at];
+        s[at] = (char)EDGE_BYTES[e];
+        snprintf(what, sizeof(what), "0x%02x at %zu", EDGE_BYTES[e], at);
+        check_string(s, n, what);
+        s[at] = saved;
+        strings++;
+      }
+    }
+    // Edge bytes from never to all of them
+    for (int round = 0; round < FUZZ_ROUNDS; round++) {
+      char *s = buf + rand() % 32;
+      int rarity = round % 5 - 1;
+      fill(s, n, rarity);
+      if (rarity < 0) {
+        snprintf(what, sizeof(what), "a valid string");
+      } else {
+        snprintf(what, sizeof(what), "1 in %d edge bytes", 1 << rarity);
+      }
+      check_string(s, n, what);
+      strings++;
+    }
+  }
+
+  if (failures > 0) {
+    fprintf(stderr, "%d mismatches\n", failures);
+    exit(1);
+  }
+  printf("utf8_validate (");
+  for (size_t k = 0; k < kernel_count; k++) {
+    printf("%s%s", k > 0 ? ", " : "", kernels[k].name);
+  }
+  printf(") and utf8_to_utf32 agree with utf8_decode on %d strings of "
+         "0..%d bytes\n",
+         strings, CHECK_LEN);
+}
+
+// ---------- Timing ----------
+
+static volatile size_t sink;
+
+#define BENCH(label, expr)                                                     \
+  do {                                                                         \
+    double best = 1e9;                                                         \
+    for (int round = 0; round < 5; round++) {                                  \
+      double start = now();                                                    \
+      sink += (size_t)(expr);                                                  \
+      double t = now() - start;                                                \
+      best = t < best ? t : best;                                              \
+    }                                                                          \
+    printf("  %-26s %7.2f GB/s\n", label, (double)s.count / best / 1e9);       \
+  } while (0)
+
+int main(void) {
+  check_equivalence();
+
+  const struct {
+    const char *name;
+    const char *text;
+  } inputs[] = {
+      {"ascii", "GET /index.html HTTP/1.1 Host: localhost Accept: */* "},
+      {"latin", "El pingüino Wenceslao hizo kilómetros bajo exhaustiva "
+                "lluvia y frío, añoraba a su querido cachorro. "},
+      {"cjk", "日本語のテキストと中文文本以及한국어 텍스트"},
+      {"emoji", "😀🎉🚀 ok 🌍🔥 ✨💡 "},
+  };
+
+  uint32_t *out = malloc(BENCH_BYTES * sizeof(*out));
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    String_Builder s = corpus(inputs[i].text);
+    printf("%s (%zu bytes)\n", inputs[i].name, s.count);
+
+    BENCH("utf8_decode loop, valid", validate_decode(s.items, s.count));
+    BENCH("utf8_validate", utf8_validate(s.items, s.count));
+    BENCH("utf8_len", utf8_len(s.items, s.count));
+    BENCH("utf8_count", utf8_count(s.items, s.count));
+    BENCH("utf8_decode loop, utf32", to_utf32_decode(s.items, s.count, out));
+    BENCH("utf8_to_utf32", utf8_to_utf32(s.items, s.count, out));
+
+    if (utf8_count(s.items, s.count) != utf8_len(s.items, s.count) ||
+        !utf8_validate(s.items, s.count)) {
+      printf("  MISMATCH\n");
+      return 1;
+    }
+    sb_free(s);
+  }
+  free(out);
+  return 0;
+}
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "admission.h"
+#include "seed.h"
+
+// Slots probed for an address before giving up on tracking it
+#define ADMISSION_PROBES 16
+// Tokens are kept in thousandths of a request, so refilling is exact integer
+// math: `rate` per second is `rate` thousandths per millisecond.
+#define TOKEN 1000u
+
+typedef struct {
+  uint8_t addr[16]; // IPv6, IPv4 as ::ffff:a.b.c.d
+  uint32_t conns;
+  uint32_t tokens;  // thousandths of a request
+  uint32_t last_ms; // last refill
+  uint32_t used;    // has held an address, ends probe chains otherwise
+} Admission_Slot;
+
+_Static_assert(sizeof(Admission_Slot) == 32, "two slots per cache line");
+
+static Admission_Config config = {0};
+static Admission_Slot *table = NULL;
+static uint32_t table_mask = 0;
+static uint64_t hash_seed = 0;
+static uint32_t open_conns = 0;
+
+static const char SHED_RESPONSE[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                    "Content-Length: 0\r\n"
+                                    "Retry-After: 1\r\n"
+                                    "Connection: close\r\n"
+                                    "\r\n";
+
+// ---------- IP table ----------
+
+static uint32_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000 +
+                    (uint64_t)ts.tv_nsec / 1000000);
+}
+
+static uint32_t addr_hash(const uint8_t addr[16]) {
+  uint64_t lo, hi;
+  memcpy(&lo, addr, 8);
+  memcpy(&hi, addr + 8, 8);
+  uint64_t h = (lo ^ hash_seed) * 0x9e3779b97f4a7c15ull;
+  h ^= hi * 0xc2b2ae3d27d4eb4full;
+  h ^= h >> 29;
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+// Refills the bucket up to `now` and returns the tokens in it.
+static uint32_t slot_refill(Admission_Slot *s, uint32_t now) {
+  uint64_t cap = (uint64_t)config.burst * TOKEN;
+  uint64_t tokens = s->tokens + (uint64_t)(now - s->last_ms) * config.rate;
+  s->tokens = (uint32_t)(tokens < cap ? tokens : cap);
+  s->last_ms = now;
+  return s->tokens;
+}
+
+// Nothing in it that a fresh slot would not have
+static bool slot_idle(Admission_Slot *s, uint32_t now) {
+  return s->conns == 0 &&
+         (config.rate == 0 || slot_refill(s, now) == config.burst * TOKEN);
+}
+
+// Slot holding `addr`, claiming one if needed. -1 when the neighbourhood is
+// full of active clients.
+static int table_find(const uint8_t addr[16], uint32_t now) {
+  uint32_t h = addr_hash(addr);
+  int reuse = -1;
+
+  // Slots are never emptied, only recycled, so a chain runs until the first
+  // slot that was never used and `addr` cannot sit past it
+  for (uint32_t i = 0; i < ADMISSION_PROBES; i++) {
+    uint32_t idx = (h + i) & table_mask;
+    Admission_Slot *s = &table[idx];
+    if (!s->used) {
+      if (reuse < 0) {
+        reuse = (int)idx;
+      }
+      break;
+    }
+    if (memcmp(s->addr, addr, sizeof(s->addr)) == 0) {
+      return (int)idx;
+    }
+    if (reuse < 0 && slot_idle(s, now)) {
+      reuse = (int)idx;
+    }
+  }
+
+  if (reuse >= 0) {
+    table[reuse] = (Admission_Slot){
+        .tokens = config.burst * TOKEN,
+        .last_ms = now,
+        .used = 1,
+    };
+    memcpy(table[reuse].addr, addr, sizeof(table[reuse].addr));
+  }
+  return reuse;
+}
+
+static bool peer_addr(int fd, uint8_t addr[16]) {
+  struct sockaddr_storage ss;
+  socklen_t len = sizeof(ss);
+  if (getpeername(fd, (struct sockaddr *)&ss, &len) < 0) {
+    return false;
+  }
+
+  if (ss.ss_family == AF_INET) {
+    const struct sockaddr_in *in = (const struct sockaddr_in *)&ss;
+    memset(addr, 0, 10);
+    addr[10] = 0xff;
+    addr[11] = 0xff;
+    memcpy(addr + 12, &in->sin_addr, 4);
+    return true;
+  }
+  if (ss.ss_family == AF_INET6) {
+    const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)&ss;
+    memcpy(addr, &in6->sin6_addr, 16);
+    return true;
+  }
+  return false;
+}
+
+// ---------- API ----------
+
+bool admission_init(const Admission_Config *c) {
+  config = *c;
+  if (config.rate > 0 && config.burst == 0) {
+    config.burst = 1;
+  }
+  if (config.burst > UINT32_MAX / TOKEN) {
+    config.burst = UINT32_MAX / TOKEN;
+  }
+
+  uint32_t slots = 64;
+  while (slots < config.table_slots && slots < (1u << 24)) {
+    slots <<= 1;
+  }
+
+  free(table);
+  table = calloc(slots, sizeof(*table));
+  if (!table) {
+    return false;
+  }
+  table_mask = slots - 1;
+
+  hash_seed = random_seed();
+  return true;
+}
+
+Admit_Result admission_accept(int fd, int *slot) {
+  *slot = ADMISSION_NONE;
+
+  if (config.max_conns > 0 && open_conns >= config.max_conns) {
+    return ADMIT_MAX_CONNS;
+  }
+
+  int tracked = ADMISSION_UNTRACKED;
+  uint8_t addr[16];
+  if ((config.max_conns_per_ip > 0 || config.rate > 0) && table &&
+      peer_addr(fd, addr)) {
+    uint32_t now = now_ms();
+    int idx = table_find(addr, now);
+    if (idx >= 0) {
+      Admission_Slot *s = &table[idx];
+      if (config.max_conns_per_ip > 0 &&
+          s->conns >= config.max_conns_per_ip) {
+        return ADMIT_MAX_CONNS_PER_IP;
+      }
+      if (config.rate > 0 && slot_refill(s, now) < TOKEN) {
+        return ADMIT_RATE_LIMITED;
+      }
+      s->conns++;
+      tracked = idx;
+    }
+  }
+
+  open_conns++;
+  *slot = tracked;
+  return ADMIT_OK;
+}
+
+Admit_Result admission_request(int slot) {
+  if (slot < 0 || config.rate == 0) {
+    return ADMIT_OK;
+  }
+
+  Admission_Slot *s = &table[slot];
+  if (slot_refill(s, now_ms()) < TOKEN) {
+    return ADMIT_RATE_LIMITED;
+  }
+  s->tokens -= TOKEN;
+  return ADMIT_OK;
+}
+
+void admission_release(int slot) {
+  if (slot == ADMISSION_NONE) {
+    return;
+  }
+  if (slot >= 0 && table[slot].conns > 0) {
+    table[slot].conns--;
+  }
+  open_conns--;
+}
+
+const char *admit_result_name(Admit_Result r) {
+  switch (r) {
+  case ADMIT_OK:
+    return "admitted";
+  case ADMIT_MAX_CONNS:
+    return "too many connections";
+  case ADMIT_MAX_CONNS_PER_IP:
+    return "too many connections from this address";
+  case ADMIT_RATE_LIMITED:
+    return "request rate exceeded";
+  }
+  return "unknown";
+}
+
+void admission_shed(int fd) {
+  ssize_t n = send(fd, SHED_RESPONSE, sizeof(SHED_RESPONSE) - 1,
+                   MSG_DONTWAIT | MSG_NOSIGNAL);
+  (void)n;
+  shutdown(fd, SHUT_WR);
+
+  // Unread request bytes would turn the close into a RST, which can reach
+  // the client before the 503 does
+  char buf[4096];
+  while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+  }
+}
@@ -0,0 +1,63 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ------------------ Admission control ------------------
+
+// Decides whether a connection or a request is served at all, before any of
+// it is parsed. Caps the number of open connections overall and per client
+// IP, and rate-limits requests per IP with a token bucket. Whatever is
+// refused gets a canned 503 and the connection is closed.
+//
+// Per-IP state lives in a fixed open-addressing table of 32-byte slots. A
+// slot with no connections and a full bucket holds nothing worth keeping
+// and is reused. When every candidate slot is busy, the client is not
+// tracked and only the global cap applies (fail open).
+//
+// Not thread-safe: used from the connection loop only.
+
+typedef struct {
+  uint32_t max_conns;        // open connections in total, 0 = no cap
+  uint32_t max_conns_per_ip; // 0 = no cap
+  uint32_t rate;             // requests per second per IP, 0 = no limit
+  uint32_t burst;            // bucket size, at least 1 when rate > 0
+  uint32_t table_slots;      // rounded up to a power of two
+} Admission_Config;
+
+typedef enum {
+  ADMIT_OK,
+  ADMIT_MAX_CONNS,
+  ADMIT_MAX_CONNS_PER_IP,
+  ADMIT_RATE_LIMITED,
+} Admit_Result;
+
+#define ADMISSION_UNTRACKED (-1) // admitted, counted in the global cap only
+#define ADMISSION_NONE (-2)      // not admitted, nothing to release
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool admission_init(const Admission_Config *config);
+
+// A connection was just accepted. On ADMIT_OK `*slot` must later go to
+// admission_release, whatever the outcome of the connection.
+Admit_Result admission_accept(int fd, int *slot);
+// A request head is about to be parsed on an admitted connection.
+Admit_Result admission_request(int slot);
+// Takes ADMISSION_NONE too, so teardown does not have to check.
+void admission_release(int slot);
+
+const char *admit_result_name(Admit_Result r);
+
+// Sends the canned 503 without blocking and shuts down the write side. The
+// caller still closes `fd`.
+void admission_shed(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ADMISSION_H
@@ -0,0 +1,132 @@
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct Arena_Block {
+  Arena_Block *prev;
+  size_t size; // bytes after the header
+};
+
+#define ARENA_HEADER                                                           \
+  ((sizeof(Arena_Block) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+static inline size_t align_up(size_t n) {
+  return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+// ---------- Blocks ----------
+
+static bool arena_new_block(Arena *arena, size_t size) {
+  size_t data = arena->block_size > size ? arena->block_size : size;
+  if (data > SIZE_MAX - ARENA_HEADER) {
+    return false;
+  }
+  Arena_Block *block = malloc(ARENA_HEADER + data);
+  if (!block) {
+    return false;
+  }
+
+  block->prev = arena->block;
+  block->size = data;
+  arena->block = block;
+  arena->at = (char *)block + ARENA_HEADER;
+  arena->end = arena->at + data;
+  arena->last = NULL;
+  // Fewer, larger blocks for arenas that keep needing more
+  if (data <= SIZE_MAX / 2) {
+    arena->block_size = data * 2;
+  }
+  return true;
+}
+
+static void *arena_bump(Arena *arena, size_t size) {
+  if (size > SIZE_MAX - ARENA_ALIGN) {
+    return NULL;
+  }
+  size = align_up(size);
+  if ((!arena->block || (size_t)(arena->end - arena->at) < size) &&
+      !arena_new_block(arena, size)) {
+    return NULL;
+  }
+
+  char *p = arena->at;
+  arena->at += size;
+  arena->last = p;
+  return p;
+}
+
+// ---------- Allocator ----------
+
+static void *arena_resize(void *ctx, void *ptr, size_t old_size,
+                          size_t new_size) {
+  Arena *arena = ctx;
+  if (ptr && ptr == arena->last) {
+    size_t room = (size_t)(arena->end - arena->last);
+    if (new_size <= room && align_up(new_size) <= room) {
+      arena->at = arena->last + align_up(new_size);
+      return ptr;
+    }
+  }
+
+  void *p = arena_bump(arena, new_size);
+  if (p && ptr) {
+    memcpy(p, ptr, old_size < new_size ? old_size : new_size);
+  }
+  return p;
+}
+
+static void arena_release(void *ctx, void *ptr, size_t size) {
+  Arena *arena = ctx;
+  (void)size;
+  if (ptr && ptr == arena->last) {
+    arena->at = arena->last;
+    arena->last = NULL;
+  }
+}
+
+// ---------- API ----------
+
+void arena_init(Arena *arena, size_t block_size) {
+  *arena = (Arena){
+      .block_size = block_size,
+      .allocator = {.resize = arena_resize,
+                    .release = arena_release,
+                    .ctx = arena},
+  };
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  void *p = arena_bump(arena, size);
+  if (p) {
+    memset(p, 0, size);
+  }
+  return p;
+}
+
+void arena_reset(Arena *arena) {
+  if (!arena->block) {
+    return;
+  }
+  Arena_Block *older = arena->block->prev;
+  while (older) {
+    Arena_Block *prev = older->prev;
+    free(older);
+    older = prev;
+  }
+  arena->block->prev = NULL;
+  arena->at = (char *)arena->block + ARENA_HEADER;
+  arena->last = NULL;
+}
+
+void arena_free(Arena *arena) {
+  arena_reset(arena);
+  free(arena->block);
+  arena->block = NULL;
+  arena->at = arena->end = arena->last = NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#include "da.h"
+
+// ------------------ Arena ------------------
+
+// Bump allocator for memory that dies all at once, like everything a request
+// allocates. Blocks come from the heap and are chained. arena_reset keeps the
+// newest block, which is the largest since block sizes only grow, so a
+// connection that has seen its typical request stops touching the heap.
+//
+// `allocator` hands the arena to the da_* containers. Growing the newest
+// allocation extends it in place. Releasing it gives its bytes back, and
+// releasing anything older does nothing until the reset. The arena points at
+// itself through it, so it must not move after arena_init.
+//
+// Not thread-safe: one arena per connection.
+
+typedef struct Arena_Block Arena_Block;
+
+typedef struct {
+  Arena_Block *block; // newest, older ones chained behind it
+  char *at;           // free space in `block`
+  char *end;
+  char *last; // start of the newest allocation, for in-place growth
+  size_t block_size; // minimum size of the next block
+  Allocator allocator;
+} Arena;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void arena_init(Arena *arena, size_t block_size);
+// Zeroed memory aligned for any type, NULL when out of memory
+void *arena_alloc(Arena *arena, size_t size);
+// Forgets every allocation, keeping the newest block
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ARENA_H
@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "compress.h"
+
+// ---------- Negotiation ----------
+
+// RFC 9110 §12.4.2: qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] )
+static int parse_qvalue(String_View sv) {
+  if (sv.count == 0 || (sv.data[0] != '0' && sv.data[0] != '1')) {
+    return -1;
+  }
+
+  int q = (sv.data[0] - '0') * 1000;
+  if (sv.count == 1) {
+    return q;
+  }
+  if (sv.data[1] != '.' || sv.count > 5) {
+    return -1;
+  }
+
+  int scale = 100;
+  for (size_t i = 2; i < sv.count; i++, scale /= 10) {
+    char c = sv.data[i];
+    if (c < '0' || c > '9') {
+      return -1;
+    }
+    q += (c - '0') * scale;
+  }
+  return q > 1000 ? -1 : q;
+}
+
+Accept_Encoding accept_encoding_parse(String_View header) {
+  Accept_Encoding ae;
+  for (int i = 0; i < ENCODING_COUNT; i++) {
+    ae.q[i] = -1;
+  }
+  int star = -1;
+
+  while (header.count > 0) {
+    String_View item = sv_trim(sv_chop_by_delim(&header, ','));
+    String_View coding = sv_trim(sv_chop_by_delim(&item, ';'));
+    if (coding.count == 0) {
+      continue;
+    }
+
+    int q = 1000;
+    while (item.count > 0) {
+      String_View param = sv_trim(sv_chop_by_delim(&item, ';'));
+      if (sv_starts_with(param, sv_from_cstr("q="))) {
+        q = parse_qvalue(sv_from_parts(param.data + 2, param.count - 2));
+      }
+    }
+    if (q < 0) {
+      continue; // malformed, ignore the whole member
+    }
+
+    if (sv_eq(coding, sv_from_cstr("gzip")) ||
+        sv_eq(coding, sv_from_cstr("x-gzip"))) {
+      ae.q[ENCODING_GZIP] = q;
+    } else if (sv_eq(coding, sv_from_cstr("br"))) {
+      ae.q[ENCODING_BR] = q;
+    } else if (sv_eq(coding, sv_from_cstr("identity"))) {
+      ae.q[ENCODING_IDENTITY] = q;
+    } else if (sv_eq(coding, sv_from_cstr("*"))) {
+      star = q;
+    }
+  }
+
+  for (int i = 0; i < ENCODING_COUNT; i++) {
+    if (ae.q[i] < 0) {
+      ae.q[i] = star;
+    }
+  }
+
+  return ae;
+}
+
+bool accept_encoding_allows(const Accept_Encoding *ae, Content_Encoding e) {
+  // identity is acceptable unless excluded explicitly (or through `*;q=0`)
+  if (e == ENCODING_IDENTITY) {
+    return ae->q[e] != 0;
+  }
+  return ae->q[e] > 0;
+}
+
+const char *content_encoding_name(Content_Encoding e) {
+  switch (e) {
+  case ENCODING_GZIP:
+    return "gzip";
+  case ENCODING_BR:
+    return "br";
+  default:
+    return "identity";
+  }
+}
+
+const char *content_encoding_ext(Content_Encoding e) {
+  switch (e) {
+  case ENCODING_GZIP:
+    return ".gz";
+  case ENCODING_BR:
+    return ".br";
+  default:
+    return "";
+  }
+}
+
+// ---------- Compression ----------
+
+bool gzip_compress(const char *data, size_t count, String_Builder *out) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+
+  // 15 window bits + 16 selects the gzip wrapper instead of zlib
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+
+  size_t bound = deflateBound(&zs, (uLong)count);
+  if (!da_reserve(out, out->count + bound)) {
+    deflateEnd(&zs);
+    return false;
+  }
+
+  zs.next_in = (Bytef *)data;
+  zs.avail_in = (uInt)count;
+  zs.next_out = (Bytef *)(out->items + out->count);
+  zs.avail_out = (uInt)bound;
+
+  int ret = deflate(&zs, Z_FINISH);
+  if (ret == Z_STREAM_END) {
+    out->count += zs.total_out;
+  }
+  deflateEnd(&zs);
+
+  return ret == Z_STREAM_END;
+}
+
+// ---------- Cache ----------
+
+// Chained hash table plus an insertion-order list for eviction. Entries are
+// refcounted so an evicted body stays alive until its last send is done.
+#define CACHE_BUCKETS 1024
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static Compressed *buckets[CACHE_BUCKETS];
+static Compressed *fifo_head = NULL;
+static Compressed *fifo_tail = NULL;
+static size_t cache_bytes = 0;
+static size_t cache_limit = 32u << 20;
+
+static size_t cache_bucket(const File_Id *id, Content_Encoding e) {
+  uint64_t h = id->ino * 0x9E3779B97F4A7C15ull;
+  h ^= id->dev + (h << 6) + (h >> 2);
+  h ^= (uint64_t)id->mtime_ns + (h << 6) + (h >> 2);
+  h ^= id->size + (uint64_t)e;
+  return (size_t)(h % CACHE_BUCKETS);
+}
+
+static bool file_id_eq(const File_Id *a, const File_Id *b) {
+  return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+         a->mtime_ns == b->mtime_ns;
+}
+
+static Compressed *cache_find(const File_Id *id, Content_Encoding e) {
+  for (Compressed *c = buckets[cache_bucket(id, e)]; c; c = c->bucket_next) {
+    if (c->encoding == e && file_id_eq(&c->id, id)) {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+static void cache_evict_oldest(void) {
+  Compressed *victim = fifo_head;
+  fifo_head = victim->fifo_next;
+  if (!fifo_head) {
+    fifo_tail = NULL;
+  }
+
+  Compressed **p = &buckets[cache_bucket(&victim->id, victim->encoding)];
+  while (*p != victim) {
+    p = &(*p)->bucket_next;
+  }
+  *p = victim->bucket_next;
+
+  cache_bytes -= victim->data.count;
+  compress_cache_release(victim);
+}
+
+void compress_cache_set_limit(size_t max_bytes) {
+  pthread_mutex_lock(&cache_lock);
+  cache_limit = max_bytes;
+  while (fifo_head && cache_bytes > cache_limit) {
+    cache_evict_oldest();
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+Compressed *compress_cache_get(const File_Id *id, Content_Encoding e) {
+  pthread_mutex_lock(&cache_lock);
+  Compressed *c = cache_find(id, e);
+  if (c) {
+    atomic_fetch_add(&c->refs, 1);
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return c;
+}
+
+Compressed *compress_cache_put(const File_Id *id, Content_Encoding e,
+                               String_Builder data) {
+  Compressed *c = calloc(1, sizeof(*c));
+  if (!c) {
+    sb_free(data);
+    return NULL;
+  }
+  c->id = *id;
+  c->encoding = e;
+  c->data = data;
+  atomic_init(&c->refs, 1);
+
+  pthread_mutex_lock(&cache_lock);
+  // Too big to ever fit, hand it out uncached
+  if (data.count > cache_limit) {
+    pthread_mutex_unlock(&cache_lock);
+    return c;
+  }
+
+  Compressed *existing = cache_find(id, e);
+  if (existing) {
+    // Another worker compressed the same version first
+    atomic_fetch_add(&existing->refs, 1);
+    pthread_mutex_unlock(&cache_lock);
+    compress_cache_release(c);
+    return existing;
+  }
+
+  atomic_fetch_add(&c->refs, 1); // the cache's own reference
+  size_t b = cache_bucket(id, e);
+  c->bucket_next = buckets[b];
+  buckets[b] = c;
+  if (fifo_tail) {
+    fifo_tail->fifo_next = c;
+  } else {
+    fifo_head = c;
+  }
+  fifo_tail = c;
+  cache_bytes += data.count;
+
+  while (fifo_head != c && cache_bytes > cache_limit) {
+    cache_evict_oldest();
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  return c;
+}
+
+void compress_cache_release(Compressed *c) {
+  if (c && atomic_fetch_sub(&c->refs, 1) == 1) {
+    sb_free(c->data);
+    free(c);
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sv.h"
+
+// ------------------ Content-Encoding ------------------
+
+typedef enum {
+  ENCODING_IDENTITY = 0,
+  ENCODING_GZIP,
+  ENCODING_BR,
+  ENCODING_COUNT,
+} Content_Encoding;
+
+// q-values in thousandths, indexed by Content_Encoding. -1 when the client
+// did not mention the coding (nor `*`).
+typedef struct {
+  int q[ENCODING_COUNT];
+} Accept_Encoding;
+
+// ------------------ Compressed cache ------------------
+
+// Identity of a file version: a rewrite changes mtime or size, a replace
+// changes the inode.
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_ns;
+} File_Id;
+
+typedef struct Compressed {
+  File_Id id;
+  Content_Encoding encoding;
+  String_Builder data;
+
+  _Atomic int refs;
+  struct Compressed *bucket_next;
+  struct Compressed *fifo_next;
+} Compressed;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ---------- Negotiation ----------
+// `header` is the (lowercased) Accept-Encoding value, empty when missing.
+Accept_Encoding accept_encoding_parse(String_View header);
+bool accept_encoding_allows(const Accept_Encoding *ae, Content_Encoding e);
+const char *content_encoding_name(Content_Encoding e);
+const char *content_encoding_ext(Content_Encoding e);
+
+// ---------- Compression ----------
+bool gzip_compress(const char *data, size_t count, String_Builder *out);
+
+// ---------- Cache ----------
+void compress_cache_set_limit(size_t max_bytes);
+// Both return a reference the caller drops with compress_cache_release.
+Compressed *compress_cache_get(const File_Id *id, Content_Encoding e);
+// Takes ownership of `data`.
+Compressed *compress_cache_put(const File_Id *id, Content_Encoding e,
+                               String_Builder data);
+void compress_cache_release(Compressed *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COMPRESS_H
@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "sv.h"
+
+#define KB(n) (((uint64_t)(n)) << 10)
+#define MB(n) (((uint64_t)(n)) << 20)
+
+// Filled in by config_load and only handed out as const afterwards
+static Config config = {
+    .max_header_size = KB(8),
+    .max_headers_total = KB(32),
+    .max_content_len = MB(10),
+    .recv_size = KB(8),
+    .body_spill_threshold = KB(64),
+    .body_rcvlowat = KB(64),
+    .log_level = LOG_DEBUG,
+
+    .workers = 4,
+    .drain_timeout = 10,
+    .restart_timeout = 5000,
+    .uring_entries = 1024,
+    .uring_bufs = 512,
+    .uring_buf_size = KB(4),
+    .docroot_cache = 512,
+    .compress_cache = MB(32),
+    .io_uring = false,
+    .port = "3490",
+    .docroot = "./public",
+    .mime_types = NULL,
+
+    // Set on the listener once, accepted sockets inherit it (see sockopt.h)
+    .socket =
+        {
+            .backlog = 511, // the kernel caps it at net.core.somaxconn
+            .nodelay = 1,   // heads and bodies go out in separate sends
+            .keepalive_idle = 60,
+            .keepalive_intvl = 10,
+            .keepalive_cnt = 6,
+        },
+    // Caps apply to the io_uring backend; the blocking one holds a single
+    // connection at a time anyway.
+    .admission =
+        {
+            .max_conns = 10000,
+            .max_conns_per_ip = 256,
+            .rate = 0,  // requests per second per IP, 0 = no limit
+            .burst = 0, // one second worth of `rate` when left at 0
+            .table_slots = 1 << 14,
+        },
+};
+
+// ---------- Options ----------
+
+typedef enum {
+  OPTION_NUMBER, // uint32_t
+  OPTION_SIZE,   // uint32_t, K/M/G suffix
+  OPTION_SIZE64, // uint64_t, K/M/G suffix
+  OPTION_BOOL,   // a bare flag on the command line
+  OPTION_STRING,
+  OPTION_LOG_LEVEL,
+} Option_Kind;
+
+typedef struct {
+  const char *name;
+  Option_Kind kind;
+  size_t offset;
+} Option;
+
+#define OPTION(name, kind, field) {name, kind, offsetof(Config, field)}
+
+static const Option OPTIONS[] = {
+    OPTION("port", OPTION_STRING, port),
+    OPTION("docroot", OPTION_STRING, docroot),
+    OPTION("mime-types", OPTION_STRING, mime_types),
+    OPTION("io-uring", OPTION_BOOL, io_uring),
+    OPTION("log-level", OPTION_LOG_LEVEL, log_level),
+    OPTION("workers", OPTION_NUMBER, workers),
+
+    OPTION("max-header-size", OPTION_SIZE, max_header_size),
+    OPTION("max-headers-total", OPTION_SIZE, max_headers_total),
+    OPTION("max-content-len", OPTION_SIZE64, max_content_len),
+    OPTION("recv-size", OPTION_SIZE, recv_size),
+    OPTION("body-spill-threshold", OPTION_SIZE, body_spill_threshold),
+    OPTION("body-rcvlowat", OPTION_SIZE, body_rcvlowat),
+    OPTION("drain-timeout", OPTION_NUMBER, drain_timeout),
+    OPTION("restart-timeout", OPTION_NUMBER, restart_timeout),
+    OPTION("uring-entries", OPTION_NUMBER, uring_entries),
+    OPTION("uring-bufs", OPTION_NUMBER, uring_bufs),
+    OPTION("uring-buf-size", OPTION_SIZE, uring_buf_size),
+    OPTION("docroot-cache", OPTION_NUMBER, docroot_cache),
+    OPTION("compress-cache", OPTION_SIZE64, compress_cache),
+
+    OPTION("backlog", OPTION_NUMBER, socket.backlog),
+    OPTION("nodelay", OPTION_NUMBER, socket.nodelay),
+    OPTION("defer-accept", OPTION_NUMBER, socket.defer_accept),
+    OPTION("fastopen", OPTION_NUMBER, socket.fastopen),
+    OPTION("rcvbuf", OPTION_SIZE, socket.rcvbuf),
+    OPTION("sndbuf", OPTION_SIZE, socket.sndbuf),
+    OPTION("busy-poll", OPTION_NUMBER, socket.busy_poll),
+    OPTION("keepalive", OPTION_NUMBER, socket.keepalive_idle),
+    OPTION("keepalive-intvl", OPTION_NUMBER, socket.keepalive_intvl),
+    OPTION("keepalive-cnt", OPTION_NUMBER, socket.keepalive_cnt),
+    OPTION("notsent-lowat", OPTION_SIZE, socket.notsent_lowat),
+
+    OPTION("max-conns", OPTION_NUMBER, admission.max_conns),
+    OPTION("max-conns-per-ip", OPTION_NUMBER, admission.max_conns_per_ip),
+    OPTION("rate", OPTION_NUMBER, admission.rate),
+    OPTION("burst", OPTION_NUMBER, admission.burst),
+    OPTION("ip-table-slots", OPTION_NUMBER, admission.table_slots),
+};
+
+#define OPTIONS_COUNT (sizeof(OPTIONS) / sizeof(OPTIONS[0]))
+
+static const Option *option_find(String_View name) {
+  for (size_t i = 0; i < OPTIONS_COUNT; i++) {
+    if (sv_eq(name, sv_from_cstr(OPTIONS[i].name))) {
+      return &OPTIONS[i];
+    }
+  }
+  return NULL;
+}
+
+static const struct {
+  const char *name;
+  Log_Level level;
+} LOG_LEVELS[] = {
+    {"debug", LOG_DEBUG}, {"info", LOG_INFO},    {"warn", LOG_WARN},
+    {"error", LOG_ERROR}, {"none", LOG_NO_LOGS},
+};
+
+// Decimal with an optional K, M or G suffix when `size` is set
+static bool parse_number(String_View sv, bool size, uint64_t max,
+                         uint64_t *out) {
+  unsigned shift = 0;
+  if (size && sv.count > 1) {
+    switch (sv.data[sv.count - 1]) {
+    case 'k':
+    case 'K':
+      shift = 10;
+      break;
+    case 'm':
+    case 'M':
+      shift = 20;
+      break;
+    case 'g':
+    case 'G':
+      shift = 30;
+      break;
+    }
+    if (shift > 0) {
+      sv.count--;
+    }
+  }
+
+  uint64_t n;
+  if (!sv_to_u64(sv, &n) || n > (max >> shift)) {
+    return false;
+  }
+  *out = n << shift;
+  return true;
+}
+
+static bool option_set(const Option *opt, String_View value) {
+  char *field = (char *)&config + opt->offset;
+  uint64_t n;
+
+  switch (opt->kind) {
+  case OPTION_NUMBER:
+  case OPTION_SIZE:
+    if (!parse_number(value, opt->kind == OPTION_SIZE, UINT32_MAX, &n)) {
+      return false;
+    }
+    *(uint32_t *)field = (uint32_t)n;
+    return true;
+  case OPTION_SIZE64:
+    if (!parse_number(value, true, INT64_MAX, &n)) {
+      return false;
+    }
+    *(uint64_t *)field = n;
+    return true;
+  case OPTION_BOOL:
+    if (sv_eq(value, sv_from_cstr("true")) || sv_eq(value, sv_from_cstr("1"))) {
+      *(bool *)field = true;
+    } else if (sv_eq(value, sv_from_cstr("false")) ||
+               sv_eq(value, sv_from_cstr("0"))) {
+      *(bool *)field = false;
+    } else {
+      return false;
+    }
+    return true;
+  case OPTION_STRING: {
+    // Lives for the whole process, like the defaults
+    char *s = strndup(value.data, value.count);
+    if (!s || s[0] == '\0') {
+      free(s);
+      return false;
+    }
+    *(const char **)field = s;
+    return true;
+  }
+  case OPTION_LOG_LEVEL:
+    for (size_t i = 0; i < sizeof(LOG_LEVELS) / sizeof(LOG_LEVELS[0]); i++) {
+      if (sv_eq(value, sv_from_cstr(LOG_LEVELS[i].name))) {
+        *(Log_Level *)field = LOG_LEVELS[i].level;
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
+
+// ---------- Sources ----------
+
+static bool config_load_file(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  bool ok = true;
+  char line[1024];
+  for (int lineno = 1; fgets(line, sizeof(line), f); lineno++) {
+    String_View sv = sv_from_cstr(line);
+    sv = sv_trim(sv_chop_by_delim(&sv, '#'));
+    if (sv.count == 0) {
+      continue;
+    }
+
+    String_View key = sv_trim(sv_chop_by_delim(&sv, '='));
+    String_View value = sv_trim(sv);
+    const Option *opt = option_find(key);
+    if (!opt) {
+      fprintf(stderr, "%s:%d: unknown setting '" SV_Fmt "'\n", path, lineno,
+              SV_Arg(key));
+      ok = false;
+    } else if (!option_set(opt, value)) {
+      fprintf(stderr, "%s:%d: bad value for %s: '" SV_Fmt "'\n", path, lineno,
+              opt->name, SV_Arg(value));
+      ok = false;
+    }
+  }
+
+  ok = ok && !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+// `--name value`, or just `--name` for a bool. Returns the arguments used, 0
+// when `argv[i]` is not an option or its value is bad.
+static int config_load_flag(int argc, char **argv, int i) {
+  String_View arg = sv_from_cstr(argv[i]);
+  if (!sv_starts_with(arg, sv_from_cstr("--"))) {
+    return 0;
+  }
+  const Option *opt = option_find(sv_from_parts(arg.data + 2, arg.count - 2));
+  if (!opt) {
+    return 0;
+  }
+
+  if (opt->kind == OPTION_BOOL) {
+    *(bool *)((char *)&config + opt->offset) = true;
+    return 1;
+  }
+  if (i + 1 >= argc || !option_set(opt, sv_from_cstr(argv[i + 1]))) {
+    fprintf(stderr, "Bad value for %s\n", argv[i]);
+    return 0;
+  }
+  return 2;
+}
+
+static bool config_check(void) {
+  const char *bad = NULL;
+  if (config.max_header_size == 0) {
+    bad = "max-header-size must be at least 1";
+  } else if (config.max_headers_total < config.max_header_size) {
+    bad = "max-headers-total must be at least max-header-size";
+  } else if (config.recv_size == 0) {
+    bad = "recv-size must be at least 1";
+  } else if (config.uring_entries == 0 || config.uring_buf_size == 0) {
+    bad = "uring-entries and uring-buf-size must be at least 1";
+  } else if (config.uring_bufs == 0 ||
+             (config.uring_bufs & (config.uring_bufs - 1)) != 0 ||
+             config.uring_bufs > 32768) {
+    bad = "uring-bufs must be a power of two up to 32768";
+  }
+
+  if (bad) {
+    fprintf(stderr, "Bad configuration: %s\n", bad);
+    return false;
+  }
+
+  if (config.admission.burst == 0) {
+    config.admission.burst = config.admission.rate; // one second worth
+  }
+  return true;
+}
+
+static void config_usage(const char *program) {
+  fprintf(stderr, "usage: %s [--config FILE]", program);
+  for (size_t i = 0; i < OPTIONS_COUNT; i++) {
+    const Option *opt = &OPTIONS[i];
+    const char *arg = opt->kind == OPTION_BOOL     ? ""
+                      : opt->kind == OPTION_STRING ? " S"
+                      : opt->kind == OPTION_LOG_LEVEL
+                          ? " LEVEL"
+                          : " N";
+    fprintf(stderr, "%s[--%s%s]", i % 4 == 0 ? "\n         " : " ", opt->name,
+            arg);
+  }
+  fprintf(stderr, "\n");
+}
+
+// ---------- API ----------
+
+const Config *config_load(int argc, char **argv) {
+  // The file first, wherever --config is, so any flag overrides it
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--config") == 0) {
+      if (!config_load_file(argv[i + 1])) {
+        return NULL;
+      }
+      break;
+    }
+  }
+
+  for (int i = 1; i < argc;) {
+    if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      i += 2;
+      continue;
+    }
+    int used = config_load_flag(argc, argv, i);
+    if (used == 0) {
+      config_usage(argv[0]);
+      return NULL;
+    }
+    i += used;
+  }
+
+  if (!config_check()) {
+    return NULL;
+  }
+  return &config;
+}
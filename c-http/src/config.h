@@ -0,0 +1,71 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "admission.h"
+#include "sockopt.h"
+
+// ------------------ Server configuration ------------------
+
+// Everything a deployment may want to tune without a rebuild, read once at
+// startup from an optional file (`--config FILE`) and the command line, which
+// wins. After config_load the struct is never written again, so workers read
+// it without locks.
+//
+// The file holds one `key = value` per line, `#` starts a comment. Keys are
+// the long flag names without the dashes (`max-content-len = 10M`). Sizes take
+// a K, M or G suffix.
+
+typedef enum {
+  LOG_DEBUG = -4,
+  LOG_INFO = 0,
+  LOG_WARN = 4,
+  LOG_ERROR = 8,
+  LOG_NO_LOGS = 1000 // mute total
+} Log_Level;
+
+typedef struct {
+  // Read on every request. First in the struct, which starts a cache line of
+  // its own, so they share a line with nothing that is ever written.
+  _Alignas(64) uint32_t max_header_size; // each header line
+  uint32_t max_headers_total;            // all header lines together
+  uint64_t max_content_len;
+  uint32_t recv_size;            // head buffer growth per recv
+  uint32_t body_spill_threshold; // larger bodies go to a temp file
+  uint32_t body_rcvlowat;        // SO_RCVLOWAT while reading a body
+  Log_Level log_level;
+
+  // Startup and shutdown only
+  uint32_t workers;         // handler threads, 0 = handlers run inline
+  uint32_t drain_timeout;   // seconds the old process drains after a restart
+  uint32_t restart_timeout; // milliseconds the new process has to get ready
+  uint32_t uring_entries;   // submission queue size
+  uint32_t uring_bufs;      // provided receive buffers, a power of two
+  uint32_t uring_buf_size;  // bytes per provided buffer
+  uint32_t docroot_cache;   // resolved paths kept, each may hold an fd
+  uint64_t compress_cache;  // bytes of compressed files kept
+  bool io_uring;
+  const char *port;
+  const char *docroot;
+  const char *mime_types; // extra MIME types file, NULL for none
+
+  Socket_Profile socket;
+  Admission_Config admission;
+} Config;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Builds the configuration from the defaults, the file named by `--config`
+// and the remaining flags, in that order. Prints usage and returns NULL on
+// anything it does not understand.
+const Config *config_load(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CONFIG_H
@@ -0,0 +1,203 @@
+#ifndef DA_H
+#define DA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------ Dynamic Arrays ------------------
+
+// Any struct that starts with DA_FIELDS(T) is a growable array of T, and the
+// da_* macros below work on all of them. Zeroed (`= {0}`) it is empty and
+// allocates from the heap on first use:
+//
+//   typedef struct {
+//     DA_FIELDS(int);
+//   } Ints;
+//
+//   Ints xs = {0};
+//   if (!da_append(&xs, 42)) {
+//     // out of memory, `xs` is as it was
+//   }
+//   da_free(&xs);
+//
+// Arrays that are nearly always short keep their first N items inline and
+// only go to the allocator once they outgrow them. After da_init_small
+// `items` points into the struct itself, which then must not be copied or
+// moved:
+//
+//   typedef struct {
+//     DA_SMALL_FIELDS(HTTP_Header, 16);
+//   } HTTP_Headers;
+//
+// Memory comes from `allocator`, the heap while it is NULL. Set it before the
+// first allocation. Everything that may allocate returns false when it cannot
+// and leaves the array untouched.
+//
+// Header only, so other programs in the repository can include it by path.
+
+typedef struct Allocator {
+  // Resizes `ptr` (NULL to allocate) from `old_size` to `new_size` bytes,
+  // keeping the contents. Returns NULL and leaves `ptr` alone on failure.
+  void *(*resize)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+  void (*release)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+} Allocator;
+
+#define DA_FIELDS(T)                                                           \
+  T *items;                                                                    \
+  size_t count;                                                                \
+  size_t capacity;                                                             \
+  const Allocator *allocator; /* NULL for the heap */                          \
+  bool borrowed /* `items` is inline storage, never resized or freed */
+
+#define DA_SMALL_FIELDS(T, N)                                                  \
+  DA_FIELDS(T);                                                                \
+  T small[N]
+
+// The first allocation holds at least this many bytes, after that the
+// capacity grows by half
+#define DA_MIN_BYTES 64
+
+// ---------- Untyped helpers ----------
+// `items_field` is the address of the array's `items` pointer, written with
+// memcpy so that one function serves every item type.
+
+static inline void *da_mem_resize_(const Allocator *a, void *ptr,
+                                   size_t old_size, size_t new_size) {
+  if (!a) {
+    return realloc(ptr, new_size);
+  }
+  return a->resize(a->ctx, ptr, old_size, new_size);
+}
+
+static inline void da_mem_release_(const Allocator *a, void *ptr,
+                                   size_t size) {
+  if (!a) {
+    free(ptr);
+  } else if (a->release) {
+    a->release(a->ctx, ptr, size);
+  }
+}
+
+static inline bool da_grow_(void *items_field, size_t *capacity,
+                            bool *borrowed, const Allocator *a, size_t count,
+                            size_t needed, size_t item_size) {
+  if (needed <= *capacity) {
+    return true;
+  }
+
+  size_t new_capacity = *capacity + *capacity / 2;
+  if (new_capacity < DA_MIN_BYTES / item_size) {
+    new_capacity = DA_MIN_BYTES / item_size;
+  }
+  if (new_capacity < needed) {
+    new_capacity = needed;
+  }
+  if (new_capacity > SIZE_MAX / item_size) {
+    return false;
+  }
+
+  void *items;
+  memcpy(&items, items_field, sizeof(items));
+  void *grown;
+  if (*borrowed) {
+    grown = da_mem_resize_(a, NULL, 0, new_capacity * item_size);
+    if (grown && count > 0) {
+      memcpy(grown, items, count * item_size);
+    }
+  } else {
+    grown = da_mem_resize_(a, items, *capacity * item_size,
+                           new_capacity * item_size);
+  }
+  if (!grown) {
+    return false;
+  }
+
+  memcpy(items_field, &grown, sizeof(grown));
+  *capacity = new_capacity;
+  *borrowed = false;
+  return true;
+}
+
+// Gives back what is not in use. Inline storage stays as it is.
+static inline bool da_shrink_(void *items_field, size_t *capacity,
+                              bool borrowed, const Allocator *a, size_t count,
+                              size_t item_size) {
+  if (borrowed || count == *capacity) {
+    return true;
+  }
+
+  void *items;
+  memcpy(&items, items_field, sizeof(items));
+  if (count == 0) {
+    da_mem_release_(a, items, *capacity * item_size);
+    items = NULL;
+  } else {
+    items = da_mem_resize_(a, items, *capacity * item_size, count * item_size);
+    if (!items) {
+      return false;
+    }
+  }
+  memcpy(items_field, &items, sizeof(items));
+  *capacity = count;
+  return true;
+}
+
+// ---------- Macros ----------
+
+// Makes room for `expected_capacity` items in total
+#define da_reserve(da, expected_capacity)                                      \
+  da_grow_(&(da)->items, &(da)->capacity, &(da)->borrowed, (da)->allocator,    \
+           (da)->count, (expected_capacity), sizeof(*(da)->items))
+
+#define da_append(da, item)                                                    \
+  (da_reserve((da), (da)->count + 1)                                           \
+       ? ((da)->items[(da)->count++] = (item), true)                           \
+       : false)
+
+#define da_append_many(da, new_items, new_items_count)                         \
+  (da_reserve((da), (da)->count + (new_items_count))                           \
+       ? (memcpy((da)->items + (da)->count, (new_items),                       \
+                 (new_items_count) * sizeof(*(da)->items)),                    \
+          (da)->count += (new_items_count), true)                              \
+       : false)
+
+// Moves the last item into slot `i`
+#define da_remove_unordered(da, i)                                             \
+  ((da)->items[(i)] = (da)->items[--(da)->count])
+
+// Empty, keeping the memory for reuse
+#define da_clear(da) ((da)->count = 0)
+
+#define da_shrink(da)                                                          \
+  da_shrink_(&(da)->items, &(da)->capacity, (da)->borrowed, (da)->allocator,   \
+             (da)->count, sizeof(*(da)->items))
+
+// Empty with no memory of its own. Small arrays go back to heap behavior
+// until the next da_init_small.
+#define da_free(da)                                                            \
+  do {                                                                         \
+    if (!(da)->borrowed) {                                                     \
+      da_mem_release_((da)->allocator, (da)->items,                            \
+                      (da)->capacity * sizeof(*(da)->items));                  \
+    }                                                                          \
+    (da)->items = NULL;                                                        \
+    (da)->count = 0;                                                           \
+    (da)->capacity = 0;                                                        \
+    (da)->borrowed = false;                                                    \
+  } while (0)
+
+// Points a DA_SMALL_FIELDS array at its inline storage. Any memory it had is
+// expected to be freed already.
+#define da_init_small(da)                                                      \
+  do {                                                                         \
+    (da)->items = (da)->small;                                                 \
+    (da)->count = 0;                                                           \
+    (da)->capacity = sizeof((da)->small) / sizeof((da)->small[0]);             \
+    (da)->borrowed = true;                                                     \
+  } while (0)
+
+#endif // DA_H
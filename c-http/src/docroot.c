@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/openat2.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "docroot.h"
+#include "mime.h"
+
+#define DOCROOT_BUCKETS 1024
+
+// Everything that can change what a name in the directory resolves to
+#define DOCROOT_WATCH_MASK                                                     \
+  (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF |       \
+   IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+static int root_fd = -1;
+static char *root_path = NULL;
+static int inotify_fd = -1;
+static bool openat2_missing = false;
+
+// ---------- Resolution ----------
+
+static int docroot_openat(const char *path) {
+  // O_NONBLOCK so a FIFO in the tree cannot hang the open
+  int flags = O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK;
+
+  if (!openat2_missing) {
+    struct open_how how = {
+        .flags = (uint64_t)flags,
+        .resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS,
+    };
+    int fd = (int)syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+    if (fd >= 0 || errno != ENOSYS) {
+      return fd;
+    }
+    openat2_missing = true;
+  }
+
+  // Pre-5.6 kernels. The path is clean so `..` cannot escape, symlinks can.
+  return openat(root_fd, path, flags);
+}
+
+// Watches the directory holding `path`. Must happen before the open so no
+// change between the two goes unseen.
+static int docroot_watch(const char *path) {
+  if (inotify_fd < 0) {
+    return -1;
+  }
+
+  const char *slash = strrchr(path, '/');
+  int dir_len = slash ? (int)(slash - path) : 0;
+
+  char dir[PATH_MAX];
+  int n = snprintf(dir, sizeof(dir), "%s/%.*s", root_path, dir_len, path);
+  if (n < 0 || (size_t)n >= sizeof(dir)) {
+    return -1;
+  }
+  return inotify_add_watch(inotify_fd, dir, DOCROOT_WATCH_MASK);
+}
+
+// Failures that describe the tree itself, so inotify tells us when they stop
+// being true. Things like EMFILE are not remembered.
+static bool docroot_error_cacheable(int error) {
+  return error == ENOENT || error == ENOTDIR || error == EISDIR ||
+         error == EACCES || error == ELOOP || error == EXDEV;
+}
+
+// ---------- Cache ----------
+
+// Chained hash table plus an insertion-order list for eviction, like the
+// compressed cache. Entries are refcounted: an evicted or invalidated file
+// stays open until the last response reading it is done.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static Docroot_File *buckets[DOCROOT_BUCKETS];
+static Docroot_File *fifo_head = NULL;
+static Docroot_File *fifo_tail = NULL;
+static size_t cache_count = 0;
+static size_t cache_limit = 512; // each entry may hold an fd
+// Bumped on every batch of inotify events. A lookup that raced with one does
+// not publish its result.
+static uint64_t cache_generation = 0;
+
+static size_t cache_bucket(String_View path) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < path.count; i++) {
+    h ^= (unsigned char)path.data[i];
+    h *= 0x100000001b3ull;
+  }
+  return (size_t)(h % DOCROOT_BUCKETS);
+}
+
+static Docroot_File *cache_find(String_View path, size_t b) {
+  for (Docroot_File *f = buckets[b]; f; f = f->bucket_next) {
+    if (strncmp(f->path, path.data, path.count) == 0 &&
+        f->path[path.count] == '\0') {
+      return f;
+    }
+  }
+  return NULL;
+}
+
+static void cache_remove(Docroot_File **fifo_link, Docroot_File *prev) {
+  Docroot_File *f = *fifo_link;
+  *fifo_link = f->fifo_next;
+  if (fifo_tail == f) {
+    fifo_tail = prev;
+  }
+
+  Docroot_File **p = &buckets[cache_bucket(sv_from_cstr(f->path))];
+  while (*p != f) {
+    p = &(*p)->bucket_next;
+  }
+  *p = f->bucket_next;
+
+  cache_count--;
+  docroot_release(f);
+}
+
+// Drops the entries named `name` in the directory watched by `wd`. A NULL
+// name means the whole directory, a negative `wd` the whole cache.
+static void cache_invalidate(int wd, const char *name) {
+  Docroot_File **link = &fifo_head;
+  Docroot_File *prev = NULL;
+
+  while (*link) {
+    Docroot_File *f = *link;
+    if (wd < 0 || (f->wd == wd && (!name || strcmp(f->name, name) == 0))) {
+      cache_remove(link, prev);
+    } else {
+      prev = f;
+      link = &f->fifo_next;
+    }
+  }
+}
+
+void docroot_cache_set_limit(size_t max_entries) {
+  pthread_mutex_lock(&cache_lock);
+  cache_limit = max_entries;
+  while (fifo_head && cache_count > cache_limit) {
+    cache_remove(&fifo_head, NULL);
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+static void *docroot_watcher(void *arg) {
+  (void)arg;
+  _Alignas(struct inotify_event) char buf[4096];
+
+  for (;;) {
+    ssize_t n = read(inotify_fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      fprintf(stderr, "docroot: inotify read failed, cache disabled\n");
+      docroot_cache_set_limit(0);
+      return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    cache_generation++;
+    for (char *p = buf; p < buf + n;) {
+      struct inotify_event *ev = (struct inotify_event *)p;
+
+      if (ev->mask & (IN_Q_OVERFLOW | IN_ISDIR)) {
+        // Lost events, or a directory appeared, moved or went away: every
+        // path below it may resolve differently now
+        cache_invalidate(-1, NULL);
+      } else {
+        // No name: the watched directory itself (deleted, moved, unwatched)
+        cache_invalidate(ev->wd, ev->len > 0 ? ev->name : NULL);
+      }
+
+      p += sizeof(*ev) + ev->len;
+    }
+    pthread_mutex_unlock(&cache_lock);
+  }
+}
+
+// Resolves a path the cache does not know and publishes the result, unless
+// inotify fired since `generation` was read.
+static Docroot_File *docroot_resolve(String_View path, size_t b,
+                                     uint64_t generation) {
+  Docroot_File *f = calloc(1, sizeof(*f));
+  if (!f || !(f->path = strndup(path.data, path.count))) {
+    free(f);
+    errno = ENOMEM;
+    return NULL;
+  }
+  const char *slash = strrchr(f->path, '/');
+  f->name = slash ? slash + 1 : f->path;
+  atomic_init(&f->refs, 1);
+
+  f->wd = docroot_watch(f->path);
+  f->fd = docroot_openat(f->path);
+  if (f->fd < 0) {
+    f->error = errno;
+  } else if (fstat(f->fd, &f->st) < 0 || !S_ISREG(f->st.st_mode)) {
+    f->error = S_ISDIR(f->st.st_mode) ? EISDIR : EACCES;
+    close(f->fd);
+    f->fd = -1;
+  } else {
+    f->content_type = mime_type_for_path(path);
+  }
+
+  if (f->wd < 0 || (f->fd < 0 && !docroot_error_cacheable(f->error))) {
+    return f; // uncached, freed on release
+  }
+
+  pthread_mutex_lock(&cache_lock);
+  if (generation != cache_generation || cache_limit == 0) {
+    pthread_mutex_unlock(&cache_lock);
+    return f;
+  }
+
+  Docroot_File *existing = cache_find(path, b);
+  if (existing) {
+    atomic_fetch_add(&existing->refs, 1);
+    pthread_mutex_unlock(&cache_lock);
+    docroot_release(f);
+    return existing;
+  }
+
+  atomic_fetch_add(&f->refs, 1); // the cache's own reference
+  f->bucket_next = buckets[b];
+  buckets[b] = f;
+  if (fifo_tail) {
+    fifo_tail->fifo_next = f;
+  } else {
+    fifo_head = f;
+  }
+  fifo_tail = f;
+  cache_count++;
+
+  while (fifo_head != f && cache_count > cache_limit) {
+    cache_remove(&fifo_head, NULL);
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  return f;
+}
+
+// ---------- API ----------
+
+bool docroot_open(const char *path) {
+  root_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd < 0 || !(root_path = strdup(path))) {
+    return false;
+  }
+
+  inotify_fd = inotify_init1(IN_CLOEXEC);
+  if (inotify_fd >= 0) {
+    pthread_t watcher;
+    if (pthread_create(&watcher, NULL, docroot_watcher, NULL) == 0) {
+      pthread_detach(watcher);
+    } else {
+      close(inotify_fd);
+      inotify_fd = -1;
+    }
+  }
+  if (inotify_fd < 0) {
+    fprintf(stderr, "docroot: no inotify, lookups will not be cached\n");
+  }
+
+  return true;
+}
+
+Docroot_File *docroot_lookup(String_View path) {
+  if (path.count == 0 || path.count >= PATH_MAX ||
+      memchr(path.data, '\0', path.count)) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  size_t b = cache_bucket(path);
+  pthread_mutex_lock(&cache_lock);
+  Docroot_File *f = cache_find(path, b);
+  if (f) {
+    atomic_fetch_add(&f->refs, 1);
+  }
+  uint64_t generation = cache_generation;
+  pthread_mutex_unlock(&cache_lock);
+
+  if (!f && !(f = docroot_resolve(path, b, generation))) {
+    return NULL;
+  }
+
+  if (f->fd < 0) {
+    int error = f->error;
+    docroot_release(f);
+    errno = error;
+    return NULL;
+  }
+  return f;
+}
+
+void docroot_release(Docroot_File *f) {
+  if (f && atomic_fetch_sub(&f->refs, 1) == 1) {
+    if (f->fd >= 0) {
+      close(f->fd);
+    }
+    free(f->path);
+    free(f);
+  }
+}
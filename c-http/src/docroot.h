@@ -0,0 +1,56 @@
+#ifndef DOCROOT_H
+#define DOCROOT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "sv.h"
+
+// ------------------ Document root ------------------
+
+// The directory static files are served from. It is opened once. Files are
+// resolved relative to it with openat2(RESOLVE_BENEATH), so `..` or a
+// symlink cannot leave it.
+//
+// Lookups go through a cache keyed by the relative path. It keeps the open
+// fd, its stat and the MIME type, and it remembers misses too. inotify
+// watches the parent directory of each cached path. A change to a name drops
+// that entry, and a change to a directory drops everything.
+
+typedef struct Docroot_File {
+  int fd; // shared between responses: read it with pread only
+  struct stat st;
+  const char *content_type;
+
+  char *path;       // cache key, relative to the root
+  const char *name; // last segment of `path`
+  int wd;           // inotify watch on the parent directory, -1 if none
+  int error;        // errno of the failed lookup, fd is -1
+
+  _Atomic int refs;
+  struct Docroot_File *bucket_next;
+  struct Docroot_File *fifo_next;
+} Docroot_File;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opens `path` and starts watching it. Without inotify the cache is
+// disabled and every lookup resolves the path again.
+bool docroot_open(const char *path);
+void docroot_cache_set_limit(size_t max_entries);
+
+// `path` is relative to the root and already cleaned, without a leading '/'.
+// Returns a reference the caller drops with docroot_release, or NULL with
+// errno set when there is no regular file there.
+Docroot_File *docroot_lookup(String_View path);
+void docroot_release(Docroot_File *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOCROOT_H
@@ -14,18 +14,23 @@ uint64_t hash(String_View s) {
 
 // TODO: Maybe import sv.h
 int equals(String_View a, String_View b) {
-  return a.count == b.count && !memcmp(a.data, b.data, a.count);
+  // Interned keys are equal by pointer
+  return a.count == b.count &&
+         (a.data == b.data || !memcmp(a.data, b.data, a.count));
 }
 
-String_View *upsert(Hashmap **m, String_View key) {
+String_View *upsert(Hashmap **m, String_View key, Arena *arena) {
   for (uint64_t h = hash(key); *m; h <<= 2) {
     if (equals(key, (*m)->key)) {
       return &(*m)->value; // found
     }
     m = &(*m)->child[h >> 62];
   }
-  // TODO: optional arena
-  *m = calloc(1, sizeof(Hashmap)); // reserve
+  *m = arena ? arena_alloc(arena, sizeof(Hashmap))
+             : calloc(1, sizeof(Hashmap)); // reserve
+  if (!*m) {
+    return NULL;
+  }
   (*m)->key = key;
   return &(*m)->value; // empty value
 }
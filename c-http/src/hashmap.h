@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "arena.h"
 #include "sv.h"
 
 typedef struct Hashmap {
@@ -14,6 +15,8 @@ typedef struct Hashmap {
 // Funciones expuestas
 uint64_t hash(String_View s);
 int equals(String_View a, String_View b);
-String_View *upsert(Hashmap **m, String_View key);
+// New nodes come from `arena`, or calloc when it is NULL. Maps built in an
+// arena go away with arena_reset and are never freed one by one.
+String_View *upsert(Hashmap **m, String_View key, Arena *arena);
 
 #endif // Hashmap_H
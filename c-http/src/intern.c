@@ -0,0 +1,173 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "seed.h"
+
+typedef struct {
+  uint64_t hash;
+  uint32_t id;
+  uint32_t count;
+  char data[]; // NUL-terminated
+} Intern_Entry;
+
+#define INTERN_MASK (INTERN_SLOTS - 1)
+
+// Slots only ever go from NULL to an entry, and entries are never freed, so
+// a reader that sees a pointer may use it for good
+static _Atomic(Intern_Entry *) slots[INTERN_SLOTS];
+// Entries published plus inserts in flight. Kept below INTERN_MAX_ENTRIES,
+// which leaves empty slots to end every probe.
+static atomic_size_t entry_count = 0;
+static atomic_uint_least32_t next_id = 1;
+// Set by intern_init before any thread interns, read-only after
+static uint64_t hash_seed = 0;
+
+#define ONES 0x0101010101010101ull
+
+// ASCII uppercase letters in `w` to lowercase, eight at a time. Only bytes
+// below 0x80 are looked at, so UTF-8 passes through.
+static inline uint64_t lower_word(uint64_t w) {
+  uint64_t low7 = w & (0x7F * ONES);
+  uint64_t above_z = low7 + (0x7F - 'Z') * ONES; // high bit: > 'Z'
+  uint64_t from_a = low7 + (0x80 - 'A') * ONES;  // high bit: >= 'A'
+  uint64_t upper = (from_a ^ above_z) & ~w & (0x80 * ONES);
+  return w | upper >> 2;
+}
+
+// Eight bytes at a time, each word folded in with a multiply and a shift:
+// header strings run to a few hundred bytes and a byte-wise hash would cost
+// more than the lowercasing. With `lower` it hashes the lowercase string
+// without writing it anywhere.
+static inline uint64_t intern_hash(const char *s, size_t n, bool lower) {
+  uint64_t h = 0x9E3779B97F4A7C15ull ^ hash_seed ^ n;
+  uint64_t w;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    memcpy(&w, s + i, 8);
+    h = (h ^ (lower ? lower_word(w) : w)) * 0xFF51AFD7ED558CCDull;
+    h ^= h >> 32;
+  }
+  if (i < n) {
+    // The last 8 bytes again, overlapping, or byte by byte when that is all
+    // there is. Fixed-size loads stay inline where a memcpy of `n - i` bytes
+    // would call into libc.
+    if (n >= 8) {
+      memcpy(&w, s + n - 8, 8);
+    } else {
+      w = 0;
+      for (; i < n; i++) {
+        w = w << 8 | (unsigned char)s[i];
+      }
+    }
+    h = (h ^ (lower ? lower_word(w) : w)) * 0xFF51AFD7ED558CCDull;
+  }
+  h *= 0xC4CEB9FE1A85EC53ull;
+  return h ^ (h >> 29);
+}
+
+// Entries made by intern_lower are lowercase, so a case-insensitive compare
+// is the same as comparing with the lowercase string
+static inline bool entry_is(const Intern_Entry *e, uint64_t h, String_View sv,
+                            bool lower) {
+  if (e->hash != h || e->count != sv.count) {
+    return false;
+  }
+  String_View have = sv_from_parts(e->data, e->count);
+  return lower ? sv_eq_ignore_case(have, sv) : sv_eq(have, sv);
+}
+
+static String_View entry_sv(const Intern_Entry *e) {
+  return sv_from_parts(e->data, e->count);
+}
+
+static Intern_Entry *entry_new(uint64_t h, String_View sv, bool lower,
+                               size_t limit) {
+  // Claim a place under the bound before allocating
+  if (atomic_fetch_add(&entry_count, 1) >= limit) {
+    atomic_fetch_sub(&entry_count, 1);
+    return NULL;
+  }
+  Intern_Entry *e = malloc(sizeof(*e) + sv.count + 1);
+  if (!e) {
+    atomic_fetch_sub(&entry_count, 1);
+    return NULL;
+  }
+  e->hash = h;
+  e->id = atomic_fetch_add(&next_id, 1);
+  e->count = (uint32_t)sv.count;
+  memcpy(e->data, sv.data, sv.count);
+  e->data[sv.count] = '\0';
+  if (lower) {
+    sv_to_lower_inplace(e->data, sv.count);
+  }
+  return e;
+}
+
+static void entry_drop(Intern_Entry *e) {
+  if (e) {
+    free(e);
+    atomic_fetch_sub(&entry_count, 1);
+  }
+}
+
+static inline String_View intern_find(String_View sv, bool lower,
+                                      size_t limit) {
+  if (sv.count > INTERN_MAX_LEN) {
+    return sv_from_parts(NULL, 0);
+  }
+
+  uint64_t h = intern_hash(sv.data, sv.count, lower);
+  Intern_Entry *mine = NULL; // allocated once the string turns out to be new
+
+  size_t i = (size_t)h & INTERN_MASK;
+  for (size_t probes = 0; probes < INTERN_SLOTS; probes++) {
+    Intern_Entry *e = atomic_load_explicit(&slots[i], memory_order_acquire);
+    if (!e) {
+      if (!mine && !(mine = entry_new(h, sv, lower, limit))) {
+        return sv_from_parts(NULL, 0);
+      }
+      if (atomic_compare_exchange_strong_explicit(&slots[i], &e, mine,
+                                                  memory_order_release,
+                                                  memory_order_acquire)) {
+        return entry_sv(mine);
+      }
+      // Another thread took the slot, `e` is its entry. It may well be the
+      // same string.
+    }
+    if (entry_is(e, h, sv, lower)) {
+      entry_drop(mine);
+      return entry_sv(e);
+    }
+    i = (i + 1) & INTERN_MASK;
+  }
+
+  entry_drop(mine);
+  return sv_from_parts(NULL, 0);
+}
+
+void intern_init(void) {
+  hash_seed = random_seed();
+}
+
+String_View intern(String_View sv) {
+  return intern_find(sv, false, INTERN_MAX_ENTRIES);
+}
+
+String_View intern_lower(String_View sv) {
+  return intern_find(sv, true, INTERN_MAX_ENTRIES);
+}
+
+String_View intern_lower_value(String_View sv) {
+  return intern_find(sv, true, INTERN_VALUE_ENTRIES);
+}
+
+uint32_t intern_id(String_View interned) {
+  const Intern_Entry *e = (const Intern_Entry *)(const void *)(
+      interned.data - offsetof(Intern_Entry, data));
+  return e->id;
+}
+
+size_t intern_count(void) { return atomic_load(&entry_count); }
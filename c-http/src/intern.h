@@ -0,0 +1,57 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sv.h"
+
+// ------------------ String interning ------------------
+
+// One shared copy of each distinct string, for the header names and values
+// that come back on every request. Equal strings intern to the same pointer,
+// so interned views compare with ==, and the copy lives for the whole
+// process.
+//
+// The table is a fixed-size open-addressing hash set. Lookups take no lock
+// and inserts claim an empty slot with a compare-and-swap, so any thread may
+// intern at any time. It is bounded: strings longer than INTERN_MAX_LEN, or
+// any new string once INTERN_MAX_ENTRIES are in, are refused and the caller
+// keeps its own copy.
+//
+// Clients choose what goes in, so the hash is keyed with a random seed
+// (intern_init), and header values, which vary far more than names, stop
+// going in at INTERN_VALUE_ENTRIES. Past that the rest of the table is kept
+// for names.
+
+#define INTERN_SLOTS 4096 // power of two
+#define INTERN_MAX_ENTRIES (INTERN_SLOTS / 4 * 3)
+#define INTERN_VALUE_ENTRIES (INTERN_SLOTS / 2)
+#define INTERN_MAX_LEN 256
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Seeds the hash. Call once, before anything is interned.
+void intern_init(void);
+
+// The interned copy of `sv`, NUL-terminated. A NULL-data view when it is
+// refused or out of memory.
+String_View intern(String_View sv);
+// intern() of `sv` in ASCII lowercase
+String_View intern_lower(String_View sv);
+// intern_lower() that takes no new string once INTERN_VALUE_ENTRIES are in,
+// known ones are still found
+String_View intern_lower_value(String_View sv);
+
+// Unique id of an interned view, never 0. Ids are handed out in order but
+// racing inserts may skip some.
+uint32_t intern_id(String_View interned);
+size_t intern_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INTERN_H
@@ -0,0 +1,1029 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "json.h"
+
+typedef struct {
+  const char *data;
+  const char *p;
+  const char *end;
+  Json_Token *tape; // NULL when only validating
+  size_t capacity;
+  size_t count;
+  Json_Error error;
+
+  // Open containers, innermost last
+  struct {
+    uint32_t token;
+    bool object;
+  } stack[JSON_MAX_DEPTH];
+  size_t depth;
+} Json_Parser;
+
+static bool json_fail(Json_Parser *jp, Json_Error err) {
+  if (jp->error == JSON_OK) {
+    jp->error = err;
+  }
+  return false;
+}
+
+static bool json_emit(Json_Parser *jp, Json_Type type, const char *start,
+                      size_t len, bool escaped) {
+  if (jp->tape) {
+    if (jp->count == jp->capacity) {
+      return json_fail(jp, JSON_ERROR_TAPE_FULL);
+    }
+    jp->tape[jp->count] = (Json_Token){
+        .start = (uint32_t)(start - jp->data),
+        .len = (uint32_t)len,
+        .next = (uint32_t)jp->count + 1,
+        .type = (uint8_t)type,
+        .escaped = escaped,
+    };
+  }
+  jp->count++;
+  return true;
+}
+
+static void json_skip_ws(Json_Parser *jp) {
+  while (jp->p < jp->end && (*jp->p == ' ' || *jp->p == '\n' ||
+                             *jp->p == '\r' || *jp->p == '\t')) {
+    jp->p++;
+  }
+}
+
+// ---------- Strings ----------
+
+// Skips the bytes a string holds as they are: anything but a quote, a
+// backslash, a control character or, with `stop_at_utf8`, a non-ASCII byte.
+// Most of a document is string contents, so this is where the time goes on
+// large ones, parsing and writing alike.
+static inline const char *json_scan_plain(const char *p, const char *end,
+                                          bool stop_at_utf8) {
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i zero = _mm_setzero_si128();
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    // The compare is signed: bytes >= 0x80 are negative, so a single one
+    // catches both control characters and non-ASCII. The writer copies
+    // UTF-8 as is and takes the negative ones back out.
+    __m128i low = _mm_cmplt_epi8(v, space);
+    if (!stop_at_utf8) {
+      low = _mm_andnot_si128(_mm_cmplt_epi8(v, zero), low);
+    }
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        low);
+    unsigned mask = (unsigned)_mm_movemask_epi8(special);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+#else
+  // Eight bytes at a time, the byte loop below pins down which one hit
+  const uint64_t ones = 0x0101010101010101ull;
+  const uint64_t highs = 0x8080808080808080ull;
+  while (end - p >= 8) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    uint64_t q = x ^ (ones * '"');
+    uint64_t b = x ^ (ones * '\\');
+    uint64_t hit = ((q - ones) & ~q) | ((b - ones) & ~b) |
+                   ((x - ones * ' ') & ~x) | (stop_at_utf8 ? x : 0);
+    if ((hit & highs) != 0) {
+      break;
+    }
+    p += 8;
+  }
+#endif
+  while (p < end) {
+    unsigned char c = (unsigned char)*p;
+    if (c == '"' || c == '\\' || c < 0x20 || (stop_at_utf8 && c >= 0x80)) {
+      break;
+    }
+    p++;
+  }
+  return p;
+}
+
+static int json_hex4(const char *p) {
+  int value = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    int digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return -1;
+    }
+    value = value * 16 + digit;
+  }
+  return value;
+}
+
+// Decodes the escape starting at the backslash `p` into UTF-8. Returns the
+// source bytes it takes, 0 when it is malformed. A \u surrogate only counts
+// as part of a pair.
+static size_t json_escape_decode(const char *p, const char *end, char out[4],
+                                 size_t *out_len) {
+  if (end - p < 2) {
+    return 0;
+  }
+
+  *out_len = 1;
+  switch (p[1]) {
+  case '"':
+  case '\\':
+  case '/':
+    out[0] = p[1];
+    return 2;
+  case 'b':
+    out[0] = '\b';
+    return 2;
+  case 'f':
+    out[0] = '\f';
+    return 2;
+  case 'n':
+    out[0] = '\n';
+    return 2;
+  case 'r':
+    out[0] = '\r';
+    return 2;
+  case 't':
+    out[0] = '\t';
+    return 2;
+  case 'u':
+    break;
+  default:
+    return 0;
+  }
+
+  int cp = end - p >= 6 ? json_hex4(p + 2) : -1;
+  size_t used = 6;
+  if (cp < 0 || (cp >= 0xDC00 && cp <= 0xDFFF)) {
+    return 0;
+  }
+  if (cp >= 0xD800 && cp <= 0xDBFF) {
+    int low = end - p >= 12 && p[6] == '\\' && p[7] == 'u' ? json_hex4(p + 8)
+                                                             : -1;
+    if (low < 0xDC00 || low > 0xDFFF) {
+      return 0;
+    }
+    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+    used = 12;
+  }
+
+  *out_len = utf8_encode((uint32_t)cp, out);
+  return used;
+}
+
+// At the opening quote
+static bool json_parse_string(Json_Parser *jp) {
+  const char *start = ++jp->p;
+  bool escaped = false;
+
+  for (;;) {
+    jp->p = json_scan_plain(jp->p, jp->end, true);
+    if (jp->p == jp->end) {
+      return json_fail(jp, JSON_ERROR_SYNTAX);
+    }
+
+    unsigned char c = (unsigned char)*jp->p;
+    if (c == '"') {
+      break;
+    }
+    if (c == '\\') {
+      char buf[4];
+      size_t n;
+      size_t used = json_escape_decode(jp->p, jp->end, buf, &n);
+      if (used == 0) {
+        return json_fail(jp, JSON_ERROR_SYNTAX);
+      }
+      escaped = true;
+      jp->p += used;
+    } else if (c < 0x20) {
+      return json_fail(jp, JSON_ERROR_SYNTAX);
+    } else {
+      // Non-ASCII: the whole run up to the next quote, backslash or control
+      // character in one go. Those are never part of a multi-byte sequence,
+      // so one cut at them is invalid anyway.
+      const char *run = json_scan_plain(jp->p, jp->end, false);
+      if (!utf8_validate(jp->p, (size_t)(run - jp->p))) {
+        return json_fail(jp, JSON_ERROR_UTF8);
+      }
+      jp->p = run;
+    }
+  }
+
+  bool ok = json_emit(jp, JSON_STRING, start, (size_t)(jp->p - start), escaped);
+  jp->p++;
+  return ok;
+}
+
+// ---------- Scalars ----------
+
+static bool json_digits(Json_Parser *jp) {
+  const char *start = jp->p;
+  while (jp->p < jp->end && *jp->p >= '0' && *jp->p <= '9') {
+    jp->p++;
+  }
+  return jp->p > start;
+}
+
+static bool json_parse_number(Json_Parser *jp) {
+  const char *start = jp->p;
+  if (*jp->p == '-') {
+    jp->p++;
+  }
+
+  // No leading zeros
+  if (jp->p < jp->end && *jp->p == '0') {
+    jp->p++;
+  } else if (!json_digits(jp)) {
+    return json_fail(jp, JSON_ERROR_SYNTAX);
+  }
+
+  if (jp->p < jp->end && *jp->p == '.') {
+    jp->p++;
+    if (!json_digits(jp)) {
+      return json_fail(jp, JSON_ERROR_SYNTAX);
+    }
+  }
+
+  if (jp->p < jp->end && (*jp->p == 'e' || *jp->p == 'E')) {
+    jp->p++;
+    if (jp->p < jp->end && (*jp->p == '+' || *jp->p == '-')) {
+      jp->p++;
+    }
+    if (!json_digits(jp)) {
+      return json_fail(jp, JSON_ERROR_SYNTAX);
+    }
+  }
+
+  return json_emit(jp, JSON_NUMBER, start, (size_t)(jp->p - start), false);
+}
+
+static bool json_parse_literal(Json_Parser *jp, const char *word,
+                               Json_Type type) {
+  size_t len = strlen(word);
+  if ((size_t)(jp->end - jp->p) < len || memcmp(jp->p, word, len) != 0) {
+    return json_fail(jp, JSON_ERROR_SYNTAX);
+  }
+  bool ok = json_emit(jp, type, jp->p, len, false);
+  jp->p += len;
+  return ok;
+}
+
+static bool json_parse_scalar(Json_Parser *jp) {
+  switch (*jp->p) {
+  case '"':
+    return json_parse_string(jp);
+  case 't':
+    return json_parse_literal(jp, "true", JSON_TRUE);
+  case 'f':
+    return json_parse_literal(jp, "false", JSON_FALSE);
+  case 'n':
+    return json_parse_literal(jp, "null", JSON_NULL);
+  default:
+    if (*jp->p == '-' || (*jp->p >= '0' && *jp->p <= '9')) {
+      return json_parse_number(jp);
+    }
+    return json_fail(jp, JSON_ERROR_SYNTAX);
+  }
+}
+
+// ---------- Containers ----------
+
+static bool json_open(Json_Parser *jp, bool object) {
+  if (jp->depth == JSON_MAX_DEPTH) {
+    return json_fail(jp, JSON_ERROR_DEPTH);
+  }
+  if (!json_emit(jp, object ? JSON_OBJECT : JSON_ARRAY, jp->p, 0, false)) {
+    return false;
+  }
+  jp->stack[jp->depth].token = (uint32_t)(jp->count - 1);
+  jp->stack[jp->depth].object = object;
+  jp->depth++;
+  jp->p++;
+  return true;
+}
+
+// At the closing bracket of the innermost container
+static void json_close(Json_Parser *jp) {
+  uint32_t token = jp->stack[--jp->depth].token;
+  jp->p++;
+  if (jp->tape) {
+    Json_Token *t = &jp->tape[token];
+    t->next = (uint32_t)jp->count;
+    t->len = (uint32_t)(jp->p - jp->data) - t->start;
+  }
+}
+
+// `"key" :`, leaving the value due
+static bool json_parse_key(Json_Parser *jp) {
+  json_skip_ws(jp);
+  if (jp->p == jp->end || *jp->p != '"') {
+    return json_fail(jp, JSON_ERROR_SYNTAX);
+  }
+  if (!json_parse_string(jp)) {
+    return false;
+  }
+  json_skip_ws(jp);
+  if (jp->p == jp->end || *jp->p != ':') {
+    return json_fail(jp, JSON_ERROR_SYNTAX);
+  }
+  jp->p++;
+  return true;
+}
+
+// No recursion: the bracket stack is the only state nesting adds.
+static void json_run(Json_Parser *jp) {
+  for (;;) {
+    // A value is due
+    json_skip_ws(jp);
+    if (jp->p == jp->end) {
+      json_fail(jp, JSON_ERROR_SYNTAX);
+      return;
+    }
+
+    char c = *jp->p;
+    if (c == '{' || c == '[') {
+      if (!json_open(jp, c == '{')) {
+        return;
+      }
+      json_skip_ws(jp);
+      if (jp->p < jp->end && *jp->p == (c == '{' ? '}' : ']')) {
+        json_close(jp);
+      } else {
+        if (c == '{' && !json_parse_key(jp)) {
+          return;
+        }
+        continue;
+      }
+    } else if (!json_parse_scalar(jp)) {
+      return;
+    }
+
+    // Commas and closing brackets, until the next value is due
+    for (;;) {
+      json_skip_ws(jp);
+      if (jp->depth == 0) {
+        if (jp->p != jp->end) {
+          json_fail(jp, JSON_ERROR_SYNTAX);
+        }
+        return;
+      }
+
+      bool object = jp->stack[jp->depth - 1].object;
+      if (jp->p == jp->end) {
+        json_fail(jp, JSON_ERROR_SYNTAX);
+        return;
+      }
+      if (*jp->p == ',') {
+        jp->p++;
+        if (object && !json_parse_key(jp)) {
+          return;
+        }
+        break;
+      }
+      if (*jp->p != (object ? '}' : ']')) {
+        json_fail(jp, JSON_ERROR_SYNTAX);
+        return;
+      }
+      json_close(jp);
+    }
+  }
+}
+
+Json_Error json_parse(Json *doc, String_View src, Json_Token *tape,
+                      size_t capacity) {
+  *doc = (Json){.src = src, .tokens = tape};
+  if (src.count > UINT32_MAX) {
+    return JSON_ERROR_TOO_BIG;
+  }
+
+  Json_Parser jp = {
+      .data = src.data,
+      .p = src.data,
+      .end = src.data + src.count,
+      .tape = tape,
+      .capacity = tape ? capacity : 0,
+  };
+  json_run(&jp);
+
+  doc->count = jp.count;
+  doc->error_at = (size_t)(jp.p - jp.data);
+  return jp.error;
+}
+
+const char *json_error_name(Json_Error err) {
+  switch (err) {
+  case JSON_OK:
+    return "ok";
+  case JSON_ERROR_SYNTAX:
+    return "syntax error";
+  case JSON_ERROR_UTF8:
+    return "invalid UTF-8";
+  case JSON_ERROR_DEPTH:
+    return "nested too deep";
+  case JSON_ERROR_TAPE_FULL:
+    return "too many values";
+  case JSON_ERROR_TOO_BIG:
+    return "document too big";
+  }
+  return "unknown";
+}
+
+// ---------- Queries ----------
+
+static const Json_Token *json_token(const Json *doc, size_t token) {
+  if (!doc->tokens || token >= doc->count) {
+    return NULL;
+  }
+  return &doc->tokens[token];
+}
+
+Json_Type json_type(const Json *doc, size_t token) {
+  const Json_Token *t = json_token(doc, token);
+  return t ? (Json_Type)t->type : JSON_NULL;
+}
+
+String_View json_sv(const Json *doc, size_t token) {
+  const Json_Token *t = json_token(doc, token);
+  if (!t) {
+    return (String_View){0};
+  }
+  return sv_from_parts(doc->src.data + t->start, t->len);
+}
+
+// String token equal to `key` once unescaped, without unescaping it anywhere
+static bool json_string_eq(const Json *doc, size_t token, String_View key) {
+  const Json_Token *t = &doc->tokens[token];
+  String_View raw = json_sv(doc, token);
+  if (!t->escaped) {
+    return sv_eq(raw, key);
+  }
+
+  const char *p = raw.data;
+  const char *end = raw.data + raw.count;
+  size_t matched = 0;
+  while (p < end) {
+    char buf[4];
+    size_t n = 1;
+    if (*p == '\\') {
+      size_t used = json_escape_decode(p, end, buf, &n);
+      if (used == 0) {
+        return false;
+      }
+      p += used;
+    } else {
+      buf[0] = *p++;
+    }
+    if (n > key.count - matched || memcmp(key.data + matched, buf, n) != 0) {
+      return false;
+    }
+    matched += n;
+  }
+  return matched == key.count;
+}
+
+size_t json_find(const Json *doc, size_t object, String_View key) {
+  const Json_Token *t = json_token(doc, object);
+  if (!t || t->type != JSON_OBJECT) {
+    return JSON_NONE;
+  }
+
+  // Members are key, value pairs; the value's `next` skips its subtree
+  for (size_t i = object + 1; i < t->next; i = doc->tokens[i + 1].next) {
+    if (json_string_eq(doc, i, key)) {
+      return i + 1;
+    }
+  }
+  return JSON_NONE;
+}
+
+size_t json_at(const Json *doc, size_t array, size_t index) {
+  const Json_Token *t = json_token(doc, array);
+  if (!t || t->type != JSON_ARRAY) {
+    return JSON_NONE;
+  }
+
+  for (size_t i = array + 1; i < t->next; i = doc->tokens[i].next) {
+    if (index-- == 0) {
+      return i;
+    }
+  }
+  return JSON_NONE;
+}
+
+size_t json_size(const Json *doc, size_t container) {
+  const Json_Token *t = json_token(doc, container);
+  if (!t || (t->type != JSON_ARRAY && t->type != JSON_OBJECT)) {
+    return 0;
+  }
+
+  size_t count = 0;
+  for (size_t i = container + 1; i < t->next; i = doc->tokens[i].next) {
+    if (t->type == JSON_OBJECT) {
+      i++; // from the key to its value
+    }
+    count++;
+  }
+  return count;
+}
+
+size_t json_query(const Json *doc, size_t from, const char *path) {
+  size_t token = json_token(doc, from) ? from : JSON_NONE;
+  const char *p = path;
+
+  while (*p != '\0' && token != JSON_NONE) {
+    if (*p == '[') {
+      p++;
+      size_t index = 0;
+      const char *digits = p;
+      while (*p >= '0' && *p <= '9' && p - digits < 10) {
+        index = index * 10 + (size_t)(*p - '0');
+        p++;
+      }
+      if (p == digits || *p != ']') {
+        return JSON_NONE;
+      }
+      p++;
+      token = json_at(doc, token, index);
+    } else {
+      if (*p == '.') {
+        p++;
+      }
+      const char *key = p;
+      while (*p != '\0' && *p != '.' && *p != '[') {
+        p++;
+      }
+      token = json_find(doc, token, sv_from_parts(key, (size_t)(p - key)));
+    }
+  }
+  return token;
+}
+
+bool json_query_string(const Json *doc, const char *path, String_View *out) {
+  size_t token = json_query(doc, 0, path);
+  if (token == JSON_NONE || json_type(doc, token) != JSON_STRING) {
+    return false;
+  }
+  *out = json_sv(doc, token);
+  return true;
+}
+
+bool json_query_i64(const Json *doc, const char *path, int64_t *out) {
+  size_t token = json_query(doc, 0, path);
+  if (token == JSON_NONE || json_type(doc, token) != JSON_NUMBER) {
+    return false;
+  }
+  // Fractions and exponents do not fit, sv_to_i64 turns them down
+  return sv_to_i64(json_sv(doc, token), out);
+}
+
+bool json_unescape(const Json *doc, size_t token, String_Builder *sb) {
+  const Json_Token *t = json_token(doc, token);
+  if (!t || t->type != JSON_STRING) {
+    return false;
+  }
+
+  String_View raw = json_sv(doc, token);
+  if (!t->escaped) {
+    return da_append_many(sb, raw.data, raw.count);
+  }
+
+  const char *p = raw.data;
+  const char *end = raw.data + raw.count;
+  while (p < end) {
+    const char *backslash = memchr(p, '\\', (size_t)(end - p));
+    if (!backslash) {
+      backslash = end;
+    }
+    if (!da_append_many(sb, p, (size_t)(backslash - p))) {
+      return false;
+    }
+    p = backslash;
+
+    if (p < end) {
+      char buf[4];
+      size_t n;
+      size_t used = json_escape_decode(p, end, buf, &n);
+      if (used == 0 || !da_append_many(sb, buf, n)) {
+        return false;
+      }
+      p += used;
+    }
+  }
+  return true;
+}
+
+// ---------- Writer ----------
+
+static void json_write_char(Json_Writer *w, char c) {
+  if (!da_append(w->sb, c)) {
+    w->failed = true;
+  }
+}
+
+// Comma before every value but the first in its container, none after a key
+static void json_write_separator(Json_Writer *w) {
+  if (w->after_key) {
+    w->after_key = false;
+    return;
+  }
+  if (w->depth == 0) {
+    return;
+  }
+  uint64_t bit = 1ull << (w->depth - 1);
+  if (w->written & bit) {
+    json_write_char(w, ',');
+  }
+  w->written |= bit;
+}
+
+void json_writer_init(Json_Writer *w, String_Builder *sb) {
+  *w = (Json_Writer){.sb = sb};
+}
+
+static void json_write_open(Json_Writer *w, char c) {
+  assert(w->depth < JSON_MAX_DEPTH);
+  json_write_separator(w);
+  json_write_char(w, c);
+  w->depth++;
+  w->written &= ~(1ull << (w->depth - 1));
+}
+
+static void json_write_close(Json_Writer *w, char c) {
+  assert(w->depth > 0 && !w->after_key);
+  w->depth--;
+  json_write_char(w, c);
+}
+
+void json_write_begin_object(Json_Writer *w) { json_write_open(w, '{'); }
+void json_write_end_object(Json_Writer *w) { json_write_close(w, '}'); }
+void json_write_begin_array(Json_Writer *w) { json_write_open(w, '['); }
+void json_write_end_array(Json_Writer *w) { json_write_close(w, ']'); }
+
+// Quoted and escaped. Clean runs are copied whole; only quotes, backslashes
+// and control characters stop the scan. False when out of memory.
+static bool json_write_quoted(String_Builder *sb, String_View s) {
+  static const char HEX[] = "0123456789abcdef";
+
+  // Room for the common case, every escape reserves its own
+  if (!da_reserve(sb, sb->count + s.count + 2)) {
+    return false;
+  }
+  sb->items[sb->count++] = '"';
+
+  const char *p = s.data;
+  const char *end = s.data + s.count;
+  while (p < end) {
+    const char *run = json_scan_plain(p, end, false);
+    if (!da_append_many(sb, p, (size_t)(run - p))) {
+      return false;
+    }
+    p = run;
+    if (p == end) {
+      break;
+    }
+
+    char esc[6] = {'\\', 0};
+    size_t n = 2;
+    switch (*p) {
+    case '"':
+    case '\\':
+      esc[1] = *p;
+      break;
+    case '\b':
+      esc[1] = 'b';
+      break;
+    case '\f':
+      esc[1] = 'f';
+      break;
+    case '\n':
+      esc[1] = 'n';
+      break;
+    case '\r':
+      esc[1] = 'r';
+      break;
+    case '\t':
+      esc[1] = 't';
+      break;
+    default:
+      memcpy(esc + 1, "u00", 3);
+      esc[4] = HEX[(unsigned char)*p >> 4];
+      esc[5] = HEX[*p & 0xF];
+      n = 6;
+      break;
+    }
+    if (!da_append_many(sb, esc, n)) {
+      return false;
+    }
+    p++;
+  }
+  return da_append(sb, '"');
+}
+
+void json_write_key(Json_Writer *w, String_View key) {
+  assert(!w->after_key);
+  json_write_separator(w);
+  if (!json_write_quoted(w->sb, key)) {
+    w->failed = true;
+  }
+  json_write_char(w, ':');
+  w->after_key = true;
+}
+
+void json_write_string(Json_Writer *w, String_View s) {
+  json_write_separator(w);
+  if (!json_write_quoted(w->sb, s)) {
+    w->failed = true;
+  }
+}
+
+void json_write_raw(Json_Writer *w, String_View json) {
+  json_write_separator(w);
+  if (!da_append_many(w->sb, json.data, json.count)) {
+    w->failed = true;
+  }
+}
+
+void json_write_bool(Json_Writer *w, bool b) {
+  json_write_raw(w, sv_from_cstr(b ? "true" : "false"));
+}
+
+void json_write_null(Json_Writer *w) { json_write_raw(w, sv_from_cstr("null")); }
+
+// ---------- Numbers ----------
+
+void json_write_u64(Json_Writer *w, uint64_t n) {
+  json_write_separator(w);
+  if (!sb_append_u64(w->sb, n)) {
+    w->failed = true;
+  }
+}
+
+void json_write_i64(Json_Writer *w, int64_t n) {
+  json_write_separator(w);
+  if (!sb_append_i64(w->sb, n)) {
+    w->failed = true;
+  }
+}
+
+// Shortest digits that read back as the same double: Grisu2 (Loitsch,
+// "Printing Floating-Point Numbers Quickly and Accurately with Integers"),
+// laid out after Milo Yip's dtoa. Doubles are handled as a 64-bit
+// significand and a binary exponent, scaled into a fixed window by a
+// cached power of ten so digit generation is integer arithmetic.
+
+typedef struct {
+  uint64_t f;
+  int e;
+} Json_Fp;
+
+// 10^k for k = -348, -340, ..., 340, normalized, rounded to nearest
+static const Json_Fp CACHED_POWERS[] = {
+    {0xfa8fd5a0081c0288ull, -1220}, {0xbaaee17fa23ebf76ull, -1193}, {0x8b16fb203055ac76ull, -1166},
+    {0xcf42894a5dce35eaull, -1140}, {0x9a6bb0aa55653b2dull, -1113}, {0xe61acf033d1a45dfull, -1087},
+    {0xab70fe17c79ac6caull, -1060}, {0xff77b1fcbebcdc4full, -1034}, {0xbe5691ef416bd60cull, -1007},
+    {0x8dd01fad907ffc3cull, -980}, {0xd3515c2831559a83ull, -954}, {0x9d71ac8fada6c9b5ull, -927},
+    {0xea9c227723ee8bcbull, -901}, {0xaecc49914078536dull, -874}, {0x823c12795db6ce57ull, -847},
+    {0xc21094364dfb5637ull, -821}, {0x9096ea6f3848984full, -794}, {0xd77485cb25823ac7ull, -768},
+    {0xa086cfcd97bf97f4ull, -741}, {0xef340a98172aace5ull, -715}, {0xb23867fb2a35b28eull, -688},
+    {0x84c8d4dfd2c63f3bull, -661}, {0xc5dd44271ad3cdbaull, -635}, {0x936b9fcebb25c996ull, -608},
+    {0xdbac6c247d62a584ull, -582}, {0xa3ab66580d5fdaf6ull, -555}, {0xf3e2f893dec3f126ull, -529},
+    {0xb5b5ada8aaff80b8ull, -502}, {0x87625f056c7c4a8bull, -475}, {0xc9bcff6034c13053ull, -449},
+    {0x964e858c91ba2655ull, -422}, {0xdff9772470297ebdull, -396}, {0xa6dfbd9fb8e5b88full, -369},
+    {0xf8a95fcf88747d94ull, -343}, {0xb94470938fa89bcfull, -316}, {0x8a08f0f8bf0f156bull, -289},
+    {0xcdb02555653131b6ull, -263}, {0x993fe2c6d07b7facull, -236}, {0xe45c10c42a2b3b06ull, -210},
+    {0xaa242499697392d3ull, -183}, {0xfd87b5f28300ca0eull, -157}, {0xbce5086492111aebull, -130},
+    {0x8cbccc096f5088ccull, -103}, {0xd1b71758e219652cull, -77}, {0x9c40000000000000ull, -50},
+    {0xe8d4a51000000000ull, -24}, {0xad78ebc5ac620000ull, 3}, {0x813f3978f8940984ull, 30},
+    {0xc097ce7bc90715b3ull, 56}, {0x8f7e32ce7bea5c70ull, 83}, {0xd5d238a4abe98068ull, 109},
+    {0x9f4f2726179a2245ull, 136}, {0xed63a231d4c4fb27ull, 162}, {0xb0de65388cc8ada8ull, 189},
+    {0x83c7088e1aab65dbull, 216}, {0xc45d1df942711d9aull, 242}, {0x924d692ca61be758ull, 269},
+    {0xda01ee641a708deaull, 295}, {0xa26da3999aef774aull, 322}, {0xf209787bb47d6b85ull, 348},
+    {0xb454e4a179dd1877ull, 375}, {0x865b86925b9bc5c2ull, 402}, {0xc83553c5c8965d3dull, 428},
+    {0x952ab45cfa97a0b3ull, 455}, {0xde469fbd99a05fe3ull, 481}, {0xa59bc234db398c25ull, 508},
+    {0xf6c69a72a3989f5cull, 534}, {0xb7dcbf5354e9beceull, 561}, {0x88fcf317f22241e2ull, 588},
+    {0xcc20ce9bd35c78a5ull, 614}, {0x98165af37b2153dfull, 641}, {0xe2a0b5dc971f303aull, 667},
+    {0xa8d9d1535ce3b396ull, 694}, {0xfb9b7cd9a4a7443cull, 720}, {0xbb764c4ca7a44410ull, 747},
+    {0x8bab8eefb6409c1aull, 774}, {0xd01fef10a657842cull, 800}, {0x9b10a4e5e9913129ull, 827},
+    {0xe7109bfba19c0c9dull, 853}, {0xac2820d9623bf429ull, 880}, {0x80444b5e7aa7cf85ull, 907},
+    {0xbf21e44003acdd2dull, 933}, {0x8e679c2f5e44ff8full, 960}, {0xd433179d9c8cb841ull, 986},
+    {0x9e19db92b4e31ba9ull, 1013}, {0xeb96bf6ebadf77d9ull, 1039}, {0xaf87023b9bf0ee6bull, 1066},
+};
+
+#define DOUBLE_HIDDEN_BIT (1ull << 52)
+
+// Upper 64 bits of the 128-bit product, rounded
+static Json_Fp json_fp_mul(Json_Fp x, Json_Fp y) {
+  const uint64_t m32 = 0xFFFFFFFFull;
+  uint64_t a = x.f >> 32, b = x.f & m32;
+  uint64_t c = y.f >> 32, d = y.f & m32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t mid = (bd >> 32) + (ad & m32) + (bc & m32) + (1ull << 31);
+  return (Json_Fp){ac + (ad >> 32) + (bc >> 32) + (mid >> 32), x.e + y.e + 64};
+}
+
+static Json_Fp json_fp_normalize(Json_Fp x) {
+  int shift = __builtin_clzll(x.f);
+  return (Json_Fp){x.f << shift, x.e - shift};
+}
+
+// `d` and the halfway points to its neighbours, which bound the digits
+// that still read back as `d`. Both share the exponent of `plus`.
+static Json_Fp json_fp_boundaries(double d, Json_Fp *minus, Json_Fp *plus) {
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  int biased = (int)((bits >> 52) & 0x7FF);
+  uint64_t significand = bits & (DOUBLE_HIDDEN_BIT - 1);
+
+  Json_Fp v = biased != 0
+                  ? (Json_Fp){significand + DOUBLE_HIDDEN_BIT, biased - 1075}
+                  : (Json_Fp){significand, -1074};
+
+  *plus = json_fp_normalize((Json_Fp){(v.f << 1) + 1, v.e - 1});
+  // The gap below a power of two is half the one above
+  *minus = v.f == DOUBLE_HIDDEN_BIT ? (Json_Fp){(v.f << 2) - 1, v.e - 2}
+                                    : (Json_Fp){(v.f << 1) - 1, v.e - 1};
+  minus->f <<= minus->e - plus->e;
+  minus->e = plus->e;
+  return v;
+}
+
+// Power of ten that brings binary exponent `e` into [-60, -32]. Sets `*k` to
+// the decimal exponent it removes.
+static Json_Fp json_cached_power(int e, int *k) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347; // log10(2)
+  int ik = (int)dk;
+  if (dk - ik > 0.0) {
+    ik++;
+  }
+  unsigned index = (unsigned)((ik >> 3) + 1);
+  *k = -(-348 + (int)index * 8);
+  return CACHED_POWERS[index];
+}
+
+// Nudges the last digit down while that keeps it inside the bounds and
+// closer to the real value
+static void json_grisu_round(char *digits, int len, uint64_t delta,
+                             uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    digits[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static int json_count_digits32(uint32_t n) {
+  int count = 1;
+  while (count < 10 && n >= SV_POW10[count]) {
+    count++;
+  }
+  return count;
+}
+
+static int json_digit_gen(Json_Fp w, Json_Fp mp, uint64_t delta, char *digits,
+                          int *k) {
+  Json_Fp one = {1ull << -mp.e, mp.e};
+  uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+  uint64_t p2 = mp.f & (one.f - 1);
+  int kappa = json_count_digits32(p1);
+  int len = 0;
+
+  // Integral part
+  while (kappa > 0) {
+    uint32_t div = (uint32_t)SV_POW10[kappa - 1];
+    uint32_t d = p1 / div;
+    p1 %= div;
+    if (d || len) {
+      digits[len++] = (char)('0' + d);
+    }
+    kappa--;
+    uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+    if (rest <= delta) {
+      *k += kappa;
+      json_grisu_round(digits, len, delta, rest, SV_POW10[kappa] << -one.e,
+                       wp_w);
+      return len;
+    }
+  }
+
+  // Fractional part
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    char d = (char)(p2 >> -one.e);
+    if (d || len) {
+      digits[len++] = (char)('0' + d);
+    }
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *k += kappa;
+      int index = -kappa;
+      json_grisu_round(digits, len, delta, p2, one.f,
+                       wp_w * (index < 20 ? SV_POW10[index] : 0));
+      return len;
+    }
+  }
+}
+
+// Digits of a positive finite `d`, which is digits * 10^k. At most 17.
+static int json_grisu2(double d, char digits[20], int *k) {
+  Json_Fp minus, plus;
+  Json_Fp v = json_fp_boundaries(d, &minus, &plus);
+  Json_Fp c = json_cached_power(plus.e, k);
+
+  Json_Fp w = json_fp_mul(json_fp_normalize(v), c);
+  Json_Fp wp = json_fp_mul(plus, c);
+  Json_Fp wm = json_fp_mul(minus, c);
+  wm.f++;
+  wp.f--;
+  return json_digit_gen(w, wp, wp.f - wm.f, digits, k);
+}
+
+// Like JavaScript prints numbers: plain digits from 1e-6 up to 1e21,
+// exponent notation outside. Returns the length, at most 25.
+static size_t json_format_double(double d, char out[32]) {
+  char *p = out;
+  if (signbit(d)) {
+    *p++ = '-';
+    d = -d;
+  }
+  if (d == 0.0) {
+    *p++ = '0';
+    return (size_t)(p - out);
+  }
+
+  char digits[20];
+  int k;
+  int len = json_grisu2(d, digits, &k);
+  int point = len + k; // digits before the decimal point
+
+  if (len <= point && point <= 21) {
+    // 1234e7 -> 12340000000
+    memcpy(p, digits, (size_t)len);
+    memset(p + len, '0', (size_t)(point - len));
+    p += point;
+  } else if (0 < point && point <= 21) {
+    // 1234e-2 -> 12.34
+    memcpy(p, digits, (size_t)point);
+    p[point] = '.';
+    memcpy(p + point + 1, digits + point, (size_t)(len - point));
+    p += len + 1;
+  } else if (-6 < point && point <= 0) {
+    // 1234e-6 -> 0.001234
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', (size_t)-point);
+    p += -point;
+    memcpy(p, digits, (size_t)len);
+    p += len;
+  } else {
+    // 1234e30 -> 1.234e33
+    *p++ = digits[0];
+    if (len > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, (size_t)(len - 1));
+      p += len - 1;
+    }
+    *p++ = 'e';
+    int exp = point - 1;
+    if (exp < 0) {
+      *p++ = '-';
+      exp = -exp;
+    }
+    p += sv_format_u64((uint64_t)exp, p);
+  }
+  return (size_t)(p - out);
+}
+
+void json_write_double(Json_Writer *w, double d) {
+  if (!isfinite(d)) {
+    json_write_null(w); // JSON has no NaN or infinity
+    return;
+  }
+  json_write_separator(w);
+  if (!da_reserve(w->sb, w->sb->count + 32)) {
+    w->failed = true;
+    return;
+  }
+  w->sb->count += json_format_double(d, w->sb->items + w->sb->count);
+}
@@ -0,0 +1,146 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sv.h"
+
+// ------------------ JSON ------------------
+
+// Tokenizer for request bodies that works in place: nothing is copied or
+// allocated, the caller hands in the tape and every value comes back as a
+// String_View into the source. Strict RFC 8259: one value, optionally
+// surrounded by whitespace, with strings checked to be valid UTF-8 and
+// escapes checked to be well formed (lone surrogates included).
+//
+// The tape holds one token per value and per object key, in document order.
+// Containers know where their subtree ends, so lookups skip over nested
+// values instead of walking them. Token 0 is the root.
+//
+//   Json_Token tape[64];
+//   Json doc;
+//   if (json_parse(&doc, body, tape, 64) == JSON_OK) {
+//     String_View input;
+//     if (json_query_string(&doc, "input", &input)) ...
+//   }
+
+typedef enum {
+  JSON_NULL,
+  JSON_FALSE,
+  JSON_TRUE,
+  JSON_NUMBER,
+  JSON_STRING,
+  JSON_ARRAY,
+  JSON_OBJECT,
+} Json_Type;
+
+typedef struct {
+  uint32_t start; // first byte; strings start after the opening quote
+  uint32_t len;   // bytes; strings without quotes, containers with brackets
+  uint32_t next;  // tape index right after this value and its children
+  uint8_t type;   // Json_Type
+  uint8_t escaped; // string with backslash escapes, see json_unescape
+  uint16_t reserved;
+} Json_Token;
+
+typedef enum {
+  JSON_OK,
+  JSON_ERROR_SYNTAX,
+  JSON_ERROR_UTF8,
+  JSON_ERROR_DEPTH,     // nested deeper than JSON_MAX_DEPTH
+  JSON_ERROR_TAPE_FULL, // more tokens than the tape holds
+  JSON_ERROR_TOO_BIG,   // offsets are 32-bit
+} Json_Error;
+
+#define JSON_MAX_DEPTH 64
+#define JSON_NONE SIZE_MAX
+
+typedef struct {
+  String_View src;
+  Json_Token *tokens;
+  size_t count;    // tokens produced, or that would be with no tape
+  size_t error_at; // byte offset of the first error
+} Json;
+
+typedef struct {
+  String_Builder *sb;
+  uint64_t written; // bit per open container: holds a value already
+  uint32_t depth;
+  bool after_key;
+  bool failed; // ran out of memory, the output is incomplete
+} Json_Writer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Parses `src` into `tape`. With a NULL tape it only validates, counting
+// tokens, which is how to find the tape size a document needs. `src` must
+// outlive `doc`.
+Json_Error json_parse(Json *doc, String_View src, Json_Token *tape,
+                      size_t capacity);
+const char *json_error_name(Json_Error err);
+
+// ---------- Queries ----------
+// Token indexes in, token indexes out, JSON_NONE when there is no such value
+// (which every query takes as input too, so lookups chain).
+
+Json_Type json_type(const Json *doc, size_t token);
+// Value of member `key` of an object. Keys are compared unescaped.
+size_t json_find(const Json *doc, size_t object, String_View key);
+// Element `index` of an array
+size_t json_at(const Json *doc, size_t array, size_t index);
+// Members or elements of a container
+size_t json_size(const Json *doc, size_t container);
+// Dotted path from `from`, with [n] for array elements: "user.tags[0]". An
+// empty path is `from` itself.
+size_t json_query(const Json *doc, size_t from, const char *path);
+
+// Source bytes of a value: string contents still escaped, numbers and
+// literals as written, containers with their brackets.
+String_View json_sv(const Json *doc, size_t token);
+// The string at `path` from the root, escaped as in json_sv
+bool json_query_string(const Json *doc, const char *path, String_View *out);
+bool json_query_i64(const Json *doc, const char *path, int64_t *out);
+
+// Appends the decoded contents of a string token to `sb`
+bool json_unescape(const Json *doc, size_t token, String_Builder *sb);
+
+// ---------- Writer ----------
+// Appends a document to a String_Builder, commas and quoting taken care of:
+//
+//   Json_Writer w;
+//   json_writer_init(&w, &sb);
+//   json_write_begin_object(&w);
+//   json_write_key(&w, sv_from_cstr("id"));
+//   json_write_u64(&w, 42);
+//   json_write_end_object(&w);
+//
+// Strings are expected to be UTF-8 and are copied as such, escaping only
+// what JSON requires. Doubles always read back to the same value, nearly
+// always in the fewest digits that do (Grisu2); NaN and infinities as null.
+// Running out of memory sets `failed` and leaves the output cut short.
+
+void json_writer_init(Json_Writer *w, String_Builder *sb);
+void json_write_begin_object(Json_Writer *w);
+void json_write_end_object(Json_Writer *w);
+void json_write_begin_array(Json_Writer *w);
+void json_write_end_array(Json_Writer *w);
+void json_write_key(Json_Writer *w, String_View key);
+
+void json_write_string(Json_Writer *w, String_View s);
+void json_write_i64(Json_Writer *w, int64_t n);
+void json_write_u64(Json_Writer *w, uint64_t n);
+void json_write_double(Json_Writer *w, double d);
+void json_write_bool(Json_Writer *w, bool b);
+void json_write_null(Json_Writer *w);
+// A value that is already JSON, copied as is
+void json_write_raw(Json_Writer *w, String_View json);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JSON_H
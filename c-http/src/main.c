@@ -1,26 +1,46 @@
-#define _POSIX_C_SOURCE 200112L // importante: antes de los includes
+#define _GNU_SOURCE // importante: antes de los includes (splice, pipe2)
 
 #include <arpa/inet.h>
+#include <assert.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "admission.h"
+#include "arena.h"
+#include "compress.h"
+#include "config.h"
+#include "docroot.h"
 #include "hashmap.h"
+#include "intern.h"
+#include "json.h"
+#include "mime.h"
+#include "restart.h"
+#include "rope.h"
+#include "sockopt.h"
 #include "sv.h"
+#include "thread_pool.h"
+#include "uring.h"
 
-int setup_server_socket(const char *host, const char *port, int backlog) {
+int setup_server_socket(const char *host, const char *port,
+                        const Socket_Profile *profile) {
   struct addrinfo hints;
   struct addrinfo *serv_info;
 
@@ -38,7 +58,9 @@ int setup_server_socket(const char *host, const char *port, int backlog) {
   int sockfd;
   struct addrinfo *p;
   for (p = serv_info; p != NULL; p = p->ai_next) {
-    sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    // CLOEXEC: a restart passes the listener explicitly, see restart.h
+    sockfd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC,
+                    p->ai_protocol);
     if (sockfd < 0) {
       perror("SERVER ERROR: socket fd");
       continue;
@@ -52,6 +74,8 @@ int setup_server_socket(const char *host, const char *port, int backlog) {
       return -1;
     }
 
+    socket_profile_apply(sockfd, profile);
+
     err = bind(sockfd, p->ai_addr, p->ai_addrlen);
     if (err < 0) {
       perror("SERVER ERROR: socket bind error");
@@ -70,7 +94,7 @@ int setup_server_socket(const char *host, const char *port, int backlog) {
     return -1;
   }
 
-  if (listen(sockfd, backlog) < 0) {
+  if (listen(sockfd, socket_profile_backlog(profile)) < 0) {
     perror("SERVER ERROR: socket listen");
     close(sockfd);
     return -1;
@@ -79,8 +103,15 @@ int setup_server_socket(const char *host, const char *port, int backlog) {
   return sockfd;
 }
 
-const char *PORT = "3490";
-const int BACKLOG = 10;
+// Set once by config_load in main, read-only from then on
+static const Config *CONFIG = NULL;
+
+// Build with -DOFFLOAD_HANDLERS=0 to run handlers inline on the connection
+// loop. `make bench/offload` also passes -DHANDLER_COST_US=n, which wraps
+// every handler in n microseconds of blocking work.
+#ifndef OFFLOAD_HANDLERS
+#define OFFLOAD_HANDLERS 1
+#endif
 
 #define KB(n) (((uint64_t)(n)) << 10)
 #define MB(n) (((uint64_t)(n)) << 20)
@@ -109,14 +140,6 @@ int find_double_crlf(const String_View *sv) {
     abort();                                                                   \
   } while (0)
 
-typedef enum {
-  LOG_DEBUG = -4,
-  LOG_INFO = 0,
-  LOG_WARN = 4,
-  LOG_ERROR = 8,
-  LOG_NO_LOGS = 1000 // mute total
-} Log_Level;
-
 static Log_Level CURRENT_LOG_LEVEL = LOG_DEBUG;
 
 static const char *log_level_to_string(Log_Level level) {
@@ -153,142 +176,783 @@ void z_log(Log_Level level, const char *fmt, ...) {
   fprintf(stderr, "\n");
 }
 
-void send_response(int client_fd, String_View version, int status,
-                   const char *reason, const char *content_type,
-                   String_View body, bool shouldClose) {
-  String_Builder sb = {0};
-  da_reserve(&sb, KB(4));
+typedef struct {
+  String_View key;
+  String_View value;
+} HTTP_Header;
+
+// Inline room for what typical requests send, more goes to the heap
+typedef struct {
+  DA_SMALL_FIELDS(HTTP_Header, 16);
+} HTTP_Headers;
+
+typedef struct {
+  String_View method;
+  String_View request_uri;
+  String_View version;
+
+  int64_t content_len;
+  String_View host;
+
+  HTTP_Headers headers;
+  Hashmap *headers_map; // nodes in `arena`
+  Arena arena;          // emptied for every request
+
+  String_Builder body;
+} HTTP_Request;
+
+#define REQUEST_ARENA_BLOCK 4096
+
+// Header names are stored lowercase. A header that was not sent reads as
+// empty, which it then is in the map too: upsert adds a node on a miss.
+static String_View *request_header(HTTP_Request *request, const char *name) {
+  static _Thread_local String_View absent;
+  String_View *value =
+      upsert(&request->headers_map, sv_from_cstr(name), &request->arena);
+  if (!value) {
+    absent = (String_View){0}; // out of memory, as if not sent
+    return &absent;
+  }
+  return value;
+}
+
+// Request line plus headers
+#define MAX_REQUEST_HEAD                                                       \
+  ((size_t)CONFIG->max_headers_total + CONFIG->max_header_size)
+// Room a response head is built in, enough for every header it may carry
+#define RESPONSE_HEAD_RESERVE 1024
+
+// Static files gzipped on the fly when no precompressed sibling exists
+#define COMPRESS_MIN_SIZE 256
+#define COMPRESS_MAX_SIZE (MB(8))
+
+// More ranges than this in one request and the Range header is ignored
+#define MAX_RANGES 16
+#define MULTIPART_BOUNDARY "zcserver-3d6b6a416f9d4b2e"
+
+// ------------------ Connections ------------------
+
+typedef struct {
+  int status; // 0 when there is nothing to send
+  const char *reason;
+  const char *content_type;
+  String_View version;
+  String_View body; // borrowed, must stay valid until sent
+  const Rope *rope; // when set the body is its pieces instead of `body`
+  int file_fd;      // when >= 0 the body is `file_size` bytes of this file,
+  size_t file_size; // starting at `file_offset`
+  uint64_t file_offset;
+  Docroot_File *static_file; // owns `file_fd`, which other responses share
+  bool omit_body; // HEAD: headers describe the body but it is not sent
+
+  const char *content_encoding; // NULL for identity
+  bool vary_encoding;           // the body depends on Accept-Encoding
+  Compressed *cached;           // reference held while `body` points into it
+
+  // Validators and ranges, static files only
+  char etag[64];
+  time_t last_modified; // 0 when unknown
+  bool accept_ranges;
+  char content_range[80];
+} HTTP_Response;
+
+typedef struct {
+  uint64_t start;
+  uint64_t end; // inclusive
+} Byte_Range;
+
+typedef struct HTTP_Conn HTTP_Conn;
+
+// Where the request body goes as it arrives. Picked by http_conn_route_body
+// once the head is parsed, before any body byte is read.
+typedef bool (*Body_Fn)(HTTP_Conn *conn, String_View chunk);
+
+typedef enum {
+  BODY_BUFFER, // the whole body in `request.body`
+  BODY_SPILL,  // `request.body` up to body_spill_threshold, a temp file
+               // above
+  BODY_STREAM, // each slice goes to `on_chunk` straight from the receive
+               // buffer, nothing is kept (NULL discards)
+} Body_Mode;
+
+typedef struct {
+  Body_Mode mode;
+  Body_Fn on_chunk;
+  int fd;            // BODY_SPILL: unlinked temp file with the whole body
+  uint64_t received; // body bytes consumed from the socket
+  bool failed;       // the sink errored, the rest is drained and dropped
+} Body_Sink;
+
+// A handler that may block. It runs on the thread pool and comes back to the
+// connection loop through `completions`; the loop then sends the response.
+typedef struct {
+  Job job;
+  HTTP_Conn *conn;
+#ifdef HANDLER_COST_US
+  Job_Fn handler; // run by costly_handler_run after the fake work
+#endif
+} Handler_Job;
+
+struct HTTP_Conn {
+  int fd;
+  int admission; // slot from admission_accept, released on free
+
+  String_Builder in; // raw bytes read from the socket
+  size_t head_len;   // request line + headers, 0 until complete
+  size_t consumed;   // bytes of `in` that belong to the current request
+
+  HTTP_Request request;
+  Body_Sink body;
+  int splice_pipe[2]; // socket -> pipe -> temp file, created on first use
+  int rcvlowat;       // current SO_RCVLOWAT of `fd`
+  String_Builder scratch;   // lowercased header copies
+  String_Builder full_path; // static file path
+  File_Id file_id;          // identity of the static file being served
+  Byte_Range ranges[MAX_RANGES];
+  size_t range_count;
+  String_Builder file;      // handler output: file contents or generated body
+  Rope rope;                // handler output assembled from many parts
+
+  HTTP_Response response;
+  String_Builder out; // serialized response head
+
+  Handler_Job handler;
+  bool expect_continue;
+  bool should_close;
+};
+
+typedef enum {
+  ROUTE_DONE,    // `conn->response` is ready
+  ROUTE_PENDING, // a handler job owns the connection until it completes
+} Route_Result;
+
+static const char *CONTINUE_MSG = "HTTP/1.1 100 Continue\r\n\r\n";
+
+// date RFC 1123 format
+static void http_date_format(time_t t, char date[64]) {
+  struct tm gmt;
+  gmtime_r(&t, &gmt);
+  strftime(date, 64, "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+}
+
+// False when out of memory
+bool http_response_head(String_Builder *sb, const HTTP_Response *r,
+                        bool should_close) {
+  // Every field is short, after this the appends below do not allocate
+  if (!da_reserve(sb, sb->count + RESPONSE_HEAD_RESERVE)) {
+    return false;
+  }
+
+  char date[64];
+  http_date_format(time(NULL), date);
 
-  // date RFC 1123 format
-  char date[128];
-  time_t now = time(NULL);
-  struct tm *gmt = gmtime(&now);
-  strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmt);
+  size_t content_len = r->file_fd >= 0 ? r->file_size
+                       : r->rope      ? r->rope->length
+                                      : r->body.count;
 
   // Status line
-  sb_appendf(&sb, SV_Fmt " %d %s\r\n", SV_Arg(version), status, reason);
+  sb_appendf(sb, SV_Fmt " %d %s\r\n", SV_Arg(r->version), r->status,
+             r->reason);
 
   // Required Headers
-  sb_appendf(&sb, "Date: %s\r\n", date);
-  sb_appendf(&sb, "Server: Z_CServer/0.1\r\n");
-  sb_appendf(&sb, "Content-Length: %zu\r\n", body.count);
-  sb_appendf(&sb, "Content-Type: %s\r\n",
-             content_type ? content_type : "text/plain");
+  sb_appendf(sb, "Date: %s\r\n", date);
+  sb_appendf(sb, "Server: Z_CServer/0.1\r\n");
+  // A 304 describes the cached representation, it has no body of its own
+  if (r->status != 304) {
+    sb_append_cstr(sb, "Content-Length: ");
+    sb_append_u64(sb, content_len);
+    sb_append_cstr(sb, "\r\n");
+    sb_appendf(sb, "Content-Type: %s\r\n",
+               r->content_type ? r->content_type : "text/plain");
+    if (r->content_encoding) {
+      sb_appendf(sb, "Content-Encoding: %s\r\n", r->content_encoding);
+    }
+  }
+  if (r->vary_encoding) {
+    sb_appendf(sb, "Vary: Accept-Encoding\r\n");
+  }
+  if (r->etag[0]) {
+    sb_appendf(sb, "ETag: %s\r\n", r->etag);
+  }
+  if (r->last_modified) {
+    char last_modified[64];
+    http_date_format(r->last_modified, last_modified);
+    sb_appendf(sb, "Last-Modified: %s\r\n", last_modified);
+  }
+  if (r->accept_ranges) {
+    sb_appendf(sb, "Accept-Ranges: bytes\r\n");
+  }
+  if (r->content_range[0]) {
+    sb_appendf(sb, "Content-Range: %s\r\n", r->content_range);
+  }
 
-  sb_appendf(&sb, "Connection: %s\r\n", shouldClose ? "close" : "keep-alive");
+  sb_appendf(sb, "Connection: %s\r\n", should_close ? "close" : "keep-alive");
 
   // headers end
-  sb_appendf(&sb, "\r\n");
+  return sb_appendf(sb, "\r\n") >= 0;
+}
 
-  // send headers
-  send(client_fd, sb.items, sb.count, 0);
+// Drops the file body. A docroot fd goes back to the cache, a spilled
+// request body stays with the connection.
+static void response_close_file(HTTP_Response *r) {
+  docroot_release(r->static_file);
+  r->static_file = NULL;
+  r->file_fd = -1;
+}
 
-  // Body
-  if (body.data && body.count > 0) {
-    send(client_fd, body.data, body.count, 0);
+void respond(HTTP_Conn *conn, String_View version, int status,
+             const char *reason, const char *content_type, String_View body) {
+  response_close_file(&conn->response);
+  compress_cache_release(conn->response.cached);
+  conn->response = (HTTP_Response){
+      .status = status,
+      .reason = reason,
+      .content_type = content_type,
+      .version = version,
+      .body = body,
+      .file_fd = -1,
+  };
+}
+
+void respond_201(HTTP_Conn *conn, String_View version, String_View body) {
+  // If body is NULL, we can send an empty response
+  respond(conn, version, 201, "Created", "text/plain", body);
+}
+
+void respond_400(HTTP_Conn *conn, String_View version) {
+  respond(conn, version, 400, "Bad Request", "text/plain",
+          sv_from_cstr("400 Bad Request"));
+  conn->should_close = true;
+}
+
+void respond_404(HTTP_Conn *conn, String_View version) {
+  respond(conn, version, 404, "Not Found", "text/plain",
+          sv_from_cstr("404 Not Found"));
+  conn->should_close = true;
+}
+
+void respond_500(HTTP_Conn *conn, String_View version) {
+  respond(conn, version, 500, "Internal Server Error", "text/plain",
+          sv_from_cstr("500 Internal Server Error"));
+  conn->should_close = true;
+}
+
+bool read_entire_fd(int fd, uint64_t offset, size_t size, String_Builder *sb) {
+  if (!da_reserve(sb, sb->count + size)) {
+    z_log(LOG_ERROR, "Out of memory reading file fd %d", fd);
+    return false;
+  }
+
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = pread(fd, sb->items + sb->count + done, size - done,
+                      (off_t)(offset + done));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      z_log(LOG_ERROR, "Could not read file fd %d: %s", fd,
+            n < 0 ? strerror(errno) : "unexpected end of file");
+      return false;
+    }
+    done += (size_t)n;
   }
 
-  sb_free(sb);
+  sb->count += size;
+  return true;
 }
 
-void respond_201(int client_fd, String_View version, String_View body,
-                 bool shouldClose) {
-  // If body is NULL, we can send an empty response
-  send_response(client_fd, version, 201, "Created", "text/plain", body,
-                shouldClose);
+// read_entire_fd into pool chunks, for bodies that are never flattened
+static bool read_fd_into_rope(int fd, uint64_t offset, size_t size,
+                              Rope *rope) {
+  while (size > 0) {
+    size_t room;
+    char *dest = rope_reserve(rope, &room);
+    if (!dest) {
+      z_log(LOG_ERROR, "Out of memory reading file fd %d", fd);
+      return false;
+    }
+    ssize_t n = pread(fd, dest, size < room ? size : room, (off_t)offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      z_log(LOG_ERROR, "Could not read file fd %d: %s", fd,
+            n < 0 ? strerror(errno) : "unexpected end of file");
+      return false;
+    }
+    rope_commit(rope, (size_t)n);
+    offset += (uint64_t)n;
+    size -= (size_t)n;
+  }
+  return true;
 }
 
-void respond_400(int client_fd, String_View version) {
-  send_response(client_fd, version, 400, "Bad Request", "text/plain",
-                sv_from_cstr("400 Bad Request"), true);
+// ------------------ Request body ------------------
+
+#define BODY_SPILL_TEMPLATE "/tmp/zcserver-body-XXXXXX"
+
+static bool write_all(int fd, const char *data, size_t count) {
+  while (count > 0) {
+    ssize_t n = write(fd, data, count);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    count -= (size_t)n;
+  }
+  return true;
 }
 
-void respond_404(int client_fd, String_View version) {
-  send_response(client_fd, version, 404, "Not Found", "text/plain",
-                sv_from_cstr("404 Not Found"), true);
+static bool body_spill(HTTP_Conn *conn) {
+  char path[] = BODY_SPILL_TEMPLATE;
+  int fd = mkostemp(path, O_CLOEXEC);
+  if (fd < 0) {
+    z_log(LOG_ERROR, "Could not create a temp file for a request body: %s",
+          strerror(errno));
+    return false;
+  }
+  unlink(path); // gone as soon as it is closed
+
+  conn->body.fd = fd;
+  String_Builder *buffered = &conn->request.body;
+  bool ok = write_all(fd, buffered->items, buffered->count);
+  buffered->count = 0;
+  return ok;
 }
 
-void respond_500(int client_fd, String_View version) {
-  send_response(client_fd, version, 500, "Internal Server Error", "text/plain",
-                sv_from_cstr("500 Internal Server Error"), true);
+static uint64_t body_remaining(const HTTP_Conn *conn) {
+  return (uint64_t)conn->request.content_len - conn->body.received;
 }
 
-#define return_defer(value)                                                    \
-  do {                                                                         \
-    result = (value);                                                          \
-    goto defer;                                                                \
-  } while (0)
+// Feeds the next slice of the body to the connection's sink. Once a sink
+// fails the rest of the body is still consumed, so the connection stays in
+// sync, and the route answers 500.
+static void body_sink_write(HTTP_Conn *conn, const char *data, size_t count) {
+  Body_Sink *sink = &conn->body;
+  sink->received += count;
+  if (sink->failed || count == 0) {
+    return;
+  }
 
-bool read_entire_file(const char *path, String_Builder *sb) {
-  bool result = true;
-
-  FILE *f = fopen(path, "rb");
-  size_t new_count = 0;
-  long long m = 0;
-  if (f == NULL)
-    return_defer(false);
-  if (fseek(f, 0, SEEK_END) < 0)
-    return_defer(false);
-#ifndef _WIN32
-  m = ftell(f);
-#else
-  m = _ftelli64(f);
-#endif
-  if (m < 0)
-    return_defer(false);
-  if (fseek(f, 0, SEEK_SET) < 0)
-    return_defer(false);
+  switch (sink->mode) {
+  case BODY_BUFFER:
+    sink->failed = !da_append_many(&conn->request.body, data, count);
+    break;
+
+  case BODY_SPILL:
+    if (sink->fd < 0) {
+      sink->failed = !da_append_many(&conn->request.body, data, count);
+    } else if (!write_all(sink->fd, data, count)) {
+      sink->failed = true;
+    }
+    break;
+
+  case BODY_STREAM:
+    if (sink->on_chunk && !sink->on_chunk(conn, sv_from_parts(data, count))) {
+      sink->failed = true;
+    }
+    break;
+  }
 
-  new_count = sb->count + m;
-  if (new_count > sb->capacity) {
-    sb->items = DECLTYPE_CAST(sb->items) realloc(sb->items, new_count);
-    assert(sb->items != NULL && "Buy more RAM lool!!");
-    sb->capacity = new_count;
+  if (sink->failed) {
+    z_log(LOG_ERROR, "Dropping the body of client %d", conn->fd);
   }
+}
 
-  fread(sb->items + sb->count, m, 1, f);
-  if (ferror(f)) {
-    return_defer(false);
+// Storage the rest of the body can be received into directly, or NULL when
+// the sink does not keep it in memory. Confirm with body_sink_commit.
+static char *body_sink_buffer(HTTP_Conn *conn, size_t *cap) {
+  Body_Sink *sink = &conn->body;
+  bool in_memory = sink->mode == BODY_BUFFER ||
+                   (sink->mode == BODY_SPILL && sink->fd < 0);
+  if (!in_memory || sink->failed) {
+    return NULL;
   }
-  sb->count = new_count;
 
-defer:
-  if (!result)
-    z_log(LOG_ERROR, "Could not read file %s: %s", path, strerror(errno));
-  if (f)
-    fclose(f);
-  return result;
+  // Reserves the whole Content-Length on the first call
+  String_Builder *body = &conn->request.body;
+  *cap = (size_t)body_remaining(conn);
+  if (!da_reserve(body, body->count + *cap)) {
+    z_log(LOG_ERROR, "Out of memory buffering the body of client %d",
+          conn->fd);
+    sink->failed = true;
+    return NULL;
+  }
+  return body->items + body->count;
 }
 
-typedef struct {
-  String_View key;
-  String_View value;
-} HTTP_Header;
+static void body_sink_commit(HTTP_Conn *conn, size_t count) {
+  conn->request.body.count += count;
+  conn->body.received += count;
+}
 
-typedef struct {
-  HTTP_Header *items;
-  size_t count;
-  size_t capacity;
-} HTTP_Headers;
+static void body_sink_open(HTTP_Conn *conn, Body_Mode mode, Body_Fn on_chunk) {
+  conn->body = (Body_Sink){.mode = mode, .on_chunk = on_chunk, .fd = -1};
 
-typedef struct {
-  String_View method;
-  String_View request_uri;
-  String_View version;
+  // The length is known up front, a big body goes to disk from the start
+  if (mode == BODY_SPILL &&
+      conn->request.content_len > (int64_t)CONFIG->body_spill_threshold &&
+      !body_spill(conn)) {
+    conn->body.failed = true;
+  }
+}
 
-  int64_t content_len;
-  String_View host;
+// Keeps the socket from waking us up for small segments while a body is
+// coming in, and back to 1 for the next head. Never above what is left, or
+// the last read would wait forever.
+static void body_update_rcvlowat(HTTP_Conn *conn) {
+  uint64_t remaining = body_remaining(conn);
+  uint64_t max = CONFIG->body_rcvlowat;
+  int lowat = (int)(remaining < max ? remaining : max);
+  if (lowat == 0) {
+    lowat = 1;
+  }
+  if (lowat == conn->rcvlowat) {
+    return;
+  }
 
-  HTTP_Headers headers;
-  Hashmap *headers_map;
+  if (setsockopt(conn->fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat)) ==
+      0) {
+    conn->rcvlowat = lowat;
+  }
+}
 
-  String_Builder body;
-} HTTP_Request;
+// Hands the body bytes that arrived along with the head to the sink.
+static void body_from_head(HTTP_Conn *conn) {
+  size_t initial = conn->in.count - conn->head_len;
+  if (initial > body_remaining(conn)) {
+    initial = (size_t)body_remaining(conn);
+  }
+  body_sink_write(conn, conn->in.items + conn->head_len, initial);
+  conn->consumed += initial;
+}
+
+// ------------------ Handlers ------------------
+
+static Thread_Pool *pool = NULL;
+static Completion_Queue completions = {.efd = -1};
+
+// Values a /create body may hold before it is only validated, not kept
+#define CREATE_JSON_TOKENS 256
+
+// {"error": "...", "offset": n} for a body that is not JSON
+static void respond_json_error(HTTP_Conn *conn, const Json *doc,
+                               Json_Error err) {
+  Json_Writer w;
+  json_writer_init(&w, &conn->file);
+  json_write_begin_object(&w);
+  json_write_key(&w, sv_from_cstr("error"));
+  json_write_string(&w, sv_from_cstr(json_error_name(err)));
+  json_write_key(&w, sv_from_cstr("offset"));
+  json_write_u64(&w, doc->error_at);
+  json_write_end_object(&w);
+  if (w.failed) {
+    respond_500(conn, conn->request.version);
+    return;
+  }
+
+  // The body was read whole, the connection can go on
+  respond(conn, conn->request.version, 400, "Bad Request", "application/json",
+          sb_to_sv(conn->file));
+}
+
+// A body sent as application/json has to be JSON. Parsed in place, a spilled
+// one straight from a mapping of its temp file. Returns the error status it
+// answered with, 0 when the body is fine.
+static int create_body_check(HTTP_Conn *conn) {
+  String_View type =
+      *request_header(&conn->request, "content-type");
+  type = sv_trim(sv_chop_by_delim(&type, ';'));
+  if (!sv_eq(type, sv_from_cstr("application/json"))) {
+    return 0;
+  }
+
+  Json doc;
+  Json_Error err;
+  if (conn->body.fd >= 0) {
+    size_t size = (size_t)conn->body.received;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, conn->body.fd, 0);
+    if (data == MAP_FAILED) {
+      respond_500(conn, conn->request.version);
+      return 500;
+    }
+    err = json_parse(&doc, sv_from_parts(data, size), NULL, 0);
+    munmap(data, size);
+  } else {
+    Json_Token tape[CREATE_JSON_TOKENS];
+    String_View body = sb_to_sv(conn->request.body);
+    err = json_parse(&doc, body, tape, CREATE_JSON_TOKENS);
+    if (err == JSON_ERROR_TAPE_FULL) {
+      err = json_parse(&doc, body, NULL, 0);
+    }
+
+    String_View input;
+    if (err == JSON_OK && json_query_string(&doc, "input", &input)) {
+      z_log(LOG_DEBUG, "Create input: " SV_Fmt, SV_Arg(input));
+    }
+  }
+
+  if (err != JSON_OK) {
+    z_log(LOG_DEBUG, "Client %d: bad JSON body, %s at byte %zu", conn->fd,
+          json_error_name(err), doc.error_at);
+    respond_json_error(conn, &doc, err);
+    return 400;
+  }
+  return 0;
+}
+
+static void create_handler_run(Job *job) {
+  HTTP_Conn *conn = ((Handler_Job *)job)->conn;
+
+  if (conn->body.failed) {
+    respond_500(conn, conn->request.version);
+    return;
+  }
+
+  if (create_body_check(conn) != 0) {
+    return;
+  }
+
+  if (conn->body.fd >= 0) {
+    // Spilled, send it from the temp file (the connection keeps the fd)
+    respond_201(conn, conn->request.version, (String_View){0});
+    conn->response.file_fd = conn->body.fd;
+    conn->response.file_size = (size_t)conn->body.received;
+    return;
+  }
+
+  if (!da_append_many(&conn->file, conn->request.body.items,
+                      conn->request.body.count)) {
+    respond_500(conn, conn->request.version);
+    return;
+  }
+  respond_201(conn, conn->request.version, sb_to_sv(conn->file));
+}
+
+static void static_handler_run(Job *job) {
+  HTTP_Conn *conn = ((Handler_Job *)job)->conn;
+  HTTP_Response *r = &conn->response;
+
+  if (read_entire_fd(r->file_fd, r->file_offset, r->file_size, &conn->file)) {
+    z_log(LOG_DEBUG, "Read file %s (%zu bytes)", conn->full_path.items,
+          conn->file.count);
+    r->body = sb_to_sv(conn->file);
+    response_close_file(r);
+  } else {
+    respond_500(conn, conn->request.version);
+  }
+}
+
+static void use_compressed(HTTP_Conn *conn, Compressed *c) {
+  HTTP_Response *r = &conn->response;
+  response_close_file(r);
+  r->cached = c;
+  r->body = sb_to_sv(c->data);
+  r->content_encoding = content_encoding_name(c->encoding);
+}
+
+// Reads the file, gzips it and publishes the result in the compressed cache.
+// Falls back to the identity body if compression fails.
+static void compress_handler_run(Job *job) {
+  HTTP_Conn *conn = ((Handler_Job *)job)->conn;
+  HTTP_Response *r = &conn->response;
+
+  if (!read_entire_fd(r->file_fd, 0, r->file_size, &conn->file)) {
+    respond_500(conn, conn->request.version);
+    return;
+  }
+
+  String_Builder gz = {0};
+  Compressed *c = NULL;
+  if (gzip_compress(conn->file.items, conn->file.count, &gz)) {
+    c = compress_cache_put(&conn->file_id, ENCODING_GZIP, gz);
+  } else {
+    sb_free(gz);
+  }
+
+  if (c) {
+    z_log(LOG_DEBUG, "Compressed %s: %zu -> %zu bytes", conn->full_path.items,
+          conn->file.count, c->data.count);
+    use_compressed(conn, c);
+  } else {
+    z_log(LOG_WARN, "Could not gzip %s, sending it as is",
+          conn->full_path.items);
+    r->content_encoding = NULL;
+    r->etag[0] = '\0'; // it was computed for the gzip variant
+    r->body = sb_to_sv(conn->file);
+    response_close_file(r);
+  }
+}
+
+// Builds a multipart/byteranges body out of `conn->ranges`. The parts can
+// add up to most of a big file, so they go into a rope and out with one
+// sendmsg instead of growing a single buffer.
+static void multirange_handler_run(Job *job) {
+  HTTP_Conn *conn = ((Handler_Job *)job)->conn;
+  HTTP_Response *r = &conn->response;
+
+  int fd = r->file_fd;
+  Rope *rope = &conn->rope;
+  for (size_t i = 0; i < conn->range_count; i++) {
+    Byte_Range range = conn->ranges[i];
+    int head = rope_appendf(rope,
+                            "\r\n--" MULTIPART_BOUNDARY "\r\n"
+                            "Content-Type: %s\r\n"
+                            "Content-Range: bytes %llu-%llu/%zu\r\n\r\n",
+                            r->content_type, (unsigned long long)range.start,
+                            (unsigned long long)range.end, r->file_size);
+    if (head < 0 ||
+        !read_fd_into_rope(fd, range.start, range.end - range.start + 1,
+                           rope)) {
+      respond_500(conn, conn->request.version);
+      return;
+    }
+  }
+  if (!rope_splice(rope,
+                   sv_from_cstr("\r\n--" MULTIPART_BOUNDARY "--\r\n"))) {
+    respond_500(conn, conn->request.version);
+    return;
+  }
+
+  r->content_type = "multipart/byteranges; boundary=" MULTIPART_BOUNDARY;
+  r->rope = rope;
+  response_close_file(r);
+}
+
+#ifdef HANDLER_COST_US
+static void costly_handler_run(Job *job) {
+  struct timespec ts = {.tv_sec = HANDLER_COST_US / 1000000,
+                        .tv_nsec = (HANDLER_COST_US % 1000000) * 1000};
+  nanosleep(&ts, NULL);
+  ((Handler_Job *)job)->handler(job);
+}
+#endif
+
+// Hands the handler to the pool. Returns false when it already ran inline
+// because offloading is disabled (or the pool failed to start).
+static bool handler_submit(HTTP_Conn *conn, Job_Fn run) {
+  conn->handler = (Handler_Job){
+      .job = {.run = run, .done = &completions},
+      .conn = conn,
+  };
+#ifdef HANDLER_COST_US
+  conn->handler.handler = run;
+  conn->handler.job.run = run = costly_handler_run;
+#endif
+
+  if (!OFFLOAD_HANDLERS || !pool) {
+    run(&conn->handler.job);
+    return false;
+  }
+
+  tp_submit(pool, &conn->handler.job);
+  return true;
+}
+
+static void handler_wait(HTTP_Conn *conn) {
+  Job *done = cq_wait(&completions);
+  assert(done == &conn->handler.job && done->next == NULL);
+  (void)done;
+  (void)conn;
+}
+
+// ------------------ Hot restart ------------------
+
+// SIGUSR2 execs the binary again (same path and arguments) and hands it the
+// listener. Once the new process accepts, this one stops accepting and
+// answers the next request on each connection with `Connection: close`.
+// Idle keep-alive connections are not closed under the client's feet, where
+// a request could be in flight; whatever is still open at the deadline is.
+
+static volatile sig_atomic_t restart_requested = 0;
+static int restart_pipe[2] = {-1, -1}; // wakes poll and io_uring
+static char **restart_argv = NULL;
+static int server_listener = -1;
+static bool draining = false;
+static time_t drain_deadline = 0;
+
+static void restart_on_signal(int sig) {
+  (void)sig;
+  int saved = errno;
+  restart_requested = 1;
+  ssize_t n = write(restart_pipe[1], "", 1);
+  (void)n;
+  errno = saved;
+}
+
+// Must run before any thread starts: they inherit the blocked SIGUSR2, so it
+// always interrupts the connection loop and not a worker.
+static bool restart_init(char **argv) {
+  if (pipe2(restart_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+    return false;
+  }
+
+  // The new binary is looked up by path when the signal comes, so a deploy
+  // only has to replace the file
+  restart_argv = argv;
+  char *path = realpath(argv[0], NULL);
+  if (path) {
+    restart_argv[0] = path;
+  }
+
+  struct sigaction sa = {.sa_handler = restart_on_signal};
+  sigemptyset(&sa.sa_mask);
+  // No SA_RESTART: blocking calls return EINTR and notice the request
+  if (sigaction(SIGUSR2, &sa, NULL) < 0) {
+    return false;
+  }
+
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR2);
+  return pthread_sigmask(SIG_BLOCK, &set, NULL) == 0;
+}
+
+// Takes SIGUSR2 back on the calling thread, once the others are running.
+static void restart_unblock(void) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR2);
+  pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+}
+
+// Handles a pending SIGUSR2. Returns true once this process is draining.
+static bool restart_poll(void) {
+  if (!restart_requested) {
+    return draining;
+  }
+  restart_requested = 0;
+
+  char buf[64];
+  while (read(restart_pipe[0], buf, sizeof(buf)) > 0) {
+  }
+
+  if (draining) {
+    return true;
+  }
+
+  z_log(LOG_INFO, "Restarting: starting %s", restart_argv[0]);
+  if (!restart_spawn(restart_argv, server_listener,
+                     (int)CONFIG->restart_timeout)) {
+    z_log(LOG_ERROR, "Restart failed, still serving");
+    return false;
+  }
 
-#define MAX_HEADER_SIZE (KB(8))    // each header
-#define MAX_HEADERS_TOTAL (KB(32)) // total
+  z_log(LOG_INFO, "New process is accepting, draining for up to %us",
+        CONFIG->drain_timeout);
+  draining = true;
+  drain_deadline = time(NULL) + CONFIG->drain_timeout;
+  return true;
+}
 
-#define MAX_CONTENT_LEN (MB(10)) // total
+static int drain_seconds_left(void) {
+  time_t left = drain_deadline - time(NULL);
+  return left > 0 ? (int)left : 0;
+}
 
 bool http_parse_request_line(HTTP_Request *request, String_View request_line) {
   request->method = sv_chop_by_delim(&request_line, ' ');
@@ -305,6 +969,42 @@ bool http_parse_request_line(HTTP_Request *request, String_View request_line) {
   return true;
 }
 
+// Headers whose values keep coming back, from one request to the next and
+// across clients, so the values are interned along with the names. Any other
+// value is copied per request.
+static const char *const REPEATED_VALUE_HEADERS[] = {
+    "accept",
+    "accept-encoding",
+    "accept-language",
+    "cache-control",
+    "connection",
+    "content-type",
+    "upgrade-insecure-requests",
+    "user-agent",
+};
+#define REPEATED_VALUE_COUNT                                                   \
+  (sizeof(REPEATED_VALUE_HEADERS) / sizeof(REPEATED_VALUE_HEADERS[0]))
+
+// Their interned names, compared by pointer
+static String_View repeated_value_keys[REPEATED_VALUE_COUNT];
+
+static void http_headers_init(void) {
+  for (size_t i = 0; i < REPEATED_VALUE_COUNT; i++) {
+    repeated_value_keys[i] = intern(sv_from_cstr(REPEATED_VALUE_HEADERS[i]));
+  }
+}
+
+static bool header_value_repeats(String_View key) {
+  for (size_t i = 0; i < REPEATED_VALUE_COUNT; i++) {
+    if (key.data == repeated_value_keys[i].data) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Names and the values worth it are interned, lowercase. The rest, or
+// anything the interner refuses, is lowercased into `buffer`.
 bool http_parse_headers(HTTP_Request *request, String_Builder *buffer,
                         String_View *header_lines) {
   size_t total_header_size = 0;
@@ -319,16 +1019,16 @@ bool http_parse_headers(HTTP_Request *request, String_Builder *buffer,
       line.count--;
     }
 
-    if (line.count > MAX_HEADER_SIZE) {
-      z_log(LOG_ERROR, "Header line exceeds maximum size: %zu > %d", line.count,
-            MAX_HEADER_SIZE);
+    if (line.count > CONFIG->max_header_size) {
+      z_log(LOG_ERROR, "Header line exceeds maximum size: %zu > %u", line.count,
+            CONFIG->max_header_size);
       return false;
     }
 
     total_header_size += line.count;
-    if (total_header_size > MAX_HEADERS_TOTAL) {
-      z_log(LOG_ERROR, "Total headers exceed maximum allowed size: %zu > %d",
-            total_header_size, MAX_HEADERS_TOTAL);
+    if (total_header_size > CONFIG->max_headers_total) {
+      z_log(LOG_ERROR, "Total headers exceed maximum allowed size: %zu > %u",
+            total_header_size, CONFIG->max_headers_total);
       return false;
     }
 
@@ -340,10 +1040,24 @@ bool http_parse_headers(HTTP_Request *request, String_Builder *buffer,
       return false;
     }
 
-    HTTP_Header h = {.key = sv_to_lower_sb(buffer, key),
-                     .value = sv_to_lower_sb(buffer, line)};
-    da_append(&request->headers, h);
-    *upsert(&request->headers_map, h.key) = h.value;
+    HTTP_Header h = {.key = intern_lower(key)};
+    if (!h.key.data) {
+      h.key = sv_to_lower_sb(buffer, key);
+    } else if (header_value_repeats(h.key)) {
+      h.value = intern_lower_value(line);
+    }
+    if (!h.value.data) {
+      h.value = sv_to_lower_sb(buffer, line);
+    }
+    String_View *slot =
+        h.key.data && h.value.data
+            ? upsert(&request->headers_map, h.key, &request->arena)
+            : NULL;
+    if (!slot || !da_append(&request->headers, h)) {
+      z_log(LOG_ERROR, "Out of memory parsing headers");
+      return false;
+    }
+    *slot = h.value;
   }
 
   return true;
@@ -353,14 +1067,14 @@ bool http_request_should_close(HTTP_Request *request) {
   // HTTP/1.0: close by default, keep-alive opt-in
   if (sv_eq(request->version, sv_from_cstr("HTTP/1.0"))) {
     String_View *connection =
-        upsert(&request->headers_map, sv_from_cstr("connection"));
+        request_header(request, "connection");
     return !(connection && sv_eq(*connection, sv_from_cstr("keep-alive")));
   }
 
   // HTTP/1.1: keep-alive by default, close opt-in
   if (sv_eq(request->version, sv_from_cstr("HTTP/1.1"))) {
     String_View *connection =
-        upsert(&request->headers_map, sv_from_cstr("connection"));
+        request_header(request, "connection");
     return (connection && sv_eq(*connection, sv_from_cstr("close")));
   }
 
@@ -368,18 +1082,6 @@ bool http_request_should_close(HTTP_Request *request) {
   return true;
 }
 
-void hashmap_reset(Hashmap *m) {
-  if (!m)
-    return;
-
-  m->key.count = 0;
-  m->value.count = 0;
-
-  for (int i = 0; i < 4; i++) {
-    hashmap_reset(m->child[i]);
-  }
-}
-
 bool is_token_char(unsigned char c) {
   if (c >= '0' && c <= '9')
     return true;
@@ -427,307 +1129,1674 @@ bool valid_method(String_View method) {
   return true;
 }
 
-int main(void) {
-  int listener = setup_server_socket(NULL, PORT, 10);
 
-  if (listener < 0) {
-    z_log(LOG_ERROR, "Failed to set up listening socket on port %s", PORT);
-    return -1;
+void http_conn_init(HTTP_Conn *conn, int fd) {
+  *conn = (HTTP_Conn){
+      .fd = fd,
+      .body = {.fd = -1},
+      .splice_pipe = {-1, -1},
+      .rcvlowat = 1,
+      .admission = ADMISSION_NONE,
+      .response = {.file_fd = -1},
+  };
+  da_init_small(&conn->request.headers);
+  arena_init(&conn->request.arena, REQUEST_ARENA_BLOCK);
+}
+
+// Gets the connection ready for the next request on keep-alive. Pipelined
+// bytes past the current request stay at the front of `conn->in`.
+void http_conn_reset(HTTP_Conn *conn) {
+  size_t rest = conn->in.count - conn->consumed;
+  if (rest > 0) {
+    memmove(conn->in.items, conn->in.items + conn->consumed, rest);
+  }
+  conn->in.count = rest;
+  conn->head_len = 0;
+  conn->consumed = 0;
+
+  response_close_file(&conn->response);
+  compress_cache_release(conn->response.cached);
+  conn->response = (HTTP_Response){.file_fd = -1};
+
+  // Field by field: the headers point into themselves and the arena at
+  // itself, neither may be copied
+  HTTP_Request *request = &conn->request;
+  request->method = request->request_uri = request->version = (String_View){0};
+  request->content_len = 0;
+  request->host = (String_View){0};
+  da_clear(&request->headers);
+  request->headers_map = NULL;
+  arena_reset(&request->arena);
+  da_clear(&request->body);
+
+  if (conn->body.fd >= 0) {
+    close(conn->body.fd);
+  }
+  conn->body = (Body_Sink){.fd = -1};
+
+  conn->scratch.count = 0;
+  conn->full_path.count = 0;
+  conn->file.count = 0;
+  rope_clear(&conn->rope);
+  conn->out.count = 0;
+  conn->range_count = 0;
+  conn->expect_continue = false;
+}
+
+void http_conn_free(HTTP_Conn *conn) {
+  admission_release(conn->admission);
+  response_close_file(&conn->response);
+  compress_cache_release(conn->response.cached);
+  if (conn->body.fd >= 0) {
+    close(conn->body.fd);
+  }
+  for (int i = 0; i < 2; i++) {
+    if (conn->splice_pipe[i] >= 0) {
+      close(conn->splice_pipe[i]);
+    }
   }
+  da_free(&conn->request.headers);
+  arena_free(&conn->request.arena);
+  sb_free(conn->request.body);
+
+  sb_free(conn->in);
+  sb_free(conn->scratch);
+  sb_free(conn->full_path);
+  sb_free(conn->file);
+  rope_free(&conn->rope);
+  sb_free(conn->out);
+}
 
-  z_log(LOG_INFO, "Server listening on port %s", PORT);
+// Parses the request head sitting at the start of `conn->in`. Returns false
+// when the connection has to be closed, after setting an error response if
+// the client deserves one.
+bool http_conn_parse(HTTP_Conn *conn) {
+  HTTP_Request *request = &conn->request;
 
-  for (;;) {
-    // TODO: Get ADDR from request
-    // struct sockaddr_storage their_addr;
-    // socklen_t addr_size = sizeof(their_addr);
+  printf("--------------------------------------\n");
+  z_log(LOG_DEBUG, "Received %zu bytes from client %d (capacity %zu)",
+        conn->in.count, conn->fd, conn->in.capacity);
 
-    int client_fd = accept(listener, NULL, NULL);
-    // accept(listener, (struct sockaddr *)&their_addr, &addr_size);
-    if (client_fd < 0) {
-      perror("SERVER ERROR: socket accept error");
-      return 1;
+  String_View request_data = sv_from_parts(conn->in.items, conn->head_len);
+
+  String_View request_line = sv_chop_by_delim(&request_data, '\n');
+
+  if (!http_parse_request_line(request, request_line)) {
+    z_log(LOG_ERROR, "Malformed HTTP request line: %.*s", SV_Arg(request_line));
+    return false;
+  }
+
+  if (!valid_method(request->method)) {
+    z_log(LOG_ERROR, "missing or invalid method");
+    respond_400(conn, sv_from_cstr("HTTP/1.0"));
+    return false;
+  }
+
+  // TODO: Validate URI maybe create a type URL
+  if (request->request_uri.count == 0) {
+    z_log(LOG_ERROR, "Missing request URI in request");
+    respond_400(conn, sv_from_cstr("HTTP/1.0"));
+    return false;
+  }
+
+  // TODO: Validate Version or change format to
+  // Proto, ProtoMayor, ProtoMinor
+  if (request->version.count == 0) {
+    z_log(LOG_ERROR, "Missing HTTP version in request");
+    respond_400(conn, sv_from_cstr("HTTP/1.0"));
+    return false;
+  }
+
+  z_log(LOG_INFO, "Parsed request line: %.*s %.*s %.*s",
+        SV_Arg(request->method), SV_Arg(request->request_uri),
+        SV_Arg(request->version));
+
+  // Lowercased copies never outgrow the head, so reserve once and keep the
+  // header views stable while parsing
+  conn->scratch.count = 0;
+  if (!da_reserve(&conn->scratch, conn->head_len)) {
+    z_log(LOG_ERROR, "Out of memory parsing headers");
+    return false;
+  }
+
+  if (!http_parse_headers(request, &conn->scratch, &request_data)) {
+    return false;
+  }
+
+  printf("--------------------------------------\n");
+
+  z_log(LOG_DEBUG, "Headers Count: %zu", request->headers.count);
+  for (size_t i = 0; i < request->headers.count; i++) {
+    z_log(LOG_DEBUG, "  Header [%zu]: %.*s: %.*s", i,
+          SV_Arg(request->headers.items[i].key),
+          SV_Arg(request->headers.items[i].value));
+  }
+
+  // TODO: RFC 7230, section 5.3: Must treat
+  //	GET /index.html HTTP/1.1
+  //	Host: www.google.com
+  // and
+  //	GET http://www.google.com/index.html HTTP/1.1
+  //	Host: doesntmatter
+  // the same. In the second case, any Host line is ignored.
+  // So get Host from URI if any
+  // Golang for reference http/request.go:1149:0
+  request->host = *request_header(request, "host");
+
+  // RFC 7230 §5.4: In HTTP/1.1 all requests MUST include a Host header
+  // field. If the Host header is missing or empty, the server MUST respond
+  // with 400 Bad Request. Golang for reference http/transfer.go:748:0
+  if (sv_eq(request->version, sv_from_cstr("HTTP/1.1"))) {
+    if (!request->host.data || request->host.count == 0) {
+      z_log(LOG_ERROR, "HTTP/1.1 request missing Host header");
+      respond_400(conn, request->version);
+      return false;
+    }
+  }
+
+  conn->should_close = draining || http_request_should_close(request);
+
+  // TODO: Maybe check the method and Transfer-Encoding: chunked
+  // Check if Content-Length doesn't exceed the buffer
+  // Content-Length Size discussion
+  // https://stackoverflow.com/questions/2880722/can-http-post-be-limitless#55998160
+  if (sv_eq(request->method, sv_from_cstr("POST"))) {
+    // handle `Transfer-Encoding: chunked`
+    String_View *cl_sv =
+        request_header(request, "content-length");
+    // A valid Content-Length is required on all HTTP/1.0 POST requests.
+    if (!cl_sv->data) {
+      z_log(LOG_ERROR, "Missing Content-Length or Body");
+      respond_400(conn, request->version);
+      return false;
     }
 
-    String_Builder sb_request_buffer = {0};
-    da_reserve(&sb_request_buffer, MB(4));
+    // RFC 9110 §8.6: 1*DIGIT, no sign
+    uint64_t content_len;
+    if (!sv_to_u64(*cl_sv, &content_len) ||
+        content_len > CONFIG->max_content_len) {
+      z_log(LOG_ERROR, "Invalid number or too big");
+      respond_400(conn, request->version);
+      return false;
+    }
+    request->content_len = (int64_t)content_len;
+
+    z_log(LOG_DEBUG, "Content-Length = %lld", request->content_len);
+    z_log(LOG_DEBUG, "Actual body count = %zu",
+          conn->in.count - conn->head_len);
+
+    // Check for "Expect: 100-continue"
+    String_View *expect =
+        request_header(request, "expect");
+    conn->expect_continue = sv_eq(*expect, sv_from_cstr("100-continue"));
+
+    // TODO: Handle Transfer-Encoding: chunked
+    String_View *te =
+        request_header(request, "transfer-encoding");
+    if (te && sv_eq(*te, sv_from_cstr("chunked"))) {
+      TODO("Implement parsing for chunked transfer encoding");
+    }
+  }
 
-    HTTP_Request request = {0};
+  return true;
+}
 
-    String_Builder full_path = {0};
-    String_Builder file = {0};
+static bool is_compressible(const char *content_type) {
+  String_View type = sv_from_cstr(content_type);
+  return sv_starts_with(type, sv_from_cstr("text/")) ||
+         sv_end_with(type, "+json") || sv_end_with(type, "+xml") ||
+         sv_eq(type, sv_from_cstr("application/json")) ||
+         sv_eq(type, sv_from_cstr("application/javascript")) ||
+         sv_eq(type, sv_from_cstr("application/xml")) ||
+         sv_eq(type, sv_from_cstr("application/wasm"));
+}
 
-    for (bool should_close = false; !should_close;) {
+static File_Id file_id_from_stat(const struct stat *st) {
+  return (File_Id){
+      .dev = (uint64_t)st->st_dev,
+      .ino = (uint64_t)st->st_ino,
+      .size = (uint64_t)st->st_size,
+      .mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec,
+  };
+}
 
-      for (;;) {
-        ssize_t n =
-            recv(client_fd, sb_request_buffer.items + sb_request_buffer.count,
-                 sb_request_buffer.capacity - sb_request_buffer.count, 0);
-        if (n == 0) {
-          z_log(LOG_WARN, "Client %d closed connection while reading body",
-                client_fd);
-          should_close = true;
-          goto defer;
-        } else if (n < 0) {
-          z_log(LOG_ERROR, "recv() failed for client %d: %s", client_fd,
-                strerror(errno));
-          should_close = true;
-          goto defer;
-        }
-        sb_request_buffer.count += (size_t)n;
+// `full_path` without its leading '/' and the NUL, as the docroot wants it.
+static String_View static_rel_path(const HTTP_Conn *conn) {
+  return sv_from_parts(conn->full_path.items + 1, conn->full_path.count - 2);
+}
+
+// Looks up `full_path` + ".gz"/".br" next to the requested file. Misses are
+// cached by the docroot too, so this costs no syscall when there is none.
+static Docroot_File *open_sibling(HTTP_Conn *conn, Content_Encoding e) {
+  String_Builder *path = &conn->full_path;
+  size_t count = path->count; // includes the NUL
+
+  path->count--;
+  Docroot_File *f = NULL;
+  if (sb_append_cstr(path, content_encoding_ext(e)) && sb_append_null(path)) {
+    f = docroot_lookup(static_rel_path(conn));
+  }
+
+  path->count = count;
+  path->items[count - 1] = '\0';
+  return f;
+}
 
-        String_View sv_full = sb_to_sv(sb_request_buffer);
-        if (find_double_crlf(&sv_full) >= 0)
-          break; // completed headers
+// Swaps the identity body of a static response for a precompressed sibling
+// the client accepts. Returns the coding of the representation to send, and
+// sets `on_the_fly` when that is a gzip still to be made (or found in the
+// cache by file identity).
+static Content_Encoding static_negotiate_encoding(HTTP_Conn *conn,
+                                                  bool *on_the_fly) {
+  HTTP_Request *request = &conn->request;
+  HTTP_Response *r = &conn->response;
+  r->vary_encoding = true;
+
+  Accept_Encoding ae = accept_encoding_parse(
+      *request_header(request, "accept-encoding"));
+
+  // Client's q-values first, br over gzip on ties
+  Content_Encoding order[] = {ENCODING_BR, ENCODING_GZIP};
+  if (ae.q[ENCODING_GZIP] > ae.q[ENCODING_BR]) {
+    order[0] = ENCODING_GZIP;
+    order[1] = ENCODING_BR;
+  }
+
+  for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+    if (!accept_encoding_allows(&ae, order[i])) {
+      continue;
+    }
+
+    Docroot_File *sibling = open_sibling(conn, order[i]);
+    if (sibling) {
+      docroot_release(r->static_file);
+      r->static_file = sibling;
+      r->file_fd = sibling->fd;
+      r->file_size = (size_t)sibling->st.st_size;
+      r->last_modified = sibling->st.st_mtime;
+      r->content_encoding = content_encoding_name(order[i]);
+      conn->file_id = file_id_from_stat(&sibling->st);
+      return order[i];
+    }
+  }
+
+  // Resumed downloads want byte ranges of the file, which an on-the-fly
+  // gzip does not have
+  String_View *range = request_header(request, "range");
+  if (range->count > 0) {
+    return ENCODING_IDENTITY;
+  }
+
+  *on_the_fly = accept_encoding_allows(&ae, ENCODING_GZIP) &&
+                r->file_size >= COMPRESS_MIN_SIZE &&
+                r->file_size <= COMPRESS_MAX_SIZE;
+  return *on_the_fly ? ENCODING_GZIP : ENCODING_IDENTITY;
+}
+
+// Strong validator from inode, size and mtime of the file served, plus the
+// coding so every variant gets its own tag. Lowercase only: header values
+// come back lowercased from http_parse_headers.
+static void static_etag(HTTP_Conn *conn, Content_Encoding e) {
+  const File_Id *id = &conn->file_id;
+  const char *suffix = e == ENCODING_IDENTITY ? "" : content_encoding_name(e);
+  snprintf(conn->response.etag, sizeof(conn->response.etag),
+           "\"%llx-%llx-%llx%s%s\"", (unsigned long long)id->ino,
+           (unsigned long long)id->size, (unsigned long long)id->mtime_ns,
+           *suffix ? "-" : "", suffix);
+}
+
+// Parses an IMF-fixdate ("sun, 06 nov 1994 08:49:37 gmt", already
+// lowercased). The obsolete RFC 850 and asctime forms are not accepted.
+static bool http_date_parse(String_View sv, time_t *out) {
+  static const char *months = "janfebmaraprmayjunjulaugsepoctnovdec";
+
+  sv = sv_trim(sv);
+  if (sv.count != 29 || sv.data[3] != ',' ||
+      !sv_end_with(sv, " gmt")) {
+    return false;
+  }
+
+  const char *p = sv.data + 5; // "06 nov 1994 08:49:37"
+  int fields[5];               // day, year, hour, min, sec
+  const size_t offsets[5] = {0, 7, 12, 15, 18};
+  const size_t widths[5] = {2, 4, 2, 2, 2};
+  for (size_t i = 0; i < 5; i++) {
+    int32_t value;
+    if (!sv_to_i32(sv_from_parts(p + offsets[i], widths[i]), &value) ||
+        value < 0) {
+      return false;
+    }
+    fields[i] = value;
+  }
+
+  const char *m = NULL;
+  for (int i = 0; i < 12 && !m; i++) {
+    if (memcmp(months + i * 3, p + 3, 3) == 0) {
+      m = months + i * 3;
+    }
+  }
+  if (!m || fields[0] < 1 || fields[0] > 31 || fields[2] > 23 ||
+      fields[3] > 59 || fields[4] > 60) {
+    return false;
+  }
+  int month = (int)(m - months) / 3 + 1;
+
+  // Days since the epoch for a proleptic Gregorian date (Howard Hinnant)
+  int64_t y = fields[1] - (month <= 2);
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  int64_t yoe = y - era * 400;
+  int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + fields[0] - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int64_t days = era * 146097 + doe - 719468;
+
+  *out = (time_t)(days * 86400 + fields[2] * 3600 + fields[3] * 60 +
+                  fields[4]);
+  return true;
+}
+
+// RFC 9110 §8.8.3.2 weak comparison: only the opaque tags have to match.
+static bool etag_list_matches(String_View list, const char *etag) {
+  String_View tag = sv_from_cstr(etag);
+  while (list.count > 0) {
+    String_View item = sv_trim(sv_chop_by_delim(&list, ','));
+    if (sv_eq(item, sv_from_cstr("*"))) {
+      return true;
+    }
+    if (sv_starts_with(item, sv_from_cstr("w/"))) {
+      sv_chop_left(&item, 2);
+    }
+    if (sv_eq(item, tag)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// RFC 9110 §13.2.2: If-None-Match wins over If-Modified-Since.
+static bool static_not_modified(HTTP_Conn *conn) {
+  HTTP_Request *request = &conn->request;
+  HTTP_Response *r = &conn->response;
+
+  String_View *inm =
+      request_header(request, "if-none-match");
+  if (inm->count > 0) {
+    return r->etag[0] && etag_list_matches(*inm, r->etag);
+  }
+
+  String_View *ims =
+      request_header(request, "if-modified-since");
+  time_t since;
+  return ims->count > 0 && r->last_modified &&
+         http_date_parse(*ims, &since) && r->last_modified <= since;
+}
+
+// Parses `bytes=a-b, c-, -n` against a representation of `size` bytes.
+// Returns -1 when the header is malformed or not worth honoring (then the
+// whole body is sent), otherwise the number of satisfiable ranges.
+static int parse_ranges(String_View header, uint64_t size, Byte_Range *ranges,
+                        size_t max) {
+  if (!sv_starts_with(header, sv_from_cstr("bytes="))) {
+    return -1;
+  }
+  sv_chop_left(&header, 6);
+
+  size_t count = 0;
+  size_t total = 0;
+  while (header.count > 0) {
+    String_View spec = sv_trim(sv_chop_by_delim(&header, ','));
+    if (spec.count == 0) {
+      continue;
+    }
+
+    String_View first = sv_trim(sv_chop_by_delim(&spec, '-'));
+    String_View last = sv_trim(spec);
+    int64_t a = -1, b = -1;
+    if ((first.count > 0 &&
+         (first.data[0] < '0' || first.data[0] > '9' || !sv_to_i64(first, &a))) ||
+        (last.count > 0 &&
+         (last.data[0] < '0' || last.data[0] > '9' || !sv_to_i64(last, &b)))) {
+      return -1;
+    }
+
+    Byte_Range range;
+    if (first.count == 0) {
+      // Suffix range: the last `b` bytes
+      if (b < 0) {
+        return -1;
+      }
+      if (b == 0 || size == 0) {
+        continue; // unsatisfiable
+      }
+      range.start = (uint64_t)b >= size ? 0 : size - (uint64_t)b;
+      range.end = size - 1;
+    } else {
+      if (b >= 0 && b < a) {
+        return -1;
       }
+      if ((uint64_t)a >= size) {
+        continue; // unsatisfiable
+      }
+      range.start = (uint64_t)a;
+      range.end = b < 0 || (uint64_t)b >= size ? size - 1 : (uint64_t)b;
+    }
 
-      printf("--------------------------------------\n");
-      z_log(LOG_DEBUG, "Received %zu bytes from client %d (capacity %zu)",
-            sb_request_buffer.count, client_fd, sb_request_buffer.capacity);
+    if (count == max) {
+      return -1;
+    }
+    ranges[count++] = range;
+    total += range.end - range.start + 1;
+  }
 
-      String_View request_data = sb_to_sv(sb_request_buffer);
+  // Overlapping ranges adding up to more than the file smell like abuse
+  if (total > size) {
+    return -1;
+  }
+  return (int)count;
+}
+
+// Turns a 200 static response into a 206 (or 416) when the client asked for
+// byte ranges of the exact representation it has.
+static Route_Result static_apply_ranges(HTTP_Conn *conn) {
+  HTTP_Request *request = &conn->request;
+  HTTP_Response *r = &conn->response;
+
+  String_View *range = request_header(request, "range");
+  if (range->count == 0 || !sv_eq(request->method, sv_from_cstr("GET"))) {
+    return ROUTE_DONE;
+  }
+
+  // If-Range: only send the part when the validator still matches,
+  // otherwise the whole new representation
+  String_View *if_range =
+      request_header(request, "if-range");
+  if (if_range->count > 0) {
+    time_t date;
+    bool is_tag = if_range->data[0] == '"';
+    if (is_tag ? !sv_eq(*if_range, sv_from_cstr(r->etag))
+               : !(http_date_parse(*if_range, &date) &&
+                   r->last_modified == date)) {
+      return ROUTE_DONE;
+    }
+  }
+
+  int count =
+      parse_ranges(*range, r->file_size, conn->ranges, MAX_RANGES);
+  if (count < 0) {
+    return ROUTE_DONE;
+  }
+
+  if (count == 0) {
+    size_t size = r->file_size;
+    respond(conn, request->version, 416, "Range Not Satisfiable",
+            "text/plain", sv_from_cstr("416 Range Not Satisfiable"));
+    snprintf(r->content_range, sizeof(r->content_range), "bytes */%zu", size);
+    return ROUTE_DONE;
+  }
+
+  r->status = 206;
+  r->reason = "Partial Content";
+
+  if (count == 1) {
+    Byte_Range only = conn->ranges[0];
+    snprintf(r->content_range, sizeof(r->content_range),
+             "bytes %llu-%llu/%zu", (unsigned long long)only.start,
+             (unsigned long long)only.end, r->file_size);
+    r->file_offset = only.start;
+    r->file_size = only.end - only.start + 1;
+    return ROUTE_DONE;
+  }
+
+  conn->range_count = (size_t)count;
+  return handler_submit(conn, multirange_handler_run) ? ROUTE_PENDING
+                                                      : ROUTE_DONE;
+}
+
+// Picks where the body of a parsed request goes, before any of it is read.
+void http_conn_route_body(HTTP_Conn *conn) {
+  HTTP_Request *request = &conn->request;
+
+  if (!sv_eq(request->method, sv_from_cstr("POST"))) {
+    body_sink_open(conn, BODY_BUFFER, NULL);
+    return;
+  }
+
+  if (sv_eq(request->request_uri, sv_from_cstr("/create"))) {
+    // Echoed back whole, so big uploads wait on disk rather than in memory
+    body_sink_open(conn, BODY_SPILL, NULL);
+    return;
+  }
+
+  // Nobody reads it (404), drop it as it arrives
+  body_sink_open(conn, BODY_STREAM, NULL);
+}
+
+// Picks the handler for a parsed request with its body fully read.
+Route_Result http_conn_route(HTTP_Conn *conn) {
+  HTTP_Request *request = &conn->request;
+
+  if (sv_eq(request->method, sv_from_cstr("POST"))) {
+    if (sv_eq(request->request_uri, sv_from_cstr("/create"))) {
+      return handler_submit(conn, create_handler_run) ? ROUTE_PENDING
+                                                      : ROUTE_DONE;
+    }
+
+    respond_404(conn, request->version);
+    return ROUTE_DONE;
+  }
+
+  if (sv_eq(request->method, sv_from_cstr("GET")) ||
+      sv_eq(request->method, sv_from_cstr("HEAD"))) {
+    // origin-form only, so the clean is rooted and `..` stops at the docroot
+    String_View uri = request->request_uri;
+    size_t path_len = 0;
+    if (!da_reserve(&conn->full_path, uri.count + 2)) { // + "." or the NUL
+      respond_500(conn, request->version);
+      return ROUTE_DONE;
+    }
+    if (uri.count == 0 || uri.data[0] != '/' ||
+        !uri_path_clean(uri, conn->full_path.items, conn->full_path.capacity,
+                        &path_len)) {
+      respond_400(conn, request->version);
+      return ROUTE_DONE;
+    }
+    conn->full_path.count = path_len;
+    sb_append_null(&conn->full_path);
+
+    if (path_len == 1) {
+      respond(conn, request->version, 200, "OK", "text/plain",
+              sv_from_cstr("Hello, world! From Home\n"));
+      conn->response.omit_body = sv_eq(request->method, sv_from_cstr("HEAD"));
+      return ROUTE_DONE;
+    }
+
+    Docroot_File *f = docroot_lookup(static_rel_path(conn));
+    if (!f) {
+      z_log(LOG_ERROR, "Could not open file %s: %s", conn->full_path.items,
+            strerror(errno));
+      respond_404(conn, request->version);
+      return ROUTE_DONE;
+    }
+
+    respond(conn, request->version, 200, "OK", f->content_type,
+            (String_View){0});
+    HTTP_Response *r = &conn->response;
+    r->static_file = f;
+    r->file_fd = f->fd;
+    r->file_size = (size_t)f->st.st_size;
+    r->last_modified = f->st.st_mtime;
+    r->accept_ranges = true;
+    r->omit_body = sv_eq(request->method, sv_from_cstr("HEAD"));
+    conn->file_id = file_id_from_stat(&f->st);
+
+    bool gzip_on_the_fly = false;
+    Content_Encoding encoding = ENCODING_IDENTITY;
+    if (is_compressible(f->content_type)) {
+      encoding = static_negotiate_encoding(conn, &gzip_on_the_fly);
+    }
+    static_etag(conn, encoding);
+
+    // Validators only, the file body is never touched
+    if (static_not_modified(conn)) {
+      response_close_file(r);
+      r->file_size = 0;
+      r->status = 304;
+      r->reason = "Not Modified";
+      r->accept_ranges = false;
+      return ROUTE_DONE;
+    }
+
+    if (!gzip_on_the_fly) {
+      return static_apply_ranges(conn);
+    }
+
+    r->accept_ranges = false;
+    Compressed *c = compress_cache_get(&conn->file_id, ENCODING_GZIP);
+    if (c) {
+      use_compressed(conn, c);
+      return ROUTE_DONE;
+    }
+    return handler_submit(conn, compress_handler_run) ? ROUTE_PENDING
+                                                      : ROUTE_DONE;
+  }
+
+  // TODO: Check Golang as a reference API
+  respond(conn, request->version, 200, "OK", "text/plain",
+          sv_from_cstr("Hello, world!"));
+  return ROUTE_DONE;
+}
 
-      String_View request_line = sv_chop_by_delim(&request_data, '\n');
+// ------------------ Admission ------------------
+
+// Both run before anything is parsed: a refused client gets the canned 503
+// and the connection goes.
+static bool conn_admit(HTTP_Conn *conn) {
+  Admit_Result r = admission_accept(conn->fd, &conn->admission);
+  if (r == ADMIT_OK) {
+    return true;
+  }
+  z_log(LOG_DEBUG, "Shedding client %d: %s", conn->fd, admit_result_name(r));
+  admission_shed(conn->fd);
+  return false;
+}
+
+static bool conn_admit_request(HTTP_Conn *conn) {
+  Admit_Result r = admission_request(conn->admission);
+  if (r == ADMIT_OK) {
+    return true;
+  }
+  z_log(LOG_DEBUG, "Shedding request from client %d: %s", conn->fd,
+        admit_result_name(r));
+  admission_shed(conn->fd);
+  return false;
+}
+
+// ------------------ Blocking backend ------------------
+
+// One connection at a time, plain accept/recv/send.
+
+// Called before blocking on `conn` and when a call got EINTR. Once draining,
+// every call gets what is left of the deadline as its timeout. Returns false
+// when the deadline passed.
+static bool conn_drain_blocking(HTTP_Conn *conn) {
+  if (!restart_poll()) {
+    return true;
+  }
+
+  int left = drain_seconds_left();
+  struct timeval tv = {.tv_sec = left > 0 ? left : 1};
+  setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  return left > 0;
+}
 
-      if (!http_parse_request_line(&request, request_line)) {
-        z_log(LOG_ERROR, "Malformed HTTP request line: %.*s",
-              SV_Arg(request_line));
-        should_close = true;
-        goto defer;
+static bool send_all(int fd, const char *data, size_t count) {
+  while (count > 0) {
+    ssize_t n = send(fd, data, count, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
       }
+      z_log(LOG_ERROR, "send() failed for client %d: %s", fd, strerror(errno));
+      return false;
+    }
+    data += n;
+    count -= (size_t)n;
+  }
+  return true;
+}
 
-      if (!valid_method(request.method)) {
-        z_log(LOG_ERROR, "missing or invalid method");
-        respond_400(client_fd, sv_from_cstr("HTTP/1.0"));
-        should_close = true;
-        goto defer;
+// iovecs handed to one sendmsg, far below IOV_MAX
+#define SEND_IOV 64
+
+// `head` and then the pieces of `rope`, gathered into as few sendmsg calls as
+// SEND_IOV allows
+static bool send_gather(int fd, String_View head, const Rope *rope) {
+  size_t total = head.count + rope->length;
+  size_t sent = 0;
+  while (sent < total) {
+    struct iovec iov[SEND_IOV];
+    size_t n = 0;
+    if (sent < head.count) {
+      iov[n++] = (struct iovec){.iov_base = (void *)(head.data + sent),
+                                .iov_len = head.count - sent};
+    }
+    size_t skip = sent > head.count ? sent - head.count : 0;
+    n += rope_iov(rope, skip, iov + n, SEND_IOV - n);
+
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = n};
+    ssize_t w = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR) {
+        continue;
       }
+      z_log(LOG_ERROR, "sendmsg() failed for client %d: %s", fd,
+            strerror(errno));
+      return false;
+    }
+    sent += (size_t)w;
+  }
+  return true;
+}
+
+static bool conn_recv_head_blocking(HTTP_Conn *conn) {
+  for (;;) {
+    String_View sv_full = sb_to_sv(conn->in);
+    int end = find_double_crlf(&sv_full);
+    if (end >= 0) {
+      conn->head_len = (size_t)end;
+      conn->consumed = (size_t)end;
+      return true; // completed headers
+    }
+
+    if (conn->in.count >= MAX_REQUEST_HEAD) {
+      z_log(LOG_ERROR, "Request head from client %d exceeds %d bytes",
+            conn->fd, (int)MAX_REQUEST_HEAD);
+      return false;
+    }
+
+    if (!conn_drain_blocking(conn)) {
+      return false;
+    }
+
+    if (!da_reserve(&conn->in, conn->in.count + CONFIG->recv_size)) {
+      z_log(LOG_ERROR, "Out of memory receiving from client %d", conn->fd);
+      return false;
+    }
+    ssize_t n = recv(conn->fd, conn->in.items + conn->in.count,
+                     conn->in.capacity - conn->in.count, 0);
+    if (n == 0) {
+      z_log(LOG_WARN, "Client %d closed connection", conn->fd);
+      return false;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      z_log(LOG_ERROR, "recv() failed for client %d: %s", conn->fd,
+            strerror(errno));
+      return false;
+    }
+    conn->in.count += (size_t)n;
+  }
+}
+
+// Moves up to `want` body bytes from the socket to the spill file through a
+// pipe, without copying them to user space. Returns the bytes moved, 0 when
+// the client closed, -1 on errors.
+static ssize_t conn_splice_body_blocking(HTTP_Conn *conn, size_t want) {
+  if (conn->splice_pipe[0] < 0 && pipe2(conn->splice_pipe, O_CLOEXEC) < 0) {
+    return -1;
+  }
+
+  ssize_t n = splice(conn->fd, NULL, conn->splice_pipe[1], NULL, want,
+                     SPLICE_F_MOVE | SPLICE_F_MORE);
+  if (n <= 0) {
+    return n;
+  }
 
-      // TODO: Validate URI maybe create a type URL
-      if (request.request_uri.count == 0) {
-        z_log(LOG_ERROR, "Missing request URI in request");
-        respond_400(client_fd, sv_from_cstr("HTTP/1.0"));
-        should_close = true;
-        goto defer;
+  for (ssize_t moved = 0; moved < n;) {
+    ssize_t m = splice(conn->splice_pipe[0], NULL, conn->body.fd, NULL,
+                       (size_t)(n - moved), SPLICE_F_MOVE);
+    if (m < 0 && errno == EINTR) {
+      continue;
+    }
+    if (m <= 0) {
+      return -1; // bytes stuck in the pipe, the connection cannot go on
+    }
+    moved += m;
+  }
+  return n;
+}
+
+// Reads the rest of the body from the socket, after the bytes that already
+// arrived along with the head. Each read asks for everything that is left.
+static bool conn_recv_body_blocking(HTTP_Conn *conn) {
+  Body_Sink *sink = &conn->body;
+
+  body_from_head(conn);
+
+  // TODO: Consider using select() or poll() with timeout to avoid
+  // blocking forever
+  while (body_remaining(conn) > 0) {
+    if (!conn_drain_blocking(conn)) {
+      return false;
+    }
+    body_update_rcvlowat(conn);
+
+    size_t cap = 0;
+    char *direct = body_sink_buffer(conn, &cap);
+    ssize_t n;
+
+    if (direct) {
+      // Straight into the reserved body, no bounce buffer
+      n = recv(conn->fd, direct, cap, 0);
+      if (n > 0) {
+        body_sink_commit(conn, (size_t)n);
+        continue;
+      }
+    } else if (sink->fd >= 0 && !sink->failed) {
+      // Spilled: the rest goes socket -> file in the kernel
+      uint64_t remaining = body_remaining(conn);
+      size_t want = remaining > KB(64) ? KB(64) : (size_t)remaining; // a pipe
+      n = conn_splice_body_blocking(conn, want);
+      if (n > 0) {
+        sink->received += (uint64_t)n;
+        continue;
       }
+    } else {
+      // Streamed or dropped: slices are handed over and forgotten
+      uint64_t remaining = body_remaining(conn);
+      char chunk[KB(16)];
+      size_t want =
+          remaining > sizeof(chunk) ? sizeof(chunk) : (size_t)remaining;
+      n = recv(conn->fd, chunk, want, 0);
+      if (n > 0) {
+        body_sink_write(conn, chunk, (size_t)n);
+        continue;
+      }
+    }
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n == 0) {
+      z_log(LOG_WARN, "Client %d closed connection while reading body",
+            conn->fd);
+    } else {
+      z_log(LOG_ERROR, "Reading the body of client %d failed: %s", conn->fd,
+            strerror(errno));
+    }
+    return false;
+  }
+
+  body_update_rcvlowat(conn);
+  return true;
+}
+
+static bool conn_send_blocking(HTTP_Conn *conn) {
+  HTTP_Response *r = &conn->response;
+  if (r->status == 0) {
+    return true;
+  }
 
-      // TODO: Validate Version or change format to
-      // Proto, ProtoMayor, ProtoMinor
-      if (request.version.count == 0) {
-        z_log(LOG_ERROR, "Missing HTTP version in request");
-        respond_400(client_fd, sv_from_cstr("HTTP/1.0"));
-        should_close = true;
-        goto defer;
+  if (!conn_drain_blocking(conn)) {
+    return false;
+  }
+
+  if (r->omit_body) {
+    return http_response_head(&conn->out, r, conn->should_close) &&
+           send_all(conn->fd, conn->out.items, conn->out.count);
+  }
+
+  if (r->file_fd >= 0 && handler_submit(conn, static_handler_run)) {
+    handler_wait(conn);
+  }
+
+  if (r->rope) {
+    return http_response_head(&conn->out, r, conn->should_close) &&
+           send_gather(conn->fd, sb_to_sv(conn->out), r->rope);
+  }
+
+  // send headers
+  if (!http_response_head(&conn->out, r, conn->should_close) ||
+      !send_all(conn->fd, conn->out.items, conn->out.count)) {
+    return false;
+  }
+
+  // Body
+  if (r->body.data && r->body.count > 0) {
+    return send_all(conn->fd, r->body.data, r->body.count);
+  }
+
+  return true;
+}
+
+static void serve_blocking(int listener) {
+  // Non-blocking listener: after a restart the new process may take the
+  // connection poll woke us for. Accepted sockets stay blocking.
+  fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+
+  for (;;) {
+    // The new process owns the listener now, its backlog included
+    if (restart_poll()) {
+      z_log(LOG_INFO, "Drained, exiting");
+      close(listener);
+      return;
+    }
+
+    struct pollfd pfds[2] = {
+        {.fd = listener, .events = POLLIN},
+        {.fd = restart_pipe[0], .events = POLLIN},
+    };
+    if (poll(pfds, 2, -1) < 0 && errno != EINTR) {
+      perror("SERVER ERROR: poll");
+      return;
+    }
+    if (!(pfds[0].revents & POLLIN)) {
+      continue;
+    }
+
+    // TODO: Get ADDR from request
+    // struct sockaddr_storage their_addr;
+    // socklen_t addr_size = sizeof(their_addr);
+
+    // Blocking on purpose: this loop waits in recv/send. The io_uring accept
+    // asks for SOCK_NONBLOCK as well.
+    int client_fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    // accept(listener, (struct sockaddr *)&their_addr, &addr_size);
+    if (client_fd < 0 && (errno == EAGAIN || errno == EINTR ||
+                          errno == ECONNABORTED)) {
+      continue;
+    }
+    if (client_fd < 0) {
+      perror("SERVER ERROR: socket accept error");
+      return;
+    }
+
+    HTTP_Conn conn;
+    http_conn_init(&conn, client_fd);
+    if (!conn_admit(&conn)) {
+      conn.should_close = true;
+    }
+
+    while (!conn.should_close) {
+      if (!conn_recv_head_blocking(&conn) || !conn_admit_request(&conn)) {
+        break;
       }
 
-      z_log(LOG_INFO, "Parsed request line: %.*s %.*s %.*s",
-            SV_Arg(request.method), SV_Arg(request.request_uri),
-            SV_Arg(request.version));
+      if (!http_conn_parse(&conn)) {
+        conn.should_close = true;
+        conn_send_blocking(&conn);
+        break;
+      }
 
-      if (!http_parse_headers(&request, &sb_request_buffer, &request_data)) {
-        should_close = true;
-        goto defer;
+      if (conn.expect_continue) {
+        send_all(client_fd, CONTINUE_MSG, strlen(CONTINUE_MSG));
       }
 
-      printf("--------------------------------------\n");
+      http_conn_route_body(&conn);
+      if (conn.request.content_len > 0 && !conn_recv_body_blocking(&conn)) {
+        break;
+      }
 
-      z_log(LOG_DEBUG, "Headers Count: %zu", request.headers.count);
-      for (size_t i = 0; i < request.headers.count; i++) {
-        z_log(LOG_DEBUG, "  Header [%zu]: %.*s: %.*s", i,
-              SV_Arg(request.headers.items[i].key),
-              SV_Arg(request.headers.items[i].value));
+      if (http_conn_route(&conn) == ROUTE_PENDING) {
+        handler_wait(&conn);
       }
 
-      // TODO: RFC 7230, section 5.3: Must treat
-      //	GET /index.html HTTP/1.1
-      //	Host: www.google.com
-      // and
-      //	GET http://www.google.com/index.html HTTP/1.1
-      //	Host: doesntmatter
-      // the same. In the second case, any Host line is ignored.
-      // So get Host from URI if any
-      // Golang for reference http/request.go:1149:0
-      request.host = *upsert(&request.headers_map, sv_from_cstr("host"));
-
-      // RFC 7230 §5.4: In HTTP/1.1 all requests MUST include a Host header
-      // field. If the Host header is missing or empty, the server MUST respond
-      // with 400 Bad Request. Golang for reference http/transfer.go:748:0
-      if (sv_eq(request.version, sv_from_cstr("HTTP/1.1"))) {
-        if (!request.host.data || request.host.count == 0) {
-          z_log(LOG_ERROR, "HTTP/1.1 request missing Host header");
-          respond_400(client_fd, request.version);
-          should_close = true;
-          goto defer;
-        }
+      if (!conn_send_blocking(&conn)) {
+        break;
       }
 
-      should_close = http_request_should_close(&request);
-
-      // TODO: Maybe check the method and Transfer-Encoding: chunked
-      // Check if Content-Length doesn't exceed the buffer
-      // Content-Length Size discussion
-      // https://stackoverflow.com/questions/2880722/can-http-post-be-limitless#55998160
-      if (sv_eq(request.method, sv_from_cstr("POST"))) {
-        // TODO: Move body read to a function
-        // handle `Transfer-Encoding: chunked`
-        String_View *cl_sv =
-            upsert(&request.headers_map, sv_from_cstr("content-length"));
-        // A valid Content-Length is required on all HTTP/1.0 POST requests.
-        if (!cl_sv->data) {
-          z_log(LOG_ERROR, "Missing Content-Length or Body");
-          respond_400(client_fd, request.version);
-          should_close = true;
-          goto defer;
-        }
+      http_conn_reset(&conn);
+    }
 
-        if (!sv_to_i64(*cl_sv, &request.content_len) ||
-            request.content_len > (int64_t)MAX_CONTENT_LEN) {
-          z_log(LOG_ERROR, "Invalid number or too big");
-          respond_400(client_fd, request.version);
-          should_close = true;
-          goto defer;
-        }
+    z_log(LOG_DEBUG, "Closed connection with client %d", client_fd);
 
-        z_log(LOG_DEBUG, "Content-Length = %lld", request.content_len);
-        z_log(LOG_DEBUG, "Actual body count = %lu", request_data.count);
+    http_conn_free(&conn);
+    close(client_fd);
+  }
+}
 
-        // Check for "Expect: 100-continue"
-        String_View *expect =
-            upsert(&request.headers_map, sv_from_cstr("expect"));
-        if (expect && sv_eq(*expect, sv_from_cstr("100-continue"))) {
-          // TODO: move to a function
-          const char *continue_msg = "HTTP/1.1 100 Continue\r\n\r\n";
-          send(client_fd, continue_msg, strlen(continue_msg), 0);
-        }
+// ------------------ io_uring backend ------------------
+
+// Single-threaded loop over many connections. Multishot accept, multishot
+// recv from a provided-buffer ring, and each response goes out as one linked
+// chain: read the file (if any) -> send the head -> send the body.
+
+enum {
+  OP_NONE, // results nobody waits for
+  OP_ACCEPT,
+  OP_RECV,
+  OP_READ,
+  OP_SEND,
+  OP_SEND_BODY,
+  OP_CONTINUE, // the interim "100 Continue"
+  OP_WAKE,
+  OP_RESTART, // the signal pipe, or the drain deadline
+};
+// The op rides in the low bits of a pointer: connections come from calloc,
+// the drain deadline is aligned by hand
+#define OP_MASK 15
+_Static_assert(_Alignof(max_align_t) > OP_MASK, "user_data pointer bits");
+#define URING_DATA(ptr, op) ((uint64_t)(uintptr_t)(ptr) | (op))
+
+#define URING_BGID 0
+// Files are sent through `http.file` this many bytes at a time
+#define URING_FILE_CHUNK (128 * 1024)
 
-        da_reserve(&request.body, (size_t)request.content_len);
+typedef struct {
+  HTTP_Conn http; // first member: handler jobs point here
+
+  // Bytes that arrived while `http.in` is in use. Past MAX_REQUEST_HEAD recv
+  // is paused until the response is out, and the socket holds the rest.
+  String_Builder backlog;
+
+  size_t body_read;   // file bytes read so far
+  size_t chunk_start; // file offset of `http.file.items[0]`
+  size_t out_sent;
+  size_t body_sent;
+  size_t continue_left; // of CONTINUE_MSG, not sent yet
+  struct iovec iov[SEND_IOV]; // rope pieces of the sendmsg in flight
+  struct msghdr msg;
+  int inflight; // SQEs submitted, not completed yet
+
+  bool recv_armed;
+  bool recv_paused;
+  bool busy; // a request is being handled or its response sent
+  bool handler_pending;
+  bool failed;
+  bool closing;
+} Uring_Conn;
+
+static Uring ring;
+static Uring_Buf_Ring bufs;
+static bool recv_multishot = true;
+
+static size_t live_count = 0; // draining ends when it drops to zero
+static _Alignas(OP_MASK + 1) struct __kernel_timespec drain_ts = {0};
+static bool drain_timed_out = false;
+
+static struct io_uring_sqe *uring_sqe(void) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+  while (!sqe) {
+    uring_submit_and_wait(&ring, 0);
+    sqe = uring_get_sqe(&ring);
+  }
+  return sqe;
+}
 
-        // Append any body bytes already read with the headers
-        size_t initial = request_data.count;
-        if ((int64_t)initial > request.content_len) {
-          initial = (size_t)request.content_len;
-        }
-        da_append_many(&request.body, request_data.data, initial);
+static void uring_arm_accept(int listener) {
+  struct io_uring_sqe *sqe = uring_sqe();
+  uring_prep_accept_multishot(sqe, listener);
+  sqe->user_data = URING_DATA(NULL, OP_ACCEPT);
+}
 
-        // TODO: Handle Transfer-Encoding: chunked
-        String_View *te =
-            upsert(&request.headers_map, sv_from_cstr("transfer-encoding"));
-        if (te && sv_eq(*te, sv_from_cstr("chunked"))) {
-          TODO("Implement parsing for chunked transfer encoding");
-        }
+static void uring_arm_wake(void) {
+  struct io_uring_sqe *sqe = uring_sqe();
+  uring_prep_poll_add(sqe, completions.efd, POLLIN);
+  sqe->user_data = URING_DATA(NULL, OP_WAKE);
+}
 
-        // Read the remaining bytes if needed
-        if ((int64_t)request.body.count < request.content_len) {
-          // TODO: Consider using select() or poll() with timeout to avoid
-          // blocking forever
-          while ((int64_t)request.body.count < request.content_len) {
-            size_t remaining = request.content_len - request.body.count;
-            size_t to_read = remaining > 8192 ? 8192 : remaining;
-            char tmp[8192];
-
-            ssize_t n = recv(client_fd, tmp, (int)to_read, 0);
-            if (n == 0) {
-              z_log(LOG_WARN, "Client %d closed connection while reading body",
-                    client_fd);
-              should_close = true;
-              goto defer;
-            } else if (n < 0) {
-              z_log(LOG_ERROR, "recv() failed for client %d: %s", client_fd,
-                    strerror(errno));
-              should_close = true;
-              goto defer;
-            }
-
-            da_append_many(&request.body, tmp, (size_t)n);
-          }
-
-          if ((int64_t)request.body.count != request.content_len) {
-            z_log(LOG_ERROR,
-                  "Client %d closed connection before sending full body",
-                  client_fd);
-            respond_400(client_fd, request.version);
-            should_close = true;
-            goto defer;
-          }
-        }
+static void uring_arm_restart(void) {
+  struct io_uring_sqe *sqe = uring_sqe();
+  uring_prep_poll_add(sqe, restart_pipe[0], POLLIN);
+  sqe->user_data = URING_DATA(NULL, OP_RESTART);
+}
 
-        if (sv_eq(request.request_uri, sv_from_cstr("/create"))) {
-          respond_201(client_fd, request.version, sb_to_sv(request.body),
-                      should_close);
+static void uring_arm_recv(Uring_Conn *uc) {
+  struct io_uring_sqe *sqe = uring_sqe();
+  uring_prep_recv_select(sqe, uc->http.fd, URING_BGID, recv_multishot);
+  sqe->user_data = URING_DATA(uc, OP_RECV);
+  uc->recv_armed = true;
+}
 
-          goto defer;
-        }
+// A one-shot recv is simply not armed again, a multishot one is cancelled.
+// Buffers it already filled still come in.
+static void uring_pause_recv(Uring_Conn *uc) {
+  if (uc->recv_paused) {
+    return;
+  }
+  uc->recv_paused = true;
+  if (uc->recv_armed && recv_multishot) {
+    struct io_uring_sqe *sqe = uring_sqe();
+    uring_prep_cancel(sqe, URING_DATA(uc, OP_RECV));
+    sqe->user_data = URING_DATA(NULL, OP_NONE);
+  }
+}
+
+static void uring_resume_recv(Uring_Conn *uc) {
+  if (!uc->recv_paused) {
+    return;
+  }
+  uc->recv_paused = false;
+  // Still armed while the cancel is on its way: its -ECANCELED arms it again
+  if (!uc->recv_armed) {
+    uring_arm_recv(uc);
+  }
+}
+
+// The Uring_Conn is freed by uring_conn_maybe_free once the kernel and the
+// pool are done with it.
+static void uring_conn_close(Uring_Conn *uc) {
+  if (uc->closing) {
+    return;
+  }
+  uc->closing = true;
+  // Terminates the armed recv
+  shutdown(uc->http.fd, SHUT_RDWR);
+}
+
+static void uring_conn_maybe_free(Uring_Conn *uc) {
+  if (!uc->closing || uc->recv_armed || uc->inflight > 0 ||
+      uc->handler_pending) {
+    return;
+  }
+
+  z_log(LOG_DEBUG, "Closed connection with client %d", uc->http.fd);
+
+  live_count--;
 
-        respond_404(client_fd, request.version);
-        goto defer;
+  close(uc->http.fd);
+  http_conn_free(&uc->http);
+  sb_free(uc->backlog);
+  free(uc);
+}
+
+static void uring_conn_process(Uring_Conn *uc);
+
+// Sends what is left of the interim response. Until it is out the response
+// waits, uring_on_io flushes it once nothing is in flight.
+static void uring_send_continue(Uring_Conn *uc) {
+  size_t len = strlen(CONTINUE_MSG);
+  struct io_uring_sqe *sqe = uring_sqe();
+  uring_prep_send(sqe, uc->http.fd, CONTINUE_MSG + len - uc->continue_left,
+                  uc->continue_left, MSG_NOSIGNAL | MSG_WAITALL);
+  sqe->user_data = URING_DATA(uc, OP_CONTINUE);
+  uc->inflight++;
+}
+
+// Submits whatever is left of the response as one linked chain. Called again
+// after a short read or send broke the previous chain, and after each chunk
+// of a file.
+static void uring_conn_flush(Uring_Conn *uc) {
+  HTTP_Conn *conn = &uc->http;
+  HTTP_Response *r = &conn->response;
+
+  bool file = r->file_fd >= 0;
+  size_t body_len = file      ? r->file_size
+                    : r->rope ? r->rope->length
+                              : r->body.count;
+  bool need_head = uc->out_sent < conn->out.count;
+  bool need_body = uc->body_sent < body_len;
+  // The next chunk once all of the last one is sent
+  bool need_read = file && need_body && uc->body_sent == uc->body_read;
+
+  if (!need_head && !need_body) {
+    // Response sent
+    if (conn->should_close) {
+      uring_conn_close(uc);
+      return;
+    }
+
+    http_conn_reset(conn);
+    if (uc->backlog.count > 0) {
+      if (!da_append_many(&conn->in, uc->backlog.items, uc->backlog.count)) {
+        z_log(LOG_ERROR, "Out of memory receiving from client %d", conn->fd);
+        uring_conn_close(uc);
+        return;
       }
+      uc->backlog.count = 0;
+    }
+    uc->busy = false;
+    uring_resume_recv(uc);
+    uring_conn_process(uc);
+    return;
+  }
 
-      if (sv_eq(request.method, sv_from_cstr("GET")) ||
-          sv_eq(request.method, sv_from_cstr("HEAD"))) {
-        if (sv_eq(request.request_uri, sv_from_cstr("/"))) {
-          send_response(client_fd, request.version, 200, "OK", "text/plain",
-                        sv_from_cstr("Hello, world! From Home\n"),
-                        should_close);
-          goto defer;
-        }
+  struct io_uring_sqe *sqe;
+  size_t chunk_len = 0;
+  if (need_read) {
+    uc->chunk_start = uc->body_read;
+    chunk_len = body_len - uc->body_read;
+    chunk_len = chunk_len < URING_FILE_CHUNK ? chunk_len : URING_FILE_CHUNK;
+    sqe = uring_sqe();
+    uring_prep_read(sqe, r->file_fd, conn->file.items, chunk_len,
+                    r->file_offset + uc->body_read);
+    sqe->user_data = URING_DATA(uc, OP_READ);
+    sqe->flags |= IOSQE_IO_LINK;
+    uc->inflight++;
+  }
 
-        sb_appendf(&full_path, "./public" SV_Fmt, SV_Arg(request.request_uri));
-        sb_path_clean(&full_path, sb_to_sv(full_path));
-        sb_append_null(&full_path);
+  if (need_head) {
+    sqe = uring_sqe();
+    uring_prep_send(sqe, conn->fd, conn->out.items + uc->out_sent,
+                    conn->out.count - uc->out_sent,
+                    MSG_NOSIGNAL | MSG_WAITALL | (need_body ? MSG_MORE : 0));
+    sqe->user_data = URING_DATA(uc, OP_SEND);
+    if (need_body) {
+      sqe->flags |= IOSQE_IO_LINK;
+    }
+    uc->inflight++;
+  }
 
-        if (!read_entire_file(full_path.items, &file)) {
-          z_log(LOG_ERROR, "Could not open file %s: %s", full_path.items,
-                strerror(errno));
-          respond_404(client_fd, request.version);
-          goto defer;
-        }
+  if (need_body) {
+    sqe = uring_sqe();
+    if (file) {
+      // The chunk as it is expected to be read, or what is left of it
+      size_t at = uc->body_sent - uc->chunk_start;
+      size_t len = need_read ? chunk_len : uc->body_read - uc->body_sent;
+      uring_prep_send(sqe, conn->fd, conn->file.items + at, len,
+                      MSG_NOSIGNAL | MSG_WAITALL);
+    } else if (r->rope) {
+      // Past SEND_IOV pieces the send comes up short and the next flush
+      // picks up the rest
+      size_t n = rope_iov(r->rope, uc->body_sent, uc->iov, SEND_IOV);
+      uc->msg = (struct msghdr){.msg_iov = uc->iov, .msg_iovlen = n};
+      uring_prep_sendmsg(sqe, conn->fd, &uc->msg, MSG_NOSIGNAL | MSG_WAITALL);
+    } else {
+      uring_prep_send(sqe, conn->fd, r->body.data + uc->body_sent,
+                      body_len - uc->body_sent, MSG_NOSIGNAL | MSG_WAITALL);
+    }
+    sqe->user_data = URING_DATA(uc, OP_SEND_BODY);
+    uc->inflight++;
+  }
+}
 
-        z_log(LOG_DEBUG, "Read file %s (%zd bytes)", full_path, file.count);
+static void uring_conn_respond(Uring_Conn *uc) {
+  HTTP_Conn *conn = &uc->http;
+  HTTP_Response *r = &conn->response;
 
-        // TODO: Make a extensions table
-        const char *filetype = "text/plain";
-        if (sv_end_with(request.request_uri, ".html")) {
-          filetype = "text/html";
-        }
-        if (sv_end_with(request.request_uri, ".png")) {
-          filetype = "image/png";
-        }
+  if (r->status == 0) {
+    uring_conn_close(uc);
+    return;
+  }
+
+  uc->busy = true;
+  uc->body_read = 0;
+  uc->chunk_start = 0;
+  uc->out_sent = 0;
+  uc->body_sent = 0;
 
-        send_response(client_fd, request.version, 200, "OK", filetype,
-                      sb_to_sv(file), should_close);
+  if (!http_response_head(&conn->out, r, conn->should_close)) {
+    z_log(LOG_ERROR, "Out of memory responding to client %d", conn->fd);
+    uring_conn_close(uc);
+    return;
+  }
+
+  if (r->omit_body) {
+    response_close_file(r);
+    r->body = (String_View){0};
+    r->rope = NULL;
+  } else if (r->file_fd >= 0) {
+    // The kernel reads the file into `file` a chunk at a time, each one
+    // linked ahead of its send
+    size_t chunk = r->file_size < URING_FILE_CHUNK ? r->file_size
+                                                   : URING_FILE_CHUNK;
+    conn->file.count = 0;
+    if (!da_reserve(&conn->file, chunk)) {
+      z_log(LOG_ERROR, "Out of memory sending a file to client %d", conn->fd);
+      uring_conn_close(uc);
+      return;
+    }
+  }
+
+  if (uc->inflight > 0) {
+    return; // the 100 Continue is still on its way
+  }
+  uring_conn_flush(uc);
+}
 
-        goto defer;
+static void uring_conn_process(Uring_Conn *uc) {
+  HTTP_Conn *conn = &uc->http;
+  HTTP_Request *request = &conn->request;
+
+  if (uc->busy || uc->closing) {
+    return;
+  }
+
+  if (conn->head_len == 0) {
+    String_View sv_full = sb_to_sv(conn->in);
+    int end = find_double_crlf(&sv_full);
+    if (end < 0) {
+      if (conn->in.count >= MAX_REQUEST_HEAD) {
+        z_log(LOG_ERROR, "Request head from client %d exceeds %d bytes",
+              conn->fd, (int)MAX_REQUEST_HEAD);
+        uring_conn_close(uc);
       }
+      return;
+    }
 
-      // TODO: Check Golang as a reference API
-      send_response(client_fd, request.version, 200, "OK", "text/plain",
-                    sv_from_cstr("Hello, world!"), should_close);
+    conn->head_len = (size_t)end;
+    conn->consumed = (size_t)end;
 
-    defer:
-      request.headers.count = 0;
-      request.body.count = 0;
-      hashmap_reset(request.headers_map);
+    if (!conn_admit_request(conn)) {
+      uring_conn_close(uc);
+      return;
+    }
 
-      sb_request_buffer.count = 0;
-      full_path.count = 0;
-      file.count = 0;
+    if (!http_conn_parse(conn)) {
+      conn->should_close = true;
+      uring_conn_respond(uc);
+      return;
+    }
 
-      if (should_close) {
+    if (conn->expect_continue) {
+      uc->continue_left = strlen(CONTINUE_MSG);
+      uring_send_continue(uc);
+    }
+
+    http_conn_route_body(conn);
+    if (request->content_len > 0) {
+      body_from_head(conn);
+    }
+  }
+
+  body_update_rcvlowat(conn);
+  if (body_remaining(conn) > 0) {
+    return; // wait for the rest of the body
+  }
+
+  uc->busy = true;
+  if (http_conn_route(conn) == ROUTE_PENDING) {
+    uc->handler_pending = true;
+    return;
+  }
+  uring_conn_respond(uc);
+}
+
+static void uring_conn_received(Uring_Conn *uc, const char *data, size_t n) {
+  HTTP_Conn *conn = &uc->http;
+
+  // Once the head is parsed the request views point into `in`, so it must not
+  // move until the response is out. Body bytes go straight to the sink.
+  if (!uc->busy && conn->head_len > 0) {
+    uint64_t remaining = body_remaining(conn);
+    size_t take = n < remaining ? n : (size_t)remaining;
+    body_sink_write(conn, data, take);
+    data += take;
+    n -= take;
+  }
+
+  if (n == 0) {
+    return;
+  }
+
+  String_Builder *into = uc->busy || conn->head_len > 0 ? &uc->backlog
+                                                         : &conn->in;
+  if (!da_append_many(into, data, n)) {
+    z_log(LOG_ERROR, "Out of memory receiving from client %d", conn->fd);
+    uring_conn_close(uc);
+    return;
+  }
+  if (into == &uc->backlog && uc->backlog.count >= MAX_REQUEST_HEAD) {
+    uring_pause_recv(uc);
+  }
+}
+
+static void uring_on_accept(int res) {
+  if (res == -ECANCELED && draining) {
+    return;
+  }
+  if (res < 0) {
+    z_log(LOG_ERROR, "accept failed: %s", strerror(-res));
+    return;
+  }
+
+  Uring_Conn *uc = calloc(1, sizeof(*uc));
+  if (!uc) {
+    z_log(LOG_ERROR, "Out of memory for client %d", res);
+    close(res);
+    return;
+  }
+
+  http_conn_init(&uc->http, res);
+  live_count++;
+
+  if (!conn_admit(&uc->http)) {
+    uc->closing = true; // nothing armed, freed right away
+    uring_conn_maybe_free(uc);
+    return;
+  }
+  uring_arm_recv(uc);
+}
+
+static void uring_on_recv(Uring_Conn *uc, int res, unsigned flags) {
+  if (!(flags & IORING_CQE_F_MORE)) {
+    uc->recv_armed = false;
+  }
+
+  if (res > 0) {
+    uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+    uring_conn_received(uc, uring_buf(&bufs, bid), (size_t)res);
+    uring_buf_recycle(&bufs, bid);
+  } else if (res == -EINVAL && recv_multishot) {
+    z_log(LOG_WARN, "Multishot recv not supported, using one-shot recv");
+    recv_multishot = false;
+  } else if (res == 0) {
+    z_log(LOG_DEBUG, "Client %d closed connection", uc->http.fd);
+    uring_conn_close(uc);
+  } else if (res == -ECANCELED && !uc->closing) {
+    // Paused by uring_pause_recv, or resumed since
+  } else if (res != -ENOBUFS) {
+    if (!uc->closing) {
+      z_log(LOG_ERROR, "recv() failed for client %d: %s", uc->http.fd,
+            strerror(-res));
+    }
+    uring_conn_close(uc);
+  }
+
+  if (uc->closing) {
+    return;
+  }
+
+  if (!uc->recv_armed && !uc->recv_paused) {
+    uring_arm_recv(uc);
+  }
+  if (res > 0) {
+    uring_conn_process(uc);
+  }
+}
+
+static void uring_on_io(Uring_Conn *uc, int op, int res) {
+  HTTP_Conn *conn = &uc->http;
+  uc->inflight--;
+
+  if (res == -ECANCELED) {
+    // An earlier short op broke the chain, the next flush resubmits this one
+  } else if (res < 0) {
+    if (!uc->closing) {
+      z_log(LOG_ERROR, "I/O failed for client %d: %s", conn->fd,
+            strerror(-res));
+    }
+    uc->failed = true;
+  } else if (op == OP_READ) {
+    if (res == 0) {
+      z_log(LOG_ERROR, "File %s ended early", conn->full_path.items);
+      uc->failed = true;
+    }
+    uc->body_read += (size_t)res;
+  } else if (op == OP_SEND) {
+    uc->out_sent += (size_t)res;
+  } else if (op == OP_SEND_BODY) {
+    uc->body_sent += (size_t)res;
+  } else if (op == OP_CONTINUE) {
+    uc->continue_left -= (size_t)res;
+  }
+
+  if (uc->inflight > 0 || uc->closing) {
+    return;
+  }
+
+  if (uc->failed) {
+    uring_conn_close(uc);
+  } else if (uc->continue_left > 0) {
+    uring_send_continue(uc);
+  } else if (uc->busy && !uc->handler_pending) {
+    uring_conn_flush(uc);
+  }
+}
+
+static void uring_on_wake(void) {
+  Job *job = cq_drain(&completions);
+  while (job) {
+    Job *next = job->next;
+    Uring_Conn *uc = (Uring_Conn *)((Handler_Job *)job)->conn;
+
+    uc->handler_pending = false;
+    if (uc->closing) {
+      uring_conn_maybe_free(uc);
+    } else {
+      uring_conn_respond(uc);
+    }
+    job = next;
+  }
+
+  uring_arm_wake();
+}
+
+// SIGUSR2 arrived. Once the new process is accepting, stop accepting and
+// start the deadline.
+static void uring_on_restart(void) {
+  if (draining) {
+    return;
+  }
+  if (!restart_poll()) {
+    uring_arm_restart();
+    return;
+  }
+
+  struct io_uring_sqe *sqe = uring_sqe();
+  uring_prep_cancel(sqe, URING_DATA(NULL, OP_ACCEPT));
+  sqe->user_data = URING_DATA(NULL, OP_NONE);
+
+  sqe = uring_sqe();
+  drain_ts.tv_sec = CONFIG->drain_timeout;
+  uring_prep_timeout(sqe, &drain_ts);
+  sqe->user_data = URING_DATA(&drain_ts, OP_RESTART);
+}
+
+// Returns false when io_uring is not usable here, so the caller can fall back
+// to the blocking backend.
+static bool serve_uring(int listener) {
+  if (!uring_init(&ring, CONFIG->uring_entries)) {
+    z_log(LOG_WARN, "io_uring unavailable: %s", strerror(errno));
+    return false;
+  }
+
+  // Provided-buffer rings need 5.19+, which also brings multishot accept
+  if (!uring_buf_ring_init(&ring, &bufs, URING_BGID, CONFIG->uring_bufs,
+                           CONFIG->uring_buf_size)) {
+    z_log(LOG_WARN, "io_uring provided buffers unavailable: %s",
+          strerror(errno));
+    uring_free(&ring);
+    return false;
+  }
+
+  z_log(LOG_INFO, "Using io_uring backend");
+
+  uring_arm_accept(listener);
+  uring_arm_restart();
+  if (completions.efd >= 0) {
+    uring_arm_wake();
+  }
+
+  while (!draining || (live_count > 0 && !drain_timed_out)) {
+    int ret = uring_submit_and_wait(&ring, 1);
+    if (ret < 0 && ret != -EINTR && ret != -EBUSY) {
+      z_log(LOG_ERROR, "io_uring_enter failed: %s", strerror(-ret));
+      break;
+    }
+
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+      uint64_t data = cqe->user_data;
+      int res = cqe->res;
+      unsigned flags = cqe->flags;
+      uring_cqe_seen(&ring);
+
+      Uring_Conn *uc = (Uring_Conn *)(uintptr_t)(data & ~(uint64_t)OP_MASK);
+      int op = (int)(data & OP_MASK);
+      switch (op) {
+      case OP_NONE:
+        break;
+      case OP_ACCEPT:
+        uring_on_accept(res);
+        if (!(flags & IORING_CQE_F_MORE) && !draining) {
+          uring_arm_accept(listener);
+        }
         break;
+      case OP_RESTART:
+        if (uc) {
+          drain_timed_out = true; // deadline, `uc` is &drain_ts
+        } else {
+          uring_on_restart();
+        }
+        break;
+      case OP_WAKE:
+        uring_on_wake();
+        break;
+      case OP_RECV:
+        uring_on_recv(uc, res, flags);
+        uring_conn_maybe_free(uc);
+        break;
+      case OP_READ:
+      case OP_SEND:
+      case OP_SEND_BODY:
+      case OP_CONTINUE:
+        uring_on_io(uc, op, res);
+        uring_conn_maybe_free(uc);
+        break;
+      default:
+        UNREACHABLE("serve_uring: unknown op");
       }
     }
+  }
 
-    z_log(LOG_DEBUG, "Closed connection with client %d", client_fd);
+  if (draining) {
+    z_log(LOG_INFO, "Drained, %zu connections left, exiting", live_count);
+    close(listener);
+  }
 
-    // TODO: Free Headers Map
-    sb_free(request.headers);
-    sb_free(request.body);
+  uring_buf_ring_free(&ring, &bufs);
+  uring_free(&ring);
+  return true;
+}
 
-    sb_free(sb_request_buffer);
-    sb_free(full_path);
-    sb_free(file);
-    close(client_fd);
+// ------------------ Main ------------------
+
+int main(int argc, char **argv) {
+  CONFIG = config_load(argc, argv);
+  if (!CONFIG) {
+    return 1;
   }
+  log_set_level(CONFIG->log_level);
 
-  return 0;
+  if (!admission_init(&CONFIG->admission)) {
+    z_log(LOG_ERROR, "Could not set up admission control");
+    return 1;
+  }
+
+  if (!restart_init(argv)) {
+    z_log(LOG_ERROR, "Could not set up restarts: %s", strerror(errno));
+    return 1;
+  }
+
+  intern_init();
+  http_headers_init();
+
+  if (!mime_init() ||
+      (CONFIG->mime_types && !mime_load_file(CONFIG->mime_types))) {
+    z_log(LOG_ERROR, "Could not build the MIME type table");
+    return 1;
+  }
+
+  docroot_cache_set_limit(CONFIG->docroot_cache);
+  compress_cache_set_limit((size_t)CONFIG->compress_cache);
+  if (!docroot_open(CONFIG->docroot)) {
+    z_log(LOG_ERROR, "Could not open document root %s: %s", CONFIG->docroot,
+          strerror(errno));
+    return 1;
+  }
+
+  // Started by a restart: the old process is still accepting on this one
+  int listener = restart_inherit();
+  if (listener >= 0) {
+    z_log(LOG_INFO, "Took over the listening socket from the old process");
+    // This binary's profile wins, the backlog included
+    socket_profile_apply(listener, &CONFIG->socket);
+    listen(listener, socket_profile_backlog(&CONFIG->socket));
+  } else {
+    listener = setup_server_socket(NULL, CONFIG->port, &CONFIG->socket);
+  }
+
+  if (listener < 0) {
+    z_log(LOG_ERROR, "Failed to set up listening socket on port %s",
+          CONFIG->port);
+    return -1;
+  }
+  server_listener = listener;
+
+  z_log(LOG_INFO, "Server listening on port %s", CONFIG->port);
+
+  if (OFFLOAD_HANDLERS && CONFIG->workers > 0) {
+    if (cq_init(&completions)) {
+      pool = tp_create(CONFIG->workers);
+    }
+    if (!pool) {
+      z_log(LOG_WARN, "Could not start thread pool, running handlers inline");
+    }
+  }
+
+  // Threads are up with SIGUSR2 blocked, it is ours from here
+  restart_unblock();
+  restart_ready();
+
+  if (CONFIG->io_uring) {
+    if (serve_uring(listener)) {
+      return draining ? 0 : 1;
+    }
+    z_log(LOG_WARN, "Falling back to the blocking backend");
+  }
+
+  serve_blocking(listener);
+  return draining ? 0 : 1;
 }
@@ -0,0 +1,786 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mime.h"
+
+// Longest extension we look up, longer ones are simply unknown
+#define MIME_MAX_EXT 16
+// A bucket holds ~4 keys on average, anything near this means a bad hash
+#define MIME_MAX_BUCKET 64
+
+typedef struct {
+  const char *ext; // lowercase, no dot
+  const char *type;
+} Mime_Entry;
+
+// ---------- Built-in table ----------
+
+// Roughly what nginx, Apache and the IANA registry agree on for the web,
+// plus the usual archive, document and media formats.
+static const Mime_Entry builtin[] = {
+    // text
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"shtml", "text/html"},
+    {"xhtml", "application/xhtml+xml"},
+    {"xht", "application/xhtml+xml"},
+    {"css", "text/css"},
+    {"js", "text/javascript"},
+    {"mjs", "text/javascript"},
+    {"cjs", "text/javascript"},
+    {"txt", "text/plain"},
+    {"text", "text/plain"},
+    {"conf", "text/plain"},
+    {"def", "text/plain"},
+    {"list", "text/plain"},
+    {"log", "text/plain"},
+    {"in", "text/plain"},
+    {"ini", "text/plain"},
+    {"c", "text/x-c"},
+    {"h", "text/x-c"},
+    {"cc", "text/x-c"},
+    {"cpp", "text/x-c"},
+    {"cxx", "text/x-c"},
+    {"hh", "text/x-c"},
+    {"hpp", "text/x-c"},
+    {"dic", "text/x-c"},
+    {"java", "text/x-java-source"},
+    {"py", "text/x-python"},
+    {"rs", "text/x-rust"},
+    {"go", "text/x-go"},
+    {"sh", "application/x-sh"},
+    {"bash", "application/x-sh"},
+    {"pl", "application/x-perl"},
+    {"pm", "application/x-perl"},
+    {"rb", "application/x-ruby"},
+    {"php", "application/x-httpd-php"},
+    {"lua", "text/x-lua"},
+    {"s", "text/x-asm"},
+    {"asm", "text/x-asm"},
+    {"f", "text/x-fortran"},
+    {"f77", "text/x-fortran"},
+    {"f90", "text/x-fortran"},
+    {"for", "text/x-fortran"},
+    {"p", "text/x-pascal"},
+    {"pas", "text/x-pascal"},
+    {"md", "text/markdown"},
+    {"markdown", "text/markdown"},
+    {"rst", "text/x-rst"},
+    {"tex", "application/x-tex"},
+    {"latex", "application/x-latex"},
+    {"ltx", "application/x-latex"},
+    {"sty", "application/x-tex"},
+    {"cls", "application/x-tex"},
+    {"bib", "text/x-bibtex"},
+    {"csv", "text/csv"},
+    {"tsv", "text/tab-separated-values"},
+    {"rtx", "text/richtext"},
+    {"rtf", "application/rtf"},
+    {"sgml", "text/sgml"},
+    {"sgm", "text/sgml"},
+    {"vcf", "text/vcard"},
+    {"vcard", "text/vcard"},
+    {"ics", "text/calendar"},
+    {"ifb", "text/calendar"},
+    {"vtt", "text/vtt"},
+    {"srt", "application/x-subrip"},
+    {"jad", "text/vnd.sun.j2me.app-descriptor"},
+    {"wml", "text/vnd.wap.wml"},
+    {"wmls", "text/vnd.wap.wmlscript"},
+    {"htc", "text/x-component"},
+    {"mml", "text/mathml"},
+    {"appcache", "text/cache-manifest"},
+    {"manifest", "text/cache-manifest"},
+    {"uu", "text/x-uuencode"},
+    {"uue", "text/x-uuencode"},
+    {"diff", "text/x-diff"},
+    {"patch", "text/x-diff"},
+    {"yaml", "application/yaml"},
+    {"yml", "application/yaml"},
+    {"toml", "application/toml"},
+
+    // structured data
+    {"json", "application/json"},
+    {"map", "application/json"},
+    {"jsonld", "application/ld+json"},
+    {"geojson", "application/geo+json"},
+    {"topojson", "application/json"},
+    {"webmanifest", "application/manifest+json"},
+    {"xml", "application/xml"},
+    {"xsl", "application/xml"},
+    {"xsd", "application/xml"},
+    {"dtd", "application/xml-dtd"},
+    {"xslt", "application/xslt+xml"},
+    {"rss", "application/rss+xml"},
+    {"atom", "application/atom+xml"},
+    {"rdf", "application/rdf+xml"},
+    {"kml", "application/vnd.google-earth.kml+xml"},
+    {"kmz", "application/vnd.google-earth.kmz"},
+    {"gpx", "application/gpx+xml"},
+    {"mathml", "application/mathml+xml"},
+    {"wasm", "application/wasm"},
+    {"cbor", "application/cbor"},
+    {"msgpack", "application/msgpack"},
+    {"proto", "text/plain"},
+    {"sql", "application/sql"},
+    {"graphql", "application/graphql+json"},
+    {"wsdl", "application/wsdl+xml"},
+    {"xspf", "application/xspf+xml"},
+    {"opml", "text/x-opml"},
+    {"ttl", "text/turtle"},
+    {"n3", "text/n3"},
+    {"sparql", "application/sparql-query"},
+
+    // images
+    {"png", "image/png"},
+    {"apng", "image/apng"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"jpe", "image/jpeg"},
+    {"jfif", "image/jpeg"},
+    {"pjpeg", "image/jpeg"},
+    {"pjp", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    {"avifs", "image/avif-sequence"},
+    {"heic", "image/heic"},
+    {"heif", "image/heif"},
+    {"jxl", "image/jxl"},
+    {"jp2", "image/jp2"},
+    {"j2k", "image/jp2"},
+    {"jpf", "image/jpx"},
+    {"jpx", "image/jpx"},
+    {"jpm", "image/jpm"},
+    {"svg", "image/svg+xml"},
+    {"svgz", "image/svg+xml"},
+    {"ico", "image/vnd.microsoft.icon"},
+    {"cur", "image/x-icon"},
+    {"bmp", "image/bmp"},
+    {"dib", "image/bmp"},
+    {"tif", "image/tiff"},
+    {"tiff", "image/tiff"},
+    {"psd", "image/vnd.adobe.photoshop"},
+    {"xcf", "image/x-xcf"},
+    {"dds", "image/vnd-ms.dds"},
+    {"ktx", "image/ktx"},
+    {"ktx2", "image/ktx2"},
+    {"exr", "image/x-exr"},
+    {"hdr", "image/vnd.radiance"},
+    {"tga", "image/x-tga"},
+    {"pbm", "image/x-portable-bitmap"},
+    {"pgm", "image/x-portable-graymap"},
+    {"ppm", "image/x-portable-pixmap"},
+    {"pnm", "image/x-portable-anymap"},
+    {"pcx", "image/vnd.zbrush.pcx"},
+    {"xbm", "image/x-xbitmap"},
+    {"xpm", "image/x-xpixmap"},
+    {"xwd", "image/x-xwindowdump"},
+    {"ras", "image/x-cmu-raster"},
+    {"rgb", "image/x-rgb"},
+    {"wbmp", "image/vnd.wap.wbmp"},
+    {"djvu", "image/vnd.djvu"},
+    {"djv", "image/vnd.djvu"},
+    {"cr2", "image/x-canon-cr2"},
+    {"nef", "image/x-nikon-nef"},
+    {"dng", "image/x-adobe-dng"},
+    {"arw", "image/x-sony-arw"},
+    {"orf", "image/x-olympus-orf"},
+    {"raf", "image/x-fuji-raf"},
+    {"emf", "image/emf"},
+    {"wmf", "image/wmf"},
+
+    // audio
+    {"mp3", "audio/mpeg"},
+    {"mpga", "audio/mpeg"},
+    {"mp2", "audio/mpeg"},
+    {"m2a", "audio/mpeg"},
+    {"m3a", "audio/mpeg"},
+    {"ogg", "audio/ogg"},
+    {"oga", "audio/ogg"},
+    {"opus", "audio/ogg"},
+    {"spx", "audio/ogg"},
+    {"wav", "audio/wav"},
+    {"weba", "audio/webm"},
+    {"flac", "audio/flac"},
+    {"aac", "audio/aac"},
+    {"m4a", "audio/mp4"},
+    {"mp4a", "audio/mp4"},
+    {"m4b", "audio/mp4"},
+    {"aif", "audio/aiff"},
+    {"aiff", "audio/aiff"},
+    {"aifc", "audio/aiff"},
+    {"mid", "audio/midi"},
+    {"midi", "audio/midi"},
+    {"kar", "audio/midi"},
+    {"rmi", "audio/midi"},
+    {"amr", "audio/amr"},
+    {"awb", "audio/amr-wb"},
+    {"au", "audio/basic"},
+    {"snd", "audio/basic"},
+    {"ra", "audio/x-realaudio"},
+    {"ram", "audio/x-pn-realaudio"},
+    {"wma", "audio/x-ms-wma"},
+    {"wax", "audio/x-ms-wax"},
+    {"mka", "audio/x-matroska"},
+    {"m3u", "audio/x-mpegurl"},
+    {"pls", "audio/x-scpls"},
+    {"caf", "audio/x-caf"},
+    {"ac3", "audio/ac3"},
+    {"dts", "audio/vnd.dts"},
+    {"ape", "audio/x-ape"},
+    {"wv", "audio/x-wavpack"},
+    {"mod", "audio/x-mod"},
+    {"xm", "audio/x-xm"},
+    {"s3m", "audio/x-s3m"},
+    {"it", "audio/x-it"},
+    {"3ga", "audio/3gpp"},
+
+    // video
+    {"mp4", "video/mp4"},
+    {"mp4v", "video/mp4"},
+    {"mpg4", "video/mp4"},
+    {"m4v", "video/x-m4v"},
+    {"webm", "video/webm"},
+    {"ogv", "video/ogg"},
+    {"mkv", "video/x-matroska"},
+    {"mk3d", "video/x-matroska"},
+    {"mov", "video/quicktime"},
+    {"qt", "video/quicktime"},
+    {"avi", "video/x-msvideo"},
+    {"wmv", "video/x-ms-wmv"},
+    {"wmx", "video/x-ms-wmx"},
+    {"wvx", "video/x-ms-wvx"},
+    {"asf", "video/x-ms-asf"},
+    {"asx", "video/x-ms-asf"},
+    {"flv", "video/x-flv"},
+    {"f4v", "video/x-f4v"},
+    {"mpeg", "video/mpeg"},
+    {"mpg", "video/mpeg"},
+    {"mpe", "video/mpeg"},
+    {"m1v", "video/mpeg"},
+    {"m2v", "video/mpeg"},
+    {"ts", "video/mp2t"},
+    {"m2ts", "video/mp2t"},
+    {"mts", "video/mp2t"},
+    {"3gp", "video/3gpp"},
+    {"3gpp", "video/3gpp"},
+    {"3g2", "video/3gpp2"},
+    {"h261", "video/h261"},
+    {"h263", "video/h263"},
+    {"h264", "video/h264"},
+    {"jpgv", "video/jpeg"},
+    {"mng", "video/x-mng"},
+    {"movie", "video/x-sgi-movie"},
+    {"m3u8", "application/vnd.apple.mpegurl"},
+    {"mpd", "application/dash+xml"},
+    {"f4m", "application/f4m+xml"},
+
+    // fonts
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"otf", "font/otf"},
+    {"ttc", "font/collection"},
+    {"eot", "application/vnd.ms-fontobject"},
+    {"pfa", "application/x-font-type1"},
+    {"pfb", "application/x-font-type1"},
+    {"pcf", "application/x-font-pcf"},
+    {"bdf", "application/x-font-bdf"},
+    {"psf", "application/x-font-linux-psf"},
+
+    // documents
+    {"pdf", "application/pdf"},
+    {"ps", "application/postscript"},
+    {"eps", "application/postscript"},
+    {"ai", "application/postscript"},
+    {"epub", "application/epub+zip"},
+    {"mobi", "application/x-mobipocket-ebook"},
+    {"azw", "application/vnd.amazon.ebook"},
+    {"azw3", "application/vnd.amazon.mobi8-ebook"},
+    {"fb2", "application/x-fictionbook+xml"},
+    {"cbz", "application/vnd.comicbook+zip"},
+    {"cbr", "application/vnd.comicbook-rar"},
+    {"doc", "application/msword"},
+    {"dot", "application/msword"},
+    {"docx", "application/"
+             "vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"dotx", "application/"
+             "vnd.openxmlformats-officedocument.wordprocessingml.template"},
+    {"xls", "application/vnd.ms-excel"},
+    {"xlt", "application/vnd.ms-excel"},
+    {"xlsx",
+     "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"xltx",
+     "application/vnd.openxmlformats-officedocument.spreadsheetml.template"},
+    {"ppt", "application/vnd.ms-powerpoint"},
+    {"pps", "application/vnd.ms-powerpoint"},
+    {"pptx", "application/"
+             "vnd.openxmlformats-officedocument.presentationml.presentation"},
+    {"ppsx", "application/"
+             "vnd.openxmlformats-officedocument.presentationml.slideshow"},
+    {"potx",
+     "application/vnd.openxmlformats-officedocument.presentationml.template"},
+    {"odt", "application/vnd.oasis.opendocument.text"},
+    {"ott", "application/vnd.oasis.opendocument.text-template"},
+    {"ods", "application/vnd.oasis.opendocument.spreadsheet"},
+    {"ots", "application/vnd.oasis.opendocument.spreadsheet-template"},
+    {"odp", "application/vnd.oasis.opendocument.presentation"},
+    {"otp", "application/vnd.oasis.opendocument.presentation-template"},
+    {"odg", "application/vnd.oasis.opendocument.graphics"},
+    {"odf", "application/vnd.oasis.opendocument.formula"},
+    {"odc", "application/vnd.oasis.opendocument.chart"},
+    {"odb", "application/vnd.oasis.opendocument.database"},
+    {"pages", "application/vnd.apple.pages"},
+    {"numbers", "application/vnd.apple.numbers"},
+    {"key", "application/vnd.apple.keynote"},
+    {"vsd", "application/vnd.visio"},
+    {"vsdx", "application/vnd.ms-visio.drawing"},
+    {"mpp", "application/vnd.ms-project"},
+    {"one", "application/onenote"},
+    {"xps", "application/vnd.ms-xpsdocument"},
+    {"oxps", "application/oxps"},
+    {"dvi", "application/x-dvi"},
+    {"chm", "application/vnd.ms-htmlhelp"},
+    {"abw", "application/x-abiword"},
+    {"gnumeric", "application/x-gnumeric"},
+    {"kdbx", "application/x-keepass2"},
+    {"ipynb", "application/x-ipynb+json"},
+
+    // archives and compressed
+    {"zip", "application/zip"},
+    {"gz", "application/gzip"},
+    {"tgz", "application/gzip"},
+    {"bz", "application/x-bzip"},
+    {"bz2", "application/x-bzip2"},
+    {"tbz", "application/x-bzip2"},
+    {"tbz2", "application/x-bzip2"},
+    {"xz", "application/x-xz"},
+    {"txz", "application/x-xz"},
+    {"lz", "application/x-lzip"},
+    {"lzma", "application/x-lzma"},
+    {"lz4", "application/x-lz4"},
+    {"zst", "application/zstd"},
+    {"br", "application/x-brotli"},
+    {"z", "application/x-compress"},
+    {"tar", "application/x-tar"},
+    {"rar", "application/vnd.rar"},
+    {"7z", "application/x-7z-compressed"},
+    {"cab", "application/vnd.ms-cab-compressed"},
+    {"arj", "application/x-arj"},
+    {"lha", "application/x-lzh-compressed"},
+    {"lzh", "application/x-lzh-compressed"},
+    {"ace", "application/x-ace-compressed"},
+    {"cpio", "application/x-cpio"},
+    {"shar", "application/x-shar"},
+    {"ar", "application/x-archive"},
+    {"iso", "application/x-iso9660-image"},
+    {"img", "application/octet-stream"},
+    {"dmg", "application/x-apple-diskimage"},
+    {"jar", "application/java-archive"},
+    {"war", "application/java-archive"},
+    {"ear", "application/java-archive"},
+    {"class", "application/java-vm"},
+    {"ser", "application/java-serialized-object"},
+    {"jnlp", "application/x-java-jnlp-file"},
+    {"xpi", "application/x-xpinstall"},
+    {"crx", "application/x-chrome-extension"},
+    {"apk", "application/vnd.android.package-archive"},
+    {"aab", "application/x-authorware-bin"},
+    {"ipa", "application/octet-stream"},
+    {"deb", "application/vnd.debian.binary-package"},
+    {"udeb", "application/vnd.debian.binary-package"},
+    {"rpm", "application/x-rpm"},
+    {"snap", "application/vnd.snap"},
+    {"flatpak", "application/vnd.flatpak"},
+    {"appimage", "application/x-iso9660-appimage"},
+    {"msi", "application/x-msdownload"},
+    {"msp", "application/octet-stream"},
+    {"msm", "application/octet-stream"},
+    {"exe", "application/vnd.microsoft.portable-executable"},
+    {"dll", "application/x-msdownload"},
+    {"com", "application/x-msdownload"},
+    {"bat", "application/x-msdownload"},
+    {"bin", "application/octet-stream"},
+    {"so", "application/octet-stream"},
+    {"o", "application/octet-stream"},
+    {"a", "application/octet-stream"},
+    {"elf", "application/octet-stream"},
+    {"dump", "application/octet-stream"},
+    {"dms", "application/octet-stream"},
+    {"lrf", "application/octet-stream"},
+    {"pkg", "application/octet-stream"},
+    {"torrent", "application/x-bittorrent"},
+
+    // security, mail and misc application
+    {"pem", "application/x-pem-file"},
+    {"crt", "application/x-x509-ca-cert"},
+    {"cer", "application/pkix-cert"},
+    {"der", "application/x-x509-ca-cert"},
+    {"crl", "application/pkix-crl"},
+    {"csr", "application/pkcs10"},
+    {"p10", "application/pkcs10"},
+    {"p7b", "application/x-pkcs7-certificates"},
+    {"p7c", "application/pkcs7-mime"},
+    {"p7m", "application/pkcs7-mime"},
+    {"p7s", "application/pkcs7-signature"},
+    {"p8", "application/pkcs8"},
+    {"p12", "application/x-pkcs12"},
+    {"pfx", "application/x-pkcs12"},
+    {"asc", "application/pgp-signature"},
+    {"sig", "application/pgp-signature"},
+    {"gpg", "application/pgp-encrypted"},
+    {"pgp", "application/pgp-encrypted"},
+    {"eml", "message/rfc822"},
+    {"mime", "message/rfc822"},
+    {"mht", "message/rfc822"},
+    {"mhtml", "message/rfc822"},
+    {"mbox", "application/mbox"},
+    {"msg", "application/vnd.ms-outlook"},
+    {"swf", "application/x-shockwave-flash"},
+    {"sqlite", "application/vnd.sqlite3"},
+    {"db", "application/vnd.sqlite3"},
+    {"mdb", "application/x-msaccess"},
+    {"parquet", "application/vnd.apache.parquet"},
+    {"arrow", "application/vnd.apache.arrow.file"},
+    {"avro", "application/avro"},
+    {"hdf", "application/x-hdf"},
+    {"h5", "application/x-hdf5"},
+    {"nc", "application/x-netcdf"},
+    {"cdf", "application/x-netcdf"},
+    {"mat", "application/x-matlab-data"},
+    {"npy", "application/octet-stream"},
+    {"npz", "application/octet-stream"},
+    {"pkl", "application/octet-stream"},
+    {"onnx", "application/octet-stream"},
+    {"pb", "application/octet-stream"},
+    {"ogx", "application/ogg"},
+    {"mxf", "application/mxf"},
+    {"smil", "application/smil+xml"},
+    {"smi", "application/smil+xml"},
+    {"xul", "application/vnd.mozilla.xul+xml"},
+    {"pac", "application/x-ns-proxy-autoconfig"},
+    {"hqx", "application/mac-binhex40"},
+    {"cpt", "application/mac-compactpro"},
+    {"sit", "application/x-stuffit"},
+    {"sitx", "application/x-stuffitx"},
+    {"run", "application/x-makeself"},
+    {"pdb", "application/x-pilot"},
+    {"prc", "application/x-pilot"},
+    {"sea", "application/x-sea"},
+    {"tcl", "application/x-tcl"},
+    {"tk", "application/x-tcl"},
+    {"stl", "model/stl"},
+    {"obj", "model/obj"},
+    {"mtl", "model/mtl"},
+    {"gltf", "model/gltf+json"},
+    {"glb", "model/gltf-binary"},
+    {"usdz", "model/vnd.usdz+zip"},
+    {"ply", "model/ply"},
+    {"3mf", "model/3mf"},
+    {"dae", "model/vnd.collada+xml"},
+    {"fbx", "application/octet-stream"},
+    {"wrl", "model/vrml"},
+    {"vrml", "model/vrml"},
+    {"x3d", "model/x3d+xml"},
+    {"igs", "model/iges"},
+    {"iges", "model/iges"},
+    {"step", "model/step"},
+    {"stp", "model/step"},
+};
+
+// ---------- Perfect hash ----------
+
+// Hash and displace: keys are spread over `bucket_count` buckets by one
+// hash, and each bucket gets a seed that sends all its keys to distinct free
+// slots through a second mix of the same hash. Buckets are placed biggest
+// first, while the table is still empty enough for them to fit.
+typedef struct {
+  DA_FIELDS(Mime_Entry);
+} Mime_Entries;
+
+typedef struct {
+  DA_FIELDS(uint32_t);
+} Mime_Bucket;
+
+static Mime_Entries entries = {0}; // built-in plus loaded, later wins
+static Mime_Entry *slots = NULL;
+static uint32_t *seeds = NULL;
+static size_t slot_mask = 0;
+static size_t bucket_mask = 0;
+
+static uint64_t mime_hash(const char *s, size_t n) {
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < n; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+// murmur3 finalizer
+static uint64_t mime_mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+static size_t mime_bucket(uint64_t h) { return mime_mix(h) & bucket_mask; }
+
+static size_t mime_slot(uint64_t h, uint32_t seed) {
+  return mime_mix(h + (uint64_t)seed * 0x9e3779b97f4a7c15ull) & slot_mask;
+}
+
+static size_t next_pow2(size_t n) {
+  size_t p = 1;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+static Mime_Bucket *sort_buckets = NULL;
+
+static int bucket_cmp(const void *a, const void *b) {
+  size_t ca = sort_buckets[*(const uint32_t *)a].count;
+  size_t cb = sort_buckets[*(const uint32_t *)b].count;
+  return (ca < cb) - (ca > cb); // biggest first
+}
+
+// Places each bucket in turn. Returns false when some bucket found no seed,
+// the caller then retries with a bigger table.
+static bool mime_place(Mime_Bucket *buckets, const uint32_t *order,
+                       const uint64_t *hashes) {
+  size_t picked[MIME_MAX_BUCKET];
+  size_t bucket_count = bucket_mask + 1;
+
+  for (size_t i = 0; i < bucket_count; i++) {
+    Mime_Bucket *b = &buckets[order[i]];
+    if (b->count == 0) {
+      break;
+    }
+    if (b->count > MIME_MAX_BUCKET) {
+      return false;
+    }
+
+    uint32_t seed = 0;
+    for (; seed < (1u << 16); seed++) {
+      size_t k = 0;
+      for (; k < b->count; k++) {
+        size_t s = mime_slot(hashes[b->items[k]], seed);
+        bool taken = slots[s].ext != NULL;
+        for (size_t j = 0; j < k && !taken; j++) {
+          taken = picked[j] == s;
+        }
+        if (taken) {
+          break;
+        }
+        picked[k] = s;
+      }
+      if (k == b->count) {
+        break;
+      }
+    }
+    if (seed == (1u << 16)) {
+      return false;
+    }
+
+    seeds[order[i]] = seed;
+    for (size_t k = 0; k < b->count; k++) {
+      slots[picked[k]] = entries.items[b->items[k]];
+    }
+  }
+
+  return true;
+}
+
+static bool mime_build(void) {
+  size_t n = entries.count;
+  size_t bucket_count = next_pow2(n / 4 + 1);
+  size_t slot_count = next_pow2(n + n / 2 + 1);
+
+  uint64_t *hashes = malloc(n * sizeof(*hashes));
+  Mime_Bucket *buckets = calloc(bucket_count, sizeof(*buckets));
+  uint32_t *order = malloc(bucket_count * sizeof(*order));
+  if (!hashes || !buckets || !order) {
+    free(hashes);
+    free(buckets);
+    free(order);
+    return false;
+  }
+
+  bucket_mask = bucket_count - 1;
+  bool bucketed = true;
+  for (size_t i = 0; i < n && bucketed; i++) {
+    const char *ext = entries.items[i].ext;
+    hashes[i] = mime_hash(ext, strlen(ext));
+    Mime_Bucket *b = &buckets[mime_bucket(hashes[i])];
+
+    // Duplicates always share a bucket, the later entry replaces the earlier
+    size_t k = 0;
+    while (k < b->count && strcmp(entries.items[b->items[k]].ext, ext) != 0) {
+      k++;
+    }
+    if (k < b->count) {
+      b->items[k] = (uint32_t)i;
+    } else {
+      bucketed = da_append(b, (uint32_t)i);
+    }
+  }
+
+  for (size_t i = 0; i < bucket_count; i++) {
+    order[i] = (uint32_t)i;
+  }
+  sort_buckets = buckets;
+  qsort(order, bucket_count, sizeof(*order), bucket_cmp);
+  sort_buckets = NULL;
+
+  bool ok = false;
+  for (int attempt = 0; bucketed && attempt < 4 && !ok;
+       attempt++, slot_count *= 2) {
+    free(slots);
+    free(seeds);
+    slots = calloc(slot_count, sizeof(*slots));
+    seeds = calloc(bucket_count, sizeof(*seeds));
+    if (!slots || !seeds) {
+      break;
+    }
+    slot_mask = slot_count - 1;
+    ok = mime_place(buckets, order, hashes);
+  }
+
+  for (size_t i = 0; i < bucket_count; i++) {
+    free(buckets[i].items);
+  }
+  free(hashes);
+  free(buckets);
+  free(order);
+
+  if (!ok) {
+    free(slots);
+    free(seeds);
+    slots = NULL;
+    seeds = NULL;
+  }
+  return ok;
+}
+
+// ---------- Loading ----------
+
+bool mime_init(void) {
+  entries.count = 0;
+  return da_append_many(&entries, builtin,
+                        sizeof(builtin) / sizeof(builtin[0])) &&
+         mime_build();
+}
+
+static char *mime_strdup_lower(String_View sv) {
+  char *s = malloc(sv.count + 1);
+  if (!s) {
+    return NULL;
+  }
+  for (size_t i = 0; i < sv.count; i++) {
+    char c = sv.data[i];
+    s[i] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+  }
+  s[sv.count] = '\0';
+  return s;
+}
+
+static String_View sv_chop_word(String_View *sv) {
+  *sv = sv_trim_left(*sv);
+  size_t i = 0;
+  while (i < sv->count && sv->data[i] != ' ' && sv->data[i] != '\t') {
+    i++;
+  }
+  return sv_chop_left(sv, i);
+}
+
+bool mime_load_file(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  // Loaded strings live for the whole process, like the built-in ones
+  char line[1024];
+  while (fgets(line, sizeof(line), f)) {
+    String_View sv = sv_from_cstr(line);
+    sv = sv_trim(sv_chop_by_delim(&sv, '#'));
+
+    String_View type = sv_chop_word(&sv);
+    if (type.count == 0 || !memchr(type.data, '/', type.count)) {
+      continue;
+    }
+
+    char *type_str = NULL;
+    for (String_View ext = sv_chop_word(&sv); ext.count > 0;
+         ext = sv_chop_word(&sv)) {
+      if (ext.count > MIME_MAX_EXT) {
+        continue;
+      }
+      if (!type_str && !(type_str = mime_strdup_lower(type))) {
+        break;
+      }
+      char *ext_str = mime_strdup_lower(ext);
+      if (!ext_str) {
+        break;
+      }
+      if (!da_append(&entries,
+                     ((Mime_Entry){.ext = ext_str, .type = type_str}))) {
+        free(ext_str);
+        break;
+      }
+    }
+  }
+
+  bool ok = !ferror(f);
+  fclose(f);
+  return mime_build() && ok;
+}
+
+// ---------- Lookup ----------
+
+const char *mime_lookup(String_View ext) {
+  if (!slots || ext.count == 0 || ext.count > MIME_MAX_EXT) {
+    return NULL;
+  }
+
+  char lower[MIME_MAX_EXT];
+  for (size_t i = 0; i < ext.count; i++) {
+    char c = ext.data[i];
+    lower[i] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+  }
+
+  uint64_t h = mime_hash(lower, ext.count);
+  const Mime_Entry *e = &slots[mime_slot(h, seeds[mime_bucket(h)])];
+  if (e->ext && strncmp(e->ext, lower, ext.count) == 0 &&
+      e->ext[ext.count] == '\0') {
+    return e->type;
+  }
+  return NULL;
+}
+
+const char *mime_type_for_path(String_View path) {
+  size_t i = path.count;
+  while (i > 0 && path.data[i - 1] != '.' && path.data[i - 1] != '/') {
+    i--;
+  }
+
+  // No dot in the last segment, or a dotfile like ".bashrc"
+  if (i < 2 || path.data[i - 1] != '.' || path.data[i - 2] == '/') {
+    return MIME_DEFAULT_TYPE;
+  }
+
+  const char *type =
+      mime_lookup(sv_from_parts(path.data + i, path.count - i));
+  return type ? type : MIME_DEFAULT_TYPE;
+}
@@ -0,0 +1,37 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include <stdbool.h>
+
+#include "sv.h"
+
+// ------------------ MIME types ------------------
+
+// Extension -> media type. The built-in table is turned into a minimal
+// perfect hash (hash and displace) at startup; lookups are one hash of the
+// lowercased extension, one probe and one compare.
+//
+// Not thread-safe while loading: call mime_init/mime_load_file before
+// serving, lookups are read-only afterwards.
+
+#define MIME_DEFAULT_TYPE "application/octet-stream"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool mime_init(void);
+// Reads a mime.types style file ("type ext ext ...", `#` comments) on top of
+// the built-in table. Later entries win.
+bool mime_load_file(const char *path);
+
+// `ext` without the dot, any case. NULL when unknown.
+const char *mime_lookup(String_View ext);
+// Type of the last path segment's extension, MIME_DEFAULT_TYPE when unknown.
+const char *mime_type_for_path(String_View path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MIME_H
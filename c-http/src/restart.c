@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "restart.h"
+
+extern char **environ;
+
+// The new process keeps its end until restart_ready
+static int handoff_fd = -1;
+
+// ---------- Fd passing ----------
+
+static bool send_fd(int sock, int fd) {
+  char byte = 'L';
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buf,
+      .msg_controllen = sizeof(control.buf),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  ssize_t n;
+  do {
+    n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  return n == 1;
+}
+
+static int recv_fd(int sock) {
+  char byte;
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buf,
+      .msg_controllen = sizeof(control.buf),
+  };
+
+  ssize_t n;
+  do {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n != 1) {
+    return -1;
+  }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+    return -1;
+  }
+
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  return fd;
+}
+
+// ---------- Old process ----------
+
+// environ plus RESTART_ENV=fd, built before fork: between fork and exec only
+// async-signal-safe calls are allowed, and there are threads around.
+static char **restart_env(int fd) {
+  size_t count = 0;
+  while (environ[count]) {
+    count++;
+  }
+
+  char **envp = calloc(count + 2, sizeof(*envp));
+  char *var = malloc(sizeof(RESTART_ENV) + 16);
+  if (!envp || !var) {
+    free(envp);
+    free(var);
+    return NULL;
+  }
+  snprintf(var, sizeof(RESTART_ENV) + 16, RESTART_ENV "=%d", fd);
+
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (strncmp(environ[i], RESTART_ENV "=", sizeof(RESTART_ENV)) != 0) {
+      envp[n++] = environ[i];
+    }
+  }
+  envp[n++] = var;
+  envp[n] = NULL;
+  return envp;
+}
+
+static void restart_env_free(char **envp) {
+  for (size_t i = 0; envp[i]; i++) {
+    if (strncmp(envp[i], RESTART_ENV "=", sizeof(RESTART_ENV)) == 0) {
+      free(envp[i]);
+    }
+  }
+  free(envp);
+}
+
+bool restart_spawn(char *const argv[], int listener, int timeout_ms) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+    return false;
+  }
+
+  char **envp = restart_env(sv[1]);
+  if (!envp) {
+    close(sv[0]);
+    close(sv[1]);
+    return false;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    // Only sv[1] survives the exec, the listener comes through it
+    fcntl(sv[1], F_SETFD, 0);
+    execve(argv[0], argv, envp);
+    _exit(127);
+  }
+  restart_env_free(envp);
+  close(sv[1]);
+
+  if (pid < 0) {
+    close(sv[0]);
+    return false;
+  }
+
+  bool ready = false;
+  if (send_fd(sv[0], listener)) {
+    struct pollfd pfd = {.fd = sv[0], .events = POLLIN};
+    int n;
+    do {
+      n = poll(&pfd, 1, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+
+    char byte = 0;
+    ready = n == 1 && read(sv[0], &byte, 1) == 1 && byte == 'R';
+  }
+  close(sv[0]);
+
+  if (!ready) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+  }
+  return ready;
+}
+
+// ---------- New process ----------
+
+int restart_inherit(void) {
+  const char *env = getenv(RESTART_ENV);
+  if (!env) {
+    return -1;
+  }
+
+  char *end;
+  long fd = strtol(env, &end, 10);
+  unsetenv(RESTART_ENV);
+  if (*end != '\0' || fd < 0 || fd > 65535) {
+    return -1;
+  }
+
+  int listener = recv_fd((int)fd);
+  if (listener < 0) {
+    close((int)fd);
+    return -1;
+  }
+
+  fcntl((int)fd, F_SETFD, FD_CLOEXEC);
+  handoff_fd = (int)fd;
+  return listener;
+}
+
+void restart_ready(void) {
+  if (handoff_fd < 0) {
+    return;
+  }
+
+  char byte = 'R';
+  ssize_t n;
+  do {
+    n = write(handoff_fd, &byte, 1);
+  } while (n < 0 && errno == EINTR);
+
+  close(handoff_fd);
+  handoff_fd = -1;
+}
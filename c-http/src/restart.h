@@ -0,0 +1,34 @@
+#ifndef RESTART_H
+#define RESTART_H
+
+#include <stdbool.h>
+
+// ------------------ Hot restart ------------------
+
+// Zero-downtime binary upgrade. The running process execs the new binary and
+// hands it the listening socket over a Unix socketpair (SCM_RIGHTS). Both
+// accept on the same socket until the new one says it is ready, so no
+// connect is refused. Then the old one stops accepting and drains.
+
+#define RESTART_ENV "ZCSERVER_HANDOFF_FD"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Old process: execs `argv` (argv[0] is the path of the new binary) and
+// passes `listener`. Returns true once the new process is ready to accept.
+// On failure or after `timeout_ms` the child is killed and we carry on.
+bool restart_spawn(char *const argv[], int listener, int timeout_ms);
+
+// New process: the listener passed by restart_spawn, or -1 when this process
+// was not started by a restart.
+int restart_inherit(void);
+// New process: tells the old one to stop accepting. No-op without a restart.
+void restart_ready(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RESTART_H
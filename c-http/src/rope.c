@@ -0,0 +1,223 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rope.h"
+
+struct Rope_Chunk {
+  Rope_Chunk *next;
+  size_t used;
+  char data[ROPE_CHUNK_SIZE];
+};
+
+// ---------- Chunk pool ----------
+
+// Free chunks kept for reuse. Past the limit they go back to the heap, so a
+// burst of big responses does not pin its memory forever.
+#define ROPE_POOL_MAX 64
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static Rope_Chunk *pool = NULL;
+static size_t pool_count = 0;
+
+static Rope_Chunk *chunk_get(void) {
+  pthread_mutex_lock(&pool_lock);
+  Rope_Chunk *c = pool;
+  if (c) {
+    pool = c->next;
+    pool_count--;
+  }
+  pthread_mutex_unlock(&pool_lock);
+
+  if (!c && !(c = malloc(sizeof(*c)))) {
+    return NULL;
+  }
+  c->next = NULL;
+  c->used = 0;
+  return c;
+}
+
+// Gives back a whole list
+static void chunk_put(Rope_Chunk *list) {
+  while (list) {
+    Rope_Chunk *next = list->next;
+    pthread_mutex_lock(&pool_lock);
+    bool keep = pool_count < ROPE_POOL_MAX;
+    if (keep) {
+      list->next = pool;
+      pool = list;
+      pool_count++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (!keep) {
+      free(list);
+    }
+    list = next;
+  }
+}
+
+// ---------- Pieces ----------
+
+// Bytes just written at the end of the newest chunk. They extend the last
+// piece when it ends right there, which is the case for back to back appends.
+static void rope_grow_tail(Rope *rope, size_t count) {
+  Rope_Chunk *c = rope->chunks;
+  const char *at = c->data + c->used;
+  String_View *last =
+      rope->pieces.count > 0 ? &rope->pieces.items[rope->pieces.count - 1]
+                             : NULL;
+
+  if (last && last->data + last->count == at) {
+    last->count += count;
+  } else {
+    // rope_reserve made room for it
+    rope->pieces.items[rope->pieces.count++] = sv_from_parts(at, count);
+  }
+  c->used += count;
+  rope->length += count;
+}
+
+char *rope_reserve(Rope *rope, size_t *room) {
+  // A new piece may be needed, reserve it now so rope_commit cannot fail
+  if (!da_reserve(&rope->pieces, rope->pieces.count + 1)) {
+    return NULL;
+  }
+
+  Rope_Chunk *c = rope->chunks;
+  if (!c || c->used == ROPE_CHUNK_SIZE) {
+    if (!(c = chunk_get())) {
+      return NULL;
+    }
+    c->next = rope->chunks;
+    rope->chunks = c;
+  }
+  *room = ROPE_CHUNK_SIZE - c->used;
+  return c->data + c->used;
+}
+
+void rope_commit(Rope *rope, size_t count) {
+  if (count > 0) {
+    rope_grow_tail(rope, count);
+  }
+}
+
+// ---------- Appending ----------
+
+bool rope_append(Rope *rope, const char *data, size_t count) {
+  // Chunks taken here go back if a later one fails
+  Rope_Chunk *chunks = rope->chunks;
+  size_t pieces = rope->pieces.count;
+  size_t length = rope->length;
+  size_t used = chunks ? chunks->used : 0;
+  size_t last = pieces > 0 ? rope->pieces.items[pieces - 1].count : 0;
+
+  while (count > 0) {
+    size_t room;
+    char *dest = rope_reserve(rope, &room);
+    if (!dest) {
+      Rope_Chunk *taken = rope->chunks;
+      while (taken != chunks) {
+        Rope_Chunk *next = taken->next;
+        taken->next = NULL;
+        chunk_put(taken);
+        taken = next;
+      }
+      rope->chunks = chunks;
+      if (chunks) {
+        chunks->used = used;
+      }
+      rope->pieces.count = pieces;
+      if (pieces > 0) {
+        rope->pieces.items[pieces - 1].count = last;
+      }
+      rope->length = length;
+      return false;
+    }
+
+    size_t n = count < room ? count : room;
+    memcpy(dest, data, n);
+    rope_commit(rope, n);
+    data += n;
+    count -= n;
+  }
+  return true;
+}
+
+int rope_appendf(Rope *rope, const char *fmt, ...) {
+  va_list args;
+
+  // Straight into the newest chunk when it fits, which is nearly always
+  size_t room = 0;
+  char *dest = rope_reserve(rope, &room);
+  if (!dest) {
+    return -1;
+  }
+  va_start(args, fmt);
+  int n = vsnprintf(dest, room, fmt, args);
+  va_end(args);
+  if (n < 0) {
+    return -1;
+  }
+  if ((size_t)n < room) {
+    rope_commit(rope, (size_t)n);
+    return n;
+  }
+
+  // Truncated. Format it whole on the heap and copy it over.
+  char *buf = malloc((size_t)n + 1);
+  if (!buf) {
+    return -1;
+  }
+  va_start(args, fmt);
+  vsnprintf(buf, (size_t)n + 1, fmt, args);
+  va_end(args);
+  bool ok = rope_append(rope, buf, (size_t)n);
+  free(buf);
+  return ok ? n : -1;
+}
+
+bool rope_splice(Rope *rope, String_View sv) {
+  if (sv.count == 0) {
+    return true;
+  }
+  if (!da_append(&rope->pieces, sv)) {
+    return false;
+  }
+  rope->length += sv.count;
+  return true;
+}
+
+// ---------- Export ----------
+
+size_t rope_iov(const Rope *rope, size_t skip, struct iovec *iov, size_t max) {
+  size_t i = 0;
+  while (i < rope->pieces.count && skip >= rope->pieces.items[i].count) {
+    skip -= rope->pieces.items[i].count;
+    i++;
+  }
+
+  size_t n = 0;
+  for (; i < rope->pieces.count && n < max; i++, n++) {
+    String_View piece = rope->pieces.items[i];
+    iov[n].iov_base = (void *)(piece.data + skip);
+    iov[n].iov_len = piece.count - skip;
+    skip = 0;
+  }
+  return n;
+}
+
+// ---------- Lifetime ----------
+
+void rope_clear(Rope *rope) {
+  chunk_put(rope->chunks);
+  rope->chunks = NULL;
+  da_clear(&rope->pieces);
+  rope->length = 0;
+}
+
+void rope_free(Rope *rope) {
+  rope_clear(rope);
+  da_free(&rope->pieces);
+}
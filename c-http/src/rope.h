@@ -0,0 +1,77 @@
+#ifndef ROPE_H
+#define ROPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "da.h"
+#include "sv.h"
+
+// ------------------ Rope ------------------
+
+// A byte string kept as a list of pieces, for large bodies assembled from
+// many parts. Appended bytes are copied into fixed-size chunks and never move
+// again, so growing it costs no realloc and no copy of what is already there.
+// External bytes can be spliced in by reference.
+//
+// It is never flattened. rope_iov hands the pieces to writev/sendmsg as they
+// are:
+//
+//   Rope rope = {0};
+//   rope_appendf(&rope, "--%s\r\n", boundary);
+//   rope_splice(&rope, static_part); // must outlive the rope
+//   struct iovec iov[16];
+//   size_t n = rope_iov(&rope, 0, iov, 16);
+//   writev(fd, iov, (int)n);
+//   rope_free(&rope);
+//
+// Chunks come from a process-wide pool, so a connection that builds ropes
+// over and over reuses the same memory. The pool is thread-safe, but a single
+// rope is not.
+
+#define ROPE_CHUNK_SIZE (16 * 1024)
+
+typedef struct Rope_Chunk Rope_Chunk;
+
+typedef struct {
+  DA_FIELDS(String_View);
+} Rope_Pieces;
+
+typedef struct {
+  Rope_Pieces pieces;
+  Rope_Chunk *chunks; // owned, newest first: appends go to the head
+  size_t length;      // bytes over all pieces
+} Rope;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Copies. Everything that may allocate returns false (or -1) when out of
+// memory and leaves the rope as it was.
+bool rope_append(Rope *rope, const char *data, size_t count);
+int rope_appendf(Rope *rope, const char *fmt, ...);
+// By reference: `sv` must stay valid while the rope holds it
+bool rope_splice(Rope *rope, String_View sv);
+
+// Free space at the end of the newest chunk, at least one byte, to be filled
+// directly (by read() say) and confirmed with rope_commit. NULL when out of
+// memory.
+char *rope_reserve(Rope *rope, size_t *room);
+// `count` at most the room rope_reserve gave
+void rope_commit(Rope *rope, size_t count);
+
+// Fills up to `max` iovecs with the pieces past the first `skip` bytes, for
+// resuming after a short write. Returns how many it filled.
+size_t rope_iov(const Rope *rope, size_t skip, struct iovec *iov, size_t max);
+
+// Empty, chunks back to the pool
+void rope_clear(Rope *rope);
+void rope_free(Rope *rope);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ROPE_H
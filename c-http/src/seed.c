@@ -0,0 +1,15 @@
+#define _GNU_SOURCE
+
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "seed.h"
+
+uint64_t random_seed(void) {
+  uint64_t seed;
+  if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed)) {
+    seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+  }
+  return seed;
+}
@@ -0,0 +1,14 @@
+#ifndef SEED_H
+#define SEED_H
+
+#include <stdint.h>
+
+// ------------------ Seed ------------------
+
+// A key for the hashes of tables clients fill, like admission's addresses
+// and the interned headers, so they cannot pick inputs that collide on
+// purpose. From getrandom, or the time and pid when it has nothing to give
+// without blocking.
+uint64_t random_seed(void);
+
+#endif // SEED_H
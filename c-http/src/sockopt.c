@@ -0,0 +1,75 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "sockopt.h"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+static bool set_int(int fd, int level, int name, const char *label,
+                    uint32_t value) {
+  int v = value > INT32_MAX ? INT32_MAX : (int)value;
+  if (setsockopt(fd, level, name, &v, sizeof(v)) < 0) {
+    fprintf(stderr, "sockopt: %s=%d failed: %s\n", label, v, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool socket_profile_apply(int fd, const Socket_Profile *p) {
+  bool ok = true;
+
+  ok &= set_int(fd, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", p->nodelay != 0);
+
+  if (p->defer_accept > 0) {
+    ok &= set_int(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, "TCP_DEFER_ACCEPT",
+                  p->defer_accept);
+  }
+  if (p->fastopen > 0) {
+    ok &= set_int(fd, IPPROTO_TCP, TCP_FASTOPEN, "TCP_FASTOPEN", p->fastopen);
+  }
+  // Before listen(): the window scale offered in the SYN-ACK depends on it
+  if (p->rcvbuf > 0) {
+    ok &= set_int(fd, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", p->rcvbuf);
+  }
+  if (p->sndbuf > 0) {
+    ok &= set_int(fd, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", p->sndbuf);
+  }
+  if (p->busy_poll > 0) {
+    ok &= set_int(fd, SOL_SOCKET, SO_BUSY_POLL, "SO_BUSY_POLL", p->busy_poll);
+  }
+
+  ok &= set_int(fd, SOL_SOCKET, SO_KEEPALIVE, "SO_KEEPALIVE",
+                p->keepalive_idle > 0);
+  if (p->keepalive_idle > 0) {
+    ok &= set_int(fd, IPPROTO_TCP, TCP_KEEPIDLE, "TCP_KEEPIDLE",
+                  p->keepalive_idle);
+    if (p->keepalive_intvl > 0) {
+      ok &= set_int(fd, IPPROTO_TCP, TCP_KEEPINTVL, "TCP_KEEPINTVL",
+                    p->keepalive_intvl);
+    }
+    if (p->keepalive_cnt > 0) {
+      ok &= set_int(fd, IPPROTO_TCP, TCP_KEEPCNT, "TCP_KEEPCNT",
+                    p->keepalive_cnt);
+    }
+  }
+
+  if (p->notsent_lowat > 0) {
+    ok &= set_int(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT",
+                  p->notsent_lowat);
+  }
+
+  return ok;
+}
+
+int socket_profile_backlog(const Socket_Profile *p) {
+  if (p->backlog == 0) {
+    return 1;
+  }
+  return p->backlog > INT32_MAX ? INT32_MAX : (int)p->backlog;
+}
@@ -0,0 +1,44 @@
+#ifndef SOCKOPT_H
+#define SOCKOPT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ------------------ Socket profile ------------------
+
+// TCP options for the listener. Linux copies socket and TCP options from the
+// listener to every socket accept() returns, so the whole profile is set
+// once here and accepted connections need no setsockopt of their own.
+//
+// 0 leaves an option at the kernel default (or off).
+
+typedef struct {
+  uint32_t backlog;         // listen() queue, capped by net.core.somaxconn
+  uint32_t nodelay;         // TCP_NODELAY, 1 = no Nagle delay on small writes
+  uint32_t defer_accept;    // TCP_DEFER_ACCEPT, seconds to wait for data
+  uint32_t fastopen;        // TCP_FASTOPEN queue, net.ipv4.tcp_fastopen & 2
+  uint32_t rcvbuf;          // SO_RCVBUF bytes, turns receive autotuning off
+  uint32_t sndbuf;          // SO_SNDBUF bytes, turns send autotuning off
+  uint32_t busy_poll;       // SO_BUSY_POLL microseconds, may need CAP_NET_ADMIN
+  uint32_t keepalive_idle;  // SO_KEEPALIVE + TCP_KEEPIDLE seconds
+  uint32_t keepalive_intvl; // TCP_KEEPINTVL seconds between probes
+  uint32_t keepalive_cnt;   // TCP_KEEPCNT probes before dropping the peer
+  uint32_t notsent_lowat;   // TCP_NOTSENT_LOWAT bytes
+} Socket_Profile;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Applies the profile to a listening (or about to listen) socket. Options the
+// kernel refuses are reported on stderr and skipped; returns false if any
+// was.
+bool socket_profile_apply(int listener, const Socket_Profile *profile);
+// `backlog` as listen() takes it
+int socket_profile_backlog(const Socket_Profile *profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOCKOPT_H
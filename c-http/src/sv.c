@@ -1,9 +1,12 @@
-#include <ctype.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "sv.h"
 
 // ---------- String Builder ----------
@@ -19,7 +22,9 @@ int sb_appendf(String_Builder *sb, const char *fmt, ...) {
   // However, further below we increase sb->count by n, not n + 1.
   // This is because we don't want the sb to include the null terminator. The
   // user can always sb_append_null() if they want it
-  da_reserve(sb, sb->count + n + 1);
+  if (n < 0 || !da_reserve(sb, sb->count + (size_t)n + 1)) {
+    return -1;
+  }
   char *dest = sb->items + sb->count;
   va_start(args, fmt);
   vsnprintf(dest, n + 1, fmt, args);
@@ -30,19 +35,117 @@ int sb_appendf(String_Builder *sb, const char *fmt, ...) {
   return n;
 }
 
-void sb_path_clean(String_Builder *sb, String_View path) {
+static const char DIGIT_PAIRS[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+const uint64_t SV_POW10[20] = {
+    1ull,
+    10ull,
+    100ull,
+    1000ull,
+    10000ull,
+    100000ull,
+    1000000ull,
+    10000000ull,
+    100000000ull,
+    1000000000ull,
+    10000000000ull,
+    100000000000ull,
+    1000000000000ull,
+    10000000000000ull,
+    100000000000000ull,
+    1000000000000000ull,
+    10000000000000000ull,
+    100000000000000000ull,
+    1000000000000000000ull,
+    10000000000000000000ull,
+};
+
+// From the bit length: log10(2) ~ 1233 / 4096 gets within one, a table
+// lookup settles it. `n | 1` makes 0 one digit and moves no other number
+// past a power of ten.
+static inline size_t decimal_digits(uint64_t n) {
+  n |= 1;
+  size_t guess = (size_t)(64 - __builtin_clzll(n)) * 1233 >> 12;
+  return guess + (n >= SV_POW10[guess]);
+}
+
+// Exactly eight digits of `n` < 10^8, zero padded. The four pairs do not
+// depend on each other, unlike a loop dividing the same number down.
+static inline void format_eight_digits(char *p, uint32_t n) {
+  uint32_t high = n / 10000, low = n % 10000;
+  memcpy(p, DIGIT_PAIRS + high / 100 * 2, 2);
+  memcpy(p + 2, DIGIT_PAIRS + high % 100 * 2, 2);
+  memcpy(p + 4, DIGIT_PAIRS + low / 100 * 2, 2);
+  memcpy(p + 6, DIGIT_PAIRS + low % 100 * 2, 2);
+}
+
+size_t sv_format_u64(uint64_t n, char out[20]) {
+  size_t len = decimal_digits(n);
+  char *p = out + len;
+  while (n >= 100000000) {
+    p -= 8;
+    format_eight_digits(p, (uint32_t)(n % 100000000));
+    n /= 100000000;
+  }
+
+  uint32_t m = (uint32_t)n;
+  while (m >= 100) {
+    p -= 2;
+    memcpy(p, DIGIT_PAIRS + m % 100 * 2, 2);
+    m /= 100;
+  }
+  if (m >= 10) {
+    memcpy(p - 2, DIGIT_PAIRS + m * 2, 2);
+  } else {
+    p[-1] = (char)('0' + m);
+  }
+  return len;
+}
+
+bool sb_append_u64(String_Builder *sb, uint64_t n) {
+  if (!da_reserve(sb, sb->count + 20)) {
+    return false;
+  }
+  sb->count += sv_format_u64(n, sb->items + sb->count);
+  return true;
+}
+
+bool sb_append_i64(String_Builder *sb, int64_t n) {
+  if (!da_reserve(sb, sb->count + 21)) {
+    return false;
+  }
+  uint64_t magnitude = (uint64_t)n;
+  if (n < 0) {
+    sb->items[sb->count++] = '-';
+    magnitude = 0 - magnitude;
+  }
+  sb->count += sv_format_u64(magnitude, sb->items + sb->count);
+  return true;
+}
+
+bool sb_path_clean(String_Builder *sb, String_View path) {
   sb->count = 0;
 
   if (path.count == 0) {
-    sb_append_cstr(sb, ".");
-    return;
+    return sb_append_cstr(sb, ".");
   }
 
   bool rooted = (path.data[0] == '/');
   size_t read_idx = 0;
 
   if (rooted) {
-    da_append(sb, '/');
+    if (!da_append(sb, '/')) {
+      return false;
+    }
     read_idx = 1;
   }
 
@@ -64,52 +167,155 @@ void sb_path_clean(String_Builder *sb, String_View path) {
         }
       } else if (!rooted) {
         // cannot backtrack, append ".."
-        if (sb->count > 0 && sb->items[sb->count - 1] != '/') {
-          da_append(sb, '/');
+        if (sb->count > 0 && sb->items[sb->count - 1] != '/' &&
+            !da_append(sb, '/')) {
+          return false;
+        }
+        if (!sb_append_cstr(sb, "..")) {
+          return false;
         }
-        sb_append_cstr(sb, "..");
       }
     } else {
       // normal path segment
-      if (sb->count > 0 && sb->items[sb->count - 1] != '/') {
-        da_append(sb, '/');
+      if (sb->count > 0 && sb->items[sb->count - 1] != '/' &&
+          !da_append(sb, '/')) {
+        return false;
       }
+      size_t start = read_idx;
       while (read_idx < path.count && path.data[read_idx] != '/') {
-        da_append(sb, path.data[read_idx]);
         read_idx++;
       }
+      if (!da_append_many(sb, path.data + start, read_idx - start)) {
+        return false;
+      }
     }
   }
 
   if (sb->count == 0) {
-    da_append_many(sb, ".", 1);
+    return da_append(sb, '.');
   }
+  return true;
 }
 
-void sb_path_clean_absolute(String_Builder *sb, String_View path) {
+bool sb_path_clean_absolute(String_Builder *sb, String_View path) {
   if (path.count == 0) {
     sb->count = 0;
-    sb_append_cstr(sb, "/");
-    return;
+    return sb_append_cstr(sb, "/");
   }
 
   String_Builder tmp = {0};
-  if (path.data[0] != '/') {
-    sb_append_cstr(sb, "/");
+  if (path.data[0] != '/' && !sb_append_cstr(sb, "/")) {
+    return false;
   }
-  da_append_many(&tmp, path.data, path.count);
-
-  sb_path_clean(sb, sb_to_sv(tmp));
+  bool ok = da_append_many(&tmp, path.data, path.count) &&
+            sb_path_clean(sb, sb_to_sv(tmp));
 
   // Restore '/' at the end
-  if (path.data[path.count - 1] == '/' &&
+  if (ok && path.data[path.count - 1] == '/' &&
       !(sb->count == 1 && sb->items[0] == '/')) {
     if (!(path.count == sb->count + 1 && sv_eq(path, sb_to_sv(*sb)))) {
-      da_append(sb, '/');
+      ok = da_append(sb, '/');
     }
   }
 
   sb_free(tmp);
+  return ok;
+}
+
+// ---------- URI ----------
+
+static int hex_digit_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c |= 0x20; // ASCII lowercase
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+bool uri_path_clean(String_View uri, char *out, size_t out_cap,
+                    size_t *out_count) {
+  size_t end = 0;
+  while (end < uri.count && uri.data[end] != '?' && uri.data[end] != '#') {
+    end++;
+  }
+  if (out_cap < end + 1) {
+    return false;
+  }
+
+  bool rooted = end > 0 && uri.data[0] == '/';
+  size_t r = 0;
+  size_t w = 0;
+
+  if (rooted) {
+    out[w++] = '/';
+    r = 1;
+  }
+
+  while (r < end) {
+    if (uri.data[r] == '/') {
+      r++; // ignore repeated slashes
+      continue;
+    }
+
+    // Decode the whole segment first, "%2e%2e" is a dot segment too
+    size_t mark = w;
+    if (w > 0 && out[w - 1] != '/') {
+      out[w++] = '/';
+    }
+    size_t segment = w;
+
+    while (r < end && uri.data[r] != '/') {
+      char c = uri.data[r++];
+      if (c == '%') {
+        int hi = r + 1 < end ? hex_digit_value(uri.data[r]) : -1;
+        int lo = hi >= 0 ? hex_digit_value(uri.data[r + 1]) : -1;
+        if (lo < 0) {
+          return false;
+        }
+        c = (char)(hi << 4 | lo);
+        r += 2;
+        if (c == '/') {
+          return false; // an encoded slash would change the segments
+        }
+      }
+      if (c == '\0') {
+        return false;
+      }
+      out[w++] = c;
+    }
+
+    size_t segment_len = w - segment;
+    if (segment_len == 1 && out[segment] == '.') {
+      w = mark;
+    } else if (segment_len == 2 && out[segment] == '.' &&
+               out[segment + 1] == '.') {
+      w = mark;
+      if (w > 1) {
+        // backtrack to the previous '/'
+        w--;
+        while (w > 0 && out[w - 1] != '/') {
+          w--;
+        }
+      } else if (!rooted) {
+        // cannot backtrack, keep ".."
+        if (w > 0 && out[w - 1] != '/') {
+          out[w++] = '/';
+        }
+        out[w++] = '.';
+        out[w++] = '.';
+      }
+    }
+  }
+
+  if (w == 0) {
+    out[w++] = '.';
+  }
+
+  *out_count = w;
+  return true;
 }
 
 // ---------- String View creation ----------
@@ -159,9 +365,15 @@ String_View sv_chop_by_delim(String_View *sv, char delim) {
   return result;
 }
 
+// isspace() in the "C" locale, without the locale lookup
+static inline bool ascii_is_space(char c) {
+  unsigned char u = (unsigned char)c;
+  return u == ' ' || (unsigned)(u - '\t') < 5; // \t \n \v \f \r
+}
+
 String_View sv_trim_left(String_View sv) {
   size_t i = 0;
-  while (i < sv.count && isspace(sv.data[i])) {
+  while (i < sv.count && ascii_is_space(sv.data[i])) {
     i += 1;
   }
 
@@ -170,7 +382,7 @@ String_View sv_trim_left(String_View sv) {
 
 String_View sv_trim_right(String_View sv) {
   size_t i = 0;
-  while (i < sv.count && isspace(sv.data[sv.count - 1 - i])) {
+  while (i < sv.count && ascii_is_space(sv.data[sv.count - 1 - i])) {
     i += 1;
   }
 
@@ -191,29 +403,174 @@ String_View sv_substr(const String_View *sv, size_t start, size_t len) {
   return sub;
 }
 
-String_View sv_to_lower_sb(String_Builder *sb, String_View sv) {
-  da_reserve(sb, sb->count + sv.count);
-  char *dest = sb->items + sb->count;
+// ---------- ASCII case ----------
+// Only A-Z and a-z ever change, bytes from 0x80 up pass through untouched.
+// That is tolower()/toupper() in the "C" locale, and what RFC 9110 means by
+// case-insensitive for header names and tokens. Letters of one case sit in a
+// run of 26 and differ from the other case in bit 0x20 alone, so every
+// kernel below finds the bytes in [lo, lo + 25] and sets or clears that bit.
+
+#define ASCII_ONES 0x0101010101010101ull
+#define ASCII_HIGH 0x8080808080808080ull
+
+static inline unsigned char ascii_lower(unsigned char c) {
+  return (unsigned char)(c | ((unsigned)(c - 'A') < 26) << 5);
+}
 
-  for (size_t i = 0; i < sv.count; i++) {
-    dest[i] = (char)tolower((unsigned char)sv.data[i]);
+// 0x20 in every byte of `x` within [lo, lo + 25]. The adds see 7-bit values
+// only, so no carry crosses into the next byte.
+static inline uint64_t ascii_case_bits_swar(uint64_t x, unsigned char lo) {
+  uint64_t low7 = x & ~ASCII_HIGH;
+  uint64_t at_least_lo = low7 + ASCII_ONES * (0x80 - lo);
+  uint64_t past_hi = low7 + ASCII_ONES * (0x80 - lo - 26);
+  return ((at_least_lo ^ past_hi) & ~x & ASCII_HIGH) >> 2;
+}
+
+#ifdef __SSE2__
+// Same with one signed compare: subtracting lo + 0x80 moves the run to the
+// bottom of the signed range, where nothing else lands
+static inline __m128i ascii_case_bits_sse2(__m128i v, unsigned char lo) {
+  __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8((char)(lo - 0x80)));
+  __m128i in_run = _mm_cmplt_epi8(shifted, _mm_set1_epi8(-128 + 26));
+  return _mm_and_si128(in_run, _mm_set1_epi8(0x20));
+}
+#endif
+
+// 8 bytes, or 4 zero-extended when `n` is below 8
+static inline uint64_t ascii_load(const char *s, size_t n) {
+  if (n >= 8) {
+    uint64_t x;
+    memcpy(&x, s, 8);
+    return x;
   }
+  uint32_t x;
+  memcpy(&x, s, 4);
+  return x;
+}
 
-  sb->count += sv.count;
+static inline void ascii_store(char *s, size_t n, uint64_t x) {
+  if (n >= 8) {
+    memcpy(s, &x, 8);
+  } else {
+    uint32_t low = (uint32_t)x;
+    memcpy(s, &low, 4);
+  }
+}
 
-  return sv_from_parts(dest, sv.count);
+// Lowering only sets the bit and raising only clears it, so doing a byte twice
+// is harmless: a short or trailing piece is covered by two overlapping loads,
+// both made before either store
+static void ascii_set_case(char *s, size_t n, bool upper) {
+  const unsigned char lo = upper ? 'a' : 'A';
+#ifdef __SSE2__
+  if (n >= 16) {
+    __m128i last = _mm_loadu_si128((const void *)(s + n - 16));
+    __m128i bits = ascii_case_bits_sse2(last, lo);
+    last = upper ? _mm_andnot_si128(bits, last) : _mm_or_si128(last, bits);
+    for (size_t i = 0; i + 16 < n; i += 16) {
+      __m128i v = _mm_loadu_si128((const void *)(s + i));
+      bits = ascii_case_bits_sse2(v, lo);
+      v = upper ? _mm_andnot_si128(bits, v) : _mm_or_si128(v, bits);
+      _mm_storeu_si128((void *)(s + i), v);
+    }
+    _mm_storeu_si128((void *)(s + n - 16), last);
+    return;
+  }
+#else
+  for (; n > 16; s += 8, n -= 8) {
+    uint64_t x = ascii_load(s, 8);
+    uint64_t bits = ascii_case_bits_swar(x, lo);
+    ascii_store(s, 8, upper ? x & ~bits : x | bits);
+  }
+#endif
+  if (n >= 4) {
+    size_t w = n >= 8 ? 8 : 4;
+    uint64_t x = ascii_load(s, n), y = ascii_load(s + n - w, n);
+    uint64_t x_bits = ascii_case_bits_swar(x, lo);
+    uint64_t y_bits = ascii_case_bits_swar(y, lo);
+    x = upper ? x & ~x_bits : x | x_bits;
+    y = upper ? y & ~y_bits : y | y_bits;
+    ascii_store(s, n, x);
+    ascii_store(s + n - w, n, y);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = (unsigned char)s[i];
+    s[i] = (char)(c ^ ((unsigned)(c - lo) < 26) << 5);
+  }
 }
 
-String_View sv_to_upper_sb(String_Builder *sb, String_View sv) {
-  da_reserve(sb, sb->count + sv.count);
-  char *dest = sb->items + sb->count;
+static inline bool ascii_eq_ignore_case_swar(uint64_t x, uint64_t y) {
+  return (x | ascii_case_bits_swar(x, 'A')) ==
+         (y | ascii_case_bits_swar(y, 'A'));
+}
 
-  for (size_t i = 0; i < sv.count; i++) {
-    dest[i] = (char)toupper((unsigned char)sv.data[i]);
+#ifdef __SSE2__
+static inline bool ascii_eq_ignore_case_sse2(const char *a, const char *b) {
+  __m128i va = _mm_loadu_si128((const void *)a);
+  __m128i vb = _mm_loadu_si128((const void *)b);
+  va = _mm_or_si128(va, ascii_case_bits_sse2(va, 'A'));
+  vb = _mm_or_si128(vb, ascii_case_bits_sse2(vb, 'A'));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) == 0xFFFF;
+}
+#endif
+
+static bool ascii_eq_ignore_case(const char *a, const char *b, size_t n) {
+#ifdef __SSE2__
+  if (n >= 16) {
+    size_t i = 0;
+    for (; i + 16 < n; i += 16) {
+      if (!ascii_eq_ignore_case_sse2(a + i, b + i)) {
+        return false;
+      }
+    }
+    return ascii_eq_ignore_case_sse2(a + n - 16, b + n - 16);
+  }
+#else
+  for (; n > 16; a += 8, b += 8, n -= 8) {
+    if (!ascii_eq_ignore_case_swar(ascii_load(a, 8), ascii_load(b, 8))) {
+      return false;
+    }
+  }
+#endif
+  if (n >= 4) {
+    size_t w = n >= 8 ? 8 : 4;
+    return ascii_eq_ignore_case_swar(ascii_load(a, n), ascii_load(b, n)) &&
+           ascii_eq_ignore_case_swar(ascii_load(a + n - w, n),
+                                     ascii_load(b + n - w, n));
   }
+  unsigned diff = 0;
+  for (size_t i = 0; i < n; i++) {
+    diff |= ascii_lower((unsigned char)a[i]) ^ ascii_lower((unsigned char)b[i]);
+  }
+  return diff == 0;
+}
 
+String_View sv_to_lower_inplace(char *data, size_t count) {
+  ascii_set_case(data, count, false);
+  return sv_from_parts(data, count);
+}
+
+String_View sv_to_lower_sb(String_Builder *sb, String_View sv) {
+  if (!da_reserve(sb, sb->count + sv.count)) {
+    return sv_from_parts(NULL, 0);
+  }
+  char *dest = sb->items + sb->count;
+  memcpy(dest, sv.data, sv.count);
   sb->count += sv.count;
 
+  return sv_to_lower_inplace(dest, sv.count);
+}
+
+String_View sv_to_upper_sb(String_Builder *sb, String_View sv) {
+  if (!da_reserve(sb, sb->count + sv.count)) {
+    return sv_from_parts(NULL, 0);
+  }
+  char *dest = sb->items + sb->count;
+  memcpy(dest, sv.data, sv.count);
+  sb->count += sv.count;
+
+  ascii_set_case(dest, sv.count, true);
   return sv_from_parts(dest, sv.count);
 }
 
@@ -246,48 +603,137 @@ bool sv_starts_with(String_View sv, String_View expected_prefix) {
   return false;
 }
 
+bool sv_eq_ignore_case(String_View a, String_View b) {
+  return a.count == b.count && ascii_eq_ignore_case(a.data, b.data, a.count);
+}
+
+bool sv_starts_with_ignore_case(String_View sv, String_View expected_prefix) {
+  return expected_prefix.count <= sv.count &&
+         ascii_eq_ignore_case(sv.data, expected_prefix.data,
+                              expected_prefix.count);
+}
+
 // ---------- Numeric conversion ----------
 
-// Converts a String_View to int64_t (base 10).
-// Returns true if valid, false on error (invalid character, overflow, or
-// underflow).
-bool sv_to_i64(String_View sv, int64_t *out) {
-  if (sv.count == 0)
-    return false;
+#define DIGITS_ZEROS 0x3030303030303030ull
 
-  size_t i = 0;
-  bool negative = false;
+// All eight bytes are '0'..'9': the high nibble is 3, and adding 6 keeps it 3
+static inline bool eight_digits(uint64_t x) {
+  return ((x & 0xF0F0F0F0F0F0F0F0ull) |
+          (((x + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) ==
+         0x3333333333333333ull;
+}
 
-  if (sv.data[0] == '-') {
-    negative = true;
-    i++;
-  } else if (sv.data[0] == '+') {
-    i++;
+// Value of eight digits, the first one in the lowest byte (a little-endian
+// load). Digit pairs, then groups of four, then the two halves: three
+// multiplies instead of eight.
+static inline uint32_t eight_digits_value(uint64_t x) {
+  x -= DIGITS_ZEROS;
+  x = x * 10 + (x >> 8);
+  x = ((x & 0x000000FF000000FFull) * (100 + (1000000ull << 32)) +
+       ((x >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32))) >>
+      32;
+  return (uint32_t)x;
+}
+
+// 1 to 8 digits as the last of eight, behind '0's. Two loads that overlap
+// in the middle instead of a loop, the bytes they share are the same.
+static inline uint64_t load_digits(const char *s, size_t n) {
+  uint64_t x;
+  if (n >= 4) {
+    uint32_t lo, hi;
+    memcpy(&lo, s, 4);
+    memcpy(&hi, s + n - 4, 4);
+    x = lo | (uint64_t)hi << (8 * (n - 4));
+  } else {
+    x = (uint64_t)(unsigned char)s[0] |
+        (uint64_t)(unsigned char)s[n / 2] << (8 * (n / 2)) |
+        (uint64_t)(unsigned char)s[n - 1] << (8 * (n - 1));
   }
+  unsigned pad = 8 * (unsigned)(8 - n);
+  return pad == 0 ? x : x << pad | DIGITS_ZEROS >> (64 - pad);
+}
 
-  if (i == sv.count)
-    return false; // only a sign, no digits
+// Plain digits, leading zeros allowed. Up to 19 digits always fit, in at most
+// three steps of eight; only a 20th needs a check and nothing divides.
+static bool parse_decimal(const char *s, size_t n, uint64_t *out) {
+  if (n == 0) {
+    return false;
+  }
+  if (n > 19) {
+    while (n > 1 && s[0] == '0') {
+      s++;
+      n--;
+    }
+  }
+  if (n > 20) {
+    for (size_t i = 0; i < n; i++) {
+      if ((unsigned)(unsigned char)s[i] - '0' > 9) {
+        return false;
+      }
+    }
+    errno = ERANGE;
+    return false;
+  }
 
-  uint64_t result = 0;
-  for (; i < sv.count; i++) {
-    char c = sv.data[i];
-    if (c < '0' || c > '9') {
-      return false; // not a decimal digit
+  size_t safe = n < 19 ? n : 19;
+  size_t i = (safe - 1) % 8 + 1;
+  uint64_t x = load_digits(s, i);
+  if (!eight_digits(x)) {
+    return false;
+  }
+  uint64_t result = eight_digits_value(x);
+  for (; i < safe; i += 8) {
+    memcpy(&x, s + i, 8);
+    if (!eight_digits(x)) {
+      return false;
     }
-    uint64_t digit = (uint64_t)(c - '0');
+    result = result * 100000000 + eight_digits_value(x);
+  }
 
-    // Overflow check: result * 10 + digit > UINT64_MAX
-    if (result > (UINT64_MAX - digit) / 10) {
+  if (n == 20) {
+    // Fits while the total stays within 18446744073709551615; the
+    // divisions fold into constants
+    unsigned digit = (unsigned)(unsigned char)s[19] - '0';
+    if (digit > 9) {
+      return false;
+    }
+    if (result > UINT64_MAX / 10 ||
+        (result == UINT64_MAX / 10 && digit > UINT64_MAX % 10)) {
       errno = ERANGE;
       return false;
     }
     result = result * 10 + digit;
   }
 
+  *out = result;
+  return true;
+}
+
+bool sv_to_u64(String_View sv, uint64_t *out) {
+  return parse_decimal(sv.data, sv.count, out);
+}
+
+// Converts a String_View to int64_t (base 10).
+// Returns true if valid, false on error (invalid character, overflow, or
+// underflow).
+bool sv_to_i64(String_View sv, int64_t *out) {
+  if (sv.count == 0)
+    return false;
+
+  bool negative = sv.data[0] == '-';
+  if (negative || sv.data[0] == '+') {
+    sv_chop_left(&sv, 1);
+  }
+
+  uint64_t result;
+  if (!parse_decimal(sv.data, sv.count, &result))
+    return false;
+
   if (negative) {
     if (result > (uint64_t)INT64_MAX + 1)
       return false;
-    *out = -(int64_t)result;
+    *out = (int64_t)(0 - result);
   } else {
     if (result > INT64_MAX)
       return false;
@@ -297,6 +743,38 @@ bool sv_to_i64(String_View sv, int64_t *out) {
   return true;
 }
 
+bool sv_to_u64_hex(String_View sv, uint64_t *out) {
+  if (sv.count == 0) {
+    return false;
+  }
+
+  size_t i = 0;
+  while (i < sv.count && sv.data[i] == '0') {
+    i++;
+  }
+  if (sv.count - i > 16) {
+    // Either too big or not hex, tell which like parse_decimal does
+    for (size_t j = i; j < sv.count; j++) {
+      if (hex_digit_value(sv.data[j]) < 0) {
+        return false;
+      }
+    }
+    errno = ERANGE;
+    return false;
+  }
+
+  uint64_t result = 0;
+  for (; i < sv.count; i++) {
+    int digit = hex_digit_value(sv.data[i]);
+    if (digit < 0) {
+      return false;
+    }
+    result = result << 4 | (uint64_t)digit;
+  }
+  *out = result;
+  return true;
+}
+
 // Helper for int32_t
 bool sv_to_i32(String_View sv, int32_t *out) {
   int64_t tmp;
@@ -316,24 +794,37 @@ uint32_t utf8_decode(const char *s, size_t len, size_t *consumed) {
     return 0;
   }
 
-  unsigned char c = (unsigned char)s[0];
+  const unsigned char *u = (const unsigned char *)s;
+  unsigned char c = u[0];
   if (c < 0x80) { // 1 byte ASCII
     *consumed = 1;
     return c;
-  } else if ((c >> 5) == 0x6 && len >= 2) { // 2 bytes
-    *consumed = 2;
-    return ((c & 0x1F) << 6) | (s[1] & 0x3F);
-  } else if ((c >> 4) == 0xE && len >= 3) { // 3 bytes
-    *consumed = 3;
-    return ((c & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
-  } else if ((c >> 3) == 0x1E && len >= 4) { // 4 bytes
-    *consumed = 4;
-    return ((c & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) |
-           (s[3] & 0x3F);
-  } else {
+  }
+
+  // Length, payload of the lead byte and the smallest code point the length
+  // is for: anything below it is an overlong form
+  size_t n = 0;
+  uint32_t cp = 0, min = 0;
+  if ((c >> 5) == 0x6) { // 2 bytes
+    n = 2, cp = c & 0x1F, min = 0x80;
+  } else if ((c >> 4) == 0xE) { // 3 bytes
+    n = 3, cp = c & 0x0F, min = 0x800;
+  } else if ((c >> 3) == 0x1E) { // 4 bytes
+    n = 4, cp = c & 0x07, min = 0x10000;
+  }
+
+  bool valid = n > 0 && len >= n;
+  for (size_t i = 1; valid && i < n; i++) {
+    valid = (u[i] & 0xC0) == 0x80;
+    cp = (cp << 6) | (u[i] & 0x3F);
+  }
+  if (!valid || cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
     *consumed = 1;
     return 0xFFFD; // replacement character
   }
+
+  *consumed = n;
+  return cp;
 }
 
 size_t utf8_encode(uint32_t cp, char out[4]) {
@@ -373,3 +864,327 @@ size_t utf8_len(const char *data, size_t nbytes) {
   }
   return count;
 }
+
+// ---------- UTF-8, bulk ----------
+
+// x86 kernels are compiled for their instruction set whatever the build
+// flags, and picked at run time from what the CPU has
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UTF8_X86 1
+#include <immintrin.h>
+#else
+#define UTF8_X86 0
+#endif
+
+#define UTF8_ASCII_MASK 0x8080808080808080ull
+
+static bool utf8_validate_scalar(const unsigned char *s, size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    uint64_t x;
+    if (n - i >= 8 && (memcpy(&x, s + i, 8), (x & UTF8_ASCII_MASK) == 0)) {
+      i += 8;
+      continue;
+    }
+    if (s[i] < 0x80) {
+      i++;
+      continue;
+    }
+
+    size_t consumed;
+    if (utf8_decode((const char *)s + i, n - i, &consumed) == 0xFFFD &&
+        consumed == 1) {
+      return false;
+    }
+    i += consumed;
+  }
+  return true;
+}
+
+#if UTF8_X86
+
+// Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per
+// Byte". Every byte is checked against the one before it with three 16-entry
+// lookups (high nibble of the previous byte, its low nibble, high nibble of
+// this one); each table entry is a set of error classes the pair could be in,
+// and the pair is in error when all three agree. Continuations owed to 3 and
+// 4-byte leads further back are checked separately.
+#define UTF8_TOO_SHORT (1 << 0)  // lead or ASCII, then a lead or ASCII
+#define UTF8_TOO_LONG (1 << 1)   // ASCII, then a continuation
+#define UTF8_OVERLONG_3 (1 << 2) // 11100000 100_____
+#define UTF8_TOO_LARGE (1 << 3)  // 11110100 1001____ and up
+#define UTF8_SURROGATE (1 << 4)  // 11101101 101_____
+#define UTF8_OVERLONG_2 (1 << 5) // 1100000_ 10______
+#define UTF8_TOO_LARGE_1000 (1 << 6) // 11110101 1000____ and up
+#define UTF8_OVERLONG_4 (1 << 6)     // 11110000 1000____
+#define UTF8_TWO_CONTS (1 << 7)      // continuation, then a continuation
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+static const uint8_t UTF8_BYTE_1_HIGH[16] = {
+    // 0_______ ASCII
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    // 10______ continuation
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    // 1100____, 1101____ 2-byte lead
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2, UTF8_TOO_SHORT,
+    // 1110____ 3-byte lead
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    // 1111____ 4-byte lead
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+static const uint8_t UTF8_BYTE_1_LOW[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4, // 0000
+    UTF8_CARRY | UTF8_OVERLONG_2,                                     // 0001
+    UTF8_CARRY,                                                       // 0010
+    UTF8_CARRY,                                                       // 0011
+    UTF8_CARRY | UTF8_TOO_LARGE,                                      // 0100
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                // 0101
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000, // 1000
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE, // 1101
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+static const uint8_t UTF8_BYTE_2_HIGH[16] = {
+    // 0_______ ASCII
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    // 1000____
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    // 1001____
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE,
+    // 101_____
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+    // 11______ lead
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+// Above these, one of the last three bytes of a block starts a sequence the
+// block does not finish
+static const uint8_t UTF8_INCOMPLETE[32] = {
+    255, 255, 255, 255, 255, 255, 255, 255,  255,  255,  255,
+    255, 255, 255, 255, 255, 255, 255, 255,  255,  255,  255,
+    255, 255, 255, 255, 255, 255, 255, 0xEF, 0xDF, 0xBF,
+};
+
+__attribute__((target("sse4.1"))) static bool
+utf8_validate_sse4(const unsigned char *s, size_t n) {
+  const __m128i byte_1_high = _mm_loadu_si128((const void *)UTF8_BYTE_1_HIGH);
+  const __m128i byte_1_low = _mm_loadu_si128((const void *)UTF8_BYTE_1_LOW);
+  const __m128i byte_2_high = _mm_loadu_si128((const void *)UTF8_BYTE_2_HIGH);
+  const __m128i incomplete_max =
+      _mm_loadu_si128((const void *)(UTF8_INCOMPLETE + 16));
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+
+  __m128i prev = _mm_setzero_si128();
+  __m128i prev_incomplete = _mm_setzero_si128();
+  __m128i error = _mm_setzero_si128();
+
+  for (size_t i = 0; i < n; i += 16) {
+    __m128i in;
+    if (n - i >= 16) {
+      in = _mm_loadu_si128((const void *)(s + i));
+    } else {
+      // Zero padding is ASCII, so a sequence cut short by the end shows up
+      // as TOO_SHORT
+      unsigned char tail[16] = {0};
+      memcpy(tail, s + i, n - i);
+      in = _mm_loadu_si128((const void *)tail);
+    }
+
+    if (_mm_movemask_epi8(in) == 0) {
+      error = _mm_or_si128(error, prev_incomplete);
+      prev_incomplete = _mm_setzero_si128();
+    } else {
+      __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+      __m128i special = _mm_and_si128(
+          _mm_and_si128(
+              _mm_shuffle_epi8(byte_1_high, _mm_and_si128(
+                                                _mm_srli_epi16(prev1, 4), nibble)),
+              _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+          _mm_shuffle_epi8(byte_2_high,
+                           _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+
+      // Continuations owed to a 3-byte lead two back or a 4-byte lead three
+      // back; the lookups flagged every continuation after a continuation
+      __m128i third = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 14),
+                                    _mm_set1_epi8((char)(0xE0 - 0x80)));
+      __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 13),
+                                     _mm_set1_epi8((char)(0xF0 - 0x80)));
+      __m128i must23 = _mm_and_si128(_mm_or_si128(third, fourth),
+                                     _mm_set1_epi8((char)0x80));
+      error = _mm_or_si128(error, _mm_xor_si128(must23, special));
+      prev_incomplete = _mm_subs_epu8(in, incomplete_max);
+    }
+    prev = in;
+  }
+
+  error = _mm_or_si128(error, prev_incomplete);
+  return _mm_testz_si128(error, error);
+}
+
+// The same over 32 bytes. Lookups shuffle within each 128-bit lane, so the
+// tables are in both.
+__attribute__((target("avx2"))) static bool
+utf8_validate_avx2(const unsigned char *s, size_t n) {
+  const __m256i byte_1_high = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const void *)UTF8_BYTE_1_HIGH));
+  const __m256i byte_1_low = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const void *)UTF8_BYTE_1_LOW));
+  const __m256i byte_2_high = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const void *)UTF8_BYTE_2_HIGH));
+  const __m256i incomplete_max =
+      _mm256_loadu_si256((const void *)UTF8_INCOMPLETE);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+  __m256i prev = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+  __m256i error = _mm256_setzero_si256();
+
+  for (size_t i = 0; i < n; i += 32) {
+    __m256i in;
+    if (n - i >= 32) {
+      in = _mm256_loadu_si256((const void *)(s + i));
+    } else {
+      unsigned char tail[32] = {0};
+      memcpy(tail, s + i, n - i);
+      in = _mm256_loadu_si256((const void *)tail);
+    }
+
+    if (_mm256_movemask_epi8(in) == 0) {
+      error = _mm256_or_si256(error, prev_incomplete);
+      prev_incomplete = _mm256_setzero_si256();
+    } else {
+      // Previous block's high lane next to this block's low lane, so
+      // alignr can shift bytes across the lane boundary
+      __m256i carried = _mm256_permute2x128_si256(prev, in, 0x21);
+      __m256i prev1 = _mm256_alignr_epi8(in, carried, 15);
+      __m256i special = _mm256_and_si256(
+          _mm256_and_si256(
+              _mm256_shuffle_epi8(byte_1_high,
+                                  _mm256_and_si256(_mm256_srli_epi16(prev1, 4),
+                                                   nibble)),
+              _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+          _mm256_shuffle_epi8(byte_2_high,
+                              _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+
+      __m256i third = _mm256_subs_epu8(_mm256_alignr_epi8(in, carried, 14),
+                                       _mm256_set1_epi8((char)(0xE0 - 0x80)));
+      __m256i fourth = _mm256_subs_epu8(_mm256_alignr_epi8(in, carried, 13),
+                                        _mm256_set1_epi8((char)(0xF0 - 0x80)));
+      __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                        _mm256_set1_epi8((char)0x80));
+      error = _mm256_or_si256(error, _mm256_xor_si256(must23, special));
+      prev_incomplete = _mm256_subs_epu8(in, incomplete_max);
+    }
+    prev = in;
+  }
+
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error);
+}
+
+// Code points are the bytes that are not continuations, 0x80..0xBF, which
+// as signed bytes are everything up to -65
+__attribute__((target("avx2,popcnt"))) static size_t
+utf8_count_avx2(const unsigned char *s, size_t n, size_t *done) {
+  const __m256i last_cont = _mm256_set1_epi8(-65);
+  size_t count = 0, i = 0;
+  for (; n - i >= 32; i += 32) {
+    __m256i v = _mm256_loadu_si256((const void *)(s + i));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, last_cont));
+    count += (size_t)__builtin_popcount(mask);
+  }
+  *done = i;
+  return count;
+}
+
+#endif // UTF8_X86
+
+bool utf8_validate(const char *data, size_t nbytes) {
+  const unsigned char *s = (const unsigned char *)data;
+#if UTF8_X86
+  if (__builtin_cpu_supports("avx2")) {
+    return utf8_validate_avx2(s, nbytes);
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return utf8_validate_sse4(s, nbytes);
+  }
+#endif
+  return utf8_validate_scalar(s, nbytes);
+}
+
+size_t utf8_count(const char *data, size_t nbytes) {
+  const unsigned char *s = (const unsigned char *)data;
+  size_t count = 0, i = 0;
+#if UTF8_X86
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    count = utf8_count_avx2(s, nbytes, &i);
+  }
+#endif
+  // Eight at a time: a byte is a continuation when its top bits are 10
+  for (; nbytes - i >= 8; i += 8) {
+    uint64_t x;
+    memcpy(&x, s + i, 8);
+    uint64_t cont = x & ~(x << 1) & UTF8_ASCII_MASK;
+    count += 8 - (size_t)__builtin_popcountll(cont);
+  }
+  for (; i < nbytes; i++) {
+    count += (s[i] & 0xC0) != 0x80;
+  }
+  return count;
+}
+
+size_t utf8_to_utf32(const char *data, size_t nbytes, uint32_t *out) {
+  const unsigned char *s = (const unsigned char *)data;
+  size_t i = 0, count = 0;
+  while (i < nbytes) {
+#if UTF8_X86 && defined(__SSE2__)
+    // ASCII runs widen 16 bytes at a time
+    if (nbytes - i >= 16) {
+      __m128i v = _mm_loadu_si128((const void *)(s + i));
+      if (_mm_movemask_epi8(v) == 0) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128((void *)(out + count), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((void *)(out + count + 4),
+                         _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((void *)(out + count + 8),
+                         _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((void *)(out + count + 12),
+                         _mm_unpackhi_epi16(hi, zero));
+        i += 16;
+        count += 16;
+        continue;
+      }
+    }
+#endif
+    if (s[i] < 0x80) {
+      out[count++] = s[i++];
+      continue;
+    }
+
+    size_t consumed;
+    uint32_t cp = utf8_decode(data + i, nbytes - i, &consumed);
+    if (cp == 0xFFFD && consumed == 1) {
+      return SIZE_MAX;
+    }
+    out[count++] = cp;
+    i += consumed;
+  }
+  return count;
+}
@@ -1,58 +1,18 @@
 #ifndef SV_H
 #define SV_H
 
-#include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-#ifdef __cplusplus
-#define DECLTYPE_CAST(T) (decltype(T))
-#else
-#define DECLTYPE_CAST(T)
-#endif // __cplusplus
-
-#define DA_INIT_CAP 256
-
-// ------------------ Dynamic Array Macros ------------------
-
-#define da_reserve(da, expected_capacity)                                      \
-  do {                                                                         \
-    if ((expected_capacity) > (da)->capacity) {                                \
-      if ((da)->capacity == 0) {                                               \
-        (da)->capacity = DA_INIT_CAP;                                          \
-      }                                                                        \
-      while ((expected_capacity) > (da)->capacity) {                           \
-        (da)->capacity *= 2;                                                   \
-      }                                                                        \
-      (da)->items = DECLTYPE_CAST((da)->items)                                 \
-          realloc((da)->items, (da)->capacity * sizeof(*(da)->items));         \
-      assert((da)->items != NULL && "Buy more RAM lol");                       \
-    }                                                                          \
-  } while (0)
-
-#define da_append(da, item)                                                    \
-  do {                                                                         \
-    da_reserve((da), (da)->count + 1);                                         \
-    (da)->items[(da)->count++] = (item);                                       \
-  } while (0)
-
-#define da_append_many(da, new_items, new_items_count)                         \
-  do {                                                                         \
-    da_reserve((da), (da)->count + (new_items_count));                         \
-    memcpy((da)->items + (da)->count, (new_items),                             \
-           (new_items_count) * sizeof(*(da)->items));                          \
-    (da)->count += (new_items_count);                                          \
-  } while (0)
+#include "da.h"
 
 // ------------------ String Builder & View Macros ------------------
 
 typedef struct {
-  char *items;
-  size_t count;
-  size_t capacity;
+  DA_FIELDS(char);
 } String_Builder;
 
 typedef struct {
@@ -60,17 +20,15 @@ typedef struct {
   size_t count;
 } String_View;
 
-#define sb_append_cstr(sb, cstr)                                               \
-  do {                                                                         \
-    const char *s = (cstr);                                                    \
-    size_t n = strlen(s);                                                      \
-    da_append_many(sb, s, n);                                                  \
-  } while (0)
+static inline bool sb_append_cstr(String_Builder *sb, const char *cstr) {
+  size_t n = strlen(cstr);
+  return da_append_many(sb, cstr, n);
+}
 
 #define sb_append_null(sb) da_append_many(sb, "", 1)
 
 // Free the memory allocated by a string builder
-#define sb_free(sb) free((sb).items)
+#define sb_free(sb) da_free(&(sb))
 
 #define sb_to_sv(sb) sv_from_parts((sb).items, (sb).count)
 
@@ -88,9 +46,25 @@ extern "C" {
 #endif
 
 // ---------- String Builder ----------
+// Returns the bytes appended, -1 when out of memory
 int sb_appendf(String_Builder *sb, const char *fmt, ...);
-void sb_path_clean(String_Builder *sb, String_View path);
-void sb_path_clean_absolute(String_Builder *sb, String_View path);
+// Decimal, two digits per step from a table, no format string to walk
+bool sb_append_u64(String_Builder *sb, uint64_t n);
+bool sb_append_i64(String_Builder *sb, int64_t n);
+// The digits of `n` without a terminator. Returns how many.
+size_t sv_format_u64(uint64_t n, char out[20]);
+// Lexical cleanup of `path` into `sb`, which it overwrites. False when out
+// of memory, `sb` then holds part of the path.
+bool sb_path_clean(String_Builder *sb, String_View path);
+bool sb_path_clean_absolute(String_Builder *sb, String_View path);
+
+// ---------- URI ----------
+// sb_path_clean for the path of a request target, in one pass and without
+// allocating: drops the query and fragment and percent-decodes on the way.
+// Fails on malformed escapes, NUL and encoded slashes, or when `out_cap` is
+// below the path length + 1. `out` may alias `uri.data`.
+bool uri_path_clean(String_View uri, char *out, size_t out_cap,
+                    size_t *out_count);
 
 // ---------- String View creation ----------
 String_View sv_from_parts(const char *data, size_t count);
@@ -99,11 +73,16 @@ String_View sv_from_cstr(const char *cstr);
 // ---------- String View manipulation ----------
 String_View sv_chop_left(String_View *sv, size_t n);
 String_View sv_chop_by_delim(String_View *sv, char delim);
+// Whitespace is what isspace() takes in the "C" locale, whatever the locale
 String_View sv_trim_left(String_View sv);
 String_View sv_trim_right(String_View sv);
 String_View sv_trim(String_View sv);
 String_View sv_substr(const String_View *sv, size_t start, size_t len);
 
+// Case mapping is ASCII only, 16 bytes at a time: bytes from 0x80 up are
+// left alone, so UTF-8 survives it
+// The _sb versions return an empty view with NULL data when out of memory
+String_View sv_to_lower_inplace(char *data, size_t count);
 String_View sv_to_lower_sb(String_Builder *sb, String_View sv);
 String_View sv_to_upper_sb(String_Builder *sb, String_View sv);
 
@@ -111,16 +90,39 @@ String_View sv_to_upper_sb(String_Builder *sb, String_View sv);
 bool sv_eq(String_View a, String_View b);
 bool sv_end_with(String_View sv, const char *cstr);
 bool sv_starts_with(String_View sv, String_View expected_prefix);
+// ASCII case-insensitive, for header names and tokens
+bool sv_eq_ignore_case(String_View a, String_View b);
+bool sv_starts_with_ignore_case(String_View sv, String_View expected_prefix);
 
 // ---------- Numeric conversion ----------
+// Whole views only: nothing before or after the digits. Eight digits are
+// checked and converted at a time. Overflow fails with errno = ERANGE.
+// Digits only, as in Content-Length
+bool sv_to_u64(String_View sv, uint64_t *out);
+// An optional sign, then digits
 bool sv_to_i64(String_View sv, int64_t *out);
 bool sv_to_i32(String_View sv, int32_t *out);
+// Hex digits in either case, no "0x", as in a chunk size
+bool sv_to_u64_hex(String_View sv, uint64_t *out);
+// 10^i for every power that fits in a uint64_t
+extern const uint64_t SV_POW10[20];
 
 // ---------- UTF-8 ----------
 uint32_t utf8_decode(const char *s, size_t len, size_t *consumed);
 size_t utf8_encode(uint32_t cp, char out[4]);
 size_t utf8_len(const char *data, size_t nbytes);
 
+// Bulk versions, vectorized where the CPU allows (AVX2, SSE4.1, else 8 bytes
+// at a time). utf8_decode rules: no overlongs, surrogates, truncated
+// sequences or code points past U+10FFFF.
+bool utf8_validate(const char *data, size_t nbytes);
+// Code points in valid UTF-8. On invalid input it counts the bytes that are
+// not continuation bytes, so validate first when that matters.
+size_t utf8_count(const char *data, size_t nbytes);
+// Decodes into `out`, which takes up to `nbytes` code points. Returns how
+// many were written, SIZE_MAX on invalid input.
+size_t utf8_to_utf32(const char *data, size_t nbytes, uint32_t *out);
+
 #ifdef __cplusplus
 }
 #endif
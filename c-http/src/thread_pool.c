@@ -0,0 +1,308 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+// ---------- Completion Queue ----------
+
+bool cq_init(Completion_Queue *cq) {
+  cq->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  atomic_init(&cq->head, NULL);
+  return cq->efd >= 0;
+}
+
+void cq_free(Completion_Queue *cq) {
+  if (cq->efd >= 0) {
+    close(cq->efd);
+  }
+  cq->efd = -1;
+}
+
+void cq_push(Completion_Queue *cq, Job *job) {
+  Job *head = atomic_load_explicit(&cq->head, memory_order_relaxed);
+  do {
+    job->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &cq->head, &head, job, memory_order_release, memory_order_relaxed));
+
+  uint64_t one = 1;
+  ssize_t n = write(cq->efd, &one, sizeof(one));
+  (void)n; // counter saturation is harmless: the reader drains the list anyway
+}
+
+Job *cq_drain(Completion_Queue *cq) {
+  uint64_t count;
+  ssize_t n = read(cq->efd, &count, sizeof(count));
+  (void)n;
+
+  Job *lifo = atomic_exchange_explicit(&cq->head, NULL, memory_order_acquire);
+
+  // The stack hands jobs back newest first, reverse it
+  Job *fifo = NULL;
+  while (lifo) {
+    Job *next = lifo->next;
+    lifo->next = fifo;
+    fifo = lifo;
+    lifo = next;
+  }
+  return fifo;
+}
+
+Job *cq_wait(Completion_Queue *cq) {
+  for (;;) {
+    Job *jobs = cq_drain(cq);
+    if (jobs) {
+      return jobs;
+    }
+
+    struct pollfd pfd = {.fd = cq->efd, .events = POLLIN};
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+      perror("THREAD POOL ERROR: poll");
+      return NULL;
+    }
+  }
+}
+
+// ---------- Work-stealing deque ----------
+
+// Chase-Lev deque (Le et al., "Correct and Efficient Work-Stealing for Weak
+// Memory Models"). The owner pushes and takes at the bottom, thieves steal
+// from the top. Fixed size: when it is full the job goes to the injector.
+#define DEQUE_CAP 1024
+
+typedef struct {
+  _Atomic int64_t top;
+  _Atomic int64_t bottom;
+  _Atomic(Job *) items[DEQUE_CAP];
+} Deque;
+
+static bool deque_push(Deque *d, Job *job) {
+  int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+  if (b - t >= DEQUE_CAP) {
+    return false;
+  }
+  atomic_store_explicit(&d->items[b % DEQUE_CAP], job, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  return true;
+}
+
+static Job *deque_take(Deque *d) {
+  int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+  if (t > b) {
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return NULL; // empty
+  }
+
+  Job *job = atomic_load_explicit(&d->items[b % DEQUE_CAP],
+                                  memory_order_relaxed);
+  if (t == b) {
+    // Last item: race against the thieves for it
+    if (!atomic_compare_exchange_strong_explicit(
+            &d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+      job = NULL;
+    }
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return job;
+}
+
+static Job *deque_steal(Deque *d) {
+  int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+  if (t >= b) {
+    return NULL;
+  }
+
+  Job *job = atomic_load_explicit(&d->items[t % DEQUE_CAP],
+                                  memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(
+          &d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+    return NULL; // lost the race, the caller moves on to another victim
+  }
+  return job;
+}
+
+// ---------- Thread Pool ----------
+
+typedef struct {
+  Thread_Pool *pool;
+  size_t index;
+  pthread_t thread;
+  Deque deque;
+} Worker;
+
+struct Thread_Pool {
+  Worker *workers;
+  size_t count;
+
+  // Injection queue for jobs submitted from outside the pool
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  Job *inject_head;
+  Job *inject_tail;
+
+  _Atomic size_t pending; // queued, not yet picked up
+  bool stop;              // guarded by `lock`
+};
+
+static _Thread_local Worker *current_worker = NULL;
+
+static Job *inject_pop(Thread_Pool *tp) {
+  pthread_mutex_lock(&tp->lock);
+  Job *job = tp->inject_head;
+  if (job) {
+    tp->inject_head = job->next;
+    if (!tp->inject_head) {
+      tp->inject_tail = NULL;
+    }
+    job->next = NULL;
+  }
+  pthread_mutex_unlock(&tp->lock);
+  return job;
+}
+
+static Job *find_job(Worker *self) {
+  Thread_Pool *tp = self->pool;
+
+  Job *job = deque_take(&self->deque);
+  if (job) {
+    return job;
+  }
+
+  for (size_t i = 1; i < tp->count; i++) {
+    Worker *victim = &tp->workers[(self->index + i) % tp->count];
+    job = deque_steal(&victim->deque);
+    if (job) {
+      return job;
+    }
+  }
+
+  return inject_pop(tp);
+}
+
+static void *worker_main(void *arg) {
+  Worker *self = arg;
+  Thread_Pool *tp = self->pool;
+  current_worker = self;
+
+  for (;;) {
+    Job *job = find_job(self);
+    if (job) {
+      atomic_fetch_sub_explicit(&tp->pending, 1, memory_order_relaxed);
+      Completion_Queue *done = job->done;
+      job->run(job);
+      if (done) {
+        cq_push(done, job);
+      }
+      continue;
+    }
+
+    pthread_mutex_lock(&tp->lock);
+    while (atomic_load(&tp->pending) == 0 && !tp->stop) {
+      pthread_cond_wait(&tp->wake, &tp->lock);
+    }
+    bool exit = tp->stop && atomic_load(&tp->pending) == 0;
+    pthread_mutex_unlock(&tp->lock);
+
+    if (exit) {
+      return NULL;
+    }
+  }
+}
+
+Thread_Pool *tp_create(size_t workers) {
+  assert(workers > 0);
+
+  Thread_Pool *tp = calloc(1, sizeof(*tp));
+  if (!tp) {
+    return NULL;
+  }
+
+  tp->workers = calloc(workers, sizeof(*tp->workers));
+  if (!tp->workers) {
+    free(tp);
+    return NULL;
+  }
+
+  pthread_mutex_init(&tp->lock, NULL);
+  pthread_cond_init(&tp->wake, NULL);
+  atomic_init(&tp->pending, 0);
+
+  for (size_t i = 0; i < workers; i++) {
+    Worker *w = &tp->workers[i];
+    w->pool = tp;
+    w->index = i;
+    atomic_init(&w->deque.top, 0);
+    atomic_init(&w->deque.bottom, 0);
+  }
+
+  for (size_t i = 0; i < workers; i++) {
+    if (pthread_create(&tp->workers[i].thread, NULL, worker_main,
+                       &tp->workers[i]) != 0) {
+      perror("THREAD POOL ERROR: pthread_create");
+      tp->count = i;
+      tp_destroy(tp);
+      return NULL;
+    }
+    tp->count = i + 1;
+  }
+
+  return tp;
+}
+
+void tp_submit(Thread_Pool *tp, Job *job) {
+  job->next = NULL;
+  atomic_fetch_add_explicit(&tp->pending, 1, memory_order_relaxed);
+
+  Worker *self = current_worker;
+  bool local = self && self->pool == tp && deque_push(&self->deque, job);
+
+  pthread_mutex_lock(&tp->lock);
+  if (!local) {
+    if (tp->inject_tail) {
+      tp->inject_tail->next = job;
+    } else {
+      tp->inject_head = job;
+    }
+    tp->inject_tail = job;
+  }
+  pthread_cond_signal(&tp->wake);
+  pthread_mutex_unlock(&tp->lock);
+}
+
+void tp_destroy(Thread_Pool *tp) {
+  if (!tp) {
+    return;
+  }
+
+  pthread_mutex_lock(&tp->lock);
+  tp->stop = true;
+  pthread_cond_broadcast(&tp->wake);
+  pthread_mutex_unlock(&tp->lock);
+
+  for (size_t i = 0; i < tp->count; i++) {
+    pthread_join(tp->workers[i].thread, NULL);
+  }
+
+  pthread_cond_destroy(&tp->wake);
+  pthread_mutex_destroy(&tp->lock);
+  free(tp->workers);
+  free(tp);
+}
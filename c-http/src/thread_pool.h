@@ -0,0 +1,61 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// ------------------ Jobs ------------------
+
+// Jobs are intrusive: embed a Job as the first member of your own struct and
+// cast back inside `run`. The pool never allocates or frees jobs.
+typedef struct Job Job;
+typedef void (*Job_Fn)(Job *job);
+
+typedef struct Completion_Queue Completion_Queue;
+
+struct Job {
+  Job_Fn run;
+  Completion_Queue *done; // where the job is posted after `run` (optional)
+  Job *next;              // intrusive link, owned by whichever queue holds it
+};
+
+// ------------------ Completion Queue ------------------
+
+// Multi-producer, single-consumer. Workers push finished jobs and bump the
+// eventfd; the loop that owns the connection polls `efd` and drains.
+struct Completion_Queue {
+  int efd;
+  _Atomic(Job *) head;
+};
+
+// ------------------ Thread Pool ------------------
+
+typedef struct Thread_Pool Thread_Pool;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ---------- Completion Queue ----------
+bool cq_init(Completion_Queue *cq);
+void cq_free(Completion_Queue *cq);
+void cq_push(Completion_Queue *cq, Job *job);
+// Takes every finished job, oldest first. Never blocks.
+Job *cq_drain(Completion_Queue *cq);
+// Blocks until at least one job is finished, then drains.
+Job *cq_wait(Completion_Queue *cq);
+
+// ---------- Thread Pool ----------
+Thread_Pool *tp_create(size_t workers);
+// Safe to call from any thread. From a worker the job lands on that worker's
+// own deque, otherwise on the shared injection queue.
+void tp_submit(Thread_Pool *tp, Job *job);
+// Stops the workers after every queued job has run.
+void tp_destroy(Thread_Pool *tp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+                                 unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// ---------- Ring ----------
+
+bool uring_init(Uring *ring, unsigned entries) {
+  memset(ring, 0, sizeof(*ring));
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  ring->fd = sys_io_uring_setup(entries, &p);
+  if (ring->fd < 0) {
+    return false;
+  }
+
+  // Anything without a single mmap (< 5.4) is too old for the rest anyway
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    close(ring->fd);
+    errno = ENOSYS;
+    return false;
+  }
+
+  size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->ring_len = sq_len > cq_len ? sq_len : cq_len;
+  ring->ring_ptr = mmap(NULL, ring->ring_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->ring_ptr == MAP_FAILED) {
+    close(ring->fd);
+    return false;
+  }
+
+  ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    munmap(ring->ring_ptr, ring->ring_len);
+    close(ring->fd);
+    return false;
+  }
+
+  char *ptr = ring->ring_ptr;
+  ring->sq_head = (unsigned *)(ptr + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(ptr + p.sq_off.tail);
+  ring->sq_array = (unsigned *)(ptr + p.sq_off.array);
+  ring->sq_mask = *(unsigned *)(ptr + p.sq_off.ring_mask);
+  ring->sq_entries = p.sq_entries;
+  ring->sqe_tail = *ring->sq_tail;
+
+  ring->cq_head = (unsigned *)(ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(ptr + p.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(ptr + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(ptr + p.cq_off.cqes);
+
+  // SQ slots map 1:1 to SQEs, fill the indirection array once
+  for (unsigned i = 0; i < p.sq_entries; i++) {
+    ring->sq_array[i] = i;
+  }
+
+  return true;
+}
+
+void uring_free(Uring *ring) {
+  if (ring->sqes) {
+    munmap(ring->sqes, ring->sqes_len);
+  }
+  if (ring->ring_ptr) {
+    munmap(ring->ring_ptr, ring->ring_len);
+  }
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (ring->sqe_tail - head >= ring->sq_entries) {
+    return NULL;
+  }
+
+  struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+  ring->sqe_tail++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr) {
+  unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+  __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+  unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  int ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags);
+  return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    return NULL;
+  }
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring *ring) {
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// ---------- Provided buffers ----------
+
+bool uring_buf_ring_init(Uring *ring, Uring_Buf_Ring *br, uint16_t bgid,
+                         unsigned entries, size_t buf_size) {
+  memset(br, 0, sizeof(*br));
+
+  // The kernel masks the ring index, entries must be a power of two
+  if (entries == 0 || (entries & (entries - 1)) != 0) {
+    errno = EINVAL;
+    return false;
+  }
+
+  br->ring_len = entries * sizeof(struct io_uring_buf);
+  br->br = mmap(NULL, br->ring_len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (br->br == MAP_FAILED) {
+    br->br = NULL;
+    return false;
+  }
+
+  br->base = malloc(entries * buf_size);
+  if (!br->base) {
+    munmap(br->br, br->ring_len);
+    br->br = NULL;
+    return false;
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)br->br;
+  reg.ring_entries = entries;
+  reg.bgid = bgid;
+
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    int saved = errno;
+    free(br->base);
+    munmap(br->br, br->ring_len);
+    memset(br, 0, sizeof(*br));
+    errno = saved;
+    return false;
+  }
+
+  br->bgid = bgid;
+  br->entries = entries;
+  br->buf_size = buf_size;
+
+  for (unsigned i = 0; i < entries; i++) {
+    struct io_uring_buf *buf = &br->br->bufs[i];
+    buf->addr = (uint64_t)(uintptr_t)(br->base + i * buf_size);
+    buf->len = (uint32_t)buf_size;
+    buf->bid = (uint16_t)i;
+  }
+  __atomic_store_n(&br->br->tail, (uint16_t)entries, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+void uring_buf_ring_free(Uring *ring, Uring_Buf_Ring *br) {
+  if (!br->br) {
+    return;
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.bgid = br->bgid;
+  sys_io_uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+  free(br->base);
+  munmap(br->br, br->ring_len);
+  memset(br, 0, sizeof(*br));
+}
+
+char *uring_buf(Uring_Buf_Ring *br, uint16_t bid) {
+  return br->base + (size_t)bid * br->buf_size;
+}
+
+void uring_buf_recycle(Uring_Buf_Ring *br, uint16_t bid) {
+  uint16_t tail = br->br->tail;
+  struct io_uring_buf *buf = &br->br->bufs[tail & (br->entries - 1)];
+  buf->addr = (uint64_t)(uintptr_t)uring_buf(br, bid);
+  buf->len = (uint32_t)br->buf_size;
+  buf->bid = bid;
+  __atomic_store_n(&br->br->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+// ---------- Prep helpers ----------
+
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd) {
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+}
+
+void uring_prep_recv_select(struct io_uring_sqe *sqe, int fd, uint16_t bgid,
+                            bool multishot) {
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = bgid;
+  sqe->len = 0; // whole provided buffer
+  if (multishot) {
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+  }
+}
+
+// SQE lengths are 32 bits. Longer ones complete short and the caller goes on
+// from where they stopped.
+static uint32_t uring_len(size_t len) {
+  return len > UINT32_MAX ? UINT32_MAX : (uint32_t)len;
+}
+
+void uring_prep_send(struct io_uring_sqe *sqe, int fd, const void *buf,
+                     size_t len, int flags) {
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = uring_len(len);
+  sqe->msg_flags = (uint32_t)flags;
+}
+
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd,
+                        const struct msghdr *msg, int flags) {
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)msg;
+  sqe->len = 1;
+  sqe->msg_flags = (uint32_t)flags;
+}
+
+void uring_prep_read(struct io_uring_sqe *sqe, int fd, void *buf, size_t len,
+                     uint64_t offset) {
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = uring_len(len);
+  sqe->off = offset;
+}
+
+void uring_prep_poll_add(struct io_uring_sqe *sqe, int fd, unsigned events) {
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+}
+
+void uring_prep_timeout(struct io_uring_sqe *sqe,
+                        struct __kernel_timespec *ts) {
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = (uint64_t)(uintptr_t)ts;
+  sqe->len = 1;
+  sqe->off = 0; // fire on the timer alone, not after n completions
+}
+
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t user_data) {
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = user_data;
+}
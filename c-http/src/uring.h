@@ -0,0 +1,89 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Minimal io_uring wrapper over the raw syscalls (no liburing). Only what the
+// server needs: one ring, one provided-buffer ring, a handful of prep helpers.
+
+typedef struct {
+  int fd;
+
+  // Submission queue
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sqe_tail; // local tail, published on submit
+  struct io_uring_sqe *sqes;
+
+  // Completion queue
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *ring_ptr;
+  size_t ring_len;
+  size_t sqes_len;
+} Uring;
+
+// Kernel-managed pool of receive buffers. The kernel picks one per recv, so a
+// connection only holds a buffer while its data is being handled.
+typedef struct {
+  struct io_uring_buf_ring *br;
+  char *base;
+  size_t ring_len;
+  size_t buf_size;
+  unsigned entries;
+  uint16_t bgid;
+} Uring_Buf_Ring;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ---------- Ring ----------
+bool uring_init(Uring *ring, unsigned entries);
+void uring_free(Uring *ring);
+// NULL when the submission queue is full; submit and retry.
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr);
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+
+// ---------- Provided buffers ----------
+bool uring_buf_ring_init(Uring *ring, Uring_Buf_Ring *br, uint16_t bgid,
+                         unsigned entries, size_t buf_size);
+void uring_buf_ring_free(Uring *ring, Uring_Buf_Ring *br);
+char *uring_buf(Uring_Buf_Ring *br, uint16_t bid);
+// Hands buffer `bid` back to the kernel.
+void uring_buf_recycle(Uring_Buf_Ring *br, uint16_t bid);
+
+// ---------- Prep helpers ----------
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd);
+void uring_prep_recv_select(struct io_uring_sqe *sqe, int fd, uint16_t bgid,
+                            bool multishot);
+void uring_prep_send(struct io_uring_sqe *sqe, int fd, const void *buf,
+                     size_t len, int flags);
+// `msg` and its iovecs must stay valid until the CQE.
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd,
+                        const struct msghdr *msg, int flags);
+void uring_prep_read(struct io_uring_sqe *sqe, int fd, void *buf, size_t len,
+                     uint64_t offset);
+void uring_prep_poll_add(struct io_uring_sqe *sqe, int fd, unsigned events);
+// `ts` is relative and must stay valid until the CQE (res -ETIME).
+void uring_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts);
+// Cancels the request submitted with `user_data`, multishot ones included.
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // URING_H
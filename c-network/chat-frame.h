@@ -0,0 +1,114 @@
+#ifndef CHAT_FRAME_H
+#define CHAT_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../c-http/src/da.h"
+
+// ------------------ Chat framing ------------------
+
+// A chat message is a line: everything up to a '\n', which is not part of it,
+// and a '\r' before the '\n' is dropped as well, so telnet and nc work as
+// clients. A stream read is only bytes, it may end in the middle of a line
+// or hold several, so input goes through a Frame_Buffer that hands out the
+// complete lines and keeps the partial one for the next read:
+//
+//   char *space = frame_space(&fb, 4096);
+//   ssize_t n = recv(fd, space, 4096, 0);
+//   frame_commit(&fb, n);
+//
+//   const char *line;
+//   size_t size;
+//   Frame_Status st;
+//   while ((st = frame_next(&fb, &line, &size)) == FRAME_OK) {
+//     // `line` stays valid until the next frame_space
+//   }
+//   if (st == FRAME_TOO_LONG) {
+//     // more than FRAME_MAX bytes without a '\n', give up on the stream
+//   }
+//
+// Header only, so the server and the client can both include it.
+
+// Longest message, without its line ending
+#define FRAME_MAX 4096
+
+typedef enum {
+  FRAME_NONE,     // no complete line yet
+  FRAME_OK,       // a line came out
+  FRAME_TOO_LONG, // the line at the front is over FRAME_MAX
+} Frame_Status;
+
+typedef struct {
+  DA_FIELDS(char);
+  size_t start;   // first byte not handed out yet
+  size_t scanned; // bytes after `start` known to hold no '\n'
+} Frame_Buffer;
+
+// Room for `n` more bytes at the end, NULL when out of memory. Moves what is
+// left of the last read to the front, so lines handed out before are gone.
+static inline char *frame_space(Frame_Buffer *fb, size_t n) {
+  if (fb->start > 0) {
+    memmove(fb->items, fb->items + fb->start, fb->count - fb->start);
+    fb->count -= fb->start;
+    fb->start = 0;
+  }
+  if (!da_reserve(fb, fb->count + n)) {
+    return NULL;
+  }
+  return fb->items + fb->count;
+}
+
+static inline void frame_commit(Frame_Buffer *fb, size_t n) { fb->count += n; }
+
+static inline Frame_Status frame_next(Frame_Buffer *fb, const char **line,
+                                      size_t *size) {
+  size_t avail = fb->count - fb->start;
+  if (avail == 0) {
+    return FRAME_NONE;
+  }
+  const char *from = fb->items + fb->start;
+  const char *nl = memchr(from + fb->scanned, '\n', avail - fb->scanned);
+  if (!nl) {
+    // Not searched again when the next read comes in
+    fb->scanned = avail;
+    // One over for a '\r' whose '\n' is still on the way
+    return avail > FRAME_MAX + 1 ? FRAME_TOO_LONG : FRAME_NONE;
+  }
+
+  size_t n = (size_t)(nl - from);
+  if (n > 0 && from[n - 1] == '\r') {
+    n--;
+  }
+  if (n > FRAME_MAX) {
+    return FRAME_TOO_LONG;
+  }
+  fb->start += (size_t)(nl - from) + 1;
+  fb->scanned = 0;
+  *line = from;
+  *size = n;
+  return FRAME_OK;
+}
+
+// Lines waiting in the buffer, an upper bound on what frame_next will hand out
+static inline size_t frame_pending(const Frame_Buffer *fb) {
+  size_t lines = 0;
+  if (fb->start == fb->count) {
+    return 0;
+  }
+  const char *at = fb->items + fb->start;
+  const char *end = fb->items + fb->count;
+  while ((at = memchr(at, '\n', (size_t)(end - at))) != NULL) {
+    lines++;
+    at++;
+  }
+  return lines;
+}
+
+static inline void frame_free(Frame_Buffer *fb) {
+  da_free(fb);
+  fb->start = fb->scanned = 0;
+}
+
+#endif // CHAT_FRAME_H
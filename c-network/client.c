@@ -1,5 +1,9 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -10,25 +14,44 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "chat-frame.h"
+
 const char *PORT = "3490";
 const int MAX_DATA_SIZE = 100;
 
+// Lines formatted per send in throughput mode
+#define SEND_BATCH 256
+// Quiet time after which throughput mode stops listening
+#define IDLE_MS 1000
+
+typedef struct {
+  DA_FIELDS(char);
+} Bytes;
+
 int setup_client_socket(char *network, char *port);
 void *get_in_addr(struct sockaddr *sa);
+int run_throughput(int sockfd, long messages);
 
 int main(int argc, char **argv) {
   puts("Hello Client");
 
-  if (argc != 2) {
-    fprintf(stderr, "usage client <hostname>\n");
+  if (argc != 2 && argc != 4) {
+    fprintf(stderr, "usage client <hostname>\n"
+                    "      client <hostname> <port> <messages>\n");
     return 1;
   }
 
-  int sockfd = setup_client_socket(argv[1], (char *)PORT);
+  int sockfd = setup_client_socket(argv[1], argc == 4 ? argv[2] : (char *)PORT);
   if (sockfd < 0) {
     return 1;
   }
 
+  if (argc == 4) {
+    int status = run_throughput(sockfd, strtol(argv[3], NULL, 10));
+    close(sockfd);
+    return status;
+  }
+
   char buf[MAX_DATA_SIZE];
   int num_bytes = recv(sockfd, buf, MAX_DATA_SIZE - 1, 0);
   if (num_bytes < 0) {
@@ -52,7 +75,7 @@ int setup_client_socket(char *network, char *port) {
   hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
 
-  int err = getaddrinfo(network, PORT, &hints, &serv_info);
+  int err = getaddrinfo(network, port, &hints, &serv_info);
   if (err != 0) {
     fprintf(stderr, "ERROR: getaddrinfo error: %s", gai_strerror(err));
     return -1;
@@ -77,9 +100,8 @@ int setup_client_socket(char *network, char *port) {
     break;
   }
 
-  freeaddrinfo(serv_info);
-
   if (p == NULL) {
+    freeaddrinfo(serv_info);
     fprintf(stderr, "CLIENT ERROR: failed to connect");
     return -1;
   }
@@ -88,6 +110,7 @@ int setup_client_socket(char *network, char *port) {
   inet_ntop(p->ai_family, get_in_addr((struct sockaddr *)p->ai_addr),
             server_info, sizeof(server_info));
   printf("CLIENT INFO: connecting to %s\n", server_info);
+  freeaddrinfo(serv_info);
 
   return sockfd;
 }
@@ -99,3 +122,131 @@ void *get_in_addr(struct sockaddr *sa) {
 
   return &(((struct sockaddr_in6 *)sa)->sin6_addr);
 }
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Sends `messages` chat lines as fast as the server takes them, and counts the
+// lines it relays back from other clients until it has been quiet for
+// IDLE_MS. Run two at once against server-chat to measure it both ways.
+int run_throughput(int sockfd, long messages) {
+  int flags = fcntl(sockfd, F_GETFL);
+  if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    perror("CLIENT ERROR: fcntl");
+    return 1;
+  }
+
+  Bytes out = {0};
+  size_t out_sent = 0;
+  Frame_Buffer in = {0};
+  long queued = 0, received = 0;
+  double start = now(), sent_at = start, first_at = 0, last_at = 0;
+  int status = 0;
+
+  for (;;) {
+    if (out_sent == out.count && queued < messages) {
+      da_clear(&out);
+      out_sent = 0;
+      for (int i = 0; i < SEND_BATCH && queued < messages; i++, queued++) {
+        char line[32];
+        int n = snprintf(line, sizeof(line), "message %ld\n", queued);
+        if (!da_append_many(&out, line, (size_t)n)) {
+          fprintf(stderr, "CLIENT ERROR: out of memory\n");
+          status = 1;
+          goto done;
+        }
+      }
+    }
+
+    // Listen without end until something has come in or gone out
+    bool sending = out_sent < out.count;
+    int timeout = sending || (messages == 0 && received == 0) ? -1 : IDLE_MS;
+    struct pollfd pfd = {.fd = sockfd,
+                         .events = POLLIN | (sending ? POLLOUT : 0)};
+    int ready = poll(&pfd, 1, timeout);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("CLIENT ERROR: poll");
+      status = 1;
+      break;
+    }
+    if (ready == 0) {
+      break;
+    }
+
+    if (pfd.revents & POLLOUT) {
+      ssize_t n = send(sockfd, out.items + out_sent, out.count - out_sent,
+                       MSG_NOSIGNAL);
+      if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        perror("CLIENT ERROR: socket send");
+        status = 1;
+        break;
+      }
+      if (n > 0) {
+        out_sent += (size_t)n;
+        if (out_sent == out.count && queued == messages) {
+          sent_at = now();
+        }
+      }
+    }
+
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+      for (;;) {
+        char *space = frame_space(&in, 4096);
+        if (!space) {
+          fprintf(stderr, "CLIENT ERROR: out of memory\n");
+          status = 1;
+          goto done;
+        }
+        ssize_t n = recv(sockfd, space, 4096, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          break;
+        }
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          if (n < 0) {
+            perror("CLIENT ERROR: socket recv");
+          } else {
+            fprintf(stderr, "CLIENT ERROR: server hung up\n");
+          }
+          status = 1;
+          goto done;
+        }
+
+        frame_commit(&in, (size_t)n);
+        const char *line;
+        size_t size;
+        Frame_Status st;
+        while ((st = frame_next(&in, &line, &size)) == FRAME_OK) {
+          received++;
+        }
+        if (st == FRAME_TOO_LONG) {
+          fprintf(stderr, "CLIENT ERROR: message over %d bytes\n", FRAME_MAX);
+          status = 1;
+          goto done;
+        }
+        last_at = now();
+        first_at = first_at > 0 ? first_at : last_at;
+      }
+    }
+  }
+
+done:
+  if (messages > 0) {
+    printf("CLIENT INFO: sent %ld messages in %.3fs (%.0f/s)\n", queued,
+           sent_at - start, (double)queued / (sent_at - start));
+  }
+  printf("CLIENT INFO: received %ld messages in %.3fs (%.0f/s)\n", received,
+         last_at - first_at,
+         last_at > first_at ? (double)received / (last_at - first_at) : 0.0);
+  da_free(&out);
+  frame_free(&in);
+  return status;
+}
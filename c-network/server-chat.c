@@ -1,141 +1,909 @@
+#define _GNU_SOURCE // accept4
 #include <arpa/inet.h>
-#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <netdb.h>
 #include <netinet/in.h>
-#include <sys/poll.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "../c-http/src/da.h"
+#include "chat-frame.h"
 #include "server.h"
 
-#define da_reserve(da, expected_capacity)                                      \
-  do {                                                                         \
-    if ((expected_capacity) > (da)->capacity) {                                \
-      if ((da)->capacity == 0) {                                               \
-        (da)->capacity = 256;                                                  \
-      }                                                                        \
-      while ((expected_capacity) > (da)->capacity) {                           \
-        (da)->capacity *= 2;                                                   \
-      }                                                                        \
-      (da)->items =                                                            \
-          realloc((da)->items, (da)->capacity * sizeof(*(da)->items));         \
-    }                                                                          \
-  } while (0)
-
-#define da_append(da, item)                                                    \
-  do {                                                                         \
-    da_reserve((da), (da)->count + 1);                                         \
-    (da)->items[(da)->count++] = (item);                                       \
-  } while (0)
-
-#define da_remove_unordered(da, i)                                             \
-  do {                                                                         \
-    size_t j = (i);                                                            \
-    (da)->items[j] = (da)->items[--(da)->count];                               \
-  } while (0)
+// Clients are sharded across threads. Each shard has its own edge-triggered
+// epoll set, all of them wait on the listening socket, and whichever shard
+// accepts a client owns it for good: its socket, its queues and its place in
+// a room are only ever touched by that thread. Every socket is non-blocking
+// and every client has its own output queue, so a client that reads slowly
+// only grows its own queue. Past CLIENT_OUT_MAX bytes it is disconnected
+// instead of holding the room back.
+//
+// A broadcast is formatted once into a refcounted Message. The posting shard
+// hands a pointer to it to each of its own members of the room, and posts it
+// to the inbox of every other shard with members there. Inboxes are lock-free
+// queues with many producers and one consumer, and an eventfd wakes the
+// consumer. Queues are written out after the loop has handled every event,
+// one gathered sendmsg per client for all that piled up meanwhile. To keep
+// those batches inside CLIENT_OUT_MAX, a client gets READ_BUDGET reads per
+// iteration and an inbox INBOX_BUDGET posts, the rest waits for the next one.
+//
+// Messages are lines (see chat-frame.h). Each client's input collects in a
+// Frame_Buffer until a line is complete, and every line one read completes
+// goes out together as a single message. The line "/join <room>" moves the
+// client to another room, everyone starts in ROOM_LOBBY. A room lives while
+// it has members or posts on their way to it, so names clients make up do not
+// pile up.
+
+// Queued bytes a client may fall behind by before it is dropped
+#define CLIENT_OUT_MAX (256 * 1024)
+#define MAX_EVENTS 256
+#define RECV_SIZE 4096
+// Reads a client gets per loop iteration
+#define READ_BUDGET 8
+// Posts a shard takes from its inbox per loop iteration
+#define INBOX_BUDGET 32
+// Connections a shard takes per loop iteration, the others get the rest
+#define ACCEPT_BUDGET 16
+// Messages gathered into one sendmsg
+#define FLUSH_IOV 64
+
+// Sets of shards are 64 bit masks
+#define SHARD_MAX 64
+
+#define ROOM_LOBBY "lobby"
+#define ROOM_NAME_MAX 32
+#define ROOM_SLOTS 1024 // power of two
+#define ROOM_MAX (ROOM_SLOTS / 4 * 3)
 
 typedef struct {
-  struct pollfd *items;
+  atomic_size_t refs; // queues and inboxes still holding it
   size_t count;
-  size_t capacity;
+  char data[];
+} Message;
+
+typedef struct {
+  DA_FIELDS(Message *);
+  size_t head;   // first message not completely sent
+  size_t offset; // bytes of `items[head]` already sent
+  size_t bytes;  // unsent bytes, held against CLIENT_OUT_MAX
+} Out_Queue;
+
+typedef struct Room Room;
+
+typedef struct Client {
+  int fd;
+  bool pending; // in `pending`, to be flushed at the end of this iteration
+  bool unread;  // in `unread`, has input left from an earlier iteration
+  Room *room;
+  struct Client *prev, *next; // members of `room` on the same shard
+  Frame_Buffer in;
+  Out_Queue out;
+} Client;
+
+// Made on first join, freed with its last reference
+struct Room {
+  uint64_t hash;
+  atomic_size_t refs;         // members on every shard plus posts in flight
+  _Atomic uint64_t shards;    // bit i: shard i has members here
+  Client *members[SHARD_MAX]; // per shard, only touched by that shard
+  struct Room *bucket_next;   // under rooms_lock
+  size_t len;
+  char name[];
+};
+
+typedef struct {
+  DA_FIELDS(int);
+} Fds;
+
+// Indexed by fd, NULL where the shard has no client
+typedef struct {
+  DA_FIELDS(Client *);
 } Clients;
 
-static void handle_new_connection(int listener, Clients *clients);
-static void handle_broadcast(int listener, Clients *clients, int sender_fd,
-                             char *buf, int nbytes);
+// A message on its way to another shard's members of `room`
+typedef struct Post {
+  _Atomic(struct Post *) next;
+  Room *room;
+  Message *msg;
+} Post;
+
+// Intrusive queue with many producers and one consumer. A producer swaps its
+// post in at `in` and then links the one before to it, the consumer follows
+// `next` from `out`. `stub` keeps the queue from ever being empty.
+typedef struct {
+  _Atomic(Post *) in;
+  Post *out;
+  Post stub;
+} Inbox;
+
+typedef struct {
+  int id;
+  int epfd;
+  int wake_fd;
+  atomic_bool woken; // wake_fd written and not yet read
+  bool inbox_ready;  // woken, and posts may be left
+  Inbox inbox;
+  Clients clients;
+  Fds pending; // clients with new messages queued
+  Fds unread;  // clients that ran out of budget with input left
+  pthread_t thread;
+} Shard;
+
+static void handle_new_connections(Shard *s);
+static void handle_readable(Shard *s, Client *client);
+static void handle_unread(Shard *s);
+static bool handle_frames(Shard *s, Client *sender);
+static void handle_command(Shard *s, Client *client, const char *line,
+                           size_t size);
+static void handle_wake(Shard *s);
+static void handle_inbox(Shard *s);
 
 char *HOST = NULL;
 char *PORT = "9034";
-int BACKLOG = 10;
+int BACKLOG = SOMAXCONN;
 
-int main(int argc, char **argv) {
-  puts("Starting chat...");
+static Shard shards[SHARD_MAX];
+static int shard_count = 0;
+static int listener = -1;
+static atomic_size_t client_count = 0;
 
-  int listener = setup_server_socket(HOST, PORT, BACKLOG);
-  if (listener == -1) {
-    fprintf(stderr, "SERVER ERROR: error getting listening socket\n");
-    return 1;
+// Only /join and the last reference to a room go through the lock, messages
+// hold their rooms by pointer
+static pthread_mutex_t rooms_lock = PTHREAD_MUTEX_INITIALIZER;
+static Room *rooms[ROOM_SLOTS];
+static size_t room_count = 0;
+static uint64_t room_seed = 0;
+static Room *lobby = NULL; // holds a reference of its own, never freed
+
+// ---------- Setup ----------
+
+// Each client is an fd, so the soft limit is what caps the room
+static void raise_fd_limit(void) {
+  struct rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+    lim.rlim_cur = lim.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &lim) < 0) {
+      perror("SERVER ERROR: setrlimit");
+    }
   }
+}
 
-  Clients clients = {0};
-  da_append(&clients, ((struct pollfd){.fd = listener, .events = POLLIN}));
+static bool set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
 
-  for (;;) {
-    int poll_count = poll(clients.items, clients.count, -1);
-    if (poll_count == -1) {
-      perror("SERVER ERROR: poll");
-      return -1;
+// ---------- Messages ----------
+
+static Message *message_new(size_t capacity) {
+  Message *msg = malloc(sizeof(*msg) + capacity);
+  if (msg) {
+    atomic_init(&msg->refs, 0);
+    msg->count = 0;
+  }
+  return msg;
+}
+
+static void message_ref(Message *msg) {
+  atomic_fetch_add_explicit(&msg->refs, 1, memory_order_relaxed);
+}
+
+static void message_unref(Message *msg) {
+  if (atomic_fetch_sub_explicit(&msg->refs, 1, memory_order_acq_rel) == 1) {
+    free(msg);
+  }
+}
+
+// ---------- Rooms ----------
+
+// Keyed so clients cannot pick names that share a bucket on purpose
+static uint64_t room_hash(const char *name, size_t len) {
+  uint64_t h = 0xCBF29CE484222325ull ^ room_seed;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (unsigned char)name[i]) * 0x100000001B3ull;
+  }
+  return h;
+}
+
+// A reference to the room called `name`, made if it is new. NULL once there
+// are ROOM_MAX or when out of memory.
+static Room *room_get(const char *name, size_t len) {
+  uint64_t h = room_hash(name, len);
+  Room **bucket = &rooms[h & (ROOM_SLOTS - 1)];
+
+  pthread_mutex_lock(&rooms_lock);
+  Room *r = *bucket;
+  while (r && !(r->hash == h && r->len == len &&
+                memcmp(r->name, name, len) == 0)) {
+    r = r->bucket_next;
+  }
+  if (r) {
+    atomic_fetch_add(&r->refs, 1);
+  } else if (room_count < ROOM_MAX &&
+             (r = calloc(1, sizeof(*r) + len + 1)) != NULL) {
+    r->hash = h;
+    atomic_init(&r->refs, 1);
+    r->len = len;
+    memcpy(r->name, name, len);
+    r->bucket_next = *bucket;
+    *bucket = r;
+    room_count++;
+  }
+  pthread_mutex_unlock(&rooms_lock);
+  return r;
+}
+
+// For a holder of another reference, which keeps the count above zero
+static void room_ref(Room *room) { atomic_fetch_add(&room->refs, 1); }
+
+// The last reference is dropped under the lock, so room_get cannot hand the
+// room out again while it goes
+static void room_unref(Room *room) {
+  size_t refs = atomic_load(&room->refs);
+  while (refs > 1) {
+    if (atomic_compare_exchange_weak(&room->refs, &refs, refs - 1)) {
+      return;
+    }
+  }
+
+  pthread_mutex_lock(&rooms_lock);
+  if (atomic_fetch_sub(&room->refs, 1) == 1) {
+    Room **link = &rooms[room->hash & (ROOM_SLOTS - 1)];
+    while (*link != room) {
+      link = &(*link)->bucket_next;
+    }
+    *link = room->bucket_next;
+    room_count--;
+    free(room);
+  }
+  pthread_mutex_unlock(&rooms_lock);
+}
+
+// Takes over the caller's reference to `room`
+static void room_enter(Shard *s, Client *client, Room *room) {
+  Client **head = &room->members[s->id];
+  if (!*head) {
+    // First member on this shard, from now on other shards post here
+    atomic_fetch_or(&room->shards, 1ull << s->id);
+  }
+  client->room = room;
+  client->prev = NULL;
+  client->next = *head;
+  if (*head) {
+    (*head)->prev = client;
+  }
+  *head = client;
+}
+
+static void room_leave(Shard *s, Client *client) {
+  Room *room = client->room;
+  if (client->prev) {
+    client->prev->next = client->next;
+  } else {
+    room->members[s->id] = client->next;
+  }
+  if (client->next) {
+    client->next->prev = client->prev;
+  }
+  if (!room->members[s->id]) {
+    atomic_fetch_and(&room->shards, ~(1ull << s->id));
+  }
+  client->room = NULL;
+  client->prev = client->next = NULL;
+  room_unref(room);
+}
+
+// ---------- Inboxes ----------
+
+static void inbox_init(Inbox *box) {
+  atomic_init(&box->stub.next, NULL);
+  atomic_init(&box->in, &box->stub);
+  box->out = &box->stub;
+}
+
+// From any thread
+static void inbox_push(Inbox *box, Post *post) {
+  atomic_store_explicit(&post->next, NULL, memory_order_relaxed);
+  Post *prev = atomic_exchange_explicit(&box->in, post, memory_order_acq_rel);
+  atomic_store_explicit(&prev->next, post, memory_order_release);
+}
+
+// From the owning shard only. NULL when empty, and also when the next post
+// is still being linked in: its producer's wakeup comes after that.
+static Post *inbox_pop(Inbox *box) {
+  Post *out = box->out;
+  Post *next = atomic_load_explicit(&out->next, memory_order_acquire);
+  if (out == &box->stub) {
+    if (!next) {
+      return NULL;
+    }
+    box->out = out = next;
+    next = atomic_load_explicit(&out->next, memory_order_acquire);
+  }
+  if (next) {
+    box->out = next;
+    return out;
+  }
+
+  // `out` is the last post. It can only be handed out with something behind
+  // it, so the stub goes in again.
+  if (out != atomic_load_explicit(&box->in, memory_order_acquire)) {
+    return NULL;
+  }
+  inbox_push(box, &box->stub);
+  next = atomic_load_explicit(&out->next, memory_order_acquire);
+  if (next) {
+    box->out = next;
+    return out;
+  }
+  return NULL;
+}
+
+// From any thread. One write per wakeup, however many posts it is for.
+static void shard_wake(Shard *s) {
+  if (!atomic_exchange(&s->woken, true)) {
+    uint64_t one = 1;
+    if (write(s->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+      perror("SERVER ERROR: eventfd write");
+    }
+  }
+}
+
+// ---------- Clients ----------
+
+static Client *client_get(Shard *s, int fd) {
+  return fd >= 0 && (size_t)fd < s->clients.count ? s->clients.items[fd]
+                                                  : NULL;
+}
+
+static Client *client_add(Shard *s, int fd) {
+  size_t needed = (size_t)fd + 1;
+  if (needed > s->clients.count) {
+    if (!da_reserve(&s->clients, needed)) {
+      return NULL;
+    }
+    memset(s->clients.items + s->clients.count, 0,
+           (needed - s->clients.count) * sizeof(*s->clients.items));
+    s->clients.count = needed;
+  }
+
+  Client *client = calloc(1, sizeof(*client));
+  if (!client) {
+    return NULL;
+  }
+  client->fd = fd;
+
+  // Both directions at once: with edge triggering EPOLLOUT only fires when a
+  // full socket buffer drains, which is exactly when a queue needs flushing
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                           .data.fd = fd};
+  if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    perror("SERVER ERROR: epoll_ctl");
+    free(client);
+    return NULL;
+  }
+
+  s->clients.items[fd] = client;
+  atomic_fetch_add(&client_count, 1);
+  room_ref(lobby);
+  room_enter(s, client, lobby);
+  return client;
+}
+
+// ---------- Output queues ----------
+
+static void client_close(Shard *s, Client *client, const char *reason) {
+  printf("SERVER INFO: socket %d %s\n", client->fd, reason);
+  room_leave(s, client);
+  // Closing removes it from the epoll set as well
+  close(client->fd);
+  s->clients.items[client->fd] = NULL;
+  atomic_fetch_sub(&client_count, 1);
+  Out_Queue *out = &client->out;
+  for (size_t i = out->head; i < out->count; i++) {
+    message_unref(out->items[i]);
+  }
+  da_free(out);
+  frame_free(&client->in);
+  free(client);
+}
+
+// Drops `sent` bytes from the front of the queue, releasing the messages
+// that are done
+static void out_consume(Out_Queue *out, size_t sent) {
+  out->bytes -= sent;
+  while (sent > 0) {
+    Message *msg = out->items[out->head];
+    size_t left = msg->count - out->offset;
+    if (sent < left) {
+      out->offset += sent;
+      return;
+    }
+    sent -= left;
+    message_unref(msg);
+    out->head++;
+    out->offset = 0;
+  }
+}
+
+// Writes as much of the queue as the socket takes, up to FLUSH_IOV messages
+// per call. False when the connection is broken.
+static bool client_flush(Client *client) {
+  Out_Queue *out = &client->out;
+  while (out->head < out->count) {
+    struct iovec iov[FLUSH_IOV];
+    size_t n = 0;
+    for (size_t i = out->head; i < out->count && n < FLUSH_IOV; i++, n++) {
+      size_t skip = i == out->head ? out->offset : 0;
+      iov[n] = (struct iovec){.iov_base = out->items[i]->data + skip,
+                              .iov_len = out->items[i]->count - skip};
+    }
+
+    // sendmsg rather than writev for MSG_NOSIGNAL
+    struct msghdr mh = {.msg_iov = iov, .msg_iovlen = n};
+    ssize_t sent = sendmsg(client->fd, &mh, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return false;
+    }
+    out_consume(out, (size_t)sent);
+  }
+
+  if (out->head == out->count) {
+    out->head = out->count = 0;
+  } else if (out->head > out->count / 2) {
+    // Keep the unsent tail at the front so the queue does not creep
+    memmove(out->items, out->items + out->head,
+            (out->count - out->head) * sizeof(*out->items));
+    out->count -= out->head;
+    out->head = 0;
+  }
+  return true;
+}
+
+// Queues a reference to `msg`, to go out with the next flush. False when the
+// client is too far behind or out of memory.
+static bool client_push(Shard *s, Client *client, Message *msg) {
+  Out_Queue *out = &client->out;
+  if (out->bytes + msg->count > CLIENT_OUT_MAX) {
+    return false;
+  }
+  if (!client->pending) {
+    if (!da_append(&s->pending, client->fd)) {
+      return false;
+    }
+    client->pending = true;
+  }
+  if (!da_append(out, msg)) {
+    return false;
+  }
+  message_ref(msg);
+  out->bytes += msg->count;
+  return true;
+}
+
+// A line from the server to `client` alone. Dropped when the client is that
+// far behind, the next broadcast disconnects it.
+static void client_notice(Shard *s, Client *client, const char *text) {
+  size_t len = strlen(text);
+  Message *msg = message_new(len);
+  if (!msg) {
+    return;
+  }
+  memcpy(msg->data, text, len);
+  msg->count = len;
+  message_ref(msg);
+  client_push(s, client, msg);
+  message_unref(msg);
+}
+
+// Once per loop iteration, after every event is handled
+static void flush_pending(Shard *s) {
+  for (size_t i = 0; i < s->pending.count; i++) {
+    // Looked up by fd: it may have been closed since it was queued
+    Client *client = client_get(s, s->pending.items[i]);
+    if (!client || !client->pending) {
+      continue;
+    }
+    client->pending = false;
+    if (!client_flush(client)) {
+      client_close(s, client, "failed");
+    }
+  }
+  da_clear(&s->pending);
+}
+
+// ---------- Broadcast ----------
+
+// Hands `msg` to this shard's members of `room`, all but `sender`
+static void room_deliver(Shard *s, Room *room, Client *sender, Message *msg) {
+  Client *next;
+  for (Client *dest = room->members[s->id]; dest; dest = next) {
+    // Saved first: closing `dest` unlinks it
+    next = dest->next;
+    if (dest != sender && !client_push(s, dest, msg)) {
+      client_close(s, dest, "too slow, disconnected");
     }
+  }
+}
+
+// To everyone in the sender's room: on this shard directly, on the others
+// through their inboxes
+static void room_post(Shard *s, Client *sender, Message *msg) {
+  Room *room = sender->room;
+  // Held while fanning out, so a recipient dropped on the way cannot free it
+  message_ref(msg);
+
+  uint64_t others = atomic_load(&room->shards) & ~(1ull << s->id);
+  while (others) {
+    int id = __builtin_ctzll(others);
+    others &= others - 1;
+    Post *post = malloc(sizeof(*post));
+    if (!post) {
+      fprintf(stderr, "SERVER ERROR: out of memory, dropping a message\n");
+      continue;
+    }
+    post->room = room;
+    post->msg = msg;
+    room_ref(room);
+    message_ref(msg);
+    inbox_push(&shards[id].inbox, post);
+    shard_wake(&shards[id]);
+  }
+
+  room_deliver(s, room, sender, msg);
+  message_unref(msg);
+}
+
+// ---------- Main loop ----------
 
-    for (int i = 0; i < clients.count; i++) {
-      if (!(clients.items[i].revents & (POLLIN | POLLHUP))) {
+static void *shard_run(void *arg) {
+  Shard *s = arg;
+  struct epoll_event events[MAX_EVENTS];
+  for (;;) {
+    // Input and posts left over are not signalled again, do not sleep on them
+    bool more = s->unread.count > 0 || s->inbox_ready;
+    int n = epoll_wait(s->epfd, events, MAX_EVENTS, more ? 0 : -1);
+    if (n < 0) {
+      if (errno == EINTR) {
         continue;
       }
+      perror("SERVER ERROR: epoll_wait");
+      exit(1);
+    }
 
-      if (clients.items[i].fd == listener) {
-        handle_new_connection(listener, &clients);
+    handle_unread(s);
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      uint32_t what = events[i].events;
+      if (fd == listener) {
+        handle_new_connections(s);
+        continue;
+      }
+      if (fd == s->wake_fd) {
+        handle_wake(s);
         continue;
       }
 
-      int sender_fd = clients.items[i].fd;
-      char buf[256];
-      int nbytes = recv(clients.items[i].fd, buf, sizeof(buf), 0);
-      if (nbytes <= 0) {
-        if (nbytes < 0) {
-          perror("SERVER ERROR: error recv");
-        } else {
-          printf("SERVER INFO: socket %d hung up\n", sender_fd);
-        }
-        close(clients.items[i].fd);
-        da_remove_unordered(&clients, i);
-        i--;
+      // Looked up by fd: an earlier event in this batch may have closed it
+      Client *client = client_get(s, fd);
+      if (!client) {
+        continue;
+      }
+      if (what & EPOLLERR) {
+        client_close(s, client, "failed");
+        continue;
+      }
+      if ((what & EPOLLOUT) && !client_flush(client)) {
+        client_close(s, client, "failed");
         continue;
       }
+      if ((what & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !client->unread) {
+        handle_readable(s, client);
+      }
+    }
+
+    handle_inbox(s);
+    flush_pending(s);
+  }
+  return NULL;
+}
+
+static bool shard_init(Shard *s, int id) {
+  s->id = id;
+  inbox_init(&s->inbox);
+  atomic_init(&s->woken, false);
+  s->epfd = epoll_create1(EPOLL_CLOEXEC);
+  s->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (s->epfd < 0 || s->wake_fd < 0) {
+    return false;
+  }
+
+  struct epoll_event wake = {.events = EPOLLIN | EPOLLET,
+                             .data.fd = s->wake_fd};
+  // Level triggered and exclusive: a new connection wakes one shard, or a
+  // few, and wakes them again while some are left in the backlog
+  struct epoll_event accept = {.events = EPOLLIN | EPOLLEXCLUSIVE,
+                               .data.fd = listener};
+  return epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->wake_fd, &wake) == 0 &&
+         epoll_ctl(s->epfd, EPOLL_CTL_ADD, listener, &accept) == 0;
+}
+
+int main(int argc, char **argv) {
+  long threads = argc == 2 ? strtol(argv[1], NULL, 10)
+                           : sysconf(_SC_NPROCESSORS_ONLN);
+  if (argc > 2 || (argc == 2 && threads < 1)) {
+    fprintf(stderr, "usage server-chat [threads]\n");
+    return 1;
+  }
+  shard_count = threads < 1           ? 1
+                : threads > SHARD_MAX ? SHARD_MAX
+                                      : (int)threads;
+  printf("Starting chat on %d threads...\n", shard_count);
+  raise_fd_limit();
+
+  if (getrandom(&room_seed, sizeof(room_seed), GRND_NONBLOCK) !=
+      sizeof(room_seed)) {
+    room_seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+  }
+  lobby = room_get(ROOM_LOBBY, strlen(ROOM_LOBBY));
+  if (!lobby) {
+    fprintf(stderr, "SERVER ERROR: out of memory\n");
+    return 1;
+  }
+
+  listener = setup_server_socket(HOST, PORT, BACKLOG);
+  if (listener == -1) {
+    fprintf(stderr, "SERVER ERROR: error getting listening socket\n");
+    return 1;
+  }
+  if (!set_nonblocking(listener)) {
+    perror("SERVER ERROR: fcntl");
+    return 1;
+  }
 
-      handle_broadcast(listener, &clients, sender_fd, buf, nbytes);
+  for (int i = 0; i < shard_count; i++) {
+    if (!shard_init(&shards[i], i)) {
+      perror("SERVER ERROR: epoll");
+      return 1;
+    }
+  }
+  for (int i = 0; i < shard_count; i++) {
+    int err = pthread_create(&shards[i].thread, NULL, shard_run, &shards[i]);
+    if (err != 0) {
+      fprintf(stderr, "SERVER ERROR: pthread_create: %s\n", strerror(err));
+      return 1;
     }
   }
+  for (int i = 0; i < shard_count; i++) {
+    pthread_join(shards[i].thread, NULL);
+  }
 
   return EXIT_SUCCESS;
 }
 
-static void handle_new_connection(int listener, Clients *clients) {
-  struct sockaddr_storage remote_addr;
-  socklen_t addr_len = sizeof remote_addr;
+static void handle_new_connections(Shard *s) {
+  for (int accepted = 0; accepted < ACCEPT_BUDGET; accepted++) {
+    struct sockaddr_storage remote_addr;
+    socklen_t addr_len = sizeof remote_addr;
 
-  int new_fd = accept(listener, (struct sockaddr *)&remote_addr, &addr_len);
-  if (new_fd < 0) {
-    perror("SERVER ERROR: error (accept)ing connection");
-    return;
+    int new_fd = accept4(listener, (struct sockaddr *)&remote_addr, &addr_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (new_fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        // EMFILE and the like: the rest wait in the backlog
+        perror("SERVER ERROR: error (accept)ing connection");
+      }
+      return;
+    }
+
+    if (!client_add(s, new_fd)) {
+      fprintf(stderr, "SERVER ERROR: could not add socket %d\n", new_fd);
+      close(new_fd);
+      continue;
+    }
+
+    char remote_ip[INET6_ADDRSTRLEN];
+    const char *client_info = inet_ntop(
+        remote_addr.ss_family, get_in_addr((struct sockaddr *)&remote_addr),
+        remote_ip, INET6_ADDRSTRLEN);
+    printf("SERVER INFO: new connection from %s on socket %d, thread %d "
+           "(%zu online)\n",
+           client_info, new_fd, s->id, atomic_load(&client_count));
   }
+}
 
-  da_append(clients, ((struct pollfd){.fd = new_fd, POLLIN}));
+static void handle_readable(Shard *s, Client *client) {
+  // Edge triggered: read until the socket is empty, or until the budget runs
+  // out and handle_unread picks up the rest
+  for (int reads = 0;; reads++) {
+    if (reads == READ_BUDGET) {
+      if (da_append(&s->unread, client->fd)) {
+        client->unread = true;
+      }
+      return;
+    }
+    char *space = frame_space(&client->in, RECV_SIZE);
+    if (!space) {
+      client_close(s, client, "out of memory, disconnected");
+      return;
+    }
+    ssize_t nbytes = recv(client->fd, space, RECV_SIZE, 0);
+    if (nbytes > 0) {
+      frame_commit(&client->in, (size_t)nbytes);
+      if (!handle_frames(s, client)) {
+        client_close(s, client, "sent an oversized message, disconnected");
+        return;
+      }
+      continue;
+    }
+    if (nbytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
 
-  char remote_ip[INET6_ADDRSTRLEN];
-  const char *client_info = inet_ntop(
-      remote_addr.ss_family, get_in_addr((struct sockaddr *)&remote_addr),
-      remote_ip, INET6_ADDRSTRLEN);
-  printf("SERVER INFO: new connection from %s on socket %d\n", client_info,
-         new_fd);
+    if (nbytes < 0) {
+      perror("SERVER ERROR: error recv");
+    }
+    client_close(s, client, nbytes == 0 ? "hung up" : "failed");
+    return;
+  }
+}
 
-  return;
+// Before the new events, so input left over is not starved by fresh input
+static void handle_unread(Shard *s) {
+  // Clients that run out of budget again are appended past `count`
+  size_t count = s->unread.count;
+  for (size_t i = 0; i < count; i++) {
+    Client *client = client_get(s, s->unread.items[i]);
+    if (client && client->unread) {
+      client->unread = false;
+      handle_readable(s, client);
+    }
+  }
+  // Nothing to move, and no array yet, on most iterations
+  if (s->unread.count > count) {
+    memmove(s->unread.items, s->unread.items + count,
+            (s->unread.count - count) * sizeof(*s->unread.items));
+  }
+  s->unread.count -= count;
 }
 
-static void handle_broadcast(int listener, Clients *clients, int sender_fd,
-                             char *buf, int nbytes) {
-  char message[512];
-  int msg_len =
-      snprintf(message, sizeof message, "[%d]: %.*s", sender_fd, nbytes, buf);
-  for (int j = 0; j < clients->count; j++) {
-    int dest_fd = clients->items[j].fd;
-    if (dest_fd != listener && dest_fd != sender_fd) {
-      if (send(dest_fd, message, msg_len, 0) == -1) {
-        perror("send");
+// Broadcasts the lines completed by the last read, false when the client
+// sent one longer than FRAME_MAX. A command ends the batch so far, since the
+// lines after a /join go to the new room.
+static bool handle_frames(Shard *s, Client *sender) {
+  char prefix[32];
+  size_t prefix_size =
+      (size_t)snprintf(prefix, sizeof(prefix), "[%d]: ", sender->fd);
+
+  Frame_Buffer *in = &sender->in;
+  Message *msg = NULL;
+  Frame_Status st;
+  for (;;) {
+    if (!msg) {
+      // Sized for every line still in the buffer. Each is written back with
+      // its prefix and a bare '\n', so none takes more than it did plus the
+      // prefix.
+      size_t lines = frame_pending(in);
+      if (lines > 0 &&
+          !(msg = message_new(in->count - in->start + lines * prefix_size))) {
+        fprintf(stderr, "SERVER ERROR: out of memory, dropping messages\n");
+      }
+    }
+
+    const char *line;
+    size_t size;
+    if ((st = frame_next(in, &line, &size)) != FRAME_OK) {
+      break;
+    }
+
+    if (size > 0 && line[0] == '/') {
+      if (msg && msg->count > 0) {
+        room_post(s, sender, msg);
+        msg = NULL;
       }
+      handle_command(s, sender, line, size);
+    } else if (msg) {
+      char *at = msg->data + msg->count;
+      memcpy(at, prefix, prefix_size);
+      memcpy(at + prefix_size, line, size);
+      at[prefix_size + size] = '\n';
+      msg->count += prefix_size + size + 1;
+    }
+  }
+
+  if (msg && msg->count > 0) {
+    room_post(s, sender, msg);
+  } else {
+    free(msg);
+  }
+  return st != FRAME_TOO_LONG;
+}
+
+static void handle_command(Shard *s, Client *client, const char *line,
+                           size_t size) {
+  const char join[] = "/join ";
+  size_t join_len = sizeof(join) - 1;
+  if (size <= join_len || memcmp(line, join, join_len) != 0) {
+    client_notice(s, client, "* commands: /join <room>\n");
+    return;
+  }
+
+  const char *name = line + join_len;
+  size_t len = size - join_len;
+  bool valid = len <= ROOM_NAME_MAX;
+  for (size_t i = 0; i < len && valid; i++) {
+    valid = name[i] > ' ' && name[i] != 0x7F;
+  }
+  if (!valid) {
+    client_notice(s, client, "* room names are 1 to 32 visible characters\n");
+    return;
+  }
+
+  Room *room = room_get(name, len);
+  if (!room) {
+    client_notice(s, client, "* too many rooms\n");
+    return;
+  }
+
+  char notice[ROOM_NAME_MAX + 32];
+  snprintf(notice, sizeof(notice), "* you are in %.*s\n", (int)room->len,
+           room->name);
+  if (room == client->room) {
+    room_unref(room);
+  } else {
+    room_leave(s, client);
+    room_enter(s, client, room);
+  }
+  client_notice(s, client, notice);
+}
+
+static void handle_wake(Shard *s) {
+  uint64_t count;
+  if (read(s->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    perror("SERVER ERROR: eventfd read");
+  }
+  // Cleared before draining: whoever posts after this writes again
+  atomic_store(&s->woken, false);
+  s->inbox_ready = true;
+}
+
+static void handle_inbox(Shard *s) {
+  if (!s->inbox_ready) {
+    return;
+  }
+  for (int taken = 0; taken < INBOX_BUDGET; taken++) {
+    Post *post = inbox_pop(&s->inbox);
+    if (!post) {
+      s->inbox_ready = false;
+      return;
     }
+    room_deliver(s, post->room, NULL, post->msg);
+    room_unref(post->room);
+    message_unref(post->msg);
+    free(post);
   }
 }